@@ -0,0 +1,133 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "BaselineReporter.hpp"
+
+BaselineReporter::BaselineReporter(const std::string& baseline_path, const std::string& save_path,
+                                   OutputOptions options)
+: ConsoleReporter(options), baseline_path_(baseline_path), save_path_(save_path)
+{
+    if (!baseline_path_.empty())
+        baseline_ = Load_(baseline_path_);
+}
+
+std::map<std::string, BaselineReporter::Rates> BaselineReporter::Load_(const std::string& path)
+{
+    std::map<std::string, Rates> rates;
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream fields(line);
+        std::string name;
+        Rates benchmark_rates;
+        if (std::getline(fields, name, '\t') &&
+            fields >> benchmark_rates.bytes_per_second >> benchmark_rates.records_per_second)
+            rates[name] = benchmark_rates;
+    }
+    return rates;
+}
+
+void BaselineReporter::ReportRuns(const std::vector<Run>& runs)
+{
+    ConsoleReporter::ReportRuns(runs);
+
+    for (const auto& run : runs) {
+        if (run.error_occurred)
+            continue;
+        // With repetitions only the mean is compared. It's reported after
+        // the repetitions and replaces them.
+        if (run.run_type == Run::RT_Aggregate && run.aggregate_name != "mean")
+            continue;
+
+        Rates rates;
+        auto bytes = run.counters.find("bytes_per_second");
+        if (bytes != run.counters.end())
+            rates.bytes_per_second = bytes->second;
+        auto items = run.counters.find("items_per_second");
+        if (items != run.counters.end())
+            rates.records_per_second = items->second;
+
+        const std::string name = run.run_name.str();
+        if (results_.find(name) == results_.end())
+            names_.push_back(name);
+        results_[name] = rates;
+    }
+}
+
+void BaselineReporter::Finalize()
+{
+    ConsoleReporter::Finalize();
+    std::ostream& out = GetOutputStream();
+
+    if (!baseline_path_.empty()) {
+        if (baseline_.empty()) {
+            out << "\nNo baseline in " << baseline_path_ << '\n';
+        } else {
+            char line[256];
+            out << "\nCompared with " << baseline_path_ << ":\n";
+            std::snprintf(line, sizeof(line), "%-48s %9s %9s %8s %12s %12s %8s\n", "Benchmark",
+                          "GB/s", "baseline", "change", "records/s", "baseline", "change");
+            out << line;
+
+            auto Change = [](double value, double baseline) {
+                return baseline > 0 ? (value/baseline - 1)*100 : 0.0;
+            };
+            for (const auto& name : names_) {
+                auto baseline = baseline_.find(name);
+                if (baseline == baseline_.end())
+                    continue;
+                const Rates& now = results_[name];
+                const Rates& then = baseline->second;
+                std::snprintf(line, sizeof(line), "%-48s %9.3f %9.3f %+7.1f%% %12.0f %12.0f %+7.1f%%\n",
+                              name.c_str(),
+                              now.bytes_per_second/1e9, then.bytes_per_second/1e9,
+                              Change(now.bytes_per_second, then.bytes_per_second),
+                              now.records_per_second, then.records_per_second,
+                              Change(now.records_per_second, then.records_per_second));
+                out << line;
+            }
+        }
+    }
+
+    if (!save_path_.empty())
+        Save_();
+}
+
+void BaselineReporter::Save_() const
+{
+    // Benchmarks that didn't run this time keep their old numbers
+    std::map<std::string, Rates> rates = Load_(save_path_);
+    for (const auto& result : results_)
+        rates[result.first] = result.second;
+
+    std::ofstream file(save_path_);
+    file << "# benchmark\tbytes/s\trecords/s\n";
+    file.precision(17);
+    for (const auto& entry : rates)
+        file << entry.first << '\t' << entry.second.bytes_per_second << '\t'
+             << entry.second.records_per_second << '\n';
+    if (!file.flush())
+        GetErrorStream() << "Can't save the baseline to " << save_path_ << '\n';
+    else
+        GetOutputStream() << "Baseline saved to " << save_path_ << '\n';
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef LIBGENE_BENCHMARKS_BASELINE_REPORTER_HPP_
+#define LIBGENE_BENCHMARKS_BASELINE_REPORTER_HPP_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+// Prints the results like the console reporter does, followed by how the
+// throughput of every benchmark compares with a stored baseline. Can also
+// store the results as the new baseline.
+//
+// Baselines are tab-separated files with a line per benchmark: its name,
+// bytes per second and records per second.
+class BaselineReporter final : public benchmark::ConsoleReporter {
+ public:
+    // Either path may be empty
+    BaselineReporter(const std::string& baseline_path, const std::string& save_path,
+                     OutputOptions options);
+
+    void ReportRuns(const std::vector<Run>& runs) override;
+    void Finalize() override;
+
+ private:
+    struct Rates {
+        double bytes_per_second{0};
+        double records_per_second{0};
+    };
+
+    static std::map<std::string, Rates> Load_(const std::string& path);
+    void Save_() const;
+
+    std::string baseline_path_;
+    std::string save_path_;
+    std::map<std::string, Rates> baseline_;
+    // In the order the benchmarks ran
+    std::vector<std::string> names_;
+    std::map<std::string, Rates> results_;
+};
+
+#endif  // LIBGENE_BENCHMARKS_BASELINE_REPORTER_HPP_
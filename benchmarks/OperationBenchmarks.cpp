@@ -0,0 +1,235 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Whole operations over generated inputs. Throughput is counted in the
+// bytes and records of the inputs.
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "SyntheticData.hpp"
+#include "Converter.hpp"
+#include "Merger.hpp"
+#include "Splitter.hpp"
+#include "Extractor.hpp"
+
+#include <libgene/def/Flags.hpp>
+#include <libgene/flags/CommandLineFlags.hpp>
+
+using gene::Flags;
+
+static std::unique_ptr<gene::CommandLineFlags> MakeFlags()
+{
+    return std::make_unique<gene::CommandLineFlags>();
+}
+
+static SyntheticDataOptions InputOptions(gene::FileType format, int files_count)
+{
+    SyntheticDataOptions options;
+    options.format = format;
+    options.files_count = files_count;
+    return options;
+}
+
+static void SetThroughput(benchmark::State& state, const SyntheticData& data)
+{
+    state.SetBytesProcessed(state.iterations()*data.bytes());
+    state.SetItemsProcessed(state.iterations()*data.records());
+}
+
+// Outputs of an iteration are removed untimed, before the next one
+static void RemoveOutputs(benchmark::State& state, const SyntheticData& data)
+{
+    state.PauseTiming();
+    data.RemoveOutputs();
+    state.ResumeTiming();
+}
+
+static void Convert(benchmark::State& state, gene::FileType input_format,
+                    const std::string& output_format)
+{
+    const auto& data = SyntheticData::Shared(InputOptions(input_format, static_cast<int>(state.range(0))));
+    const std::string output_path = data.OutputPath("converted." + output_format);
+
+    for (auto _ : state) {
+        {
+            auto flags = MakeFlags();
+            flags->SetSetting(Flags::kOutputFormat, output_format);
+            Converter converter(data.paths(), output_path, std::move(flags));
+            if (!converter.Process())
+                state.SkipWithError("Conversion failed");
+        }
+        RemoveOutputs(state, data);
+    }
+    SetThroughput(state, data);
+}
+
+static void BM_ConvertFastqToFasta(benchmark::State& state)
+{
+    Convert(state, gene::FileType::Fastq, "fasta");
+}
+BENCHMARK(BM_ConvertFastqToFasta)->Arg(1)->Arg(8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+static void BM_ConvertFastqToCsv(benchmark::State& state)
+{
+    Convert(state, gene::FileType::Fastq, "csv");
+}
+BENCHMARK(BM_ConvertFastqToCsv)->Arg(1)->Arg(8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+static void BM_ConvertSamToFastq(benchmark::State& state)
+{
+    Convert(state, gene::FileType::Sam, "fastq");
+}
+BENCHMARK(BM_ConvertSamToFastq)->Arg(1)->Arg(8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+static void BM_MergeFastq(benchmark::State& state)
+{
+    const auto& data = SyntheticData::Shared(InputOptions(gene::FileType::Fastq, static_cast<int>(state.range(0))));
+    const std::string output_path = data.OutputPath("merged.fastq");
+
+    for (auto _ : state) {
+        {
+            Merger merger(data.paths(), output_path, MakeFlags());
+            if (!merger.Process())
+                state.SkipWithError("Merging failed");
+        }
+        RemoveOutputs(state, data);
+    }
+    SetThroughput(state, data);
+}
+BENCHMARK(BM_MergeFastq)->Arg(2)->Arg(8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+static void BM_SplitFastqByRecords(benchmark::State& state)
+{
+    const auto& data = SyntheticData::Shared(InputOptions(gene::FileType::Fastq, 1));
+    const std::string output_path = data.OutputPath("split.fastq");
+    // Into 'range(0)' parts
+    const std::string records_per_part = std::to_string(data.records()/state.range(0));
+
+    for (auto _ : state) {
+        {
+            auto flags = MakeFlags();
+            flags->SetSetting("r", records_per_part);
+            Splitter splitter(data.paths().front(), output_path, std::move(flags));
+            if (!splitter.Process())
+                state.SkipWithError("Splitting failed");
+        }
+        RemoveOutputs(state, data);
+    }
+    SetThroughput(state, data);
+}
+BENCHMARK(BM_SplitFastqByRecords)->Arg(4)->Arg(64)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// Extracts into one output, or demultiplexes into one per query with
+// Flags::kDemultiplexByTags
+static void Extract(benchmark::State& state, const SyntheticData& data,
+                    const std::vector<std::string>& flag_names,
+                    const std::vector<std::string>& queries)
+{
+    std::vector<std::pair<std::string, std::string>> input_paths;
+    for (size_t i = 0; i < data.paths().size(); ++i)
+        input_paths.emplace_back(data.paths()[i], data.mate_paths().empty() ? "" : data.mate_paths()[i]);
+
+    bool demultiplex = false;
+    for (const auto& name : flag_names)
+        demultiplex = demultiplex || name == Flags::kDemultiplexByTags || name == Flags::kIlluminaR2Tags;
+
+    std::vector<std::pair<std::string, std::string>> output_paths;
+    if (demultiplex) {
+        // The first path is the output directory, which isn't used
+        output_paths.emplace_back(data.OutputPath("demultiplexed"), "");
+        for (const auto& query : queries)
+            output_paths.emplace_back(data.OutputPath(query + ".fastq"), "");
+    } else {
+        output_paths.emplace_back(data.OutputPath("extracted.fastq"), "");
+    }
+
+    for (auto _ : state) {
+        {
+            auto flags = MakeFlags();
+            for (const auto& name : flag_names)
+                flags->SetSetting(name, "");
+            Extractor extractor(ExtractorJob(input_paths, output_paths, std::move(flags), queries));
+            if (!extractor.Process())
+                state.SkipWithError("Extraction failed");
+        }
+        RemoveOutputs(state, data);
+    }
+    SetThroughput(state, data);
+}
+
+static void BM_ExtractByName(benchmark::State& state)
+{
+    const auto& data = SyntheticData::Shared(InputOptions(gene::FileType::Fastq, static_cast<int>(state.range(0))));
+    // Matches the descriptions of the reads with the first two barcodes
+    Extract(state, data, {}, {"1:N:0:" + data.barcodes()[0], "1:N:0:" + data.barcodes()[1]});
+}
+BENCHMARK(BM_ExtractByName)->Arg(1)->Arg(8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+static void BM_ExtractFromSequence(benchmark::State& state)
+{
+    const auto& data = SyntheticData::Shared(InputOptions(gene::FileType::Fastq, static_cast<int>(state.range(0))));
+    Extract(state, data, {Flags::kTagIsInSequence}, {"ACGTACGT", "TTGGCCAA"});
+}
+BENCHMARK(BM_ExtractFromSequence)->Arg(1)->Arg(8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+static void BM_ExtractByWildcard(benchmark::State& state)
+{
+    const auto& data = SyntheticData::Shared(InputOptions(gene::FileType::Fastq, static_cast<int>(state.range(0))));
+    std::string pattern = "*1:N:0:" + data.barcodes()[0];
+    pattern.back() = '?';
+    Extract(state, data, {}, {pattern});
+}
+BENCHMARK(BM_ExtractByWildcard)->Arg(1)->Arg(8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+static void BM_Demultiplex(benchmark::State& state)
+{
+    const auto& data = SyntheticData::Shared(InputOptions(gene::FileType::Fastq, static_cast<int>(state.range(0))));
+    Extract(state, data, {Flags::kDemultiplexByTags}, data.barcodes());
+}
+BENCHMARK(BM_Demultiplex)->Arg(1)->Arg(8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+static void BM_DemultiplexWithErrorCorrection(benchmark::State& state)
+{
+    auto options = InputOptions(gene::FileType::Fastq, static_cast<int>(state.range(0)));
+    options.error_rate = 0.01;
+    const auto& data = SyntheticData::Shared(options);
+    Extract(state, data, {Flags::kDemultiplexByTags, Flags::kDemultiplexWithErrorCorrection},
+            data.barcodes());
+}
+BENCHMARK(BM_DemultiplexWithErrorCorrection)->Arg(1)->Arg(8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+static void BM_DemultiplexByR2Barcodes(benchmark::State& state)
+{
+    auto options = InputOptions(gene::FileType::Fastq, static_cast<int>(state.range(0)));
+    options.barcode_mates = true;
+    const auto& data = SyntheticData::Shared(options);
+    Extract(state, data, {Flags::kIlluminaR2Tags}, data.barcodes());
+}
+BENCHMARK(BM_DemultiplexByR2Barcodes)->Arg(1)->Arg(8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+static void BM_DemultiplexManyBarcodes(benchmark::State& state)
+{
+    auto options = InputOptions(gene::FileType::Fastq, 8);
+    options.barcodes_count = static_cast<int>(state.range(0));
+    const auto& data = SyntheticData::Shared(options);
+    Extract(state, data, {Flags::kDemultiplexByTags}, data.barcodes());
+}
+BENCHMARK(BM_DemultiplexManyBarcodes)->Arg(96)->Arg(384)->Unit(benchmark::kMillisecond)->UseRealTime();
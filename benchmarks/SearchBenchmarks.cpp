@@ -0,0 +1,112 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// The searches the extractor runs for every record, on the descriptions of
+// generated reads
+
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "SyntheticData.hpp"
+
+#include <libgene/search/FuzzySearch.hpp>
+#include <libgene/search/WildcardMatcher.hpp>
+
+static SyntheticDataOptions SearchOptions(int barcodes_count)
+{
+    SyntheticDataOptions options;
+    options.records_per_file = 20000;
+    options.barcodes_count = barcodes_count;
+    // Enough errors for some barcodes to only be found with a mismatch
+    options.error_rate = 0.01;
+    return options;
+}
+
+// Looks for every barcode in turn, like demultiplexing does, and stops at
+// the first one found
+template <typename FindT>
+static void SearchBarcodes(benchmark::State& state, FindT find)
+{
+    const auto& data = SyntheticData::Shared(SearchOptions(static_cast<int>(state.range(0))));
+    const auto records = data.LoadRecords();
+    const auto& barcodes = data.barcodes();
+
+    int64_t found = 0;
+    int64_t bytes = 0;
+    for (const auto& record : records)
+        bytes += record.desc.size();
+
+    for (auto _ : state) {
+        for (const auto& record : records) {
+            for (const auto& barcode : barcodes) {
+                if (find(record.desc, barcode) != std::string::npos) {
+                    ++found;
+                    break;
+                }
+            }
+        }
+    }
+    benchmark::DoNotOptimize(found);
+    state.SetBytesProcessed(state.iterations()*bytes);
+    state.SetItemsProcessed(state.iterations()*records.size());
+}
+
+static void BM_FuzzySearchNAwareFind(benchmark::State& state)
+{
+    SearchBarcodes(state, [](const std::string& text, const std::string& query) {
+        return gene::FuzzySearch::NAwareFind(text, query);
+    });
+}
+BENCHMARK(BM_FuzzySearchNAwareFind)->Arg(16)->Arg(96);
+
+static void BM_FuzzySearchFindByHamming1(benchmark::State& state)
+{
+    SearchBarcodes(state, [](const std::string& text, const std::string& query) {
+        return gene::FuzzySearch::FindByHamming1(text, query);
+    });
+}
+BENCHMARK(BM_FuzzySearchFindByHamming1)->Arg(16)->Arg(96);
+
+static void BM_WildcardMatcherMatch(benchmark::State& state)
+{
+    const auto& data = SyntheticData::Shared(SearchOptions(16));
+    const auto records = data.LoadRecords();
+
+    // Anything with the first barcode, its last base left open
+    std::string pattern = "*1:N:0:" + data.barcodes()[0];
+    pattern.back() = '?';
+
+    int64_t matched = 0;
+    int64_t bytes = 0;
+    std::vector<std::string> id_lines;
+    for (const auto& record : records) {
+        // What the extractor matches against
+        id_lines.push_back(record.name + ' ' + record.desc);
+        bytes += id_lines.back().size();
+    }
+
+    for (auto _ : state) {
+        for (const auto& id_line : id_lines)
+            matched += gene::WildcardMatcher::Match(pattern, id_line);
+    }
+    benchmark::DoNotOptimize(matched);
+    state.SetBytesProcessed(state.iterations()*bytes);
+    state.SetItemsProcessed(state.iterations()*id_lines.size());
+}
+BENCHMARK(BM_WildcardMatcherMatch);
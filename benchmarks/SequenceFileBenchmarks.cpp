@@ -0,0 +1,89 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Reading and writing records with libgene's files, which every operation
+// is built on
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "SyntheticData.hpp"
+
+#include <libgene/file/sequence/SequenceFile.hpp>
+#include <libgene/flags/CommandLineFlags.hpp>
+
+static SyntheticDataOptions FileOptions(gene::FileType format)
+{
+    SyntheticDataOptions options;
+    options.format = format;
+    options.records_per_file = 200000;
+    return options;
+}
+
+static void BM_SequenceFileRead(benchmark::State& state, gene::FileType format)
+{
+    const auto& data = SyntheticData::Shared(FileOptions(format));
+    auto flags = std::make_unique<gene::CommandLineFlags>();
+
+    int64_t records = 0;
+    for (auto _ : state) {
+        auto file = gene::SequenceFile::FileWithName(data.paths().front(), flags, gene::OpenMode::Read);
+        if (!file) {
+            state.SkipWithError("Can't open the input");
+            break;
+        }
+        gene::SequenceRecord record;
+        while (!(record = file->Read()).Empty())
+            ++records;
+    }
+    benchmark::DoNotOptimize(records);
+    state.SetBytesProcessed(state.iterations()*data.bytes());
+    state.SetItemsProcessed(state.iterations()*data.records());
+}
+BENCHMARK_CAPTURE(BM_SequenceFileRead, fastq, gene::FileType::Fastq)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_SequenceFileRead, fasta, gene::FileType::Fasta)->Unit(benchmark::kMillisecond);
+
+static void BM_SequenceFileWrite(benchmark::State& state, gene::FileType format)
+{
+    const auto& data = SyntheticData::Shared(FileOptions(format));
+    const auto records = data.LoadRecords();
+    const std::string output_path = data.OutputPath("written." + SyntheticData::Extension(format));
+    auto flags = std::make_unique<gene::CommandLineFlags>();
+
+    for (auto _ : state) {
+        {
+            // Closing the file is part of writing it
+            auto file = gene::SequenceFile::FileWithName(output_path, flags, gene::OpenMode::Write);
+            if (!file) {
+                state.SkipWithError("Can't create the output");
+                break;
+            }
+            for (const auto& record : records)
+                file->Write(record);
+        }
+        state.PauseTiming();
+        data.RemoveOutputs();
+        state.ResumeTiming();
+    }
+    state.SetBytesProcessed(state.iterations()*data.bytes());
+    state.SetItemsProcessed(state.iterations()*records.size());
+}
+BENCHMARK_CAPTURE(BM_SequenceFileWrite, fastq, gene::FileType::Fastq)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_SequenceFileWrite, fasta, gene::FileType::Fasta)->Unit(benchmark::kMillisecond);
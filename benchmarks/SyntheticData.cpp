@@ -0,0 +1,330 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <stdexcept>
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include "SyntheticData.hpp"
+
+#include <libgene/file/sequence/SequenceFile.hpp>
+#include <libgene/flags/CommandLineFlags.hpp>
+
+// Reads of the FASTA files are wrapped at this width
+constexpr size_t kFastaLineWidth = 60;
+// Output is written in pieces of about this size
+constexpr size_t kWriteChunkSize = 1024*1024;
+
+namespace {
+
+// SplitMix64. The distributions of the standard library differ between
+// implementations, so numbers are only ever taken from the raw generator.
+class Random {
+ public:
+    explicit Random(uint64_t seed)
+    : state_(seed)
+    {
+    }
+
+    uint64_t Next()
+    {
+        uint64_t z = (state_ += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27))*0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+    // Slightly biased for large 'n', which doesn't matter here
+    uint64_t Below(uint64_t n)
+    {
+        return Next() % n;
+    }
+    bool Chance(double probability)
+    {
+        return (Next() >> 11)*0x1.0p-53 < probability;
+    }
+
+ private:
+    uint64_t state_;
+};
+
+constexpr char kBases[] = "ACGT";
+
+// Replaces the base with one of the other three
+char WrongBase(char base, Random& random)
+{
+    char wrong;
+    do {
+        wrong = kBases[random.Below(4)];
+    } while (wrong == base);
+    return wrong;
+}
+
+class ChunkedFile {
+ public:
+    explicit ChunkedFile(const std::string& path)
+    : file_(std::fopen(path.c_str(), "wb"))
+    {
+        if (!file_)
+            throw std::runtime_error("Can't create " + path);
+        buffer_.reserve(kWriteChunkSize + 4096);
+    }
+    ~ChunkedFile()
+    {
+        if (file_)
+            std::fclose(file_);
+    }
+
+    std::string& buffer()
+    {
+        return buffer_;
+    }
+    void FlushIfFull()
+    {
+        if (buffer_.size() >= kWriteChunkSize)
+            Flush_();
+    }
+    // Returns the size of the file
+    int64_t Close()
+    {
+        Flush_();
+        if (std::fclose(file_) != 0) {
+            file_ = nullptr;
+            throw std::runtime_error("Can't write synthetic data");
+        }
+        file_ = nullptr;
+        return written_;
+    }
+
+ private:
+    void Flush_()
+    {
+        if (std::fwrite(buffer_.data(), 1, buffer_.size(), file_) != buffer_.size())
+            throw std::runtime_error("Can't write synthetic data");
+        written_ += buffer_.size();
+        buffer_.clear();
+    }
+
+    std::FILE *file_;
+    std::string buffer_;
+    int64_t written_{0};
+};
+
+}  // namespace
+
+SyntheticData::SyntheticData(const SyntheticDataOptions& options)
+: options_(options)
+{
+    if (options_.format != gene::FileType::Fasta &&
+        options_.format != gene::FileType::Fastq &&
+        options_.format != gene::FileType::Sam)
+        throw std::invalid_argument("Synthetic data is either FASTA, FASTQ or SAM");
+    if (options_.min_read_length <= 0 || options_.max_read_length < options_.min_read_length)
+        throw std::invalid_argument("Invalid read lengths");
+    // There have to be enough different barcodes of the length
+    if (options_.barcodes_count <= 0 || options_.barcode_length <= 0 ||
+        (options_.barcode_length < 16 && options_.barcodes_count > (1 << (2*options_.barcode_length))))
+        throw std::invalid_argument("Invalid barcodes");
+
+    const char *root = std::getenv("GENEUTILS_BENCHMARK_DIR");
+    std::string pattern = std::string(root ? root : "/tmp") + "/geneutils-benchmark-XXXXXX";
+    if (!mkdtemp(&pattern[0]))
+        throw std::runtime_error("Can't create a directory for synthetic data");
+    directory_ = pattern;
+
+    Random random(options_.seed);
+    std::set<std::string> unique_barcodes;
+    while (barcodes_.size() < static_cast<size_t>(options_.barcodes_count)) {
+        std::string barcode(options_.barcode_length, 'A');
+        for (auto& base : barcode)
+            base = kBases[random.Below(4)];
+        if (unique_barcodes.insert(barcode).second)
+            barcodes_.push_back(barcode);
+    }
+
+    for (int i = 0; i < options_.files_count; ++i)
+        WriteFile_(i);
+    records_ = options_.files_count*options_.records_per_file;
+}
+
+SyntheticData::~SyntheticData()
+{
+    RemoveOutputs();
+    for (const auto& path : paths_)
+        std::remove(path.c_str());
+    for (const auto& path : mate_paths_)
+        std::remove(path.c_str());
+    rmdir(directory_.c_str());
+}
+
+const SyntheticData& SyntheticData::Shared(const SyntheticDataOptions& options)
+{
+    static std::mutex mutex;
+    static std::map<std::string, std::unique_ptr<SyntheticData>> generated;
+
+    std::ostringstream key;
+    key << static_cast<int>(options.format) << ' ' << options.files_count << ' '
+        << options.records_per_file << ' ' << options.min_read_length << ' '
+        << options.max_read_length << ' ' << options.barcodes_count << ' '
+        << options.barcode_length << ' ' << options.error_rate << ' '
+        << options.barcode_mates << ' ' << options.seed;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& data = generated[key.str()];
+    if (!data)
+        data = std::make_unique<SyntheticData>(options);
+    return *data;
+}
+
+std::string SyntheticData::Extension(gene::FileType format)
+{
+    switch (format) {
+        case gene::FileType::Fasta:
+            return "fasta";
+        case gene::FileType::Sam:
+            return "sam";
+        default:
+            return "fastq";
+    }
+}
+
+std::vector<gene::SequenceRecord> SyntheticData::LoadRecords() const
+{
+    auto flags = std::make_unique<gene::CommandLineFlags>();
+    auto file = gene::SequenceFile::FileWithName(paths_.front(), flags, gene::OpenMode::Read);
+    if (!file)
+        throw std::runtime_error("Can't open " + paths_.front());
+
+    std::vector<gene::SequenceRecord> records;
+    gene::SequenceRecord record;
+    while (!(record = file->Read()).Empty())
+        records.push_back(std::move(record));
+    return records;
+}
+
+std::string SyntheticData::OutputPath(const std::string& name) const
+{
+    return directory_ + "/out-" + name;
+}
+
+void SyntheticData::RemoveOutputs() const
+{
+    DIR *directory = opendir(directory_.c_str());
+    if (!directory)
+        return;
+    // Operations may name their outputs after the inputs, parts and
+    // segments included, so anything that isn't an input goes
+    std::set<std::string> inputs(paths_.begin(), paths_.end());
+    inputs.insert(mate_paths_.begin(), mate_paths_.end());
+    while (dirent *entry = readdir(directory)) {
+        std::string path = directory_ + '/' + entry->d_name;
+        if (entry->d_name[0] != '.' && inputs.count(path) == 0)
+            std::remove(path.c_str());
+    }
+    closedir(directory);
+}
+
+void SyntheticData::WriteFile_(int index)
+{
+    const std::string extension = Extension(options_.format);
+    const std::string name = "input" + std::to_string(index);
+    paths_.push_back(directory_ + '/' + name + "_R1." + extension);
+    ChunkedFile file(paths_.back());
+    std::unique_ptr<ChunkedFile> mate_file;
+    if (options_.barcode_mates) {
+        mate_paths_.push_back(directory_ + '/' + name + "_R2." + extension);
+        mate_file = std::make_unique<ChunkedFile>(mate_paths_.back());
+    }
+
+    // Every file has a generator of its own, so a file doesn't depend on
+    // how many were generated before it
+    Random random(options_.seed ^ ((index + 1)*0xd1b54a32d192ed03ull));
+    const int length_range = options_.max_read_length - options_.min_read_length + 1;
+    int64_t position = 1;
+    std::string read, quality, barcode, barcode_quality;
+
+    auto MakeRead = [&random](std::string& bases, std::string& scores, size_t length) {
+        bases.resize(length);
+        scores.resize(length);
+        for (size_t i = 0; i < length; ++i) {
+            bases[i] = kBases[random.Below(4)];
+            scores[i] = static_cast<char>(33 + 20 + random.Below(21));
+        }
+    };
+    // Wrong bases get the quality a base caller would give them
+    auto AddErrors = [this, &random](std::string& bases, std::string& scores) {
+        for (size_t i = 0; i < bases.size(); ++i) {
+            if (random.Chance(options_.error_rate)) {
+                bases[i] = WrongBase(bases[i], random);
+                scores[i] = static_cast<char>(33 + 2 + random.Below(8));
+            }
+        }
+    };
+    auto AppendRecord = [this](std::string& out, const std::string& id, const std::string& description,
+                               const std::string& bases, const std::string& scores) {
+        if (options_.format == gene::FileType::Fastq) {
+            out.append("@").append(id).append(" ").append(description).append("\n");
+            out.append(bases).append("\n+\n").append(scores).append("\n");
+        } else {
+            out.append(">").append(id).append(" ").append(description).append("\n");
+            for (size_t i = 0; i < bases.size(); i += kFastaLineWidth)
+                out.append(bases, i, kFastaLineWidth).append("\n");
+        }
+    };
+
+    if (options_.format == gene::FileType::Sam) {
+        file.buffer().append("@HD\tVN:1.6\tSO:coordinate\n"
+                             "@SQ\tSN:chr1\tLN:2147483647\n"
+                             "@PG\tID:geneutils-benchmarks\tPN:geneutils-benchmarks\n");
+    }
+
+    for (int64_t r = 0; r < options_.records_per_file; ++r) {
+        const std::string id = "SYN:" + std::to_string(index) + ':' + std::to_string(r);
+        MakeRead(read, quality, options_.min_read_length + random.Below(length_range));
+        AddErrors(read, quality);
+        barcode = barcodes_[random.Below(barcodes_.size())];
+        barcode_quality.assign(barcode.size(), 'I');
+        AddErrors(barcode, barcode_quality);
+
+        std::string& out = file.buffer();
+        if (options_.format == gene::FileType::Sam) {
+            position += 1 + random.Below(100);
+            out.append(id).append("\t0\tchr1\t").append(std::to_string(position))
+               .append("\t60\t").append(std::to_string(read.size())).append("M\t*\t0\t0\t")
+               .append(read).append("\t").append(quality)
+               .append("\tBC:Z:").append(barcode).append("\n");
+        } else {
+            AppendRecord(out, id, "1:N:0:" + barcode, read, quality);
+        }
+        file.FlushIfFull();
+
+        if (mate_file) {
+            AppendRecord(mate_file->buffer(), id, "2:N:0:", barcode, barcode_quality);
+            mate_file->FlushIfFull();
+        }
+    }
+    bytes_ += file.Close();
+    if (mate_file)
+        bytes_ += mate_file->Close();
+}
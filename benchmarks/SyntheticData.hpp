@@ -0,0 +1,110 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef LIBGENE_BENCHMARKS_SYNTHETIC_DATA_HPP_
+#define LIBGENE_BENCHMARKS_SYNTHETIC_DATA_HPP_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <libgene/def/FileType.hpp>
+#include <libgene/file/sequence/SequenceRecord.hpp>
+
+struct SyntheticDataOptions {
+    // Fasta, Fastq or Sam
+    gene::FileType format{gene::FileType::Fastq};
+    int files_count{1};
+    int64_t records_per_file{100000};
+    int min_read_length{100};
+    int max_read_length{150};
+    // Every read carries one of the barcodes in its description, Illumina
+    // style ("1:N:0:<barcode>"), or in its mate with 'barcode_mates'
+    int barcodes_count{16};
+    int barcode_length{8};
+    // Chance of every base of a read or of its barcode to be read wrong
+    double error_rate{0.001};
+    // Writes a file of barcode reads next to every input, the way some
+    // Illumina runs keep barcodes in their _R2 files
+    bool barcode_mates{false};
+    uint64_t seed{42};
+};
+
+// Input files for the benchmarks, generated into a directory of their own
+// and removed along with it. The same options always give the same files,
+// whatever the platform.
+class SyntheticData final {
+ public:
+    explicit SyntheticData(const SyntheticDataOptions& options);
+    ~SyntheticData();
+
+    SyntheticData(const SyntheticData&) = delete;
+    SyntheticData& operator=(const SyntheticData&) = delete;
+
+    // Generated the first time the options are asked for and kept until
+    // the program exits, as benchmarks get run several times over
+    static const SyntheticData& Shared(const SyntheticDataOptions& options);
+
+    const std::vector<std::string>& paths() const
+    {
+        return paths_;
+    }
+    // Empty unless the options ask for barcode mates
+    const std::vector<std::string>& mate_paths() const
+    {
+        return mate_paths_;
+    }
+    const std::vector<std::string>& barcodes() const
+    {
+        return barcodes_;
+    }
+    int64_t records() const
+    {
+        return records_;
+    }
+    // Of all the files, mates included
+    int64_t bytes() const
+    {
+        return bytes_;
+    }
+
+    // Reads all records of the first file, for benchmarks of parts of
+    // the operations
+    std::vector<gene::SequenceRecord> LoadRecords() const;
+
+    // A path for an output file named 'name' in the directory of the data.
+    // Outputs are removed with the data.
+    std::string OutputPath(const std::string& name) const;
+    // Removes every file of the directory but the inputs, e.g. between
+    // benchmark iterations
+    void RemoveOutputs() const;
+
+    static std::string Extension(gene::FileType format);
+
+ private:
+    void WriteFile_(int index);
+
+    SyntheticDataOptions options_;
+    std::string directory_;
+    std::vector<std::string> paths_;
+    std::vector<std::string> mate_paths_;
+    std::vector<std::string> barcodes_;
+    int64_t records_{0};
+    int64_t bytes_{0};
+};
+
+#endif  // LIBGENE_BENCHMARKS_SYNTHETIC_DATA_HPP_
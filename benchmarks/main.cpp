@@ -0,0 +1,59 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <cstring>
+#include <string>
+
+#include <unistd.h>
+
+#include <benchmark/benchmark.h>
+
+#include "BaselineReporter.hpp"
+
+// Compare the results with the baseline in the file
+static const char kBaselineFlag[] = "--baseline=";
+// Store the results as the baseline in the file
+static const char kSaveBaselineFlag[] = "--save_baseline=";
+
+int main(int argc, char **argv)
+{
+    // Taken out of the arguments before the library sees them
+    std::string baseline_path, save_path;
+    int kept = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strncmp(argv[i], kBaselineFlag, sizeof(kBaselineFlag) - 1) == 0)
+            baseline_path = argv[i] + sizeof(kBaselineFlag) - 1;
+        else if (std::strncmp(argv[i], kSaveBaselineFlag, sizeof(kSaveBaselineFlag) - 1) == 0)
+            save_path = argv[i] + sizeof(kSaveBaselineFlag) - 1;
+        else
+            argv[kept++] = argv[i];
+    }
+    argc = kept;
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+
+    // Colors only make sense on a terminal
+    auto options = benchmark::ConsoleReporter::OO_Tabular;
+    if (isatty(STDOUT_FILENO))
+        options = benchmark::ConsoleReporter::OO_Defaults;
+    BaselineReporter reporter(baseline_path, save_path, options);
+    benchmark::RunSpecifiedBenchmarks(&reporter);
+    benchmark::Shutdown();
+    return 0;
+}
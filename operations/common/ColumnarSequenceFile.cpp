@@ -0,0 +1,482 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "ColumnarSequenceFile.hpp"
+#include "PackedSequence.hpp"
+#include <libgene/log/Logger.hpp>
+
+const std::string ColumnarSequenceFile::kExtension = "gcol";
+
+static const char kMagic[] = "GUCOL001";
+static const char kTrailerMagic[] = "GUCOLEND";
+constexpr size_t kMagicLength = 8;
+constexpr size_t kBlockHeaderLength = 3*4;
+constexpr size_t kIndexEntryLength = 8 + 4;
+constexpr size_t kTrailerLength = 8 + kMagicLength;
+
+static void PutU32(std::string& out, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        out.push_back(static_cast<char>((value >> (8*i)) & 0xFF));
+}
+
+static void PutU64(std::string& out, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i)
+        out.push_back(static_cast<char>((value >> (8*i)) & 0xFF));
+}
+
+static uint32_t GetU32(const unsigned char *data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+static uint64_t GetU64(const unsigned char *data)
+{
+    return GetU32(data) | (static_cast<uint64_t>(GetU32(data + 4)) << 32);
+}
+
+// Bounds-checked cursor over a decompressed block
+class BlockCursor {
+ public:
+    BlockCursor(const unsigned char *data, size_t size)
+    : data_(data), end_(data + size)
+    {
+    }
+
+    const unsigned char *Take(size_t bytes)
+    {
+        if (static_cast<size_t>(end_ - data_) < bytes)
+            throw std::runtime_error("Columnar block is corrupted\n");
+        auto taken = data_;
+        data_ += bytes;
+        return taken;
+    }
+
+    uint32_t U32() { return GetU32(Take(4)); }
+
+ private:
+    const unsigned char *data_;
+    const unsigned char *end_;
+};
+
+// Run of bases that don't fit into two bits, all equal to 'base'
+struct BaseRun {
+    uint32_t start;
+    uint32_t length;
+    char base;
+};
+
+static void EncodeStrings(const std::vector<gene::SequenceRecord>& records,
+                          std::string gene::SequenceRecord::*field,
+                          std::string& out)
+{
+    for (const auto& record : records)
+        PutU32(out, static_cast<uint32_t>((record.*field).size()));
+    for (const auto& record : records)
+        out.append(record.*field);
+}
+
+static void DecodeStrings(BlockCursor& cursor,
+                          std::vector<gene::SequenceRecord>& records,
+                          std::string gene::SequenceRecord::*field)
+{
+    std::vector<uint32_t> lengths(records.size());
+    for (auto& length : lengths)
+        length = cursor.U32();
+    for (size_t i = 0; i < records.size(); ++i) {
+        auto bytes = reinterpret_cast<const char *>(cursor.Take(lengths[i]));
+        (records[i].*field).assign(bytes, lengths[i]);
+    }
+}
+
+static void EncodeColumns(const std::vector<gene::SequenceRecord>& records, std::string& out)
+{
+    EncodeStrings(records, &gene::SequenceRecord::name, out);
+    EncodeStrings(records, &gene::SequenceRecord::desc, out);
+
+    std::string bases;
+    for (const auto& record : records) {
+        PutU32(out, static_cast<uint32_t>(record.seq.size()));
+        bases.append(record.seq);
+    }
+
+    std::string packed((bases.size() + 3)/4, '\0');
+    PackedSequence::PackBases(bases.data(), bases.size(),
+                              reinterpret_cast<unsigned char *>(&packed[0]));
+
+    std::vector<BaseRun> runs;
+    for (uint32_t position = 0; position < bases.size(); ++position) {
+        char base = bases[position];
+        if (base == 'A' || base == 'C' || base == 'G' || base == 'T')
+            continue;
+        if (!runs.empty() && runs.back().base == base &&
+            runs.back().start + runs.back().length == position) {
+            ++runs.back().length;
+        } else {
+            runs.push_back({position, 1, base});
+        }
+    }
+    out.append(packed);
+
+    PutU32(out, static_cast<uint32_t>(runs.size()));
+    for (const auto& run : runs) {
+        PutU32(out, run.start);
+        PutU32(out, run.length);
+        out.push_back(run.base);
+    }
+
+    EncodeStrings(records, &gene::SequenceRecord::quality, out);
+}
+
+static void DecodeColumns(BlockCursor& cursor, std::vector<gene::SequenceRecord>& records)
+{
+    DecodeStrings(cursor, records, &gene::SequenceRecord::name);
+    DecodeStrings(cursor, records, &gene::SequenceRecord::desc);
+
+    std::vector<uint32_t> lengths(records.size());
+    size_t total_bases = 0;
+    for (auto& length : lengths) {
+        length = cursor.U32();
+        total_bases += length;
+    }
+
+    auto packed = cursor.Take((total_bases + 3)/4);
+    std::string bases(total_bases, 'A');
+    if (total_bases != 0)
+        PackedSequence::UnpackBases(packed, total_bases, &bases[0]);
+
+    uint32_t runs_count = cursor.U32();
+    for (uint32_t i = 0; i < runs_count; ++i) {
+        uint32_t start = cursor.U32();
+        uint32_t length = cursor.U32();
+        char base = static_cast<char>(*cursor.Take(1));
+        if (start > total_bases || length > total_bases - start)
+            throw std::runtime_error("Columnar block is corrupted\n");
+        bases.replace(start, length, length, base);
+    }
+
+    size_t offset = 0;
+    for (size_t i = 0; i < records.size(); ++i) {
+        records[i].seq.assign(bases, offset, lengths[i]);
+        offset += lengths[i];
+    }
+
+    DecodeStrings(cursor, records, &gene::SequenceRecord::quality);
+}
+
+ColumnarSequenceFile::ColumnarSequenceFile(const std::string& path, gene::OpenMode mode)
+: path_(path), mode_(mode)
+{
+}
+
+std::unique_ptr<ColumnarSequenceFile> ColumnarSequenceFile::FileWithName(const std::string& path,
+                                                                         gene::OpenMode mode)
+{
+    std::unique_ptr<ColumnarSequenceFile> file(new ColumnarSequenceFile(path, mode));
+    if (mode == gene::OpenMode::Read) {
+        if (!file->MapInput_())
+            return nullptr;
+    } else {
+        file->output_.open(path, std::ios::binary | std::ios::trunc);
+        if (!file->output_)
+            return nullptr;
+        file->output_.write(kMagic, kMagicLength);
+        file->written_ = kMagicLength;
+    }
+    return file;
+}
+
+ColumnarSequenceFile::~ColumnarSequenceFile()
+{
+    try {
+        Close();
+    } catch (const std::exception& e) {
+        PrintfLog("%s", e.what());
+    }
+    if (data_)
+        munmap(const_cast<unsigned char *>(data_), static_cast<size_t>(size_));
+    if (descriptor_ >= 0)
+        close(descriptor_);
+}
+
+bool ColumnarSequenceFile::MapInput_()
+{
+    descriptor_ = open(path_.c_str(), O_RDONLY);
+    if (descriptor_ < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(descriptor_, &info) != 0)
+        return false;
+    size_ = info.st_size;
+
+    // A file too short to be valid still opens, but reports itself invalid
+    if (size_ < static_cast<int64_t>(kMagicLength + 8 + kTrailerLength))
+        return true;
+
+    void *mapping = mmap(nullptr, static_cast<size_t>(size_), PROT_READ, MAP_PRIVATE, descriptor_, 0);
+    if (mapping == MAP_FAILED)
+        return false;
+    data_ = static_cast<const unsigned char *>(mapping);
+
+    const unsigned char *trailer = data_ + size_ - kTrailerLength;
+    if (std::memcmp(data_, kMagic, kMagicLength) != 0 ||
+        std::memcmp(trailer + 8, kTrailerMagic, kMagicLength) != 0)
+        return true;
+
+    footer_offset_ = static_cast<int64_t>(GetU64(trailer));
+    int64_t footer_end = size_ - kTrailerLength - 8;
+    if (footer_offset_ < static_cast<int64_t>(kMagicLength) || footer_offset_ > footer_end)
+        return true;
+
+    uint64_t blocks_count = GetU64(data_ + footer_end);
+    if (blocks_count != static_cast<uint64_t>(footer_end - footer_offset_)/kIndexEntryLength)
+        return true;
+
+    const unsigned char *entry = data_ + footer_offset_;
+    for (uint64_t i = 0; i < blocks_count; ++i, entry += kIndexEntryLength) {
+        BlockIndex block{static_cast<int64_t>(GetU64(entry)), GetU32(entry + 8)};
+        if (block.offset < static_cast<int64_t>(kMagicLength) ||
+            block.offset + static_cast<int64_t>(kBlockHeaderLength) > footer_offset_)
+            return true;
+        blocks_.push_back(block);
+    }
+    valid_ = true;
+    return true;
+}
+
+void ColumnarSequenceFile::DecodeBlock(size_t index, std::vector<gene::SequenceRecord>& records) const
+{
+    const unsigned char *header = data_ + blocks_[index].offset;
+    uLongf raw_size = GetU32(header);
+    uLong compressed_size = GetU32(header + 4);
+    uint32_t records_count = GetU32(header + 8);
+    if (blocks_[index].offset + kBlockHeaderLength + compressed_size > static_cast<uint64_t>(footer_offset_))
+        throw std::runtime_error("Columnar block is corrupted\n");
+
+    std::vector<unsigned char> raw(raw_size);
+    if (uncompress(raw.data(), &raw_size, header + kBlockHeaderLength, compressed_size) != Z_OK ||
+        raw_size != raw.size())
+        throw std::runtime_error("Columnar block is corrupted\n");
+
+    records.resize(records_count);
+    BlockCursor cursor(raw.data(), raw.size());
+    DecodeColumns(cursor, records);
+}
+
+gene::SequenceRecord ColumnarSequenceFile::Read()
+{
+    while (next_record_ == decoded_.size()) {
+        if (!valid_ || next_block_ == blocks_.size())
+            return gene::SequenceRecord();
+        DecodeBlock(next_block_++, decoded_);
+        next_record_ = 0;
+    }
+    return std::move(decoded_[next_record_++]);
+}
+
+void ColumnarSequenceFile::Write(const gene::SequenceRecord& record)
+{
+    pending_.push_back(record);
+    pending_bytes_ += record.name.size() + record.desc.size() + record.seq.size() + record.quality.size();
+    if (pending_.size() >= kBlockRecords || pending_bytes_ >= kBlockBytes)
+        WriteBlock_();
+}
+
+void ColumnarSequenceFile::WriteBlock_()
+{
+    std::string raw;
+    raw.reserve(pending_bytes_ + pending_.size()*16);
+    EncodeColumns(pending_, raw);
+
+    uLongf compressed_size = compressBound(raw.size());
+    std::string block;
+    block.reserve(kBlockHeaderLength + compressed_size);
+    PutU32(block, static_cast<uint32_t>(raw.size()));
+    block.resize(kBlockHeaderLength + compressed_size);
+    // Speed matters more than ratio for intermediate files
+    if (compress2(reinterpret_cast<Bytef *>(&block[kBlockHeaderLength]), &compressed_size,
+                  reinterpret_cast<const Bytef *>(raw.data()), raw.size(), Z_BEST_SPEED) != Z_OK)
+        throw std::runtime_error("Can't compress columnar block\n");
+    block.resize(kBlockHeaderLength + compressed_size);
+
+    std::string counts;
+    PutU32(counts, static_cast<uint32_t>(compressed_size));
+    PutU32(counts, static_cast<uint32_t>(pending_.size()));
+    block.replace(4, counts.size(), counts);
+
+    blocks_.push_back({written_, static_cast<uint32_t>(pending_.size())});
+    output_.write(block.data(), block.size());
+    written_ += block.size();
+
+    pending_.clear();
+    pending_bytes_ = 0;
+}
+
+std::string ColumnarSequenceFile::EncodeFooter_(const std::vector<BlockIndex>& blocks,
+                                                int64_t footer_offset)
+{
+    std::string footer;
+    for (const auto& block : blocks) {
+        PutU64(footer, static_cast<uint64_t>(block.offset));
+        PutU32(footer, block.records);
+    }
+    PutU64(footer, blocks.size());
+    PutU64(footer, static_cast<uint64_t>(footer_offset));
+    footer.append(kTrailerMagic, kMagicLength);
+    return footer;
+}
+
+void ColumnarSequenceFile::WriteFooter_()
+{
+    std::string footer = EncodeFooter_(blocks_, written_);
+    output_.write(footer.data(), footer.size());
+    written_ += footer.size();
+}
+
+void ColumnarSequenceFile::Close()
+{
+    if (mode_ != gene::OpenMode::Write || closed_)
+        return;
+    closed_ = true;
+
+    if (!pending_.empty())
+        WriteBlock_();
+    WriteFooter_();
+    output_.close();
+    if (!output_) {
+        PrintfLog("Can't write %s\n", path_.c_str());
+        throw std::runtime_error("Can't write columnar file\n");
+    }
+}
+
+void ColumnarSequenceFile::Concatenate(const std::string& path, const std::string& other_path)
+{
+    auto CantJoin = [&path, &other_path]
+    {
+        PrintfLog("Can't append %s to %s\n", other_path.c_str(), path.c_str());
+        return std::runtime_error("Can't join output segments\n");
+    };
+
+    // Only the index of the output is read. Its blocks stay where they are,
+    // so joining many segments doesn't copy the output over and over again.
+    std::vector<BlockIndex> blocks;
+    int64_t footer_offset;
+    {
+        auto first = FileWithName(path, gene::OpenMode::Read);
+        if (!first || !first->valid_)
+            throw CantJoin();
+        blocks = first->blocks_;
+        footer_offset = first->footer_offset_;
+    }
+
+    auto second = FileWithName(other_path, gene::OpenMode::Read);
+    if (!second || !second->valid_)
+        throw CantJoin();
+
+    std::fstream output(path, std::ios::binary | std::ios::in | std::ios::out);
+    if (!output)
+        throw CantJoin();
+
+    // The blocks of the other file are contiguous and replace the footer,
+    // keeping their offsets relative to each other
+    int64_t written = footer_offset;
+    output.seekp(footer_offset);
+    if (!second->blocks_.empty()) {
+        int64_t begin = second->blocks_.front().offset;
+        int64_t end = second->footer_offset_;
+        for (const auto& block : second->blocks_)
+            blocks.push_back({block.offset - begin + footer_offset, block.records});
+        // Compressed blocks are copied as they are
+        output.write(reinterpret_cast<const char *>(second->data_ + begin), end - begin);
+        written += end - begin;
+    }
+
+    std::string footer = EncodeFooter_(blocks, written);
+    output.write(footer.data(), footer.size());
+    written += footer.size();
+    output.close();
+    // The new footer is never shorter than the old one, but make sure no
+    // stale trailer is left past the new end either way
+    if (!output || truncate(path.c_str(), written) != 0)
+        throw CantJoin();
+
+    second = nullptr;
+    std::remove(other_path.c_str());
+}
+
+int64_t ColumnarSequenceFile::position() const
+{
+    if (mode_ == gene::OpenMode::Write)
+        return written_;
+    return next_block_ < blocks_.size() ? blocks_[next_block_].offset : size_;
+}
+
+int64_t ColumnarSequenceFile::length() const
+{
+    return mode_ == gene::OpenMode::Write ? written_ : size_;
+}
+
+std::string ColumnarSequenceFile::filePath() const
+{
+    return path_;
+}
+
+std::string ColumnarSequenceFile::strFileType() const
+{
+    return "columnar";
+}
+
+gene::FileType ColumnarSequenceFile::fileType() const
+{
+    return gene::FileType::Unknown;
+}
+
+gene::FileKind ColumnarSequenceFile::fileKind() const
+{
+    // Mates are kept in separate files
+    return gene::FileKind::SingleEnd;
+}
+
+bool ColumnarSequenceFile::isValidGeneFile() const
+{
+    return mode_ == gene::OpenMode::Write || valid_;
+}
+
+size_t ColumnarSequenceFile::blocks_count() const
+{
+    return blocks_.size();
+}
+
+int64_t ColumnarSequenceFile::records_count() const
+{
+    int64_t count = 0;
+    for (const auto& block : blocks_)
+        count += block.records;
+    return count + static_cast<int64_t>(pending_.size());
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef LIBGENE_OPERATIONS_COLUMNAR_SEQUENCE_FILE_HPP_
+#define LIBGENE_OPERATIONS_COLUMNAR_SEQUENCE_FILE_HPP_
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <cstddef>
+
+#include "RecordFile.hpp"
+
+// Binary format for the intermediate files operations pass to each other.
+//
+// Records are stored in blocks. Within a block every field is kept in a
+// column of its own: names, descriptions, sequence lengths, bases packed four
+// to a byte, runs of anything but A/C/G/T (the N mask, mostly) and qualities.
+// Blocks are compressed independently and indexed by a footer, so a reader
+// can decode any block without looking at the others, from several threads
+// at once. Layout:
+//
+//   "GUCOL001"
+//   per block:  u32 raw size, u32 compressed size, u32 records, zlib data
+//   footer:     (u64 offset, u32 records) per block, u64 blocks count
+//   trailer:    u64 footer offset, "GUCOLEND"
+class ColumnarSequenceFile final : public RecordFile {
+ public:
+    static const std::string kExtension;
+    static constexpr size_t kBlockRecords = 64*1024;
+    static constexpr size_t kBlockBytes = 4*1024*1024;
+
+    static std::unique_ptr<ColumnarSequenceFile> FileWithName(const std::string& path,
+                                                              gene::OpenMode mode);
+    // Moves the blocks of 'other_path' to the end of 'path'. Only the blocks
+    // of 'other_path' and the footer are written, 'path' is extended in place.
+    static void Concatenate(const std::string& path, const std::string& other_path);
+
+    ~ColumnarSequenceFile() override;
+
+    gene::SequenceRecord Read() override;
+    void Write(const gene::SequenceRecord& record) override;
+
+    int64_t position() const override;
+    int64_t length() const override;
+    std::string filePath() const override;
+    std::string strFileType() const override;
+    gene::FileType fileType() const override;
+    gene::FileKind fileKind() const override;
+    bool isValidGeneFile() const override;
+
+    // Writes the last block and the footer. The destructor does it too, but
+    // can't report errors.
+    void Close();
+
+    size_t blocks_count() const;
+    int64_t records_count() const;
+    // Safe to call from several threads at once
+    void DecodeBlock(size_t index, std::vector<gene::SequenceRecord>& records) const;
+
+ private:
+    struct BlockIndex {
+        int64_t offset;
+        uint32_t records;
+    };
+
+    ColumnarSequenceFile(const std::string& path, gene::OpenMode mode);
+    bool MapInput_();
+    void WriteBlock_();
+    void WriteFooter_();
+    static std::string EncodeFooter_(const std::vector<BlockIndex>& blocks, int64_t footer_offset);
+
+    std::string path_;
+    gene::OpenMode mode_;
+    std::vector<BlockIndex> blocks_;
+
+    // Reading
+    int descriptor_{-1};
+    const unsigned char *data_{nullptr};
+    int64_t size_{0};
+    int64_t footer_offset_{0};
+    bool valid_{false};
+    size_t next_block_{0};
+    std::vector<gene::SequenceRecord> decoded_;
+    size_t next_record_{0};
+
+    // Writing
+    std::ofstream output_;
+    std::vector<gene::SequenceRecord> pending_;
+    size_t pending_bytes_{0};
+    int64_t written_{0};
+    bool closed_{false};
+};
+
+#endif  // LIBGENE_OPERATIONS_COLUMNAR_SEQUENCE_FILE_HPP_
@@ -0,0 +1,306 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include <sys/stat.h>
+
+#include "FastaStream.hpp"
+#include <libgene/def/FileType.hpp>
+#include <libgene/utils/StringUtils.hpp>
+#include <libgene/log/Logger.hpp>
+
+bool FastaStreamReader::IsPlainFasta(const std::string& path)
+{
+    return gene::utils::str2type(gene::utils::GetExtension(path)) == gene::FileType::Fasta;
+}
+
+FastaStreamReader::FastaStreamReader(const std::string& path)
+: buffer_(new char[kBufferSize])
+{
+    file_ = std::fopen(path.c_str(), "rb");
+    struct stat info;
+    if (file_ && fstat(fileno(file_), &info) == 0)
+        length_ = info.st_size;
+}
+
+FastaStreamReader::~FastaStreamReader()
+{
+    if (file_)
+        std::fclose(file_);
+}
+
+bool FastaStreamReader::is_open() const
+{
+    return file_ != nullptr;
+}
+
+bool FastaStreamReader::Fill_()
+{
+    size_t leftover = end_ - begin_;
+    if (leftover != 0 && begin_ != 0)
+        std::memmove(buffer_.get(), buffer_.get() + begin_, leftover);
+    buffer_offset_ += begin_;
+    begin_ = 0;
+    end_ = leftover;
+
+    size_t read = std::fread(buffer_.get() + end_, 1, kBufferSize - end_, file_);
+    end_ += read;
+    return read != 0;
+}
+
+bool FastaStreamReader::NextRecord(std::string& header)
+{
+    in_sequence_ = false;
+    // Skip the rest of the current record, down to the next '>' that starts
+    // a line
+    while (true) {
+        if (begin_ == end_ && !Fill_())
+            return false;
+        if (at_line_start_ && buffer_[begin_] == '>')
+            break;
+
+        const char *start = buffer_.get() + begin_;
+        auto newline = static_cast<const char *>(std::memchr(start, '\n', end_ - begin_));
+        at_line_start_ = (newline != nullptr);
+        begin_ = newline ? (newline - buffer_.get()) + 1 : end_;
+    }
+
+    ++begin_;
+    header.clear();
+    while (begin_ != end_ || Fill_()) {
+        const char *start = buffer_.get() + begin_;
+        auto newline = static_cast<const char *>(std::memchr(start, '\n', end_ - begin_));
+        if (newline) {
+            header.append(start, newline - start);
+            begin_ = (newline - buffer_.get()) + 1;
+            break;
+        }
+        header.append(start, end_ - begin_);
+        begin_ = end_;
+    }
+    if (!header.empty() && header.back() == '\r')
+        header.pop_back();
+
+    in_sequence_ = true;
+    at_line_start_ = true;
+    // Records may be wrapped differently, and a short one says nothing about
+    // the width of the next
+    line_width_ = 0;
+    PeekLineWidth_();
+    return true;
+}
+
+void FastaStreamReader::PeekLineWidth_()
+{
+    // Writers want to know the width before the first line is read, so look
+    // ahead without consuming anything
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        if (begin_ != end_) {
+            const char *start = buffer_.get() + begin_;
+            auto newline = static_cast<const char *>(std::memchr(start, '\n', end_ - begin_));
+            if (newline) {
+                if (*start == '>')
+                    return;
+                size_t width = newline - start;
+                if (width != 0 && start[width - 1] == '\r')
+                    --width;
+                line_width_ = width;
+                return;
+            }
+        }
+        if (!Fill_())
+            return;
+    }
+}
+
+template <typename SpanHandler>
+size_t FastaStreamReader::ReadSpans_(size_t limit, SpanHandler handle_span)
+{
+    size_t count = 0;
+    while (in_sequence_ && count < limit) {
+        if (begin_ == end_ && !Fill_()) {
+            in_sequence_ = false;
+            break;
+        }
+        if (at_line_start_ && buffer_[begin_] == '>') {
+            in_sequence_ = false;
+            break;
+        }
+        at_line_start_ = false;
+
+        const char *start = buffer_.get() + begin_;
+        size_t available = end_ - begin_;
+        auto newline = static_cast<const char *>(std::memchr(start, '\n', available));
+        size_t line_end = newline ? static_cast<size_t>(newline - start) : available;
+        size_t span = line_end;
+        if (span != 0 && start[span - 1] == '\r') {
+            --span;
+            // A lone '\r' at the end of the buffer may be half of a "\r\n"
+            if (!newline && span == 0) {
+                if (!Fill_())
+                    begin_ = end_;
+                continue;
+            }
+        }
+
+        size_t take = std::min(span, limit - count);
+        if (take != 0)
+            handle_span(start, take);
+        count += take;
+        begin_ += take;
+
+        if (newline && take == span) {
+            begin_ += line_end - span + 1;
+            at_line_start_ = true;
+        }
+    }
+    return count;
+}
+
+size_t FastaStreamReader::ReadBases(char *bases, size_t capacity)
+{
+    size_t count = 0;
+    return ReadSpans_(capacity, [bases, &count](const char *span, size_t length)
+    {
+        std::memcpy(bases + count, span, length);
+        count += length;
+    });
+}
+
+int64_t FastaStreamReader::CopySequenceTo(FastaStreamWriter& writer)
+{
+    return static_cast<int64_t>(ReadSpans_(std::numeric_limits<size_t>::max(),
+                                           [&writer](const char *span, size_t length)
+    {
+        writer.AppendBases(span, length);
+    }));
+}
+
+size_t FastaStreamReader::line_width() const
+{
+    return line_width_;
+}
+
+int64_t FastaStreamReader::position() const
+{
+    return buffer_offset_ + static_cast<int64_t>(begin_);
+}
+
+int64_t FastaStreamReader::length() const
+{
+    return length_;
+}
+
+FastaStreamWriter::FastaStreamWriter(const std::string& path)
+{
+    file_ = std::fopen(path.c_str(), "wb");
+    buffer_.reserve(kBufferSize + 1);
+}
+
+FastaStreamWriter::~FastaStreamWriter()
+{
+    try {
+        Close();
+    } catch (const std::exception& e) {
+        PrintfLog("%s", e.what());
+    }
+}
+
+bool FastaStreamWriter::is_open() const
+{
+    return file_ != nullptr;
+}
+
+void FastaStreamWriter::BeginRecord(const std::string& header, size_t line_width)
+{
+    if (column_ != 0) {
+        buffer_.push_back('\n');
+        column_ = 0;
+    }
+    line_width_ = line_width;
+    buffer_.push_back('>');
+    buffer_.append(header);
+    buffer_.push_back('\n');
+    if (buffer_.size() >= kBufferSize)
+        Flush_();
+}
+
+void FastaStreamWriter::AppendBases(const char *bases, size_t count)
+{
+    if (line_width_ == 0) {
+        buffer_.append(bases, count);
+        column_ += count;
+        if (buffer_.size() >= kBufferSize)
+            Flush_();
+        return;
+    }
+
+    // Whole lines are block copies with a newline after each
+    while (count != 0) {
+        size_t take = std::min(line_width_ - column_, count);
+        buffer_.append(bases, take);
+        bases += take;
+        count -= take;
+        column_ += take;
+        if (column_ == line_width_) {
+            buffer_.push_back('\n');
+            column_ = 0;
+        }
+        if (buffer_.size() >= kBufferSize)
+            Flush_();
+    }
+}
+
+void FastaStreamWriter::Flush_()
+{
+    if (buffer_.empty())
+        return;
+    if (std::fwrite(buffer_.data(), 1, buffer_.size(), file_) != buffer_.size())
+        throw std::runtime_error("Can't write FASTA output\n");
+    bytes_written_ += buffer_.size();
+    buffer_.clear();
+}
+
+void FastaStreamWriter::Close()
+{
+    if (!file_)
+        return;
+
+    if (column_ != 0) {
+        buffer_.push_back('\n');
+        column_ = 0;
+    }
+    bool written = true;
+    try {
+        Flush_();
+    } catch (const std::runtime_error&) {
+        written = false;
+    }
+    written = (std::fclose(file_) == 0) && written;
+    file_ = nullptr;
+    if (!written)
+        throw std::runtime_error("Can't write FASTA output\n");
+}
+
+int64_t FastaStreamWriter::bytes_written() const
+{
+    return bytes_written_;
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef LIBGENE_OPERATIONS_FASTA_STREAM_HPP_
+#define LIBGENE_OPERATIONS_FASTA_STREAM_HPP_
+
+#include <memory>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+
+// Reads uncompressed FASTA without holding a whole record in memory: the
+// header comes first, then the sequence in pieces of whatever size the
+// caller asks for, with the line breaks taken out.
+class FastaStreamWriter;
+
+class FastaStreamReader final {
+ public:
+    static constexpr size_t kBufferSize = 1024*1024;
+
+    // Only plain FASTA files can be streamed, compressed ones go through
+    // libgene
+    static bool IsPlainFasta(const std::string& path);
+
+    explicit FastaStreamReader(const std::string& path);
+    ~FastaStreamReader();
+
+    bool is_open() const;
+
+    // Skips what's left of the current record and returns the header line
+    // of the next one, without the '>'. Returns false at the end of file.
+    bool NextRecord(std::string& header);
+    // Reads up to 'capacity' bases of the current record. Returns 0 once the
+    // record is over.
+    size_t ReadBases(char *bases, size_t capacity);
+    // Passes the rest of the current record's sequence straight from the
+    // read buffer to 'writer'. Returns the number of bases.
+    int64_t CopySequenceTo(FastaStreamWriter& writer);
+
+    // Length of the first sequence line of the current record, known once
+    // NextRecord() returned it. 0 if the record has no sequence, or its first
+    // line doesn't fit into the read buffer.
+    size_t line_width() const;
+    int64_t position() const;
+    int64_t length() const;
+
+ private:
+    // Keeps the unconsumed bytes and reads more after them
+    bool Fill_();
+    void PeekLineWidth_();
+    // Hands the sequence over in spans of contiguous bases
+    template <typename SpanHandler>
+    size_t ReadSpans_(size_t limit, SpanHandler handle_span);
+
+    FILE *file_{nullptr};
+    std::unique_ptr<char[]> buffer_;
+    size_t begin_{0};
+    size_t end_{0};
+    int64_t buffer_offset_{0};
+    int64_t length_{0};
+
+    bool in_sequence_{false};
+    bool at_line_start_{true};
+    size_t line_width_{0};
+};
+
+// Writes FASTA records whose sequences arrive in pieces, wrapping the lines
+// of every record at the width it was started with.
+class FastaStreamWriter final {
+ public:
+    static constexpr size_t kBufferSize = 1024*1024;
+
+    explicit FastaStreamWriter(const std::string& path);
+    ~FastaStreamWriter();
+
+    bool is_open() const;
+
+    // 'header' goes after the '>' as it is. The sequence is wrapped at
+    // 'line_width', 0 keeps it on one line.
+    void BeginRecord(const std::string& header, size_t line_width);
+    void AppendBases(const char *bases, size_t count);
+    // Flushes and closes the file. Throws std::runtime_error if the data
+    // didn't make it to disk.
+    void Close();
+
+    int64_t bytes_written() const;
+
+ private:
+    void Flush_();
+
+    FILE *file_{nullptr};
+    std::string buffer_;
+    size_t line_width_{0};
+    size_t column_{0};
+    int64_t bytes_written_{0};
+};
+
+#endif  // LIBGENE_OPERATIONS_FASTA_STREAM_HPP_
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+#include "FileSegments.hpp"
+#include "ColumnarSequenceFile.hpp"
+#include "SeparatedRecordFile.hpp"
+#include <libgene/def/FileType.hpp>
+#include <libgene/utils/StringUtils.hpp>
+#include <libgene/log/Logger.hpp>
+
+std::string SegmentPath(const std::string& path, size_t index)
+{
+    return gene::utils::InsertSuffixBeforePathExtension(path, "-segment" + std::to_string(index));
+}
+
+void RemoveSegment(const std::string& segment_path)
+{
+    std::remove(segment_path.c_str());
+    auto type = gene::utils::str2type(gene::utils::GetExtension(segment_path));
+    if (type == gene::FileType::Csv || type == gene::FileType::Tsv)
+        std::remove(SeparatedRecordFile::ColumnTypesPath(segment_path).c_str());
+}
+
+void AppendSegment(const std::string& path, const std::string& segment_path)
+{
+    // Columnar files end with an index of their blocks
+    if (gene::utils::GetExtension(path) == ColumnarSequenceFile::kExtension) {
+        ColumnarSequenceFile::Concatenate(path, segment_path);
+        return;
+    }
+
+    // Separated formats start every file with the same header line
+    std::string output_header;
+    auto type = gene::utils::str2type(gene::utils::GetExtension(path));
+    bool separated_format = (type == gene::FileType::Csv || type == gene::FileType::Tsv);
+    if (separated_format) {
+        std::ifstream output(path, std::ios::binary);
+        std::getline(output, output_header);
+    }
+
+    std::ifstream segment(segment_path, std::ios::binary);
+    std::ofstream output(path, std::ios::binary | std::ios::app);
+    if (!segment || !output) {
+        PrintfLog("Can't append %s to %s\n", segment_path.c_str(), path.c_str());
+        throw std::runtime_error("Can't join output segments\n");
+    }
+
+    if (separated_format) {
+        std::string segment_header;
+        std::getline(segment, segment_header);
+        if (segment_header != output_header)
+            output << segment_header << '\n';
+    }
+    output << segment.rdbuf();
+    output.close();
+    segment.close();
+    RemoveSegment(segment_path);
+}
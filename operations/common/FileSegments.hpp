@@ -0,0 +1,41 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef LIBGENE_OPERATIONS_FILE_SEGMENTS_HPP_
+#define LIBGENE_OPERATIONS_FILE_SEGMENTS_HPP_
+
+#include <string>
+
+// An output written in pieces keeps every piece after the first one in a
+// segment file next to it, and joins the segments in order once they are
+// all complete.
+
+// Path of segment 'index' (counting from 1) of the output at 'path'
+std::string SegmentPath(const std::string& path, size_t index);
+
+// Removes the segment at 'segment_path' along with its column types file,
+// if it has one
+void RemoveSegment(const std::string& segment_path);
+
+// Appends 'segment_path' to the end of 'path' and removes the segment.
+// Columnar files are joined block by block. CSV and TSV tables always start
+// with a header line, which is dropped from the segment when the output
+// already starts with it.
+// Throws std::runtime_error if either file can't be opened.
+void AppendSegment(const std::string& path, const std::string& segment_path);
+
+#endif  // LIBGENE_OPERATIONS_FILE_SEGMENTS_HPP_
@@ -0,0 +1,313 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+#include "PackedSequence.hpp"
+
+static const char kBases[] = "ACGT";
+
+static int BaseCode(char base)
+{
+    switch (base) {
+        case 'A': return 0;
+        case 'C': return 1;
+        case 'G': return 2;
+        case 'T': return 3;
+        default: return -1;
+    }
+}
+
+static char ComplementBase(char base)
+{
+    switch (base) {
+        case 'A': return 'T';
+        case 'C': return 'G';
+        case 'G': return 'C';
+        case 'T': return 'A';
+        case 'U': return 'A';
+        case 'R': return 'Y';
+        case 'Y': return 'R';
+        case 'K': return 'M';
+        case 'M': return 'K';
+        case 'B': return 'V';
+        case 'V': return 'B';
+        case 'D': return 'H';
+        case 'H': return 'D';
+        case 'a': return 't';
+        case 'c': return 'g';
+        case 'g': return 'c';
+        case 't': return 'a';
+        case 'u': return 'a';
+        case 'r': return 'y';
+        case 'y': return 'r';
+        case 'k': return 'm';
+        case 'm': return 'k';
+        case 'b': return 'v';
+        case 'v': return 'b';
+        case 'd': return 'h';
+        case 'h': return 'd';
+        // N, S, W and gaps are their own complements
+        default: return base;
+    }
+}
+
+// Reverses the order of the 32 two-bit groups of 'word'
+static uint64_t ReverseBasesInWord(uint64_t word)
+{
+    word = ((word >> 2) & 0x3333333333333333ull) | ((word & 0x3333333333333333ull) << 2);
+    word = ((word >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((word & 0x0F0F0F0F0F0F0F0Full) << 4);
+    return __builtin_bswap64(word);
+}
+
+void PackedSequence::PackBases(const char *bases, size_t count, unsigned char *packed)
+{
+    size_t i = 0;
+#if defined(__SSSE3__)
+    // Sixteen bases at a time: compare to get the codes, then let two
+    // multiply-adds fold every four codes into a byte
+    const __m128i c_base = _mm_set1_epi8('C');
+    const __m128i g_base = _mm_set1_epi8('G');
+    const __m128i t_base = _mm_set1_epi8('T');
+    const __m128i pair_weights = _mm_set1_epi16(0x0401);
+    const __m128i quad_weights = _mm_set1_epi32(0x00100001);
+    const __m128i gather = _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1,
+                                         -1, -1, -1, -1, -1, -1, -1, -1);
+    for (; i + 16 <= count; i += 16) {
+        __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bases + i));
+        __m128i codes = _mm_and_si128(_mm_cmpeq_epi8(input, c_base), _mm_set1_epi8(1));
+        codes = _mm_or_si128(codes, _mm_and_si128(_mm_cmpeq_epi8(input, g_base), _mm_set1_epi8(2)));
+        codes = _mm_or_si128(codes, _mm_and_si128(_mm_cmpeq_epi8(input, t_base), _mm_set1_epi8(3)));
+
+        __m128i pairs = _mm_maddubs_epi16(codes, pair_weights);
+        __m128i quads = _mm_madd_epi16(pairs, quad_weights);
+        uint32_t word = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_shuffle_epi8(quads, gather)));
+        std::memcpy(packed + i/4, &word, sizeof(word));
+    }
+#endif
+    for (; i < count; i += 4) {
+        unsigned char byte = 0;
+        for (size_t j = 0; j < 4 && i + j < count; ++j)
+            byte |= static_cast<unsigned char>(std::max(BaseCode(bases[i + j]), 0) << (2*j));
+        packed[i/4] = byte;
+    }
+}
+
+void PackedSequence::UnpackBases(const unsigned char *packed, size_t count, char *bases)
+{
+    size_t i = 0;
+#if defined(__SSSE3__)
+    // Every byte is spread over four lanes, each lane masks its own code.
+    // The masked values are either in the low or in the high nibble, and
+    // one table lookup turns both into letters.
+    const __m128i spread = _mm_setr_epi8(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3);
+    const __m128i masks = _mm_set1_epi32(static_cast<int>(0xC0300C03));
+    const __m128i letters = _mm_setr_epi8('A', 'C', 'G', 'T', 'C', 0, 0, 0,
+                                          'G', 0, 0, 0, 'T', 0, 0, 0);
+    const __m128i low_nibble = _mm_set1_epi8(0x0F);
+    for (; i + 16 <= count; i += 16) {
+        uint32_t word;
+        std::memcpy(&word, packed + i/4, sizeof(word));
+        __m128i codes = _mm_and_si128(_mm_shuffle_epi8(_mm_cvtsi32_si128(static_cast<int>(word)), spread),
+                                      masks);
+        __m128i index = _mm_or_si128(_mm_and_si128(codes, low_nibble),
+                                     _mm_and_si128(_mm_srli_epi16(codes, 4), low_nibble));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(bases + i), _mm_shuffle_epi8(letters, index));
+    }
+#endif
+    for (; i < count; ++i)
+        bases[i] = kBases[(packed[i/4] >> (2*(i % 4))) & 3];
+}
+
+PackedSequence::PackedSequence(const std::string& sequence)
+{
+    Assign(sequence.data(), sequence.size());
+}
+
+void PackedSequence::Assign(const char *bases, size_t count)
+{
+    size_ = count;
+    words_.assign((count + kBasesPerWord - 1)/kBasesPerWord, 0);
+    PackBases(bases, count, reinterpret_cast<unsigned char *>(words_.data()));
+
+    runs_.clear();
+    for (size_t i = 0; i < count; ++i) {
+        if (BaseCode(bases[i]) >= 0)
+            continue;
+        if (!runs_.empty() && runs_.back().base == bases[i] &&
+            runs_.back().start + runs_.back().length == i) {
+            ++runs_.back().length;
+        } else {
+            runs_.push_back({static_cast<uint32_t>(i), 1, bases[i]});
+        }
+    }
+}
+
+void PackedSequence::UnpackTo(std::string& sequence) const
+{
+    sequence.resize(size_);
+    if (size_ == 0)
+        return;
+
+    UnpackBases(reinterpret_cast<const unsigned char *>(words_.data()), size_, &sequence[0]);
+    for (const auto& run : runs_)
+        sequence.replace(run.start, run.length, run.length, run.base);
+}
+
+std::string PackedSequence::Unpack() const
+{
+    std::string sequence;
+    UnpackTo(sequence);
+    return sequence;
+}
+
+size_t PackedSequence::size() const
+{
+    return size_;
+}
+
+bool PackedSequence::empty() const
+{
+    return size_ == 0;
+}
+
+size_t PackedSequence::bytes() const
+{
+    return words_.capacity()*sizeof(uint64_t) + runs_.capacity()*sizeof(Run);
+}
+
+const PackedSequence::Run *PackedSequence::RunAt_(size_t position) const
+{
+    auto next = std::upper_bound(runs_.begin(), runs_.end(), position,
+                                 [](size_t value, const Run& run) { return value < run.start; });
+    if (next == runs_.begin())
+        return nullptr;
+    const Run& run = *(next - 1);
+    return (position < run.start + run.length) ? &run : nullptr;
+}
+
+char PackedSequence::at(size_t position) const
+{
+    if (auto run = RunAt_(position))
+        return run->base;
+    return kBases[Codes_(position, 1)];
+}
+
+uint64_t PackedSequence::Codes_(size_t position, size_t count) const
+{
+    size_t word = position/kBasesPerWord;
+    size_t offset = position % kBasesPerWord;
+    uint64_t codes = words_[word] >> (2*offset);
+    if (offset != 0 && offset + count > kBasesPerWord)
+        codes |= words_[word + 1] << (2*(kBasesPerWord - offset));
+    if (count < kBasesPerWord)
+        codes &= (1ull << (2*count)) - 1;
+    return codes;
+}
+
+PackedSequence PackedSequence::ReverseComplement() const
+{
+    PackedSequence result;
+    result.size_ = size_;
+    result.words_.resize(words_.size());
+
+    // Reversing the words leaves the padding of the last word in front, so
+    // the result is shifted down by its length
+    size_t padding = words_.size()*kBasesPerWord - size_;
+    for (size_t i = 0; i < words_.size(); ++i)
+        result.words_[i] = ~ReverseBasesInWord(words_[words_.size() - 1 - i]);
+    if (padding != 0) {
+        for (size_t i = 0; i < result.words_.size(); ++i) {
+            result.words_[i] >>= 2*padding;
+            if (i + 1 < result.words_.size())
+                result.words_[i] |= result.words_[i + 1] << (2*(kBasesPerWord - padding));
+        }
+        result.words_.back() &= (1ull << (2*(kBasesPerWord - padding))) - 1;
+    }
+
+    result.runs_.reserve(runs_.size());
+    for (auto run = runs_.rbegin(); run != runs_.rend(); ++run) {
+        result.runs_.push_back({static_cast<uint32_t>(size_ - run->start - run->length),
+                                run->length,
+                                ComplementBase(run->base)});
+    }
+    return result;
+}
+
+int PackedSequence::Mismatches(const PackedSequence& pattern, size_t position, int limit) const
+{
+    if (position > size_ || pattern.size_ > size_ - position)
+        return limit + 1;
+
+    bool has_runs = !pattern.runs_.empty() || !runs_.empty();
+    int mismatches = 0;
+    for (size_t i = 0; i < pattern.size_; i += kBasesPerWord) {
+        size_t count = std::min(kBasesPerWord, pattern.size_ - i);
+        uint64_t difference = Codes_(position + i, count) ^ pattern.Codes_(i, count);
+        difference = (difference | (difference >> 1)) & 0x5555555555555555ull;
+        mismatches += __builtin_popcountll(difference);
+        // Runs can only be told apart by their letters, which may take
+        // mismatches back
+        if (mismatches > limit && !has_runs)
+            return mismatches;
+    }
+    if (!has_runs)
+        return mismatches;
+
+    std::vector<size_t> positions;
+    for (const auto& run : pattern.runs_) {
+        for (size_t j = run.start; j < run.start + run.length; ++j)
+            positions.push_back(j);
+    }
+    auto first_run = std::upper_bound(runs_.begin(), runs_.end(), position,
+                                      [](size_t value, const Run& run) { return value < run.start; });
+    if (first_run != runs_.begin())
+        --first_run;
+    for (auto run = first_run; run != runs_.end() && run->start < position + pattern.size_; ++run) {
+        size_t begin = std::max<size_t>(run->start, position);
+        size_t end = std::min<size_t>(run->start + run->length, position + pattern.size_);
+        for (size_t j = begin; j < end; ++j)
+            positions.push_back(j - position);
+    }
+    std::sort(positions.begin(), positions.end());
+    positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+
+    for (size_t j : positions) {
+        bool codes_differ = (Codes_(position + j, 1) != pattern.Codes_(j, 1));
+        char pattern_base = pattern.at(j);
+        bool bases_differ = (pattern_base != 'N' && pattern_base != at(position + j));
+        mismatches += static_cast<int>(bases_differ) - static_cast<int>(codes_differ);
+    }
+    return mismatches;
+}
+
+size_t PackedSequence::Find(const PackedSequence& pattern, int max_mismatches) const
+{
+    if (pattern.size_ > size_)
+        return std::string::npos;
+
+    for (size_t position = 0; position + pattern.size_ <= size_; ++position) {
+        if (Mismatches(pattern, position, max_mismatches) <= max_mismatches)
+            return position;
+    }
+    return std::string::npos;
+}
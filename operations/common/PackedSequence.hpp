@@ -0,0 +1,82 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef LIBGENE_OPERATIONS_PACKED_SEQUENCE_HPP_
+#define LIBGENE_OPERATIONS_PACKED_SEQUENCE_HPP_
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Nucleotide sequence stored with two bits per base (A=0, C=1, G=2, T=3),
+// four times smaller than a std::string. Anything else (N, IUPAC codes,
+// lowercase) is kept in a sparse list of runs, which take precedence over
+// whatever the packed words hold at those positions.
+//
+// Base i occupies bits 2*(i%32) and up of word i/32, so on little-endian
+// machines the words can be read as a byte stream with four bases a byte.
+class PackedSequence final {
+ public:
+    static constexpr size_t kBasesPerWord = 32;
+
+    PackedSequence() = default;
+    explicit PackedSequence(const std::string& sequence);
+
+    void Assign(const char *bases, size_t count);
+    std::string Unpack() const;
+    void UnpackTo(std::string& sequence) const;
+
+    size_t size() const;
+    bool empty() const;
+    char at(size_t position) const;
+    // Memory taken, not counting the object itself
+    size_t bytes() const;
+
+    PackedSequence ReverseComplement() const;
+
+    // Counts the bases of 'pattern' that differ from this sequence starting
+    // at 'position', stopping early once the count exceeds 'limit'. N in the
+    // pattern matches anything.
+    int Mismatches(const PackedSequence& pattern, size_t position, int limit) const;
+    // First position where 'pattern' occurs with at most 'max_mismatches'
+    // mismatches, or std::string::npos
+    size_t Find(const PackedSequence& pattern, int max_mismatches) const;
+
+    // Kernels shared with the binary file formats. Non-ACGT bases are packed
+    // as A, 'packed' has to hold (count + 3)/4 bytes.
+    static void PackBases(const char *bases, size_t count, unsigned char *packed);
+    static void UnpackBases(const unsigned char *packed, size_t count, char *bases);
+
+ private:
+    struct Run {
+        uint32_t start;
+        uint32_t length;
+        char base;
+    };
+
+    // Codes of 'count' (at most 32) bases starting at 'position', in the
+    // low bits of the result
+    uint64_t Codes_(size_t position, size_t count) const;
+    const Run *RunAt_(size_t position) const;
+
+    std::vector<uint64_t> words_;
+    std::vector<Run> runs_;
+    size_t size_{0};
+};
+
+#endif  // LIBGENE_OPERATIONS_PACKED_SEQUENCE_HPP_
@@ -0,0 +1,187 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "PrefetchingRecordFile.hpp"
+
+// How far ahead of the reading thread the kernel is asked to read
+constexpr int64_t kAdviseWindow = 8*1024*1024;
+
+PrefetchingRecordFile::PrefetchingRecordFile(std::unique_ptr<RecordFile>&& file, size_t depth)
+: file_(std::move(file))
+, depth_(depth != 0 ? depth : kDefaultDepth)
+, length_(file_->length())
+, file_path_(file_->filePath())
+, str_file_type_(file_->strFileType())
+, file_type_(file_->fileType())
+, file_kind_(file_->fileKind())
+, is_valid_(file_->isValidGeneFile())
+{
+    position_ = file_->position();
+}
+
+PrefetchingRecordFile::~PrefetchingRecordFile()
+{
+    if (thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        slot_free_.notify_all();
+        thread_.join();
+    }
+}
+
+void PrefetchingRecordFile::Advise_(int64_t position)
+{
+    if (position + kAdviseWindow/2 < advised_until_)
+        return;
+
+    int64_t from = std::max(position, advised_until_);
+    advised_until_ = position + kAdviseWindow;
+    // The hints are about the file, not the descriptor, so one is opened
+    // just for them. Keeping it open would double the descriptors of wide
+    // merges, and without a free one there's simply no hint.
+    int descriptor = open(file_path_.c_str(), O_RDONLY);
+    if (descriptor < 0)
+        return;
+#if defined(F_RDADVISE)
+    struct radvisory advice;
+    advice.ra_offset = from;
+    advice.ra_count = static_cast<int>(advised_until_ - from);
+    fcntl(descriptor, F_RDADVISE, &advice);
+#elif defined(POSIX_FADV_WILLNEED)
+    posix_fadvise(descriptor, from, advised_until_ - from, POSIX_FADV_WILLNEED);
+#endif
+    close(descriptor);
+}
+
+void PrefetchingRecordFile::Fill_()
+{
+    try {
+        bool reached_end = false;
+        while (!reached_end) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                slot_free_.wait(lock, [this] { return stopping_ || batches_.size() < depth_; });
+                if (stopping_)
+                    return;
+            }
+
+            Batch batch;
+            batch.records.reserve(kBatchRecords);
+            size_t bytes = 0;
+            while (batch.records.size() < kBatchRecords && bytes < kBatchBytes) {
+                gene::SequenceRecord record = file_->Read();
+                if (record.Empty()) {
+                    reached_end = true;
+                    break;
+                }
+                bytes += record.name.size() + record.desc.size() + record.seq.size() + record.quality.size();
+                batch.records.push_back(std::move(record));
+            }
+            batch.position = file_->position();
+            Advise_(batch.position);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                batches_.push_back(std::move(batch));
+                reached_end_ = reached_end;
+            }
+            batch_ready_.notify_one();
+        }
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        error_ = std::current_exception();
+        reached_end_ = true;
+        batch_ready_.notify_one();
+    }
+}
+
+void PrefetchingRecordFile::Start()
+{
+    if (!thread_.joinable() && !reached_end_)
+        thread_ = std::thread(&PrefetchingRecordFile::Fill_, this);
+}
+
+gene::SequenceRecord PrefetchingRecordFile::Read()
+{
+    Start();
+
+    while (next_record_ == current_.records.size()) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            batch_ready_.wait(lock, [this] { return !batches_.empty() || reached_end_; });
+            if (batches_.empty()) {
+                if (error_)
+                    std::rethrow_exception(error_);
+                return gene::SequenceRecord();
+            }
+            current_ = std::move(batches_.front());
+            batches_.pop_front();
+        }
+        slot_free_.notify_one();
+        next_record_ = 0;
+        position_ = current_.position;
+    }
+    return std::move(current_.records[next_record_++]);
+}
+
+void PrefetchingRecordFile::Write(const gene::SequenceRecord&)
+{
+    throw std::logic_error("Can't write to a prefetching file\n");
+}
+
+int64_t PrefetchingRecordFile::position() const
+{
+    return position_;
+}
+
+int64_t PrefetchingRecordFile::length() const
+{
+    return length_;
+}
+
+std::string PrefetchingRecordFile::filePath() const
+{
+    return file_path_;
+}
+
+std::string PrefetchingRecordFile::strFileType() const
+{
+    return str_file_type_;
+}
+
+gene::FileType PrefetchingRecordFile::fileType() const
+{
+    return file_type_;
+}
+
+gene::FileKind PrefetchingRecordFile::fileKind() const
+{
+    return file_kind_;
+}
+
+bool PrefetchingRecordFile::isValidGeneFile() const
+{
+    return is_valid_;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef LIBGENE_OPERATIONS_PREFETCHING_RECORD_FILE_HPP_
+#define LIBGENE_OPERATIONS_PREFETCHING_RECORD_FILE_HPP_
+
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <exception>
+#include <condition_variable>
+
+#include "RecordFile.hpp"
+
+// Reads records from another file on a background thread, up to 'depth'
+// batches ahead of the caller, so that disk reads and parsing overlap with
+// whatever the caller does with the records. The thread also tells the
+// kernel which part of the file comes next.
+//
+// The background thread starts with the first Read(), or earlier with
+// Start(). Everything else is answered from what the file reported when it
+// was wrapped.
+class PrefetchingRecordFile final : public RecordFile {
+ public:
+    static constexpr size_t kBatchRecords = 4096;
+    static constexpr size_t kBatchBytes = 1024*1024;
+    static constexpr size_t kDefaultDepth = 4;
+
+    PrefetchingRecordFile(std::unique_ptr<RecordFile>&& file, size_t depth);
+    ~PrefetchingRecordFile() override;
+
+    // Starts reading ahead before the first Read(), e.g. so that the files
+    // to be read next get decoded while the current one is being read
+    void Start();
+
+    gene::SequenceRecord Read() override;
+    // Prefetching files are read-only
+    void Write(const gene::SequenceRecord& record) override;
+
+    int64_t position() const override;
+    int64_t length() const override;
+    std::string filePath() const override;
+    std::string strFileType() const override;
+    gene::FileType fileType() const override;
+    gene::FileKind fileKind() const override;
+    bool isValidGeneFile() const override;
+
+ private:
+    struct Batch {
+        std::vector<gene::SequenceRecord> records;
+        // Position of the underlying file after the last record
+        int64_t position;
+    };
+
+    void Fill_();
+    void Advise_(int64_t position);
+
+    std::unique_ptr<RecordFile> file_;
+    const size_t depth_;
+    const int64_t length_;
+    const std::string file_path_;
+    const std::string str_file_type_;
+    const gene::FileType file_type_;
+    const gene::FileKind file_kind_;
+    const bool is_valid_;
+    // Only used by the background thread once it's started
+    int64_t advised_until_{0};
+
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable batch_ready_;
+    std::condition_variable slot_free_;
+    std::deque<Batch> batches_;
+    bool reached_end_{false};
+    bool stopping_{false};
+    std::exception_ptr error_;
+
+    // Owned by the thread calling Read(). The background thread never
+    // touches these, it only hands batches over through 'batches_'.
+    Batch current_;
+    size_t next_record_{0};
+    int64_t position_{0};
+};
+
+#endif  // LIBGENE_OPERATIONS_PREFETCHING_RECORD_FILE_HPP_
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "ProgressSampler.hpp"
+#include "RunStatistics.hpp"
+
+ProgressSampler::ProgressSampler(size_t slots_count, const std::function<bool(float)>& callback,
+                                 Progress&& progress, RunStatistics *statistics,
+                                 std::chrono::milliseconds interval)
+: slots_(new Slot[slots_count]),
+  slots_count_(slots_count),
+  callback_(callback),
+  progress_(std::move(progress)),
+  statistics_(statistics),
+  interval_(interval)
+{
+    if (callback_ || statistics_)
+        thread_ = std::thread(&ProgressSampler::Run_, this);
+}
+
+ProgressSampler::~ProgressSampler()
+{
+    Stop();
+}
+
+ProgressSampler::Counters& ProgressSampler::slot(size_t index)
+{
+    return slots_[index].counters;
+}
+
+ProgressSampler::Totals ProgressSampler::totals() const
+{
+    Totals totals{0, 0, 0};
+    for (size_t i = 0; i < slots_count_; ++i) {
+        const auto& counters = slots_[i].counters;
+        totals.records += counters.records.load(std::memory_order_relaxed);
+        totals.bytes += counters.bytes.load(std::memory_order_relaxed);
+        totals.matches += counters.matches.load(std::memory_order_relaxed);
+    }
+    return totals;
+}
+
+void ProgressSampler::Cancel()
+{
+    cancelled_.store(true, std::memory_order_relaxed);
+}
+
+void ProgressSampler::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    stop_condition_.notify_one();
+    if (thread_.joinable())
+        thread_.join();
+}
+
+void ProgressSampler::Run_()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_condition_.wait_for(lock, interval_, [this] { return stopping_; })) {
+        // Once cancelled, the workers are only waited for
+        if (cancelled())
+            continue;
+        lock.unlock();
+        auto current = totals();
+        if (statistics_)
+            statistics_->AddSample(current.records, current.bytes);
+        if (callback_ && callback_(progress_(current)))
+            Cancel();
+        lock.lock();
+    }
+
+    // The workers are done by now, so the callback gets to see where they
+    // ended up, however short the run was
+    if (callback_ && !cancelled()) {
+        lock.unlock();
+        callback_(progress_(totals()));
+    }
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef LIBGENE_OPERATIONS_PROGRESS_SAMPLER_HPP_
+#define LIBGENE_OPERATIONS_PROGRESS_SAMPLER_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <cstdint>
+#include <cstddef>
+
+class RunStatistics;
+
+// Reports the progress of work spread over several threads.
+//
+// Workers keep their counts in slots of their own, spaced far enough apart
+// not to share cache lines, and never call the progress callback. A thread
+// of the sampler's sums the slots up at a fixed rate and calls the callback
+// with the result, so the callback is only ever called from one thread.
+// Cancelling is a flag the workers check, set when the callback asks to
+// stop. The same samples make the timeline of the run's statistics.
+class ProgressSampler final {
+ public:
+    static constexpr auto kDefaultInterval = std::chrono::milliseconds(50);
+
+    // Counts of one slot. A slot is written by one thread at a time, which
+    // stores the new values with relaxed order.
+    struct Counters {
+        std::atomic<int64_t> records{0};
+        std::atomic<int64_t> bytes{0};
+        std::atomic<int64_t> matches{0};
+    };
+    struct Totals {
+        int64_t records;
+        int64_t bytes;
+        int64_t matches;
+    };
+    // Turns the totals into the value the callback gets
+    typedef std::function<float(const Totals&)> Progress;
+
+    // Doesn't start a thread if there's neither a 'callback' nor 'statistics'
+    ProgressSampler(size_t slots_count, const std::function<bool(float)>& callback,
+                    Progress&& progress, RunStatistics *statistics = nullptr,
+                    std::chrono::milliseconds interval = kDefaultInterval);
+    ~ProgressSampler();
+
+    Counters& slot(size_t index);
+    Totals totals() const;
+
+    bool cancelled() const
+    {
+        return cancelled_.load(std::memory_order_relaxed);
+    }
+    void Cancel();
+
+    // Stops sampling. Unless cancelled, the callback is called once more
+    // with the final progress, and never after this returns.
+    void Stop();
+
+ private:
+    // Counters are placed this far apart. Twice a cache line, as the array
+    // itself may start anywhere within one.
+    static constexpr size_t kSlotSize = 128;
+    struct Slot {
+        Counters counters;
+        char padding[kSlotSize - sizeof(Counters)];
+    };
+
+    void Run_();
+
+    std::unique_ptr<Slot[]> slots_;
+    size_t slots_count_;
+    std::function<bool(float)> callback_;
+    Progress progress_;
+    RunStatistics *statistics_;
+    std::chrono::milliseconds interval_;
+    std::atomic<bool> cancelled_{false};
+
+    std::mutex mutex_;
+    std::condition_variable stop_condition_;
+    bool stopping_{false};
+    std::thread thread_;
+};
+
+#endif  // LIBGENE_OPERATIONS_PROGRESS_SAMPLER_HPP_
@@ -0,0 +1,190 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+#include "QualityBinner.hpp"
+#include <libgene/def/Flags.hpp>
+#include <libgene/log/Logger.hpp>
+
+// Illumina's 8-level binning; scores 0 and 1 (no call) are kept
+static const std::vector<QualityBinner::Bin> kIllumina8Bins = {
+    {2, 9, 6}, {10, 19, 15}, {20, 24, 22}, {25, 29, 27},
+    {30, 34, 33}, {35, 39, 37}, {40, 93, 40}};
+static const std::vector<QualityBinner::Bin> kNcbi4Bins = {
+    {0, 9, 5}, {10, 19, 15}, {20, 29, 25}, {30, 93, 35}};
+
+// Built-in schemes go up to the highest Phred+33 score, so their top bin is
+// cut down to the highest score 'max_score' of the output's encoding
+static std::vector<QualityBinner::Bin> ClampBins(std::vector<QualityBinner::Bin> bins, int max_score)
+{
+    for (auto& bin : bins) {
+        bin.high = std::min(bin.high, max_score);
+        bin.value = std::min(bin.value, max_score);
+    }
+    return bins;
+}
+
+static std::vector<QualityBinner::Bin> ParseBins(const std::string& scheme, int max_score)
+{
+    if (scheme == "illumina8")
+        return ClampBins(kIllumina8Bins, max_score);
+    if (scheme == "ncbi4")
+        return ClampBins(kNcbi4Bins, max_score);
+
+    std::vector<QualityBinner::Bin> bins;
+    size_t start = 0;
+    while (start <= scheme.size()) {
+        size_t end = scheme.find(',', start);
+        if (end == std::string::npos)
+            end = scheme.size();
+        auto bin = scheme.substr(start, end - start);
+
+        size_t dash = bin.find('-');
+        size_t colon = bin.find(':');
+        if (dash == std::string::npos || colon == std::string::npos || colon < dash)
+            throw std::invalid_argument("Quality bin '" + bin + "' isn't in the form low-high:value");
+        try {
+            bins.push_back({std::stoi(bin.substr(0, dash)),
+                            std::stoi(bin.substr(dash + 1, colon - dash - 1)),
+                            std::stoi(bin.substr(colon + 1))});
+        } catch (const std::logic_error&) {
+            throw std::invalid_argument("Quality bin '" + bin + "' isn't in the form low-high:value");
+        }
+        start = end + 1;
+    }
+    return bins;
+}
+
+QualityBinner::QualityBinner(const std::string& scheme, int phred_offset)
+: bins_(ParseBins(scheme, 127 - phred_offset)), phred_offset_(phred_offset), bin_counts_(bins_.size(), 0)
+{
+    for (int c = 0; c < 128; ++c)
+        table_[c] = static_cast<unsigned char>(c);
+
+    std::vector<bool> assigned(128, false);
+    // Only bins given by the user can go past this
+    int max_score = 127 - phred_offset_;
+    for (const auto& bin : bins_) {
+        if (bin.low < 0 || bin.low > bin.high || bin.high > max_score ||
+            bin.value < 0 || bin.value > max_score)
+            throw std::invalid_argument("Quality bin " + std::to_string(bin.low) + "-" +
+                                        std::to_string(bin.high) + " is out of range");
+
+        for (int score = bin.low; score <= bin.high; ++score) {
+            if (assigned[score + phred_offset_])
+                throw std::invalid_argument("Quality bins overlap at " + std::to_string(score));
+            assigned[score + phred_offset_] = true;
+            table_[score + phred_offset_] = static_cast<unsigned char>(bin.value + phred_offset_);
+        }
+        ranges_.emplace_back(static_cast<char>(bin.low + phred_offset_),
+                             static_cast<char>(bin.high + phred_offset_));
+    }
+}
+
+int QualityBinner::PhredOffsetForFormat(const std::string& format_name)
+{
+    using gene::Flags;
+
+    if (format_name.find(Flags::kIllumina1_3Suffix) != std::string::npos ||
+        format_name.find(Flags::kSolexaSuffix) != std::string::npos)
+        return 64;
+    return 33;
+}
+
+void QualityBinner::Apply(std::string& quality)
+{
+    size_t length = quality.size();
+    if (length == 0)
+        return;
+
+    auto data = reinterpret_cast<unsigned char *>(&quality[0]);
+    size_t i = 0;
+#if defined(__SSSE3__)
+    // 128-entry lookup: one 16-entry shuffle for each high nibble, and the
+    // high nibble picks which result to keep
+    __m128i tables[8];
+    for (int h = 0; h < 8; ++h)
+        tables[h] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(table_ + 16*h));
+    const __m128i low_nibble = _mm_set1_epi8(0x0F);
+
+    for (; i + 16 <= length; i += 16) {
+        __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        __m128i low = _mm_and_si128(input, low_nibble);
+        __m128i high = _mm_and_si128(_mm_srli_epi16(input, 4), low_nibble);
+
+        __m128i output = _mm_setzero_si128();
+        for (int h = 0; h < 8; ++h) {
+            __m128i selected = _mm_cmpeq_epi8(high, _mm_set1_epi8(static_cast<char>(h)));
+            output = _mm_or_si128(output, _mm_and_si128(selected, _mm_shuffle_epi8(tables[h], low)));
+        }
+        // Characters from 128 up can't be qualities, leave them alone
+        __m128i not_ascii = _mm_cmplt_epi8(input, _mm_setzero_si128());
+        output = _mm_or_si128(_mm_and_si128(not_ascii, input), _mm_andnot_si128(not_ascii, output));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(data + i), output);
+
+        int unchanged = _mm_movemask_epi8(_mm_cmpeq_epi8(input, output));
+        changed_count_ += 16 - __builtin_popcount(unchanged);
+        for (size_t b = 0; b < ranges_.size(); ++b) {
+            __m128i outside = _mm_or_si128(_mm_cmpgt_epi8(_mm_set1_epi8(ranges_[b].first), input),
+                                           _mm_cmpgt_epi8(input, _mm_set1_epi8(ranges_[b].second)));
+            bin_counts_[b] += 16 - __builtin_popcount(_mm_movemask_epi8(outside));
+        }
+    }
+#endif
+    for (; i < length; ++i) {
+        unsigned char c = data[i];
+        if (c >= 128)
+            continue;
+        for (size_t b = 0; b < ranges_.size(); ++b) {
+            if (static_cast<char>(c) >= ranges_[b].first && static_cast<char>(c) <= ranges_[b].second)
+                ++bin_counts_[b];
+        }
+        if (table_[c] != c) {
+            data[i] = table_[c];
+            ++changed_count_;
+        }
+    }
+    values_count_ += length;
+}
+
+void QualityBinner::MergeStatistics(const QualityBinner& other)
+{
+    values_count_ += other.values_count_;
+    changed_count_ += other.changed_count_;
+    for (size_t b = 0; b < bin_counts_.size() && b < other.bin_counts_.size(); ++b)
+        bin_counts_[b] += other.bin_counts_[b];
+}
+
+void QualityBinner::LogStatistics() const
+{
+    if (values_count_ == 0)
+        return;
+
+    PrintfLog("Binned %lld quality values, %lld (%.1f%%) changed\n",
+              values_count_, changed_count_, 100.0*changed_count_/values_count_);
+    for (size_t b = 0; b < bins_.size(); ++b) {
+        PrintfLog("  Q%d-Q%d -> Q%d: %lld (%.1f%%)\n",
+                  bins_[b].low, bins_[b].high, bins_[b].value,
+                  bin_counts_[b], 100.0*bin_counts_[b]/values_count_);
+    }
+}
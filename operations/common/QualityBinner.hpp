@@ -0,0 +1,66 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef LIBGENE_OPERATIONS_QUALITY_BINNER_HPP_
+#define LIBGENE_OPERATIONS_QUALITY_BINNER_HPP_
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// Lossy quality output: maps every quality score into one of a few bins,
+// which makes quality strings far more compressible.
+//
+// Schemes are "illumina8", "ncbi4", or a comma-separated list of bins given
+// as "low-high:value" in Phred scores, e.g. "0-19:10,20-29:25,30-93:37".
+// Scores outside of every bin are left as they are. The top bin of the
+// built-in schemes ends at the highest score the encoding can hold (63 for
+// Phred+64), while bins given by the user have to fit into it.
+class QualityBinner final {
+ public:
+    struct Bin {
+        int low;
+        int high;
+        int value;
+    };
+
+    // Throws std::invalid_argument for malformed schemes
+    QualityBinner(const std::string& scheme, int phred_offset);
+
+    // 64 for the Illumina 1.3 to 1.7 and Solexa variants of FASTQ, 33 for
+    // everything else
+    static int PhredOffsetForFormat(const std::string& format_name);
+
+    void Apply(std::string& quality);
+    // Adds the statistics of a copy of this binner used elsewhere
+    void MergeStatistics(const QualityBinner& other);
+    void LogStatistics() const;
+
+ private:
+    std::vector<Bin> bins_;
+    int phred_offset_;
+    // Binned character for every character below 128
+    unsigned char table_[128];
+    // Bin limits as characters
+    std::vector<std::pair<char, char>> ranges_;
+
+    int64_t values_count_{0};
+    int64_t changed_count_{0};
+    std::vector<int64_t> bin_counts_;
+};
+
+#endif  // LIBGENE_OPERATIONS_QUALITY_BINNER_HPP_
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "RecordFile.hpp"
+#include "ColumnarSequenceFile.hpp"
+#include "PrefetchingRecordFile.hpp"
+#include "SeparatedRecordFile.hpp"
+
+#include <libgene/file/sequence/SequenceFile.hpp>
+#include <libgene/utils/StringUtils.hpp>
+
+// Read input files on a background thread, this many batches ahead (the
+// default if no number is given)
+static const std::string kPrefetchFlag = "prefetch";
+// Write CSV and TSV output with SeparatedRecordFile instead of libgene
+static const std::string kFastTablesFlag = "fast-tables";
+
+// Forwards to the libgene implementation of the format
+class LibgeneRecordFile final : public RecordFile {
+ public:
+    explicit LibgeneRecordFile(std::unique_ptr<gene::SequenceFile>&& file)
+    : file_(std::move(file))
+    {
+    }
+
+    gene::SequenceRecord Read() override { return file_->Read(); }
+    void Write(const gene::SequenceRecord& record) override { file_->Write(record); }
+
+    int64_t position() const override { return file_->position(); }
+    int64_t length() const override { return file_->length(); }
+    std::string filePath() const override { return file_->filePath(); }
+    std::string strFileType() const override { return file_->strFileType(); }
+    gene::FileType fileType() const override { return file_->fileType(); }
+    gene::FileKind fileKind() const override { return file_->fileKind(); }
+    bool isValidGeneFile() const override { return file_->isValidGeneFile(); }
+
+ private:
+    std::unique_ptr<gene::SequenceFile> file_;
+};
+
+std::unique_ptr<RecordFile> RecordFile::FileWithName(const std::string& path,
+                                                     const std::unique_ptr<gene::CommandLineFlags>& flags,
+                                                     gene::OpenMode mode)
+{
+    std::unique_ptr<RecordFile> file;
+    auto extension = gene::utils::GetExtension(path);
+    auto type = gene::utils::str2type(extension);
+    if (extension == ColumnarSequenceFile::kExtension) {
+        file = ColumnarSequenceFile::FileWithName(path, mode);
+    } else if (mode == gene::OpenMode::Write &&
+               (type == gene::FileType::Csv || type == gene::FileType::Tsv) &&
+               flags->SettingExists(kFastTablesFlag)) {
+        file = SeparatedRecordFile::FileWithName(path, flags);
+    } else if (auto sequence_file = gene::SequenceFile::FileWithName(path, flags, mode)) {
+        file = std::make_unique<LibgeneRecordFile>(std::move(sequence_file));
+    }
+
+    if (file && mode == gene::OpenMode::Read && flags->SettingExists(kPrefetchFlag)) {
+        int depth = flags->GetIntSetting(kPrefetchFlag);
+        file = std::make_unique<PrefetchingRecordFile>(std::move(file),
+                                                       depth > 0 ? static_cast<size_t>(depth) : 0);
+    }
+    return file;
+}
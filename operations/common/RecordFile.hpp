@@ -0,0 +1,57 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef LIBGENE_OPERATIONS_RECORD_FILE_HPP_
+#define LIBGENE_OPERATIONS_RECORD_FILE_HPP_
+
+#include <memory>
+#include <string>
+#include <cstdint>
+
+#include <libgene/def/FileType.hpp>
+#include <libgene/file/sequence/SequenceRecord.hpp>
+#include <libgene/flags/CommandLineFlags.hpp>
+
+// A file of sequence records the operations read from or write to. Formats
+// libgene knows about are handled by gene::SequenceFile; formats private to
+// the operations (see ColumnarSequenceFile) are implemented here, and so is
+// writing CSV and TSV tables when asked to with "fast-tables" (see
+// SeparatedRecordFile).
+class RecordFile {
+ public:
+    virtual ~RecordFile() = default;
+
+    // Picks the implementation by the extension of 'path'. Returns nullptr
+    // if the file can't be opened.
+    static std::unique_ptr<RecordFile> FileWithName(const std::string& path,
+                                                    const std::unique_ptr<gene::CommandLineFlags>& flags,
+                                                    gene::OpenMode mode);
+
+    // Returns an empty record at the end of the file
+    virtual gene::SequenceRecord Read() = 0;
+    virtual void Write(const gene::SequenceRecord& record) = 0;
+
+    virtual int64_t position() const = 0;
+    virtual int64_t length() const = 0;
+    virtual std::string filePath() const = 0;
+    virtual std::string strFileType() const = 0;
+    virtual gene::FileType fileType() const = 0;
+    virtual gene::FileKind fileKind() const = 0;
+    virtual bool isValidGeneFile() const = 0;
+};
+
+#endif  // LIBGENE_OPERATIONS_RECORD_FILE_HPP_
@@ -0,0 +1,192 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+
+#include "RunStatistics.hpp"
+
+static double Seconds(RunStatistics::Clock::duration duration)
+{
+    return std::chrono::duration<double>(duration).count();
+}
+
+RunStatistics::Thread::Thread(const std::string& name)
+: name_(name), started_(Clock::now()), last_lap_(started_)
+{
+    stage_times_.fill(Clock::duration::zero());
+    flush_latencies_.fill(0);
+}
+
+void RunStatistics::Thread::AddFlush(Clock::duration latency)
+{
+    auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+    size_t bucket = 0;
+    while (bucket + 1 < kHistogramBuckets && microseconds >= (2ll << bucket))
+        ++bucket;
+    flush_latencies_[bucket]++;
+}
+
+RunStatistics::RunStatistics(const std::string& operation)
+: operation_(operation), started_(Clock::now())
+{
+}
+
+RunStatistics::Thread *RunStatistics::AddThread(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    threads_.emplace_back(name);
+    return &threads_.back();
+}
+
+void RunStatistics::AddSample(int64_t records, int64_t bytes)
+{
+    auto elapsed = Clock::now() - started_;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto previous = samples_.empty() ? Clock::duration::zero() : samples_.back().elapsed;
+    if (elapsed - previous >= kSampleInterval)
+        samples_.push_back({elapsed, records, bytes});
+}
+
+void RunStatistics::Finish(int64_t records, int64_t bytes)
+{
+    elapsed_ = Clock::now() - started_;
+    records_ = records;
+    bytes_ = bytes;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    samples_.push_back({elapsed_, records, bytes});
+}
+
+const char *RunStatistics::StageName(Stage stage)
+{
+    switch (stage) {
+        case Stage::Read:
+            return "read";
+        case Stage::Match:
+            return "match";
+        case Stage::Format:
+            return "format";
+        case Stage::LockWait:
+            return "lock_wait";
+        case Stage::Write:
+            return "write";
+    }
+    return "unknown";
+}
+
+void RunStatistics::WriteHistogram_(std::ostream& json, const Histogram& histogram)
+{
+    // Only the buckets that have anything in them
+    json << '[';
+    bool first = true;
+    for (size_t i = 0; i < kHistogramBuckets; ++i) {
+        if (histogram[i] == 0)
+            continue;
+        json << (first ? "" : ", ") << "{\"below_us\": ";
+        if (i + 1 < kHistogramBuckets)
+            json << (2ll << i);
+        else
+            json << "null";
+        json << ", \"count\": " << histogram[i] << '}';
+        first = false;
+    }
+    json << ']';
+}
+
+void RunStatistics::WriteJson(const std::string& path) const
+{
+    std::ofstream json(path);
+    if (!json)
+        throw std::runtime_error("Can't create statistics file " + path + "\n");
+    json << std::fixed << std::setprecision(6);
+
+    const double seconds = Seconds(elapsed_);
+    std::array<Clock::duration, kStagesCount> stage_times;
+    stage_times.fill(Clock::duration::zero());
+    Histogram flush_latencies;
+    flush_latencies.fill(0);
+    for (const auto& thread : threads_) {
+        for (size_t i = 0; i < kStagesCount; ++i)
+            stage_times[i] += thread.stage_times_[i];
+        for (size_t i = 0; i < kHistogramBuckets; ++i)
+            flush_latencies[i] += thread.flush_latencies_[i];
+    }
+    auto WriteStages = [&json](const std::array<Clock::duration, kStagesCount>& times) {
+        json << '{';
+        for (size_t i = 0; i < kStagesCount; ++i) {
+            json << (i == 0 ? "" : ", ") << '"' << StageName(static_cast<Stage>(i)) << "\": "
+                 << Seconds(times[i]);
+        }
+        json << '}';
+    };
+
+    json << "{\n"
+         << "  \"operation\": \"" << operation_ << "\",\n"
+         << "  \"seconds\": " << seconds << ",\n"
+         << "  \"records\": " << records_ << ",\n"
+         << "  \"bytes\": " << bytes_ << ",\n"
+         << "  \"records_per_second\": " << (seconds > 0 ? records_/seconds : 0.0) << ",\n"
+         << "  \"gigabytes_per_second\": " << (seconds > 0 ? bytes_/seconds/1e9 : 0.0) << ",\n"
+         << "  \"stage_seconds\": ";
+    WriteStages(stage_times);
+    json << ",\n  \"flush_latency\": ";
+    WriteHistogram_(json, flush_latencies);
+
+    json << ",\n  \"threads\": [";
+    for (size_t t = 0; t < threads_.size(); ++t) {
+        const auto& thread = threads_[t];
+        Clock::duration busy = Clock::duration::zero();
+        for (const auto& time : thread.stage_times_)
+            busy += time;
+        const auto thread_elapsed = thread.last_lap_ - thread.started_;
+
+        json << (t == 0 ? "\n" : ",\n")
+             << "    {\"name\": \"" << thread.name_ << "\", "
+             << "\"seconds\": " << Seconds(thread_elapsed) << ", "
+             << "\"idle_seconds\": " << Seconds(thread_elapsed - busy) << ", "
+             << "\"records\": " << thread.records_ << ", "
+             << "\"bytes\": " << thread.bytes_ << ",\n"
+             << "     \"stage_seconds\": ";
+        WriteStages(thread.stage_times_);
+        json << ",\n     \"flush_latency\": ";
+        WriteHistogram_(json, thread.flush_latencies_);
+        json << '}';
+    }
+    json << "\n  ],\n";
+
+    // Rates over each interval between samples
+    json << "  \"timeline\": [";
+    Sample previous{Clock::duration::zero(), 0, 0};
+    for (size_t i = 0; i < samples_.size(); ++i) {
+        const auto& sample = samples_[i];
+        const double interval = Seconds(sample.elapsed - previous.elapsed);
+        json << (i == 0 ? "\n" : ",\n")
+             << "    {\"seconds\": " << Seconds(sample.elapsed) << ", "
+             << "\"records\": " << sample.records << ", "
+             << "\"records_per_second\": "
+             << (interval > 0 ? (sample.records - previous.records)/interval : 0.0) << ", "
+             << "\"bytes_per_second\": "
+             << (interval > 0 ? (sample.bytes - previous.bytes)/interval : 0.0) << '}';
+        previous = sample;
+    }
+    json << "\n  ]\n}\n";
+
+    if (!json.flush())
+        throw std::runtime_error("Can't write statistics file " + path + "\n");
+}
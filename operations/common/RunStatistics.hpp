@@ -0,0 +1,135 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef LIBGENE_OPERATIONS_RUN_STATISTICS_HPP_
+#define LIBGENE_OPERATIONS_RUN_STATISTICS_HPP_
+
+#include <array>
+#include <chrono>
+#include <deque>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Where the time of an operation goes, for finding bottlenecks without a
+// profiler. Written out as JSON at the end of a run if asked for with the
+// "stats-json" flag.
+//
+// Every thread taking part gets a Thread of its own and splits its time
+// into stages by calling Lap() whenever it moves on to the next one. The
+// totals over time come from the progress sampler, see ProgressSampler.
+class RunStatistics final {
+ public:
+    typedef std::chrono::steady_clock Clock;
+
+    enum class Stage {
+        // Reading and parsing a record, both done by RecordFile::Read()
+        Read,
+        Match,
+        // Copying and converting records for the output
+        Format,
+        // Blocked on a lock or on another thread to make room
+        LockWait,
+        Write,
+    };
+    static constexpr size_t kStagesCount = static_cast<size_t>(Stage::Write) + 1;
+    // Bucket 'i' counts latencies of less than 2^(i + 1) microseconds, the
+    // last one everything longer
+    static constexpr size_t kHistogramBuckets = 32;
+    typedef std::array<int64_t, kHistogramBuckets> Histogram;
+
+    // Owned by one thread, and only looked at after that thread is done
+    class Thread final {
+     public:
+        explicit Thread(const std::string& name);
+
+        // The time since the last lap is not accounted for, e.g. as the
+        // thread was idle
+        void Restart(Clock::time_point now = Clock::now())
+        {
+            last_lap_ = now;
+        }
+        // Adds the time since the last lap to 'stage'
+        void Lap(Stage stage, Clock::time_point now = Clock::now())
+        {
+            stage_times_[static_cast<size_t>(stage)] += now - last_lap_;
+            last_lap_ = now;
+        }
+        void AddRecords(int64_t records, int64_t bytes)
+        {
+            records_ += records;
+            bytes_ += bytes;
+        }
+        // 'latency' is the time from a buffer being handed over to its
+        // records being written
+        void AddFlush(Clock::duration latency);
+
+     private:
+        friend class RunStatistics;
+
+        std::string name_;
+        Clock::time_point started_;
+        Clock::time_point last_lap_;
+        std::array<Clock::duration, kStagesCount> stage_times_;
+        int64_t records_{0};
+        int64_t bytes_{0};
+        Histogram flush_latencies_;
+    };
+
+    explicit RunStatistics(const std::string& operation);
+
+    static const char *StageName(Stage stage);
+
+    // Safe to call from any thread. The returned thread lives as long as
+    // the statistics.
+    Thread *AddThread(const std::string& name);
+
+    // Called with the running totals, as often as it suits the caller. Only
+    // a sample a second is kept.
+    void AddSample(int64_t records, int64_t bytes);
+
+    // Finishes the run. 'records' and 'bytes' are the totals of the whole
+    // operation.
+    void Finish(int64_t records, int64_t bytes);
+    // Throws std::runtime_error if the file can't be written
+    void WriteJson(const std::string& path) const;
+
+ private:
+    static constexpr auto kSampleInterval = std::chrono::seconds(1);
+    struct Sample {
+        Clock::duration elapsed;
+        int64_t records;
+        int64_t bytes;
+    };
+
+    static void WriteHistogram_(std::ostream& json, const Histogram& histogram);
+
+    std::string operation_;
+    Clock::time_point started_;
+    Clock::duration elapsed_{};
+    int64_t records_{0};
+    int64_t bytes_{0};
+
+    std::mutex mutex_;
+    // A deque, so that adding threads doesn't move the ones handed out
+    std::deque<Thread> threads_;
+    std::vector<Sample> samples_;
+};
+
+#endif  // LIBGENE_OPERATIONS_RUN_STATISTICS_HPP_
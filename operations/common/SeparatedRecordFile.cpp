@@ -0,0 +1,293 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "SeparatedRecordFile.hpp"
+#include <libgene/def/Flags.hpp>
+#include <libgene/utils/StringUtils.hpp>
+#include <libgene/log/Logger.hpp>
+
+namespace {
+
+// Header titles and column type numbers of the .ctp file, by Column
+const char *kColumnTitles[] = { "Name", "Description", "Sequence", "Quality", "Unknown" };
+const int kColumnTypes[] = { 0 /* id */, 1 /* description */, 3 /* data */, 3 /* data */ };
+
+// Returns the first quote in [begin, end), or 'end'
+inline const char *FindQuote(const char *begin, const char *end)
+{
+#if defined(__SSE2__)
+    const __m128i quote = _mm_set1_epi8('"');
+    for (; end - begin >= 16; begin += 16) {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+        const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, quote));
+        if (mask != 0)
+            return begin + __builtin_ctz(static_cast<unsigned>(mask));
+    }
+#endif
+    for (; begin != end; ++begin) {
+        if (*begin == '"')
+            return begin;
+    }
+    return end;
+}
+
+// Copies 'field' to 'out' with its quotes doubled and returns the end
+inline char *CopyEscaped(const std::string& field, char *out)
+{
+    const char *begin = field.data(), *end = begin + field.size();
+    while (true) {
+        const char *quote = FindQuote(begin, end);
+        std::memcpy(out, begin, static_cast<size_t>(quote - begin));
+        out += quote - begin;
+        if (quote == end)
+            return out;
+        *out++ = '"';
+        *out++ = '"';
+        begin = quote + 1;
+    }
+}
+
+}  // namespace
+
+std::unique_ptr<SeparatedRecordFile> SeparatedRecordFile::FileWithName(const std::string& path,
+                                                                       const std::unique_ptr<gene::CommandLineFlags>& flags)
+{
+    auto type = gene::utils::str2type(gene::utils::GetExtension(path));
+    if (type != gene::FileType::Csv && type != gene::FileType::Tsv)
+        return nullptr;
+
+    FILE *file = std::fopen(path.c_str(), "wb");
+    if (!file)
+        return nullptr;
+
+    std::unique_ptr<SeparatedRecordFile> separated_file(new SeparatedRecordFile(path, type, file,
+                                                                                PlanColumns_(flags)));
+    separated_file->WriteHeader_();
+    separated_file->WriteColumnTypes_();
+    return separated_file;
+}
+
+std::string SeparatedRecordFile::ColumnTypesPath(const std::string& path)
+{
+    auto extension = gene::utils::GetExtension(path);
+    if (extension.empty())
+        return path + ".ctp";
+    return path.substr(0, path.size() - extension.size()) + "ctp";
+}
+
+std::vector<SeparatedRecordFile::Column> SeparatedRecordFile::PlanColumns_(const std::unique_ptr<gene::CommandLineFlags>& flags)
+{
+    std::vector<Column> plan = { Column::Name, Column::Description, Column::Sequence, Column::Quality };
+
+    // One letter per column, N, D, S or Q. A letter used again, or any
+    // other character, leaves its column empty.
+    const std::string *order = flags->GetSetting(gene::Flags::kReorderOutputColumns);
+    if (order) {
+        plan.clear();
+        bool used[4] = {false, false, false, false};
+        for (char letter : *order) {
+            const char *kLetters = "NDSQ";
+            const char *found = std::strchr(kLetters, std::toupper(static_cast<unsigned char>(letter)));
+            int column = (letter != '\0' && found) ? static_cast<int>(found - kLetters) : -1;
+            if (column >= 0 && !used[column]) {
+                used[column] = true;
+                plan.push_back(static_cast<Column>(column));
+            } else {
+                plan.push_back(Column::Unknown);
+            }
+        }
+    }
+
+    if (flags->SettingExists(gene::Flags::kOmitQuality))
+        std::replace(plan.begin(), plan.end(), Column::Quality, Column::Unknown);
+    while (!plan.empty() && plan.back() == Column::Unknown)
+        plan.pop_back();
+    return plan;
+}
+
+SeparatedRecordFile::SeparatedRecordFile(const std::string& path, gene::FileType type, FILE *file,
+                                         std::vector<Column>&& plan)
+: path_(path),
+  type_(type),
+  delimiter_(type == gene::FileType::Tsv ? '\t' : ','),
+  file_(file),
+  plan_(std::move(plan)),
+  buffer_(new char[kBufferSize])
+{
+}
+
+SeparatedRecordFile::~SeparatedRecordFile()
+{
+    try {
+        Close();
+    } catch (const std::runtime_error& e) {
+        PrintfLog("%s", e.what());
+    }
+}
+
+void SeparatedRecordFile::WriteHeader_()
+{
+    std::string header;
+    for (size_t i = 0; i < plan_.size(); ++i) {
+        if (i != 0)
+            header += delimiter_;
+        header += kColumnTitles[static_cast<int>(plan_[i])];
+    }
+    header += '\n';
+    std::memcpy(buffer_.get(), header.data(), header.size());
+    used_ = header.size();
+}
+
+void SeparatedRecordFile::WriteColumnTypes_() const
+{
+    std::ofstream types(ColumnTypesPath(path_), std::ios::binary);
+    types << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+             "<!DOCTYPE plist PUBLIC \"-//Apple//DTD PLIST 1.0//EN\" "
+             "\"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n"
+             "<plist version=\"1.0\">\n"
+             "\t<dict>\n"
+             "\t\t<key>column_types</key>\n"
+             "\t\t<dict>\n"
+             "\t\t\t<key>columns</key>\n"
+             "\t\t\t<array>\n";
+    // Listed by column kind, not by position
+    for (int kind = 0; kind < 4; ++kind) {
+        auto it = std::find(plan_.begin(), plan_.end(), static_cast<Column>(kind));
+        if (it == plan_.end())
+            continue;
+        types << "\t\t\t\t<dict>\n"
+                 "\t\t\t\t\t<key>description</key>\n"
+                 "\t\t\t\t\t<string>" << kColumnTitles[kind] << "</string>\n"
+                 "\t\t\t\t\t<key>id</key>\n"
+                 "\t\t\t\t\t<integer>" << (it - plan_.begin()) << "</integer>\n"
+                 "\t\t\t\t\t<key>type</key>\n"
+                 "\t\t\t\t\t<integer>" << kColumnTypes[kind] << "</integer>\n"
+                 "\t\t\t\t</dict>\n";
+    }
+    types << "\t\t\t</array>\n"
+             "\t\t\t<key>groups</key>\n"
+             "\t\t\t<array />\n"
+             "\t\t</dict>\n"
+             "\t</dict>\n"
+             "</plist>\n";
+}
+
+gene::SequenceRecord SeparatedRecordFile::Read()
+{
+    return gene::SequenceRecord();
+}
+
+void SeparatedRecordFile::Write(const gene::SequenceRecord& record)
+{
+    const std::string *fields[] = { &record.name, &record.desc, &record.seq, &record.quality };
+
+    // Quotes, delimiters and the line break, with every quote in the fields
+    // possibly doubled
+    size_t bound = 3*plan_.size() + 1;
+    for (auto column : plan_) {
+        if (column != Column::Unknown)
+            bound += 2*fields[static_cast<int>(column)]->size();
+    }
+    if (used_ + bound > capacity_) {
+        Flush_();
+        if (bound > capacity_) {
+            buffer_.reset(new char[bound]);
+            capacity_ = bound;
+        }
+    }
+
+    char *out = buffer_.get() + used_;
+    for (size_t i = 0; i < plan_.size(); ++i) {
+        if (i != 0)
+            *out++ = delimiter_;
+        if (plan_[i] == Column::Unknown)
+            continue;
+        *out++ = '"';
+        out = CopyEscaped(*fields[static_cast<int>(plan_[i])], out);
+        *out++ = '"';
+    }
+    *out++ = '\n';
+    used_ = static_cast<size_t>(out - buffer_.get());
+}
+
+void SeparatedRecordFile::Flush_()
+{
+    if (used_ != 0 && std::fwrite(buffer_.get(), 1, used_, file_) != used_)
+        throw std::runtime_error("Can't write to " + path_ + "\n");
+    written_ += static_cast<int64_t>(used_);
+    used_ = 0;
+}
+
+void SeparatedRecordFile::Close()
+{
+    if (!file_)
+        return;
+    FILE *file = file_;
+    file_ = nullptr;
+    bool flushed = (used_ == 0 || std::fwrite(buffer_.get(), 1, used_, file) == used_);
+    written_ += static_cast<int64_t>(used_);
+    used_ = 0;
+    if (std::fclose(file) != 0 || !flushed)
+        throw std::runtime_error("Can't write to " + path_ + "\n");
+}
+
+int64_t SeparatedRecordFile::position() const
+{
+    return written_ + static_cast<int64_t>(used_);
+}
+
+int64_t SeparatedRecordFile::length() const
+{
+    return position();
+}
+
+std::string SeparatedRecordFile::filePath() const
+{
+    return path_;
+}
+
+std::string SeparatedRecordFile::strFileType() const
+{
+    return type_ == gene::FileType::Tsv ? "tsv" : "csv";
+}
+
+gene::FileType SeparatedRecordFile::fileType() const
+{
+    return type_;
+}
+
+gene::FileKind SeparatedRecordFile::fileKind() const
+{
+    return gene::FileKind::SingleEnd;
+}
+
+bool SeparatedRecordFile::isValidGeneFile() const
+{
+    // Records can't be read back without their names and sequences
+    return std::find(plan_.begin(), plan_.end(), Column::Name) != plan_.end() &&
+           std::find(plan_.begin(), plan_.end(), Column::Sequence) != plan_.end();
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef LIBGENE_OPERATIONS_SEPARATED_RECORD_FILE_HPP_
+#define LIBGENE_OPERATIONS_SEPARATED_RECORD_FILE_HPP_
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+
+#include "RecordFile.hpp"
+
+// Writes records as CSV or TSV tables, the way libgene's GenomicCsvFile and
+// GenomicTsvFile lay them out: a header line naming the columns, one quoted
+// field per column, and a .ctp file with the column types next to the
+// table.
+//
+// The order of the columns is worked out from the flags once, when the file
+// is opened. Writing a record then only follows that plan, copying fields
+// straight into the output buffer. Fields are searched for quotes 16 bytes
+// at a time, and most of them, having none, are copied whole.
+//
+// Reading isn't supported, separated inputs are read by libgene.
+class SeparatedRecordFile final : public RecordFile {
+ public:
+    static constexpr size_t kBufferSize = 1024*1024;
+
+    // Returns nullptr if the file can't be created
+    static std::unique_ptr<SeparatedRecordFile> FileWithName(const std::string& path,
+                                                             const std::unique_ptr<gene::CommandLineFlags>& flags);
+    // Path of the column types file kept along with the table at 'path'
+    static std::string ColumnTypesPath(const std::string& path);
+
+    ~SeparatedRecordFile() override;
+
+    // Always returns an empty record
+    gene::SequenceRecord Read() override;
+    void Write(const gene::SequenceRecord& record) override;
+
+    int64_t position() const override;
+    int64_t length() const override;
+    std::string filePath() const override;
+    std::string strFileType() const override;
+    gene::FileType fileType() const override;
+    gene::FileKind fileKind() const override;
+    bool isValidGeneFile() const override;
+
+    // Writes out what is left in the buffer. The destructor does it too, but
+    // can't report errors.
+    void Close();
+
+ private:
+    enum class Column : uint8_t { Name, Description, Sequence, Quality, Unknown };
+
+    SeparatedRecordFile(const std::string& path, gene::FileType type, FILE *file,
+                        std::vector<Column>&& plan);
+    // Columns in the order the flags ask for, default N, D, S, Q
+    static std::vector<Column> PlanColumns_(const std::unique_ptr<gene::CommandLineFlags>& flags);
+    void WriteHeader_();
+    void WriteColumnTypes_() const;
+    void Flush_();
+
+    std::string path_;
+    gene::FileType type_;
+    char delimiter_;
+    FILE *file_;
+    std::vector<Column> plan_;
+
+    std::unique_ptr<char[]> buffer_;
+    size_t capacity_{kBufferSize};
+    size_t used_{0};
+    int64_t written_{0};
+};
+
+#endif  // LIBGENE_OPERATIONS_SEPARATED_RECORD_FILE_HPP_
@@ -0,0 +1,309 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "SeparatedTableReader.hpp"
+#include <libgene/def/FileType.hpp>
+#include <libgene/utils/StringUtils.hpp>
+
+namespace {
+
+// Bitmasks of a 64 byte block, bit i standing for byte i
+struct BlockMasks {
+    uint64_t quotes;
+    uint64_t delimiters;
+    uint64_t line_breaks;
+};
+
+#if defined(__SSE2__)
+inline uint64_t MatchMask(const __m128i chunks[4], char c)
+{
+    const __m128i pattern = _mm_set1_epi8(c);
+    uint64_t mask = 0;
+    for (int i = 0; i < 4; ++i) {
+        const auto bits = _mm_movemask_epi8(_mm_cmpeq_epi8(chunks[i], pattern));
+        mask |= static_cast<uint64_t>(static_cast<uint16_t>(bits)) << (16*i);
+    }
+    return mask;
+}
+
+BlockMasks ScanBlock(const char *block, char delimiter)
+{
+    __m128i chunks[4];
+    for (int i = 0; i < 4; ++i)
+        chunks[i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + 16*i));
+    return {MatchMask(chunks, '"'), MatchMask(chunks, delimiter), MatchMask(chunks, '\n')};
+}
+#else
+BlockMasks ScanBlock(const char *block, char delimiter)
+{
+    BlockMasks masks{0, 0, 0};
+    for (int i = 0; i < 64; ++i) {
+        const uint64_t bit = uint64_t{1} << i;
+        masks.quotes |= block[i] == '"' ? bit : 0;
+        masks.delimiters |= block[i] == delimiter ? bit : 0;
+        masks.line_breaks |= block[i] == '\n' ? bit : 0;
+    }
+    return masks;
+}
+#endif
+
+// Sets every bit from a quote up to (but not including) the next one, so
+// the bits left set are the quoted bytes along with their opening quotes
+inline uint64_t PrefixXor(uint64_t mask)
+{
+    mask ^= mask << 1;
+    mask ^= mask << 2;
+    mask ^= mask << 4;
+    mask ^= mask << 8;
+    mask ^= mask << 16;
+    mask ^= mask << 32;
+    return mask;
+}
+
+// Takes the quotes out of a field, "" inside quotes being a quote
+void Unquote(const char *begin, const char *end, std::string& field)
+{
+    field.clear();
+    bool in_quotes = false;
+    for (const char *c = begin; c != end; ++c) {
+        if (*c != '"') {
+            field += *c;
+        } else if (in_quotes && c + 1 != end && c[1] == '"') {
+            field += '"';
+            ++c;
+        } else {
+            in_quotes = !in_quotes;
+        }
+    }
+}
+
+}  // namespace
+
+char SeparatedTableReader::DelimiterForPath(const std::string& path)
+{
+    if (gene::utils::str2type(gene::utils::GetExtension(path)) == gene::FileType::Tsv)
+        return '\t';
+    return ',';
+}
+
+SeparatedTableReader::SeparatedTableReader(const std::string& path)
+: SeparatedTableReader(path, DelimiterForPath(path))
+{
+}
+
+SeparatedTableReader::SeparatedTableReader(const std::string& path, char delimiter)
+: buffer_(new char[kBufferSize]),
+  delimiter_(delimiter)
+{
+    file_ = std::fopen(path.c_str(), "rb");
+    struct stat info;
+    if (file_ && fstat(fileno(file_), &info) == 0)
+        length_ = info.st_size;
+}
+
+SeparatedTableReader::~SeparatedTableReader()
+{
+    if (file_)
+        std::fclose(file_);
+}
+
+bool SeparatedTableReader::is_open() const
+{
+    return file_ != nullptr;
+}
+
+void SeparatedTableReader::Fill_()
+{
+    std::memmove(buffer_.get(), buffer_.get() + begin_, end_ - begin_);
+    buffer_offset_ += static_cast<int64_t>(begin_);
+    end_ -= begin_;
+    begin_ = 0;
+    // A row that doesn't fit is read into a larger buffer
+    if (end_ == capacity_) {
+        if (capacity_ > UINT32_MAX/2)
+            throw std::runtime_error("Table row is too long");
+        std::unique_ptr<char[]> buffer(new char[capacity_*2]);
+        std::memcpy(buffer.get(), buffer_.get(), end_);
+        buffer_ = std::move(buffer);
+        capacity_ *= 2;
+    }
+
+    const size_t read = std::fread(buffer_.get() + end_, 1, capacity_ - end_, file_);
+    end_ += read;
+    end_of_file_ = read == 0;
+    Index_(0);
+}
+
+void SeparatedTableReader::Index_(size_t from)
+{
+    structurals_.clear();
+    next_structural_ = 0;
+
+    const char *data = buffer_.get();
+    uint64_t in_quotes = 0;
+    for (size_t block = from; block < end_; block += 64) {
+        BlockMasks masks;
+        if (end_ - block >= 64) {
+            masks = ScanBlock(data + block, delimiter_);
+        } else {
+            // The tail goes through a zero padded copy, so as not to read
+            // past the data
+            char tail[64] = {};
+            std::memcpy(tail, data + block, end_ - block);
+            masks = ScanBlock(tail, delimiter_);
+        }
+
+        const uint64_t quoted = PrefixXor(masks.quotes) ^ in_quotes;
+        // All ones if the block ends inside quotes, zero otherwise
+        in_quotes = static_cast<uint64_t>(static_cast<int64_t>(quoted) >> 63);
+
+        uint64_t structural = (masks.delimiters | masks.line_breaks) & ~quoted;
+        while (structural) {
+            structurals_.push_back(static_cast<uint32_t>(block) +
+                                   static_cast<uint32_t>(__builtin_ctzll(structural)));
+            structural &= structural - 1;
+        }
+    }
+}
+
+void SeparatedTableReader::SetProjection(const std::vector<size_t>& columns)
+{
+    projection_ = columns;
+    columns_needed_ = 0;
+    for (auto column : projection_)
+        columns_needed_ = std::max(columns_needed_, column + 1);
+}
+
+bool SeparatedTableReader::NextRow_()
+{
+    // Fields past the last projected one are only looked through for the
+    // line break
+    const size_t spans_needed = projection_.empty() ? SIZE_MAX : columns_needed_;
+    while (true) {
+        const char *data = buffer_.get();
+        spans_.clear();
+        row_begin_ = begin_;
+        size_t field_begin = begin_;
+        bool row_ended = false;
+        while (next_structural_ != structurals_.size()) {
+            const size_t position = structurals_[next_structural_++];
+            if (spans_.size() < spans_needed)
+                spans_.emplace_back(field_begin, position);
+            field_begin = position + 1;
+            if (data[position] == '\n') {
+                row_end_ = position;
+                row_ended = true;
+                break;
+            }
+        }
+
+        if (!row_ended) {
+            // The rest of the buffer is an incomplete row, it is read again
+            // once there is more of it
+            if (!end_of_file_) {
+                Fill_();
+                continue;
+            }
+            if (begin_ == end_)
+                return false;
+            if (spans_.size() < spans_needed)
+                spans_.emplace_back(field_begin, end_);
+            row_end_ = end_;
+        }
+        begin_ = row_ended ? row_end_ + 1 : end_;
+
+        if (row_end_ != row_begin_ && data[row_end_ - 1] == '\r') {
+            --row_end_;
+            if (spans_.back().second > row_end_)
+                spans_.back().second = row_end_;
+        }
+        // Empty lines are skipped
+        if (row_end_ != row_begin_)
+            return true;
+    }
+}
+
+bool SeparatedTableReader::ReadRow(std::vector<std::string_view>& fields)
+{
+    fields.clear();
+    if (!file_ || !NextRow_())
+        return false;
+
+    // Rows without all the projected columns come back without fields
+    size_t count = spans_.size();
+    if (!projection_.empty())
+        count = spans_.size() < columns_needed_ ? 0 : projection_.size();
+
+    const char *data = buffer_.get();
+    quoted_fields_.clear();
+    for (size_t i = 0; i < count; ++i) {
+        const auto& span = spans_[projection_.empty() ? i : projection_[i]];
+        const char *begin = data + span.first;
+        const size_t size = span.second - span.first;
+        if (std::memchr(begin, '"', size) != nullptr)
+            quoted_fields_.push_back(fields.size());
+        fields.emplace_back(begin, size);
+    }
+
+    // Views into 'unquoted_' are only taken once it won't grow any more
+    if (unquoted_.size() < quoted_fields_.size())
+        unquoted_.resize(quoted_fields_.size());
+    for (size_t i = 0; i < quoted_fields_.size(); ++i) {
+        auto& field = fields[quoted_fields_[i]];
+        Unquote(field.data(), field.data() + field.size(), unquoted_[i]);
+        field = unquoted_[i];
+    }
+    return true;
+}
+
+bool SeparatedTableReader::ReadRow(std::vector<std::string>& fields)
+{
+    std::vector<std::string_view> views;
+    if (!ReadRow(views)) {
+        fields.clear();
+        return false;
+    }
+    fields.resize(views.size());
+    for (size_t i = 0; i < views.size(); ++i)
+        fields[i].assign(views[i].data(), views[i].size());
+    return true;
+}
+
+std::string_view SeparatedTableReader::last_row() const
+{
+    return std::string_view(buffer_.get() + row_begin_, row_end_ - row_begin_);
+}
+
+int64_t SeparatedTableReader::position() const
+{
+    return buffer_offset_ + static_cast<int64_t>(begin_);
+}
+
+int64_t SeparatedTableReader::length() const
+{
+    return length_;
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef LIBGENE_OPERATIONS_SEPARATED_TABLE_READER_HPP_
+#define LIBGENE_OPERATIONS_SEPARATED_TABLE_READER_HPP_
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+
+// Reads comma or tab separated tables row by row. Fields may be quoted the
+// way RFC 4180 has it: a quoted field can hold delimiters, line breaks and
+// doubled quotes. Line breaks can be either LF or CRLF, empty lines are
+// skipped.
+//
+// Tokenizing takes two passes over the read buffer. The first one goes
+// through it in blocks of 64 bytes, turning each block into bitmasks of
+// its quotes, delimiters and line breaks. A prefix XOR of the quote mask
+// marks what is quoted, and the delimiters and line breaks outside of it
+// are recorded by position. The second pass cuts rows and fields at those
+// positions without looking at the bytes in between, and hands the fields
+// out as views into the buffer. Only fields with quotes in them get copied,
+// to take the quotes out.
+class SeparatedTableReader final {
+ public:
+    static constexpr size_t kBufferSize = 1024*1024;
+
+    // Tables with a .tsv extension are split at tabs, any other at commas
+    static char DelimiterForPath(const std::string& path);
+
+    explicit SeparatedTableReader(const std::string& path);
+    SeparatedTableReader(const std::string& path, char delimiter);
+    ~SeparatedTableReader();
+
+    bool is_open() const;
+
+    // Makes ReadRow() return only the given columns, in the given order.
+    // Other fields are skipped without being unquoted or copied. Rows
+    // without all of the columns come back without fields. An empty
+    // projection, the default, returns every column.
+    void SetProjection(const std::vector<size_t>& columns);
+
+    // Reads the next row. Returns false at the end of file. The views stay
+    // valid until the next call.
+    bool ReadRow(std::vector<std::string_view>& fields);
+    // Same, copying the fields into 'fields'
+    bool ReadRow(std::vector<std::string>& fields);
+    // Text of the row ReadRow() returned last, without the line break. Valid
+    // until the next call.
+    std::string_view last_row() const;
+
+    int64_t position() const;
+    int64_t length() const;
+
+ private:
+    // Moves the unread rows to the start of the buffer, reads more after
+    // them and indexes the buffer anew
+    void Fill_();
+    // The first pass over [from, end_), which has to start outside quotes
+    void Index_(size_t from);
+    // Cuts the next row into 'spans_'. Returns false at the end of file.
+    bool NextRow_();
+
+    FILE *file_{nullptr};
+    std::unique_ptr<char[]> buffer_;
+    size_t capacity_{kBufferSize};
+    size_t begin_{0};
+    size_t end_{0};
+    int64_t buffer_offset_{0};
+    int64_t length_{0};
+    bool end_of_file_{false};
+
+    const char delimiter_;
+    // Positions of the delimiters and line breaks outside quotes
+    std::vector<uint32_t> structurals_;
+    size_t next_structural_{0};
+
+    std::vector<size_t> projection_;
+    // Columns a row needs to have for the projection
+    size_t columns_needed_{0};
+
+    // The row read last: its fields as [begin, end) in the buffer, up to
+    // the last projected one
+    std::vector<std::pair<size_t, size_t>> spans_;
+    size_t row_begin_{0};
+    size_t row_end_{0};
+    // Fields with the quotes taken out, and where they go in the row
+    std::vector<std::string> unquoted_;
+    std::vector<size_t> quoted_fields_;
+};
+
+#endif  // LIBGENE_OPERATIONS_SEPARATED_TABLE_READER_HPP_
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+
+#include "TraceRecorder.hpp"
+
+TraceRecorder::Thread::Thread(const std::string& name, size_t capacity,
+                              Clock::duration minimum_duration)
+: name_(name),
+  events_(std::max<size_t>(capacity, 1)),
+  minimum_duration_(minimum_duration),
+  last_lap_(Clock::now())
+{
+}
+
+TraceRecorder::TraceRecorder(size_t events_per_thread, Clock::duration minimum_duration)
+: events_per_thread_(events_per_thread),
+  minimum_duration_(minimum_duration),
+  started_(Clock::now())
+{
+}
+
+TraceRecorder::Thread *TraceRecorder::AddThread(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    threads_.emplace_back(name, events_per_thread_, minimum_duration_);
+    return &threads_.back();
+}
+
+void TraceRecorder::WriteJson(const std::string& path) const
+{
+    std::ofstream json(path);
+    if (!json)
+        throw std::runtime_error("Can't create trace file " + path + "\n");
+    json << std::fixed << std::setprecision(3);
+
+    auto Microseconds = [](Clock::duration duration) {
+        return std::chrono::duration<double, std::micro>(duration).count();
+    };
+
+    json << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    bool first = true;
+    for (size_t t = 0; t < threads_.size(); ++t) {
+        const auto& thread = threads_[t];
+        const size_t tid = t + 1;
+        const size_t capacity = thread.events_.size();
+        const int64_t dropped = std::max<int64_t>(thread.recorded_ - capacity, 0);
+
+        json << (first ? "\n" : ",\n")
+             << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << tid
+             << ", \"args\": {\"name\": \"" << thread.name_ << "\", \"dropped_events\": " << dropped << "}},\n"
+             << "{\"name\": \"thread_sort_index\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << tid
+             << ", \"args\": {\"sort_index\": " << tid << "}}";
+        first = false;
+
+        // Oldest event first. Once the ring buffer has wrapped around, that's
+        // the one about to be overwritten next.
+        const size_t count = static_cast<size_t>(thread.recorded_ - dropped);
+        const size_t oldest = (dropped > 0 ? thread.next_ : 0);
+        for (size_t i = 0; i < count; ++i) {
+            const auto& event = thread.events_[(oldest + i) % capacity];
+            json << ",\n{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << tid
+                 << ", \"ts\": " << Microseconds(event.begin - started_)
+                 << ", \"dur\": " << Microseconds(event.end - event.begin) << '}';
+        }
+    }
+    json << "\n]}\n";
+
+    if (!json.flush())
+        throw std::runtime_error("Can't write trace file " + path + "\n");
+}
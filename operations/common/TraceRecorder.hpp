@@ -0,0 +1,134 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef LIBGENE_OPERATIONS_TRACE_RECORDER_HPP_
+#define LIBGENE_OPERATIONS_TRACE_RECORDER_HPP_
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "RunStatistics.hpp"
+
+// Records what every thread of an operation was doing and when, written
+// out at the end of a run in the Chrome trace event format (to be opened
+// with chrome://tracing or Perfetto) if asked for with the "trace-json"
+// flag.
+//
+// Threads record into ring buffers of their own, so recording takes no
+// locks, and a thread that runs for long only keeps its latest events.
+// Events shorter than a minimum duration are left out, or reading and
+// matching single records would crowd out the stalls worth seeing.
+class TraceRecorder final {
+ public:
+    typedef RunStatistics::Clock Clock;
+
+    static constexpr size_t kDefaultEventsPerThread = 64*1024;
+    static constexpr auto kDefaultMinimumDuration = std::chrono::microseconds(10);
+
+    // Owned by one thread, and only looked at after that thread is done
+    class Thread final {
+     public:
+        Thread(const std::string& name, size_t capacity, Clock::duration minimum_duration);
+
+        // The time since the last lap is left out of the trace
+        void Restart(Clock::time_point now = Clock::now())
+        {
+            last_lap_ = now;
+        }
+        // Records an event 'name' lasting from the last lap until 'now'.
+        // 'name' has to outlive the recorder.
+        void Lap(const char *name, Clock::time_point now = Clock::now())
+        {
+            if (now - last_lap_ >= minimum_duration_) {
+                events_[next_] = {name, last_lap_, now};
+                next_ = (next_ + 1 == events_.size() ? 0 : next_ + 1);
+                recorded_++;
+            }
+            last_lap_ = now;
+        }
+
+     private:
+        friend class TraceRecorder;
+
+        struct Event {
+            const char *name;
+            Clock::time_point begin;
+            Clock::time_point end;
+        };
+
+        std::string name_;
+        std::vector<Event> events_;
+        Clock::duration minimum_duration_;
+        size_t next_{0};
+        int64_t recorded_{0};
+        Clock::time_point last_lap_;
+    };
+
+    explicit TraceRecorder(size_t events_per_thread = kDefaultEventsPerThread,
+                           Clock::duration minimum_duration = kDefaultMinimumDuration);
+
+    // Safe to call from any thread. The returned thread lives as long as
+    // the recorder.
+    Thread *AddThread(const std::string& name);
+
+    // Throws std::runtime_error if the file can't be written
+    void WriteJson(const std::string& path) const;
+
+ private:
+    const size_t events_per_thread_;
+    const Clock::duration minimum_duration_;
+    const Clock::time_point started_;
+
+    std::mutex mutex_;
+    // A deque, so that adding threads doesn't move the ones handed out
+    std::deque<Thread> threads_;
+};
+
+// Splits the time of a thread into stages for its statistics and its
+// trace, either of which may be missing. Reads the clock once a lap.
+struct StageTimer {
+    RunStatistics::Thread *statistics{nullptr};
+    TraceRecorder::Thread *trace{nullptr};
+
+    void Restart()
+    {
+        if (!statistics && !trace)
+            return;
+        auto now = TraceRecorder::Clock::now();
+        if (statistics)
+            statistics->Restart(now);
+        if (trace)
+            trace->Restart(now);
+    }
+    void Lap(RunStatistics::Stage stage)
+    {
+        if (!statistics && !trace)
+            return;
+        auto now = TraceRecorder::Clock::now();
+        if (statistics)
+            statistics->Lap(stage, now);
+        if (trace)
+            trace->Lap(RunStatistics::StageName(stage), now);
+    }
+};
+
+#endif  // LIBGENE_OPERATIONS_TRACE_RECORDER_HPP_
@@ -14,9 +14,19 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <chrono>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <thread>
 
 #include "Converter.hpp"
+#include "FastaStream.hpp"
+#include "FileSegments.hpp"
+#include "ProgressSampler.hpp"
+#include "RunStatistics.hpp"
+#include "TraceRecorder.hpp"
 #include <libgene/utils/StringUtils.hpp>
 #include <libgene/utils/CppUtils.hpp>
 #include <libgene/def/Flags.hpp>
@@ -26,6 +36,17 @@
 #include <libgene/file/sequence/SequenceRecord.hpp>
 #include <libgene/log/Logger.hpp>
 
+// Bins output qualities, see QualityBinner for the schemes
+static const std::string kQualityBinsFlag = "quality-bins";
+// Copy FASTA records in pieces instead of reading each one whole
+static const std::string kStreamFastaFlag = "stream-fasta";
+// Number of inputs converted at the same time, all logical cores by default
+static const std::string kConversionThreadsFlag = "conversion-threads";
+// Path of a JSON file to write the statistics of the run to
+static const std::string kStatsJsonFlag = "stats-json";
+// Path of a Chrome trace of the run's threads to write
+static const std::string kTraceJsonFlag = "trace-json";
+
 template <int ThrottleCount = 1024>
 bool HasToUpdateProgress_(int64_t count)
 {
@@ -62,7 +83,7 @@ bool Converter::Init_()
         gene::FileType type = gene::utils::str2type(extension);
         
         if (type != gene::FileType::Sam && type != gene::FileType::Bam) {
-            auto inFile = gene::SequenceFile::FileWithName(filePath, flags_, gene::OpenMode::Read);
+            auto inFile = RecordFile::FileWithName(filePath, flags_, gene::OpenMode::Read);
             if (inFile) {
                 totalSizeInBytes += inFile->length();
                 sequence_input_files_.push_back(std::move(inFile));
@@ -90,74 +111,331 @@ bool Converter::Init_()
                                                             "-converted");
     }
     
-    if (!(output_file_ = gene::SequenceFile::FileWithName(outputFilePath, flags_, gene::OpenMode::Write))) {
+    if (flags_->SettingExists(kQualityBinsFlag)) {
+        try {
+            int phred_offset = QualityBinner::PhredOffsetForFormat(*flags_->GetSetting(gene::Flags::kOutputFormat));
+            quality_binner_ = std::make_unique<QualityBinner>(*flags_->GetSetting(kQualityBinsFlag),
+                                                              phred_offset);
+        } catch (const std::invalid_argument& e) {
+            PrintfLog("%s\n", e.what());
+            return false;
+        }
+    }
+
+    if (!(output_file_ = RecordFile::FileWithName(outputFilePath, flags_, gene::OpenMode::Write))) {
         PrintfLog("Can't create output file\n");
         return false;
     }
     return true;
 }
 
-bool Converter::Process()
+bool Converter::StreamsFasta_()
 {
-    if (!Init_()) {
-        PrintfLog("Can't proceed further. Aborting operation.");
+    if (!flags_->SettingExists(kStreamFastaFlag))
         return false;
+    for (const auto& path : inputPaths) {
+        if (!FastaStreamReader::IsPlainFasta(path))
+            return false;
     }
 
-    if (flags_->verbose && !sequence_input_files_.empty()) {
-        PrintfLog("Converting %s(%s) -> %s(%s)\n", sequence_input_files_[0]->filePath().c_str(),
-               sequence_input_files_[0]->strFileType().c_str(), output_file_->filePath().c_str(),
-               output_file_->strFileType().c_str());
+    if (outputFilePath.empty()) {
+        outputFilePath = gene::utils::ConstructOutputNameWithFile(inputPaths.front(),
+                                                            gene::FileType::Unknown,
+                                                            outputFilePath,
+                                                            flags_,
+                                                            "-converted");
     }
-    
-    gene::SequenceRecord record;
+    return FastaStreamReader::IsPlainFasta(outputFilePath);
+}
+
+bool Converter::ProcessFastaStream_()
+{
+    std::vector<std::unique_ptr<FastaStreamReader>> readers;
+    for (const auto& path : inputPaths) {
+        auto reader = std::make_unique<FastaStreamReader>(path);
+        if (!reader->is_open()) {
+            PrintfLog("Can't open input file %s\n", path.c_str());
+            return false;
+        }
+        totalSizeInBytes += reader->length();
+        readers.push_back(std::move(reader));
+    }
+
+    if (flags_->verbose) {
+        PrintfLog("Converting %s(fasta) -> %s(fasta) in pieces\n", inputPaths.front().c_str(),
+                  outputFilePath.c_str());
+    }
+
     auto start = std::chrono::high_resolution_clock::now();
     int64_t counter = 0;
     int64_t bytesProcessed = 0;
+    // Created with the first record, so that inputs without any leave no
+    // output behind
+    std::unique_ptr<FastaStreamWriter> writer;
+    std::string header;
 
-    for (const auto& input_file : sequence_input_files_) {
-        while (!(record = input_file->Read()).Empty()) {
-            if (HasToUpdateProgress_(counter) && update_progress_callback) {
-                bool hasToCancelOperation = update_progress_callback((input_file->position() + bytesProcessed)/static_cast<float>(totalSizeInBytes*100.0));
+    for (const auto& reader : readers) {
+        while (reader->NextRecord(header)) {
+            if (!writer) {
+                writer = std::make_unique<FastaStreamWriter>(outputFilePath);
+                if (!writer->is_open()) {
+                    PrintfLog("Can't create output file\n");
+                    return false;
+                }
+            }
+            if (HasToUpdateProgress_<64>(counter) && update_progress_callback) {
+                bool hasToCancelOperation = update_progress_callback((reader->position() + bytesProcessed)/static_cast<float>(totalSizeInBytes)*100);
                 if (hasToCancelOperation)
                     return true;
             }
-            
+
+            ++counter;
+            // Every record keeps the line width it had
+            writer->BeginRecord(header, reader->line_width());
+            reader->CopySequenceTo(*writer);
+        }
+        bytesProcessed += reader->length();
+    }
+
+    if (counter == 0) {
+        PrintfLog("Input file was either empty, or it had an incorrect format\n");
+        return false;
+    }
+    writer->Close();
+
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> secondsElapsed = end - start;
+
+    if (flags_->verbose)
+        PrintfLog("%ld records processed in %.2f seconds\n", counter, secondsElapsed.count());
+
+    return true;
+}
+
+size_t Converter::InputsCount_() const
+{
+    return sequence_input_files_.size() + alignment_input_files_.size();
+}
+
+int64_t Converter::InputLength_(size_t index) const
+{
+    if (index < sequence_input_files_.size())
+        return sequence_input_files_[index]->length();
+    return alignment_input_files_[index - sequence_input_files_.size()]->length();
+}
+
+int Converter::ConversionThreadsCount_() const
+{
+    int threads = static_cast<int>(std::thread::hardware_concurrency());
+    if (flags_->SettingExists(kConversionThreadsFlag))
+        threads = flags_->GetIntSetting(kConversionThreadsFlag);
+    return std::max(1, std::min(threads, static_cast<int>(InputsCount_())));
+}
+
+int64_t Converter::ConvertInput_(size_t index, RecordFile& output, QualityBinner *binner,
+                                 ProgressSampler& sampler, StageTimer& timer)
+{
+    auto& progress = sampler.slot(index);
+    int64_t counter = 0;
+
+    if (index < sequence_input_files_.size()) {
+        const auto& input_file = sequence_input_files_[index];
+        gene::SequenceRecord record;
+        while (!(record = input_file->Read()).Empty()) {
+            timer.Lap(RunStatistics::Stage::Read);
+            if (HasToUpdateProgress_(counter)) {
+                if (sampler.cancelled())
+                    return counter;
+                progress.records.store(counter, std::memory_order_relaxed);
+                progress.bytes.store(input_file->position(), std::memory_order_relaxed);
+            }
+
             ++counter;
             if (fastqFormatConversion)
                 record.ShiftQuality(inputFastqVariant, outputFastqVariant);
-            
-            output_file_->Write(record);
+            if (binner)
+                binner->Apply(record.quality);
+            timer.Lap(RunStatistics::Stage::Format);
+
+            output.Write(record);
+            timer.Lap(RunStatistics::Stage::Write);
         }
-        bytesProcessed += input_file->length();
-    }
-    
-    gene::SamRecord samRecord;
-    for (const auto& inputFile : alignment_input_files_) {
-        while (!(samRecord = inputFile->read()).SEQ.empty()) {
-            if (HasToUpdateProgress_(counter) && update_progress_callback) {
-                bool hasToCancelOperation = update_progress_callback((inputFile->position() + bytesProcessed)/static_cast<float>(totalSizeInBytes*100.0));
-                if (hasToCancelOperation)
-                    return true;
+    } else {
+        const auto& input_file = alignment_input_files_[index - sequence_input_files_.size()];
+        gene::SamRecord samRecord;
+        while (!(samRecord = input_file->read()).SEQ.empty()) {
+            timer.Lap(RunStatistics::Stage::Read);
+            if (HasToUpdateProgress_(counter)) {
+                if (sampler.cancelled())
+                    return counter;
+                progress.records.store(counter, std::memory_order_relaxed);
+                progress.bytes.store(input_file->position(), std::memory_order_relaxed);
             }
-            
+
             ++counter;
             gene::SequenceRecord r{std::move(samRecord)};
-            output_file_->Write(r);
+            if (binner)
+                binner->Apply(r.quality);
+            timer.Lap(RunStatistics::Stage::Format);
+            output.Write(r);
+            timer.Lap(RunStatistics::Stage::Write);
         }
-        bytesProcessed += inputFile->length();
     }
-    
+    progress.records.store(counter, std::memory_order_relaxed);
+    progress.bytes.store(InputLength_(index), std::memory_order_relaxed);
+    if (timer.statistics)
+        timer.statistics->AddRecords(counter, InputLength_(index));
+    return counter;
+}
+
+void Converter::RemoveSegments_() const
+{
+    for (size_t i = 1; i < InputsCount_(); ++i)
+        RemoveSegment(SegmentPath(outputFilePath, i));
+}
+
+bool Converter::Process()
+{
+    if (StreamsFasta_())
+        return ProcessFastaStream_();
+
+    if (!Init_()) {
+        PrintfLog("Can't proceed further. Aborting operation.");
+        return false;
+    }
+
+    const size_t inputs_count = InputsCount_();
+    const int threads_count = ConversionThreadsCount_();
+    if (flags_->verbose && !sequence_input_files_.empty()) {
+        PrintfLog("Converting %s(%s) -> %s(%s)\n", sequence_input_files_[0]->filePath().c_str(),
+               sequence_input_files_[0]->strFileType().c_str(), output_file_->filePath().c_str(),
+               output_file_->strFileType().c_str());
+    }
+    if (flags_->verbose && inputs_count > 1)
+        PrintfLog("Converting %zu inputs on %d threads\n", inputs_count, threads_count);
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // The first input goes straight to the output file. Every other one is
+    // converted into a segment, and the segments are appended in input order
+    // once all of them are done.
+    std::vector<int64_t> counters(inputs_count, 0);
+    // Binning statistics are kept per thread and merged at the end
+    std::vector<QualityBinner> binners;
+    if (quality_binner_)
+        binners.assign(threads_count, *quality_binner_);
+    std::atomic<size_t> next_input{0};
+    std::unique_ptr<RunStatistics> statistics;
+    if (flags_->SettingExists(kStatsJsonFlag))
+        statistics = std::make_unique<RunStatistics>("convert");
+    std::unique_ptr<TraceRecorder> trace;
+    if (flags_->SettingExists(kTraceJsonFlag))
+        trace = std::make_unique<TraceRecorder>();
+    // Every input has a slot of its own, the bytes in it being its position
+    ProgressSampler sampler(inputs_count, update_progress_callback,
+                            [this](const ProgressSampler::Totals& totals) {
+        return totals.bytes/static_cast<float>(totalSizeInBytes)*100;
+    }, statistics.get());
+
+    std::vector<std::future<void>> workers;
+    workers.reserve(threads_count);
+    for (int t = 0; t < threads_count; ++t) {
+        workers.push_back(std::async(std::launch::async, [&, t]() {
+            QualityBinner *binner = (binners.empty() ? nullptr : &binners[t]);
+            StageTimer timer;
+            if (statistics)
+                timer.statistics = statistics->AddThread("convert " + std::to_string(t));
+            if (trace)
+                timer.trace = trace->AddThread("convert " + std::to_string(t));
+            try {
+                size_t index;
+                while (!sampler.cancelled() && (index = next_input++) < inputs_count) {
+                    if (index == 0) {
+                        counters[index] = ConvertInput_(index, *output_file_, binner, sampler,
+                                                        timer);
+                        continue;
+                    }
+                    auto segment_path = SegmentPath(outputFilePath, index);
+                    auto segment = RecordFile::FileWithName(segment_path, flags_, gene::OpenMode::Write);
+                    if (!segment) {
+                        PrintfLog("Can't create output segment %s\n", segment_path.c_str());
+                        throw std::runtime_error("Can't create output segment\n");
+                    }
+                    counters[index] = ConvertInput_(index, *segment, binner, sampler,
+                                                    timer);
+                    // Closing the segment flushes what's left of it
+                    segment.reset();
+                    timer.Lap(RunStatistics::Stage::Write);
+                }
+            } catch (...) {
+                // Stop the other threads as well
+                sampler.Cancel();
+                throw;
+            }
+        }));
+    }
+
+    try {
+        for (auto& worker : workers)
+            worker.get();
+    } catch (const std::exception& e) {
+        PrintfLog("%s", e.what());
+        RemoveSegments_();
+        return false;
+    }
+    // With no errors, only the progress callback cancels
+    sampler.Stop();
+    if (sampler.cancelled()) {
+        RemoveSegments_();
+        return true;
+    }
+
+    int64_t counter = 0;
+    for (auto count : counters)
+        counter += count;
     if (counter == 0) {
         PrintfLog("Input file was either empty, or it had an incorrect format\n");
+        RemoveSegments_();
+        return false;
+    }
+
+    // Segments can only be appended to a complete output file
+    output_file_.reset();
+    try {
+        for (size_t i = 1; i < inputs_count; ++i)
+            AppendSegment(outputFilePath, SegmentPath(outputFilePath, i));
+    } catch (const std::runtime_error&) {
+        RemoveSegments_();
         return false;
     }
     
     auto end = std::chrono::high_resolution_clock::now();
+    if (statistics) {
+        statistics->Finish(counter, totalSizeInBytes);
+        try {
+            statistics->WriteJson(*flags_->GetSetting(kStatsJsonFlag));
+        } catch (const std::runtime_error& e) {
+            // The conversion itself went fine
+            PrintfLog("%s", e.what());
+        }
+    }
+    if (trace) {
+        try {
+            trace->WriteJson(*flags_->GetSetting(kTraceJsonFlag));
+        } catch (const std::runtime_error& e) {
+            PrintfLog("%s", e.what());
+        }
+    }
     std::chrono::duration<double> secondsElapsed = end - start;
     
-    if (flags_->verbose)
+    if (flags_->verbose) {
         PrintfLog("%ld records processed in %.2f seconds\n", counter, secondsElapsed.count());
+        if (quality_binner_) {
+            for (const auto& binner : binners)
+                quality_binner_->MergeStatistics(binner);
+            quality_binner_->LogStatistics();
+        }
+    }
 
     return true;
 }
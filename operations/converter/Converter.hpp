@@ -21,8 +21,14 @@
 #include <memory>
 #include <string>
 #include <functional>
+#include <cstdint>
+
+#include "RecordFile.hpp"
+#include "QualityBinner.hpp"
+#include "ProgressSampler.hpp"
+#include "RunStatistics.hpp"
+#include "TraceRecorder.hpp"
 
-#include <libgene/file/sequence/SequenceFile.hpp>
 #include <libgene/file/alignment/AlignmentFile.hpp>
 #include <libgene/flags/CommandLineFlags.hpp>
 #include <libgene/def/FileType.hpp>
@@ -36,8 +42,8 @@ class Converter final {
     std::function<bool(float)> update_progress_callback;
 
  private:
-    std::unique_ptr<gene::SequenceFile> output_file_;
-    std::vector<std::unique_ptr<gene::SequenceFile>> sequence_input_files_;
+    std::unique_ptr<RecordFile> output_file_;
+    std::vector<std::unique_ptr<RecordFile>> sequence_input_files_;
     std::vector<std::unique_ptr<gene::AlignmentFile>> alignment_input_files_;
     std::unique_ptr<gene::CommandLineFlags> flags_;
 
@@ -47,7 +53,21 @@ class Converter final {
     bool fastqFormatConversion{false};
     gene::FastqVariant inputFastqVariant;
     gene::FastqVariant outputFastqVariant;
+    std::unique_ptr<QualityBinner> quality_binner_;
     bool Init_();
+    bool StreamsFasta_();
+    bool ProcessFastaStream_();
+
+    // Inputs are numbered with the sequence files first, then the alignment ones
+    size_t InputsCount_() const;
+    int64_t InputLength_(size_t index) const;
+    int ConversionThreadsCount_() const;
+    // Writes every record of input 'index' to 'output' and returns how many
+    // there were. Slot 'index' of 'sampler' follows the bytes read from the
+    // input, and 'timer' the time taken.
+    int64_t ConvertInput_(size_t index, RecordFile& output, QualityBinner *binner,
+                          ProgressSampler& sampler, StageTimer& timer);
+    void RemoveSegments_() const;
 };
 
 #endif  // LIBGENE_OPERATIONS_CONVERTER_HPP_
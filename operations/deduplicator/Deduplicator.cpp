@@ -0,0 +1,372 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <future>
+#include <stdexcept>
+#include <thread>
+
+#include "Deduplicator.hpp"
+#include <libgene/file/sequence/SequenceRecord.hpp>
+#include <libgene/log/Logger.hpp>
+
+// Which of the duplicates to keep: "first" (the default) or "best-quality"
+static const std::string kDedupKeepFlag = "dedup-keep";
+// Memory cap for the table of sequences, in megabytes
+static const std::string kDedupMemoryFlag = "dedup-memory-mb";
+// Number of threads hashing records, all logical cores by default
+static const std::string kDedupThreadsFlag = "dedup-threads";
+
+constexpr int64_t kDefaultMemoryCap = 1024*1024*1024;
+constexpr size_t kBatchRecords = 8192;
+constexpr size_t kPartitionsCount = 64;
+
+template <int ThrottleCount = 1024>
+bool HasToUpdateProgress_(int64_t count)
+{
+    return (count % ThrottleCount) == 0;
+}
+
+static uint64_t QualityScore(const gene::SequenceRecord& record)
+{
+    uint64_t score = 0;
+    for (char quality : record.quality)
+        score += static_cast<unsigned char>(quality);
+    return score;
+}
+
+Deduplicator::Deduplicator(std::vector<std::pair<std::string, std::string>> input_paths,
+                           std::pair<std::string, std::string> output_paths,
+                           std::unique_ptr<gene::CommandLineFlags>&& flags)
+: input_paths_(std::move(input_paths)),
+  output_paths_(std::move(output_paths)),
+  flags_(std::move(flags)),
+  memory_cap_(kDefaultMemoryCap),
+  threads_count_(static_cast<int>(std::thread::hardware_concurrency()))
+{
+    if (flags_->SettingExists(kDedupMemoryFlag))
+        memory_cap_ = static_cast<int64_t>(flags_->GetIntSetting(kDedupMemoryFlag))*1024*1024;
+    if (flags_->SettingExists(kDedupThreadsFlag))
+        threads_count_ = flags_->GetIntSetting(kDedupThreadsFlag);
+    threads_count_ = std::max(threads_count_, 1);
+}
+
+bool Deduplicator::Init_()
+{
+    if (flags_->SettingExists(kDedupKeepFlag)) {
+        const auto& keep = *flags_->GetSetting(kDedupKeepFlag);
+        if (keep == "best-quality") {
+            keep_best_quality_ = true;
+        } else if (keep != "first") {
+            PrintfLog("Unknown duplicate to keep '%s', expected 'first' or 'best-quality'\n",
+                      keep.c_str());
+            return false;
+        }
+    }
+    if (memory_cap_ <= 0) {
+        PrintfLog("Deduplication memory cap has to be positive\n");
+        return false;
+    }
+    if (input_paths_.empty())
+        return false;
+
+    paired_end_ = !input_paths_.front().second.empty();
+    for (const auto& paths : input_paths_) {
+        if (paths.second.empty() == paired_end_) {
+            PrintfLog("Either every input or none of them has to have a mate file\n");
+            return false;
+        }
+    }
+    if (paired_end_ && output_paths_.second.empty()) {
+        PrintfLog("Paired-end reads need two output files\n");
+        return false;
+    }
+    return true;
+}
+
+bool Deduplicator::ReportProgress_(float fraction) const
+{
+    return update_progress_callback && update_progress_callback(fraction*100);
+}
+
+bool Deduplicator::OpenInputs_(std::vector<RecordFilePtrsPair>& input_files) const
+{
+    auto open = [this](const std::string& path) {
+        auto file = RecordFile::FileWithName(path, flags_, gene::OpenMode::Read);
+        if (!file || !file->isValidGeneFile()) {
+            PrintfLog("Can't open input file %s\n", path.c_str());
+            return RecordFilePtr();
+        }
+        return file;
+    };
+
+    for (const auto& paths : input_paths_) {
+        RecordFilePtrsPair files;
+        if (!(files.first = open(paths.first)))
+            return false;
+        if (paired_end_ && !(files.second = open(paths.second)))
+            return false;
+        input_files.push_back(std::move(files));
+    }
+    return true;
+}
+
+bool Deduplicator::ReadPair_(RecordFilePtrsPair& input, RecordPair& record_pair) const
+{
+    record_pair.first = input.first->Read();
+    if (!paired_end_)
+        return !record_pair.first.Empty();
+
+    record_pair.second = input.second->Read();
+    if (record_pair.first.Empty() != record_pair.second.Empty()) {
+        PrintfLog("Mate files %s and %s have different numbers of records\n",
+                  input.first->filePath().c_str(), input.second->filePath().c_str());
+        throw std::runtime_error("Mate files don't match\n");
+    }
+    return !record_pair.first.Empty();
+}
+
+bool Deduplicator::FindKeptRecords_()
+{
+    std::vector<RecordFilePtrsPair> input_files;
+    if (!OpenInputs_(input_files))
+        throw std::runtime_error("Can't open input files\n");
+    for (const auto& files : input_files)
+        total_size_in_bytes_ += files.first->length() + (files.second ? files.second->length() : 0);
+
+    DuplicateTable table(static_cast<size_t>(threads_count_)*4, keep_best_quality_);
+    std::vector<FILE *> partitions;
+    auto close_partitions = [&partitions] {
+        for (auto partition : partitions)
+            fclose(partition);
+        partitions.clear();
+    };
+
+    // Records are hashed and inserted on worker threads, a few batches at a
+    // time. Which record wins among duplicates only depends on its index,
+    // so the order the batches get done in doesn't matter.
+    std::deque<std::future<void>> tasks;
+    auto hash_batch = [this, &table](std::vector<RecordPair> batch, uint64_t first_index) {
+        std::vector<DuplicateTable::Candidate> candidates;
+        candidates.reserve(batch.size());
+        for (size_t i = 0; i < batch.size(); ++i) {
+            const auto& records = batch[i];
+            DuplicateTable::Candidate candidate;
+            candidate.hash = HashRead(records.first.seq, paired_end_ ? &records.second.seq : nullptr);
+            candidate.index = first_index + i;
+            candidate.score = 0;
+            if (keep_best_quality_) {
+                candidate.score = QualityScore(records.first);
+                if (paired_end_)
+                    candidate.score += QualityScore(records.second);
+            }
+            candidates.push_back(candidate);
+        }
+        table.Insert(candidates);
+    };
+    auto wait_for_tasks = [&tasks](size_t pending) {
+        while (tasks.size() > pending) {
+            tasks.front().get();
+            tasks.pop_front();
+        }
+    };
+
+    try {
+        int64_t bytes_processed = 0;
+        std::vector<RecordPair> batch;
+        RecordPair record_pair;
+        for (auto& input : input_files) {
+            while (ReadPair_(input, record_pair)) {
+                if (HasToUpdateProgress_(records_count_)) {
+                    int64_t position = input.first->position() + (input.second ? input.second->position() : 0);
+                    if (ReportProgress_((position + bytes_processed)/static_cast<float>(total_size_in_bytes_)/2)) {
+                        wait_for_tasks(0);
+                        close_partitions();
+                        return false;
+                    }
+                }
+
+                batch.push_back(std::move(record_pair));
+                if (batch.size() == kBatchRecords) {
+                    wait_for_tasks(static_cast<size_t>(threads_count_) - 1);
+                    uint64_t first_index = static_cast<uint64_t>(records_count_ + 1 - batch.size());
+                    tasks.push_back(std::async(std::launch::async, hash_batch, std::move(batch), first_index));
+                    batch = std::vector<RecordPair>();
+                    batch.reserve(kBatchRecords);
+                }
+                ++records_count_;
+
+                if (table.bytes() > memory_cap_ && HasToUpdateProgress_(records_count_)) {
+                    wait_for_tasks(0);
+                    if (partitions.empty()) {
+                        for (size_t p = 0; p < kPartitionsCount; ++p) {
+                            partition_paths_.push_back(output_paths_.first + "-dedup" +
+                                                       std::to_string(p + 1) + ".tmp");
+                            FILE *partition = fopen(partition_paths_.back().c_str(), "wb");
+                            if (!partition) {
+                                PrintfLog("Can't create %s\n", partition_paths_.back().c_str());
+                                throw std::runtime_error("Can't create duplicate table partition\n");
+                            }
+                            partitions.push_back(partition);
+                        }
+                        if (flags_->verbose)
+                            PrintfLog("Spilling sequences to %zu partitions\n", partitions.size());
+                    }
+                    table.Spill(partitions);
+                }
+            }
+            bytes_processed += input.first->length() + (input.second ? input.second->length() : 0);
+        }
+        if (!batch.empty()) {
+            uint64_t first_index = static_cast<uint64_t>(records_count_) - batch.size();
+            tasks.push_back(std::async(std::launch::async, hash_batch, std::move(batch), first_index));
+        }
+        wait_for_tasks(0);
+    } catch (...) {
+        while (!tasks.empty()) {
+            tasks.front().wait();
+            tasks.pop_front();
+        }
+        close_partitions();
+        throw;
+    }
+
+    kept_.assign(static_cast<size_t>(records_count_), false);
+    if (partitions.empty()) {
+        table.TakeWinners([this](uint64_t index) { kept_[index] = true; });
+    } else {
+        table.Spill(partitions);
+        close_partitions();
+        ResolvePartitions_(table);
+    }
+    return true;
+}
+
+void Deduplicator::ResolvePartitions_(DuplicateTable& table)
+{
+    // Every hash lives in a single partition, so each one is resolved on its own
+    std::vector<DuplicateTable::Candidate> candidates(kBatchRecords);
+    for (const auto& path : partition_paths_) {
+        FILE *partition = fopen(path.c_str(), "rb");
+        if (!partition) {
+            PrintfLog("Can't read %s\n", path.c_str());
+            throw std::runtime_error("Can't read duplicate table partition\n");
+        }
+        size_t count;
+        while ((count = fread(candidates.data(), sizeof(candidates[0]), candidates.size(), partition)) > 0) {
+            candidates.resize(count);
+            table.Insert(candidates);
+            candidates.resize(kBatchRecords);
+        }
+        fclose(partition);
+        std::remove(path.c_str());
+        table.TakeWinners([this](uint64_t index) { kept_[index] = true; });
+    }
+}
+
+bool Deduplicator::WriteKeptRecords_()
+{
+    std::vector<RecordFilePtrsPair> input_files;
+    if (!OpenInputs_(input_files))
+        throw std::runtime_error("Can't open input files\n");
+
+    RecordFilePtrsPair outputs;
+    outputs.first = RecordFile::FileWithName(output_paths_.first, flags_, gene::OpenMode::Write);
+    if (paired_end_)
+        outputs.second = RecordFile::FileWithName(output_paths_.second, flags_, gene::OpenMode::Write);
+    if (!outputs.first || (paired_end_ && !outputs.second)) {
+        PrintfLog("Can't create output file\n");
+        throw std::runtime_error("Can't create output file\n");
+    }
+
+    int64_t index = 0;
+    int64_t bytes_processed = 0;
+    RecordPair record_pair;
+    for (auto& input : input_files) {
+        while (ReadPair_(input, record_pair)) {
+            if (HasToUpdateProgress_(index)) {
+                int64_t position = input.first->position() + (input.second ? input.second->position() : 0);
+                if (ReportProgress_(0.5f + (position + bytes_processed)/static_cast<float>(total_size_in_bytes_)/2))
+                    return false;
+            }
+
+            if (index >= records_count_) {
+                PrintfLog("Input files changed while being deduplicated\n");
+                throw std::runtime_error("Input files changed\n");
+            }
+            if (kept_[static_cast<size_t>(index)]) {
+                outputs.first->Write(record_pair.first);
+                if (paired_end_)
+                    outputs.second->Write(record_pair.second);
+            }
+            ++index;
+        }
+        bytes_processed += input.first->length() + (input.second ? input.second->length() : 0);
+    }
+    return true;
+}
+
+void Deduplicator::RemovePartitions_() const
+{
+    for (const auto& path : partition_paths_)
+        std::remove(path.c_str());
+}
+
+bool Deduplicator::Process()
+{
+    if (!Init_()) {
+        PrintfLog("Can't proceed further. Aborting operation.");
+        return false;
+    }
+
+    if (flags_->verbose) {
+        PrintfLog("Removing duplicate %s into ->%s, keeping the %s of them\n",
+                  paired_end_ ? "pairs" : "reads", output_paths_.first.c_str(),
+                  keep_best_quality_ ? "best quality one" : "first one");
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    try {
+        if (!FindKeptRecords_()) {
+            RemovePartitions_();
+            return true;
+        }
+        if (records_count_ == 0) {
+            PrintfLog("Input file was either empty, or it had an incorrect format\n");
+            return false;
+        }
+        if (!WriteKeptRecords_())
+            return true;
+    } catch (const std::runtime_error&) {
+        RemovePartitions_();
+        return false;
+    }
+
+    auto secondsElapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start);
+    if (flags_->verbose) {
+        int64_t kept = std::count(kept_.begin(), kept_.end(), true);
+        PrintfLog("%lld of %lld %s kept, %lld duplicates (%.1f%%) removed in %.2f seconds\n",
+                  kept, records_count_, paired_end_ ? "pairs" : "reads",
+                  records_count_ - kept, 100.0*(records_count_ - kept)/records_count_,
+                  secondsElapsed.count());
+    }
+
+    return true;
+}
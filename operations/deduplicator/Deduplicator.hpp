@@ -0,0 +1,84 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef LIBGENE_OPERATIONS_DEDUPLICATOR_HPP_
+#define LIBGENE_OPERATIONS_DEDUPLICATOR_HPP_
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <utility>
+#include <functional>
+#include <cstdint>
+
+#include "RecordFile.hpp"
+#include "DuplicateTable.hpp"
+
+#include <libgene/flags/CommandLineFlags.hpp>
+
+// Removes reads (or pairs of reads) whose sequences exactly repeat an
+// earlier one, keeping either the first of them or the one with the highest
+// total quality. The output keeps the order of the input.
+//
+// The inputs are read twice: first to find the record to keep for every
+// sequence, then to write out those records. If the table of sequences
+// outgrows the memory cap it gets spilled into partitions on disk, which
+// are then resolved one at a time.
+class Deduplicator final {
+ public:
+    // '.second' of the input and output paths is empty for single-end reads
+    Deduplicator(std::vector<std::pair<std::string, std::string>> input_paths,
+                 std::pair<std::string, std::string> output_paths,
+                 std::unique_ptr<gene::CommandLineFlags>&& flags);
+    bool Process();
+    std::function<bool(float)> update_progress_callback;
+
+ private:
+    typedef std::unique_ptr<RecordFile> RecordFilePtr;
+    typedef std::pair<RecordFilePtr, RecordFilePtr> RecordFilePtrsPair;
+    typedef std::pair<gene::SequenceRecord, gene::SequenceRecord> RecordPair;
+
+    std::vector<std::pair<std::string, std::string>> input_paths_;
+    std::pair<std::string, std::string> output_paths_;
+    std::unique_ptr<gene::CommandLineFlags> flags_;
+
+    bool paired_end_{false};
+    bool keep_best_quality_{false};
+    int64_t memory_cap_;
+    int threads_count_;
+
+    int64_t total_size_in_bytes_{0};
+    int64_t records_count_{0};
+    // Set for every record (or pair) that makes it into the output
+    std::vector<bool> kept_;
+    std::vector<std::string> partition_paths_;
+
+    bool Init_();
+    bool ReportProgress_(float fraction) const;
+    bool OpenInputs_(std::vector<RecordFilePtrsPair>& input_files) const;
+    // Returns false at the end of the input, throws if the mate files don't
+    // have the same number of records
+    bool ReadPair_(RecordFilePtrsPair& input, RecordPair& record_pair) const;
+
+    // Returns false if the operation got cancelled
+    bool FindKeptRecords_();
+    void ResolvePartitions_(DuplicateTable& table);
+    bool WriteKeptRecords_();
+    void RemovePartitions_() const;
+};
+
+#endif  // LIBGENE_OPERATIONS_DEDUPLICATOR_HPP_
@@ -0,0 +1,216 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "DuplicateTable.hpp"
+
+constexpr uint64_t kEmptyIndex = UINT64_MAX;
+constexpr size_t kInitialShardSlots = 1024;
+
+static inline uint64_t Rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t Fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+// MurmurHash3_x64_128 by Austin Appleby, which is in the public domain
+static ReadHash MurmurHash3(const char *data, size_t length, uint32_t seed)
+{
+    const size_t blocks_count = length/16;
+    uint64_t h1 = seed;
+    uint64_t h2 = seed;
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+
+    for (size_t i = 0; i < blocks_count; ++i) {
+        uint64_t k1, k2;
+        std::memcpy(&k1, data + i*16, sizeof(k1));
+        std::memcpy(&k2, data + i*16 + 8, sizeof(k2));
+
+        k1 *= c1; k1 = Rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = Rotl64(h1, 27); h1 += h2; h1 = h1*5 + 0x52dce729;
+        k2 *= c2; k2 = Rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = Rotl64(h2, 31); h2 += h1; h2 = h2*5 + 0x38495ab5;
+    }
+
+    const auto tail = reinterpret_cast<const uint8_t *>(data + blocks_count*16);
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+    switch (length & 15) {
+        case 15: k2 ^= static_cast<uint64_t>(tail[14]) << 48;  // fall through
+        case 14: k2 ^= static_cast<uint64_t>(tail[13]) << 40;  // fall through
+        case 13: k2 ^= static_cast<uint64_t>(tail[12]) << 32;  // fall through
+        case 12: k2 ^= static_cast<uint64_t>(tail[11]) << 24;  // fall through
+        case 11: k2 ^= static_cast<uint64_t>(tail[10]) << 16;  // fall through
+        case 10: k2 ^= static_cast<uint64_t>(tail[9]) << 8;    // fall through
+        case 9:  k2 ^= static_cast<uint64_t>(tail[8]);
+                 k2 *= c2; k2 = Rotl64(k2, 33); k2 *= c1; h2 ^= k2;  // fall through
+        case 8:  k1 ^= static_cast<uint64_t>(tail[7]) << 56;  // fall through
+        case 7:  k1 ^= static_cast<uint64_t>(tail[6]) << 48;  // fall through
+        case 6:  k1 ^= static_cast<uint64_t>(tail[5]) << 40;  // fall through
+        case 5:  k1 ^= static_cast<uint64_t>(tail[4]) << 32;  // fall through
+        case 4:  k1 ^= static_cast<uint64_t>(tail[3]) << 24;  // fall through
+        case 3:  k1 ^= static_cast<uint64_t>(tail[2]) << 16;  // fall through
+        case 2:  k1 ^= static_cast<uint64_t>(tail[1]) << 8;   // fall through
+        case 1:  k1 ^= static_cast<uint64_t>(tail[0]);
+                 k1 *= c1; k1 = Rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= length;
+    h2 ^= length;
+    h1 += h2;
+    h2 += h1;
+    h1 = Fmix64(h1);
+    h2 = Fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+    return ReadHash{h1, h2};
+}
+
+ReadHash HashRead(const std::string& sequence, const std::string *mate_sequence)
+{
+    if (!mate_sequence)
+        return MurmurHash3(sequence.data(), sequence.size(), 0);
+
+    // The separator keeps "AC"+"GT" apart from "A"+"CGT"
+    thread_local std::string pair;
+    pair.assign(sequence);
+    pair.push_back('\n');
+    pair.append(*mate_sequence);
+    return MurmurHash3(pair.data(), pair.size(), 0);
+}
+
+DuplicateTable::DuplicateTable(size_t shards_count, bool prefer_higher_score)
+: prefer_higher_score_(prefer_higher_score)
+{
+    // A power of two, so that the shard is a mask of the hash away
+    size_t count = 1;
+    while (count < shards_count)
+        count *= 2;
+    for (size_t i = 0; i < count; ++i)
+        shards_.push_back(std::make_unique<Shard>());
+}
+
+size_t DuplicateTable::ShardOf_(const ReadHash& hash) const
+{
+    return static_cast<size_t>(hash.high) & (shards_.size() - 1);
+}
+
+bool DuplicateTable::Beats_(const Candidate& a, const Candidate& b) const
+{
+    if (prefer_higher_score_ && a.score != b.score)
+        return a.score > b.score;
+    return a.index < b.index;
+}
+
+void DuplicateTable::Grow_(Shard& shard)
+{
+    std::vector<Candidate> slots(std::max(shard.slots.size()*2, kInitialShardSlots),
+                                 Candidate{ReadHash{0, 0}, kEmptyIndex, 0});
+    bytes_ += static_cast<int64_t>((slots.size() - shard.slots.size())*sizeof(Candidate));
+    std::swap(slots, shard.slots);
+    shard.size = 0;
+    for (const auto& candidate : slots) {
+        if (candidate.index != kEmptyIndex)
+            Insert_(shard, candidate);
+    }
+}
+
+void DuplicateTable::Insert_(Shard& shard, const Candidate& candidate)
+{
+    // Keep the load factor under 0.7 so that probe sequences stay short
+    if ((shard.size + 1)*10 > shard.slots.size()*7)
+        Grow_(shard);
+
+    const size_t mask = shard.slots.size() - 1;
+    for (size_t slot = candidate.hash.low & mask; ; slot = (slot + 1) & mask) {
+        auto& existing = shard.slots[slot];
+        if (existing.index == kEmptyIndex) {
+            existing = candidate;
+            ++shard.size;
+            return;
+        }
+        if (existing.hash == candidate.hash) {
+            if (Beats_(candidate, existing))
+                existing = candidate;
+            return;
+        }
+    }
+}
+
+void DuplicateTable::Insert(const std::vector<Candidate>& candidates)
+{
+    std::vector<std::vector<const Candidate *>> by_shard(shards_.size());
+    for (const auto& candidate : candidates)
+        by_shard[ShardOf_(candidate.hash)].push_back(&candidate);
+
+    for (size_t s = 0; s < shards_.size(); ++s) {
+        if (by_shard[s].empty())
+            continue;
+        auto& shard = *shards_[s];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto candidate : by_shard[s])
+            Insert_(shard, *candidate);
+    }
+}
+
+int64_t DuplicateTable::bytes() const
+{
+    return bytes_;
+}
+
+void DuplicateTable::TakeWinners(const std::function<void(uint64_t)>& winner)
+{
+    for (auto& shard : shards_) {
+        for (const auto& candidate : shard->slots) {
+            if (candidate.index != kEmptyIndex)
+                winner(candidate.index);
+        }
+        shard->slots = std::vector<Candidate>();
+        shard->size = 0;
+    }
+    bytes_ = 0;
+}
+
+void DuplicateTable::Spill(const std::vector<FILE *>& partitions)
+{
+    for (auto& shard : shards_) {
+        for (const auto& candidate : shard->slots) {
+            if (candidate.index == kEmptyIndex)
+                continue;
+            // The shard and the slot come from other bits of the hash
+            FILE *partition = partitions[(candidate.hash.high >> 32) % partitions.size()];
+            if (fwrite(&candidate, sizeof(candidate), 1, partition) != 1)
+                throw std::runtime_error("Can't write duplicate table partition\n");
+        }
+        shard->slots = std::vector<Candidate>();
+        shard->size = 0;
+    }
+    bytes_ = 0;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef LIBGENE_OPERATIONS_DUPLICATE_TABLE_HPP_
+#define LIBGENE_OPERATIONS_DUPLICATE_TABLE_HPP_
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <functional>
+
+// 128-bit hash of a read's sequence, or of both sequences of a pair
+struct ReadHash {
+    uint64_t high;
+    uint64_t low;
+
+    bool operator==(const ReadHash& other) const
+    {
+        return high == other.high && low == other.low;
+    }
+};
+
+// 'mate_sequence' is nullptr for single-end reads
+ReadHash HashRead(const std::string& sequence, const std::string *mate_sequence);
+
+// Remembers which record wins among all records sharing a hash: either the
+// first one, or the one with the highest score (the earlier one on ties).
+//
+// The table is split into shards by hash, each one an open-addressing table
+// with its own lock, so that several threads can insert at once.
+class DuplicateTable final {
+ public:
+    struct Candidate {
+        ReadHash hash;
+        uint64_t index;
+        uint64_t score;
+    };
+
+    DuplicateTable(size_t shards_count, bool prefer_higher_score);
+
+    // Thread-safe. 'candidates' are grouped by shard, so each shard is
+    // locked once per call.
+    void Insert(const std::vector<Candidate>& candidates);
+
+    // Memory taken by the slots of all shards
+    int64_t bytes() const;
+
+    // The following are not thread-safe, and leave the table empty
+
+    // Calls 'winner' with the index of the winning record of every hash
+    void TakeWinners(const std::function<void(uint64_t)>& winner);
+    // Appends the winners so far to one of 'partitions' by their hash, so
+    // that every hash always ends up in the same partition
+    void Spill(const std::vector<FILE *>& partitions);
+
+ private:
+    struct Shard {
+        std::mutex mutex;
+        std::vector<Candidate> slots;
+        size_t size{0};
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    const bool prefer_higher_score_;
+    std::atomic<int64_t> bytes_{0};
+
+    bool Beats_(const Candidate& a, const Candidate& b) const;
+    void Insert_(Shard& shard, const Candidate& candidate);
+    void Grow_(Shard& shard);
+    size_t ShardOf_(const ReadHash& hash) const;
+};
+
+#endif  // LIBGENE_OPERATIONS_DUPLICATE_TABLE_HPP_
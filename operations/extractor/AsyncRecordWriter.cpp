@@ -0,0 +1,148 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <string>
+
+#include "AsyncRecordWriter.hpp"
+
+AsyncRecordWriter::AsyncRecordWriter(int threads_count, OutputBufferBudget& budget,
+                                     RunStatistics *statistics, TraceRecorder *trace)
+: budget_(budget), timed_(statistics != nullptr)
+{
+    threads_count = std::max(threads_count, 1);
+    free_bytes_limit_ = budget_.capacity()/(4*threads_count);
+    for (int i = 0; i < threads_count; ++i) {
+        workers_.push_back(std::make_unique<Worker>());
+        auto& timer = workers_.back()->timer;
+        if (statistics)
+            timer.statistics = statistics->AddThread("writer " + std::to_string(i));
+        if (trace)
+            timer.trace = trace->AddThread("writer " + std::to_string(i));
+    }
+
+    for (auto& worker : workers_) {
+        Worker *worker_ptr = worker.get();
+        worker->thread = std::thread([this, worker_ptr] { Run_(*worker_ptr); });
+    }
+}
+
+AsyncRecordWriter::~AsyncRecordWriter()
+{
+    try {
+        Finish();
+    } catch (...) {
+        // The error has already been reported by the operation
+    }
+}
+
+int AsyncRecordWriter::DefaultThreadsCount()
+{
+    int logical_cores = static_cast<int>(std::thread::hardware_concurrency());
+    return std::min(std::max(logical_cores/2, 1), 4);
+}
+
+void AsyncRecordWriter::Submit(const void *target, RecordArena& buffer, WriteFunction write)
+{
+    // The arena goes to the writer together with its memory, which stays
+    // accounted for until the writer is done with it
+    Job job{RecordArena(), std::move(write), RunStatistics::Clock::time_point()};
+    std::swap(job.buffer, buffer);
+    if (timed_)
+        job.submitted = RunStatistics::Clock::now();
+
+    auto& worker = *workers_[std::hash<const void *>()(target) % workers_.size()];
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.jobs.push_back(std::move(job));
+        if (!worker.free_buffers.empty()) {
+            std::swap(buffer, worker.free_buffers.back());
+            worker.free_buffers.pop_back();
+            worker.free_bytes -= buffer.capacity();
+        }
+    }
+    worker.has_jobs.notify_one();
+}
+
+void AsyncRecordWriter::Run_(Worker& worker)
+{
+    RecordPair scratch;
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(worker.mutex);
+            worker.has_jobs.wait(lock, [&worker] {
+                return !worker.jobs.empty() || worker.finishing;
+            });
+            if (worker.jobs.empty())
+                return;
+
+            job = std::move(worker.jobs.front());
+            worker.jobs.pop_front();
+        }
+
+        // Waiting for jobs is left out
+        worker.timer.Restart();
+        try {
+            job.write(job.buffer, scratch);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex_);
+            if (!error_)
+                error_ = std::current_exception();
+        }
+        worker.timer.Lap(RunStatistics::Stage::Write);
+        if (auto statistics = worker.timer.statistics) {
+            statistics->AddFlush(RunStatistics::Clock::now() - job.submitted);
+            statistics->AddRecords(static_cast<int64_t>(job.buffer.size()), job.buffer.bytes());
+        }
+
+        job.buffer.Reset();
+        int64_t capacity = job.buffer.capacity();
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            if (worker.free_bytes + capacity <= free_bytes_limit_) {
+                worker.free_bytes += capacity;
+                worker.free_buffers.push_back(std::move(job.buffer));
+                continue;
+            }
+        }
+        budget_.Release(capacity);
+    }
+}
+
+void AsyncRecordWriter::Finish()
+{
+    if (finished_)
+        return;
+
+    finished_ = true;
+    for (auto& worker : workers_) {
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            worker->finishing = true;
+        }
+        worker->has_jobs.notify_one();
+    }
+    for (auto& worker : workers_) {
+        worker->thread.join();
+        budget_.Release(worker->free_bytes);
+        worker->free_buffers.clear();
+        worker->free_bytes = 0;
+    }
+
+    if (error_)
+        std::rethrow_exception(error_);
+}
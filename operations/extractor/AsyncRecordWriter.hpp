@@ -0,0 +1,103 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBGENE_OPERATIONS_ASYNC_RECORD_WRITER_HPP_
+#define LIBGENE_OPERATIONS_ASYNC_RECORD_WRITER_HPP_
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <exception>
+#include <condition_variable>
+
+#include "RecordArena.hpp"
+#include "OutputBufferBudget.hpp"
+#include "RunStatistics.hpp"
+#include "TraceRecorder.hpp"
+
+#include <libgene/file/sequence/SequenceRecord.hpp>
+
+// Writes buffered records on a small pool of background threads, so that
+// scanning tasks hand off full buffers instead of blocking on file I/O.
+//
+// Every output target is always served by the same thread, which keeps the
+// buffers of a target in submission order and makes per-file locks
+// unnecessary.
+//
+// Written buffers are reset and kept by their thread, to be handed back to
+// the next task submitting to it, so that buffers get refilled without
+// growing them again. Kept buffers stay counted against the budget. All
+// threads together keep at most a quarter of the budget that way, and free
+// the buffers beyond that, returning their memory to the budget.
+class AsyncRecordWriter final {
+ public:
+    typedef std::pair<gene::SequenceRecord, gene::SequenceRecord> RecordPair;
+    // Writes out the records of an arena. The pair is scratch space owned by
+    // the writing thread.
+    typedef std::function<void(const RecordArena&, RecordPair&)> WriteFunction;
+
+    // Every thread adds itself to 'statistics' and 'trace', if given
+    AsyncRecordWriter(int threads_count, OutputBufferBudget& budget,
+                      RunStatistics *statistics = nullptr, TraceRecorder *trace = nullptr);
+    ~AsyncRecordWriter();
+
+    static int DefaultThreadsCount();
+
+    // Takes over the records of 'buffer' and leaves it empty, ready to be
+    // filled again while the taken records are written in the background.
+    // 'buffer' may come back with the memory of an earlier buffer, which is
+    // already counted against the budget.
+    void Submit(const void *target, RecordArena& buffer, WriteFunction write);
+
+    // Waits for all submitted buffers to be written. Rethrows the first
+    // exception raised by a write function.
+    void Finish();
+
+ private:
+    struct Job {
+        RecordArena buffer;
+        WriteFunction write;
+        RunStatistics::Clock::time_point submitted{};
+    };
+    struct Worker {
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable has_jobs;
+        std::deque<Job> jobs;
+        // Written buffers, reset and waiting to be handed out again
+        std::vector<RecordArena> free_buffers;
+        int64_t free_bytes{0};
+        bool finishing{false};
+        StageTimer timer;
+    };
+
+    void Run_(Worker& worker);
+
+    OutputBufferBudget& budget_;
+    const bool timed_;
+    // Bytes every worker may keep in its free buffers
+    int64_t free_bytes_limit_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+
+    std::mutex error_mutex_;
+    std::exception_ptr error_;
+    bool finished_{false};
+};
+
+#endif  // LIBGENE_OPERATIONS_ASYNC_RECORD_WRITER_HPP_
@@ -18,27 +18,39 @@
 #include <future>
 #include <chrono>
 #include <iostream>
+#include <string>
 #include <cassert>
 #include <stdexcept>
 
 #include "Extractor.hpp"
+#include "ProgressSampler.hpp"
 #include <libgene/utils/CppUtils.hpp>
 #include <libgene/utils/StringUtils.hpp>
 #include <libgene/search/WildcardMatcher.hpp>
 #include <libgene/search/FuzzySearch.hpp>
 #include <libgene/def/Flags.hpp>
-#include <libgene/file/sequence/SequenceFile.hpp>
 #include <libgene/log/Logger.hpp>
 #include <libgene/def/Def.hpp>
 
 using gene::Flags;
-using gene::SequenceFile;
 using gene::SequenceRecord;
 
-constexpr int64_t kThreadLocalOutputBufferSize = 1024;
+// Memory cap for all thread-local output buffers, in megabytes
+static const std::string kOutputBufferBudgetFlag = "buffer-mb";
+// Number of background threads writing the output files
+static const std::string kWriterThreadsFlag = "writer-threads";
+// Maximum number of demultiplexed outputs (pairs of files) open at once
+static const std::string kMaxOpenOutputsFlag = "max-open-outputs";
+// Path of a JSON file to write the statistics of the run to
+static const std::string kStatsJsonFlag = "stats-json";
+// Path of a Chrome trace of the run's threads to write
+static const std::string kTraceJsonFlag = "trace-json";
+// Read by RecordFile when the inputs are opened
+static const std::string kPrefetchFlag = "prefetch";
 
 template <typename TaskT>
 static void LaunchMultithreadedTask(TaskT& task, int files_count);
+static int TasksCountForFiles(int files_count);
 
 template <int ThrottleCount = 1024>
 bool HasToUpdateProgress_(int64_t count)
@@ -47,45 +59,34 @@ bool HasToUpdateProgress_(int64_t count)
 }
 
 Extractor::Extractor(ExtractorJob&& job)
+: Extractor(std::move(job), nullptr)
+{
+}
+
+Extractor::Extractor(ExtractorJob&& job, const Extractor *input_owner)
 : flags_(std::move(job.flags))
 , queries_(std::move(job.queries))
 {
     demultiplex_input_ = flags_->SettingExists(Flags::kDemultiplexByTags);
     illumina_r2_barcodes_ = flags_->SettingExists(Flags::kIlluminaR2Tags);
+    enable_error_correction_ = flags_->SettingExists(Flags::kDemultiplexWithErrorCorrection);
     
     if ((solexa_variant_ = flags_->SettingExists(Flags::kSolexaFastqCutoffLength))) {
         trim_length_ = flags_->GetIntSetting(Flags::kSolexaFastqCutoffLength);
         PrintfLog("Demultiplexing as Solexa FASTQ with trim length %i", trim_length_);
     }
-    
-    for (const auto& input_path_pair : job.input_paths) {
-        auto r1_input_file = SequenceFile::FileWithName(input_path_pair.first,
-                                                        flags_,
-                                                        gene::OpenMode::Read);
 
-        if (r1_input_file) {
-            if (r1_input_file->fileKind() != gene::FileKind::SingleEnd)
-                paired_demultiplexing_ = true;
-
-            std::unique_ptr<SequenceFile> r2_input_file = nullptr;
-            if (!input_path_pair.second.empty())
-                r2_input_file = SequenceFile::FileWithName(input_path_pair.second,
-                                                           flags_,
-                                                           gene::OpenMode::Read);
-
-            input_files_.push_back(std::make_pair(std::move(r1_input_file),
-                                                  std::move(r2_input_file)));
-
-            if (input_files_.back().second)
-                total_size_in_bytes_ += input_files_.back().second->length();
-            else
-                total_size_in_bytes_ += input_files_.back().first->length();
-        }
+    if (input_owner) {
+        paired_end_inputs_ = input_owner->paired_end_inputs_;
+        total_size_in_bytes_ = input_owner->total_size_in_bytes_;
+    } else {
+        OpenInputs_(job.input_paths);
     }
     
     // There's no point in doing this special treatment for a single file
-    paired_demultiplexing_ &= (!job.input_paths.empty() &&
-                               !job.input_paths.front().second.empty());
+    paired_demultiplexing_ = paired_end_inputs_ &&
+                             (!job.input_paths.empty() &&
+                              !job.input_paths.front().second.empty());
     
     // Check for weird fastq special case in some Illumina raw sequencing files
     // follow a misleading structure not containing paired reads in _R1 & _R2
@@ -112,360 +113,544 @@ Extractor::Extractor(ExtractorJob&& job)
         DEBUG_ASSERT_(job.output_paths.size() == queries_.size() + 1,
                       "For each input index, there should be its corresponding output file.");
 
-        for (int i = 1; i < job.output_paths.size(); ++i) {
-            auto file_pair = std::make_pair(SequenceFile::FileWithName(job.output_paths[i].first, flags_, gene::OpenMode::Write),
-                                            SequenceFile::FileWithName(job.output_paths[i].second, flags_, gene::OpenMode::Write));
-
-            demultiplexed_output_files_[queries_[i - 1]] = std::move(file_pair);
+        for (int i = 1; i < job.output_paths.size(); ++i)
+            demultiplexed_output_paths_[queries_[i - 1]] = job.output_paths[i];
+    } else if (!job.output_paths.empty()) {
+        output_file_ = RecordFile::FileWithName(job.output_paths.front().first,
+                                                flags_,
+                                                gene::OpenMode::Write);
+        if (!output_file_) {
+            PrintfLog("Can't create output file\n");
+            throw std::runtime_error("Can't create output file\n");
         }
     }
 }
 
-void Extractor::MultipleOutputFilesExtract_(std::atomic<int64_t>& counter,
-                                            std::atomic<int64_t>& extracted)
+void Extractor::OpenInputs_(const std::vector<std::pair<std::string, std::string>>& input_paths)
 {
-    std::atomic<int64_t> bytes_processed(0);
-    bool enable_error_correction = flags_->SettingExists(Flags::kDemultiplexWithErrorCorrection);
-    
-    // Prepare mutexes for each file
-    for (const auto& query : queries_)
-        write_mutexes_.emplace(query, std::make_unique<std::mutex>());
-    
-    auto extractTask = [this, &counter, &extracted, &bytes_processed, enable_error_correction]
-                       (const int start, const int end)
-    {
-        std::map<std::string, std::vector<std::pair<SequenceRecord, SequenceRecord>>> local_buffer;
+    for (const auto& input_path_pair : input_paths) {
+        auto r1_input_file = RecordFile::FileWithName(input_path_pair.first,
+                                                      flags_,
+                                                      gene::OpenMode::Read);
 
-        for (const auto& query : queries_) {
-            std::vector<std::pair<SequenceRecord, SequenceRecord>> storage_for_key;
-            storage_for_key.reserve(kThreadLocalOutputBufferSize);
-            local_buffer.emplace(query, storage_for_key);
-        }
-        
-        for (int64_t i = start; i < end; ++i) {
-            auto& input_file_pair = input_files_[i];
-            int64_t previous_offset_in_bytes = 0;
+        if (r1_input_file) {
+            if (r1_input_file->fileKind() != gene::FileKind::SingleEnd)
+                paired_end_inputs_ = true;
 
-            int64_t read_iteration = 0;
-            std::pair<SequenceRecord, SequenceRecord> record_pair;
-            while (!(record_pair.first = input_file_pair.first->Read()).Empty()) {
+            std::unique_ptr<RecordFile> r2_input_file = nullptr;
+            if (!input_path_pair.second.empty())
+                r2_input_file = RecordFile::FileWithName(input_path_pair.second,
+                                                         flags_,
+                                                         gene::OpenMode::Read);
 
-                if (input_file_pair.second)
-                    record_pair.second = input_file_pair.second->Read();
+            input_files_.push_back(std::make_pair(std::move(r1_input_file),
+                                                  std::move(r2_input_file)));
 
-                counter++;
-                read_iteration++;
-                
-                // Search
-                for (const auto& q : queries_) {
-                    bool keep_record = false;
-
-                    if (solexa_variant_)
-                        keep_record = record_pair.first.trimBarcodeSingleEnd(q, trim_length_, enable_error_correction);
-                    else if (enable_error_correction)
-                        keep_record = (gene::FuzzySearch::FindByHamming1(record_pair.first.desc, q) != std::string::npos);
-                    else
-                        keep_record = (gene::FuzzySearch::NAwareFind(record_pair.first.desc, q) != std::string::npos);
-                    
-                    if (keep_record) {
-                        extracted++;
-                        
-                        auto& buffer_for_current_query = local_buffer[q];
-                        buffer_for_current_query.emplace_back(std::move(record_pair));
-
-                        if (buffer_for_current_query.size() >= kThreadLocalOutputBufferSize)
-                            FlushThreadLocalBuffer_(q, buffer_for_current_query);
-                    }
-                }
-                
-                if (HasToUpdateProgress_<8192>(read_iteration) && update_progress_callback) {
-                    int64_t current_position;
-                    if (input_file_pair.second)
-                       current_position = input_file_pair.second->position();
-                    else
-                        current_position = input_file_pair.first->position();
-
-                    bytes_processed += current_position - previous_offset_in_bytes;
-                    previous_offset_in_bytes = current_position;
-                    
-                    float currentProgress = bytes_processed/static_cast<float>(total_size_in_bytes_)*100;
-                    bool hasToCancelOperation = update_progress_callback(currentProgress);
-                    if (hasToCancelOperation) {
-                        operation_cancelled_ = true;
-                        i = end; // This will end the outermost loop
-                        break;
-                    }
-                }
-            }
+            if (input_files_.back().second)
+                total_size_in_bytes_ += input_files_.back().second->length();
+            else
+                total_size_in_bytes_ += input_files_.back().first->length();
         }
-        for (auto& storage_with_key : local_buffer) {
-            FlushThreadLocalBuffer_(storage_with_key.first,
-                                    storage_with_key.second);
+    }
+}
+
+bool Extractor::ReadsMateFiles_() const
+{
+    // Plain extraction only ever looks at the first file of a pair
+    return demultiplex_input_ || illumina_r2_barcodes_;
+}
+
+int64_t Extractor::OutputBufferBudgetSize_() const
+{
+    if (flags_->SettingExists(kOutputBufferBudgetFlag))
+        return flags_->GetIntSetting(kOutputBufferBudgetFlag)*1024ll*1024ll;
+
+    return OutputBufferBudget::kDefaultCapacity;
+}
+
+int64_t Extractor::OutputBuffersCount_() const
+{
+    if (demultiplex_input_ || illumina_r2_barcodes_)
+        return queries_.size();
+
+    return 1;
+}
+
+void Extractor::PrepareScan_(OutputBufferBudget *buffer_budget,
+                             AsyncRecordWriter *writer,
+                             OutputFilePool *output_pool)
+{
+    buffer_budget_ = buffer_budget;
+    writer_ = writer;
+    output_pool_ = output_pool;
+
+    for (const auto& query_with_paths : demultiplexed_output_paths_) {
+        demultiplexed_outputs_[query_with_paths.first] = output_pool_->AddTarget(query_with_paths.second,
+                                                                                 flags_);
+    }
+}
+
+void Extractor::PrepareScanBuffers_(ScanBuffers& buffers) const
+{
+    // Buffers grow on demand: with thousands of barcodes most of them stay
+    // small, and the budget decides when they get flushed.
+    if (demultiplex_input_ || illumina_r2_barcodes_) {
+        for (const auto& query : queries_)
+            buffers.record_pairs.emplace(query, RecordArena());
+    }
+}
+
+void Extractor::FlushScanBuffers_(ScanBuffers& buffers)
+{
+    if (demultiplex_input_ || illumina_r2_barcodes_) {
+        for (auto& storage_with_key : buffers.record_pairs) {
+            if (!storage_with_key.second.empty())
+                FlushThreadLocalBuffer_(storage_with_key.first, storage_with_key.second);
         }
-    };
-    LaunchMultithreadedTask(extractTask, static_cast<int>(input_files_.size()));
+    } else if (!buffers.records.empty()) {
+        FlushThreadLocalBuffer_(buffers.records);
+    }
 }
 
-void Extractor::MultipleOutputPairedFilesExtract_(std::atomic<int64_t>& counter,
-                                                  std::atomic<int64_t>& extracted)
+void Extractor::ReleaseScanBuffers_(ScanBuffers& buffers) const
 {
-    std::atomic<int64_t> bytes_processed(0);
-    bool enable_error_correction = flags_->SettingExists(Flags::kDemultiplexWithErrorCorrection);
-    
-    // Prepare mutexes for each file
-    for (const auto& query : queries_)
-        write_mutexes_.emplace(query, std::make_unique<std::mutex>());
+    buffer_budget_->Release(buffers.records.capacity());
+    buffers.records.Release();
+    for (auto& storage_with_key : buffers.record_pairs) {
+        buffer_budget_->Release(storage_with_key.second.capacity());
+        storage_with_key.second.Release();
+    }
+}
+
+void Extractor::BufferRecord_(ScanBuffers& buffers,
+                              RecordArena& pending,
+                              const std::string *key,
+                              const SequenceRecord& record,
+                              const SequenceRecord *mate)
+{
+    buffers.timer->Lap(RunStatistics::Stage::Match);
+    // The budget counts the memory the buffer reserves, not just its records
+    int64_t capacity_before = pending.capacity();
+    pending.Append(record);
+    if (mate)
+        pending.Append(*mate);
+    buffers.timer->Lap(RunStatistics::Stage::Format);
+
+    if (!buffer_budget_->Acquire(pending.capacity() - capacity_before)) {
+        // Over budget: hand off everything this task holds and stall until
+        // the writer catches up, rather than letting the buffers grow further.
+        FlushScanBuffers_(buffers);
+        buffer_budget_->WaitForCapacity();
+        buffers.timer->Lap(RunStatistics::Stage::LockWait);
+    } else if (pending.bytes() >= buffer_budget_->FlushThreshold()) {
+        if (key)
+            FlushThreadLocalBuffer_(*key, pending);
+        else
+            FlushThreadLocalBuffer_(pending);
+        // Handing over takes the locks of the writer's queues
+        buffers.timer->Lap(RunStatistics::Stage::LockWait);
+    }
+}
+
+void Extractor::ConsumeRecordPair_(ScanBuffers& buffers,
+                                   SequenceRecordPair& record_pair,
+                                   bool take_records)
+{
+    buffers.processed++;
+    if (illumina_r2_barcodes_)
+        DemultiplexByR2Barcode_(buffers, record_pair);
+    else if (demultiplex_input_)
+        DemultiplexRecord_(buffers, record_pair, take_records);
+    else
+        ExtractRecord_(buffers, record_pair);
+}
+
+void Extractor::DemultiplexRecord_(ScanBuffers& buffers,
+                                   SequenceRecordPair& input_pair,
+                                   bool take_records)
+{
+    // Solexa trimming modifies the record in place, so work on a copy
+    // if the record is still needed by another job.
+    SequenceRecordPair trimmed_copy;
+    SequenceRecordPair *record_pair = &input_pair;
+    if (solexa_variant_ && !take_records) {
+        trimmed_copy = input_pair;
+        record_pair = &trimmed_copy;
+    }
     
-    std::atomic_bool cancel_everything(false);
-    auto extractTask = [this, &counter, &extracted, &bytes_processed,
-                        &cancel_everything, enable_error_correction]
-                        (const int start, const int end) {
-        std::map<std::string, std::vector<std::pair<SequenceRecord, SequenceRecord>>> local_buffer;
-
-        for (const auto& query : queries_) {
-            std::vector<std::pair<SequenceRecord, SequenceRecord>> storage_for_key;
-            storage_for_key.reserve(kThreadLocalOutputBufferSize);
-            local_buffer.emplace(query, storage_for_key);
-        }
+    // Search
+    for (const auto& q : queries_) {
+        bool keep_record = false;
+
+        if (solexa_variant_)
+            keep_record = record_pair->first.trimBarcodeSingleEnd(q, trim_length_, enable_error_correction_);
+        else if (enable_error_correction_)
+            keep_record = (gene::FuzzySearch::FindByHamming1(record_pair->first.desc, q) != std::string::npos);
+        else
+            keep_record = (gene::FuzzySearch::NAwareFind(record_pair->first.desc, q) != std::string::npos);
         
-        for (int64_t i = start; i < end; ++i) {
-            auto& [r1_input_file, r2_input_file] = input_files_[i];
-            int64_t previous_offset_in_bytes = 0, read_iteration = 0;
-            SequenceRecord barcode_record;
-
-            while (!(barcode_record = r2_input_file->Read()).Empty()) {
-                if (cancel_everything.load())
-                    return;
+        if (keep_record) {
+            buffers.extracted++;
+            
+            BufferRecord_(buffers, buffers.record_pairs[q], &q,
+                          record_pair->first, &record_pair->second);
+            // The record now belongs to the first matching barcode
+            break;
+        }
+    }
+}
 
-                SequenceRecord read_record;
-                read_record = r1_input_file->Read();
+void Extractor::DemultiplexByR2Barcode_(ScanBuffers& buffers,
+                                        const SequenceRecordPair& record_pair)
+{
+    auto& [read_record, barcode_record] = record_pair;
+    if (barcode_record.Empty())
+        return;
+
+    const auto& barcode = barcode_record.seq;
+    // Search
+    for (const auto& q : queries_) {
+        bool keep_record = false;
+        if (enable_error_correction_)
+            keep_record = (gene::FuzzySearch::FindByHamming1(barcode, q) != std::string::npos);
+        else
+            keep_record = (gene::FuzzySearch::NAwareFind(barcode, q) != std::string::npos);
+
+        if (keep_record) {
+            buffers.extracted++;
+            
+            std::string key = q;
+            if (paired_demultiplexing_)
+                assert(false && "not implemented");
+
+            if (read_record.name != barcode_record.name) {
+                PrintfLog("[ERROR] Found a pair of reads that don't correspond to each other:\nR1: %s\nR2: %s\nAborting.",
+                          read_record.name.c_str(),
+                          barcode_record.name.c_str());
+
+                operation_cancelled_ = true;
+                throw std::runtime_error("Found a pair of reads that don't correspond to each other");
+            }
+            BufferRecord_(buffers, buffers.record_pairs[key], &key,
+                          read_record, &barcode_record);
+            break;
+        }
+    }
+}
 
-                counter++;
-                read_iteration++;
-                
-                auto& barcode = barcode_record.seq;
-                // Search
-                for (const auto& q : queries_) {
-                    bool keep_record = false;
-                    if (enable_error_correction)
-                        keep_record = (gene::FuzzySearch::FindByHamming1(barcode, q) != std::string::npos);
-                    else
-                        keep_record = (gene::FuzzySearch::NAwareFind(barcode, q) != std::string::npos);
-
-                    if (keep_record) {
-                        extracted++;
-                        
-                        std::string key = q;
-                        if (paired_demultiplexing_)
-                            assert(false && "not implemented");
-
-                        if (read_record.name != barcode_record.name) {
-                            PrintfLog("[ERROR] Found a pair of reads that don't correspond to each other:\nR1: %s\nR2: %s\nAborting.",
-                                      read_record.name.c_str(),
-                                      barcode_record.name.c_str());
-
-                            operation_cancelled_ = true;
-                            cancel_everything.store(true);
-                            throw std::runtime_error("Found a pair of reads that don't correspond to each other");
-                        }
-                        auto& buffer_for_current_query = local_buffer[key];
-                        if (buffer_for_current_query.size() >= kThreadLocalOutputBufferSize)
-                            FlushThreadLocalBuffer_(key, buffer_for_current_query);
-
-                        buffer_for_current_query.emplace_back(std::make_pair(std::move(read_record),
-                                                                             std::move(barcode_record)));
-                    }
-                }
-                
-                if (HasToUpdateProgress_<8192>(read_iteration) && update_progress_callback) {
-                    int64_t current_position = r2_input_file->position();
-                    bytes_processed += current_position - previous_offset_in_bytes;
-                    previous_offset_in_bytes = current_position;
-                    
-                    float currentProgress = bytes_processed/static_cast<float>(total_size_in_bytes_)*100;
-                    bool hasToCancelOperation = update_progress_callback(currentProgress);
-                    if (hasToCancelOperation) {
-                        operation_cancelled_ = true;
-                        i = end; // This will end the outermost loop
-                        break;
-                    }
-                }
+void Extractor::ExtractRecord_(ScanBuffers& buffers,
+                               const SequenceRecordPair& record_pair)
+{
+    const auto& record = record_pair.first;
+
+    // Search
+    bool found = false;
+    for (const auto& q : queries_) {
+        if (wildcard_search_) {
+            if (search_in_data_ && (gene::WildcardMatcher::Match(q, record.seq) || record.seq.find(q) != std::string::npos))
+                found = true;
+            else {
+                std::string id_line = record.name + ' ' + record.desc;
+                found = (gene::WildcardMatcher::Match(q, id_line) ||
+                         id_line.find(q) != std::string::npos);
             }
+        } else {
+            if (search_in_data_ && record.seq.find(q) != std::string::npos)
+                found = true;
+            else if ((record.name + ' ' + record.desc).find(q) != std::string::npos)
+                found = true;
         }
-        for (auto& storage_with_key : local_buffer)
-            FlushThreadLocalBuffer_(storage_with_key.first, storage_with_key.second);
+        if (found)
+            break;
+    }
+    
+    if (found) {
+        buffers.extracted++;
+        BufferRecord_(buffers, buffers.records, nullptr, record, nullptr);
+    }
+}
+
+const std::vector<std::string>& Extractor::ScanSettings_()
+{
+    static const std::vector<std::string> settings = {
+        Flags::kInputFormat,
+        kPrefetchFlag,
+        kOutputBufferBudgetFlag,
+        kWriterThreadsFlag,
+        kMaxOpenOutputsFlag,
+        kStatsJsonFlag,
+        kTraceJsonFlag,
     };
-    LaunchMultithreadedTask(extractTask, static_cast<int>(input_files_.size()));
+    return settings;
 }
 
-void Extractor::SingleOutputFileExtract_(std::atomic<int64_t>& counter,
-                                         std::atomic<int64_t>& extracted)
+void Extractor::ScanInputs_(const std::vector<Extractor *>& extractors,
+                            const std::function<bool(float)>& progress_callback)
 {
-    std::atomic<int64_t> bytes_processed(0);
-    auto extractTask = [this, &counter, &extracted, &bytes_processed]
-                       (const int start, const int end) {
-        
-        SequenceRecord record;
-        std::vector<SequenceRecord> local_buffer;
-        local_buffer.reserve(kThreadLocalOutputBufferSize);
+    auto& input_files = extractors.front()->input_files_;
+    const int64_t total_size_in_bytes = extractors.front()->total_size_in_bytes_;
+
+    // Every task holds a buffer per output file of each extractor
+    int64_t buffers_count = 0;
+    for (auto extractor : extractors)
+        buffers_count += extractor->OutputBuffersCount_();
+    buffers_count *= TasksCountForFiles(static_cast<int>(input_files.size()));
+
+    OutputBufferBudget buffer_budget(extractors.front()->OutputBufferBudgetSize_(),
+                                     buffers_count);
+
+    const auto& flags = extractors.front()->flags_;
+    std::unique_ptr<RunStatistics> statistics;
+    if (flags->SettingExists(kStatsJsonFlag))
+        statistics = std::make_unique<RunStatistics>(extractors.front()->demultiplex_input_ ? "demultiplex" : "extract");
+    std::unique_ptr<TraceRecorder> trace;
+    if (flags->SettingExists(kTraceJsonFlag))
+        trace = std::make_unique<TraceRecorder>();
+
+    size_t max_open_outputs = OutputFilePool::DefaultCapacity();
+    if (flags->SettingExists(kMaxOpenOutputsFlag))
+        max_open_outputs = flags->GetIntSetting(kMaxOpenOutputsFlag);
+    // Spill buffers of closed outputs get half as much memory as the buffers
+    // of the scanning tasks
+    OutputFilePool output_pool(max_open_outputs, buffer_budget.capacity()/2);
+
+    // Declared after the pool, so that its threads are stopped before the
+    // pool goes away
+    int writer_threads = AsyncRecordWriter::DefaultThreadsCount();
+    if (flags->SettingExists(kWriterThreadsFlag))
+        writer_threads = flags->GetIntSetting(kWriterThreadsFlag);
+    AsyncRecordWriter writer(writer_threads, buffer_budget, statistics.get(), trace.get());
+
+    bool read_mate_files = false;
+    for (auto extractor : extractors) {
+        extractor->PrepareScan_(&buffer_budget, &writer, &output_pool);
+        read_mate_files = read_mate_files || extractor->ReadsMateFiles_();
+    }
+
+    // Tasks count the records of each input file in a slot of its own
+    ProgressSampler sampler(input_files.size(), progress_callback,
+                            [total_size_in_bytes](const ProgressSampler::Totals& totals) {
+        return totals.bytes/static_cast<float>(total_size_in_bytes)*100;
+    }, statistics.get());
+    auto CancelEverything = [&extractors, &sampler]
+    {
+        sampler.Cancel();
+        for (auto extractor : extractors)
+            extractor->operation_cancelled_ = true;
+    };
+
+    auto scanTask = [&](const int start, const int end) {
+        StageTimer timer;
+        if (statistics)
+            timer.statistics = statistics->AddThread("scan " + std::to_string(start));
+        if (trace)
+            timer.trace = trace->AddThread("scan " + std::to_string(start));
+
+        std::vector<ScanBuffers> buffers(extractors.size());
+        for (size_t j = 0; j < extractors.size(); ++j) {
+            extractors[j]->PrepareScanBuffers_(buffers[j]);
+            buffers[j].timer = &timer;
+        }
         
-        bool found = false;
-        for (int64_t i = start; i < end; ++i) {
-            auto& [input_file, r2_input_file] = input_files_[i];
-            int64_t previous_offset_in_bytes = 0;
+        auto TaskMatches = [&buffers] {
+            int64_t matches = 0;
+            for (const auto& extractor_buffers : buffers)
+                matches += extractor_buffers.extracted;
+            return matches;
+        };
+
+        for (int64_t i = start; i < end && !sampler.cancelled(); ++i) {
+            auto& [r1_input_file, r2_input_file] = input_files[i];
+            const bool read_r2 = read_mate_files && r2_input_file;
+            auto& progress_file = read_r2 ? r2_input_file : r1_input_file;
+            auto& progress = sampler.slot(i);
+            const int64_t previous_matches = TaskMatches();
             int64_t read_iteration = 0;
+            auto UpdateProgress = [&] {
+                progress.records.store(read_iteration, std::memory_order_relaxed);
+                progress.bytes.store(progress_file->position(), std::memory_order_relaxed);
+                progress.matches.store(TaskMatches() - previous_matches, std::memory_order_relaxed);
+            };
+
+            SequenceRecordPair record_pair;
+            while (!sampler.cancelled() && !(record_pair.first = r1_input_file->Read()).Empty()) {
+                if (read_r2)
+                    record_pair.second = r2_input_file->Read();
+                timer.Lap(RunStatistics::Stage::Read);
 
-            while (!(record = input_file->Read()).Empty()) {
-                counter++;
                 read_iteration++;
-                
-                if (HasToUpdateProgress_(read_iteration) && update_progress_callback) {
-                    int64_t current_position = input_file->position();
-                    bytes_processed += current_position - previous_offset_in_bytes;
-                    previous_offset_in_bytes = current_position;
-                    
-                    bool hasToCancelOperation = update_progress_callback(bytes_processed/static_cast<float>(total_size_in_bytes_*100.0));
-                    if (hasToCancelOperation) {
-                        operation_cancelled_ = true;
-                        i = end; // This will end the outermost loop.
-                        break;
-                    }
-                }
-                
-                // Search
-                found = false;
-                for (const auto& q : queries_) {
-                    if (wildcard_search_) {
-                        if (search_in_data_ && (gene::WildcardMatcher::Match(q, record.seq) || record.seq.find(q) != std::string::npos))
-                            found = true;
-                        else {
-                            std::string id_line = record.name + ' ' + record.desc;
-                            found = (gene::WildcardMatcher::Match(q, id_line) ||
-                                     id_line.find(q) != std::string::npos);
-                        }
-                    } else {
-                        if (search_in_data_ && record.seq.find(q) != std::string::npos)
-                            found = true;
-                        else if ((record.name + ' ' + record.desc).find(q) != std::string::npos)
-                            found = true;
+                try {
+                    for (size_t j = 0; j < extractors.size(); ++j) {
+                        bool is_last_consumer = (j + 1 == extractors.size());
+                        extractors[j]->ConsumeRecordPair_(buffers[j],
+                                                          record_pair,
+                                                          is_last_consumer);
                     }
-                    if (found)
-                        break;
+                } catch (...) {
+                    CancelEverything();
+                    throw;
                 }
+                timer.Lap(RunStatistics::Stage::Match);
                 
-                if (found) {
-                    extracted++;
-                    if (local_buffer.size() >= kThreadLocalOutputBufferSize)
-                        FlushThreadLocalBuffer_(local_buffer);
-
-                    local_buffer.emplace_back(std::move(record));
-                }
+                if (HasToUpdateProgress_(read_iteration))
+                    UpdateProgress();
             }
+            UpdateProgress();
+            if (timer.statistics)
+                timer.statistics->AddRecords(read_iteration, progress_file->position());
+        }
+        for (size_t j = 0; j < extractors.size(); ++j) {
+            if (!sampler.cancelled())
+                extractors[j]->FlushScanBuffers_(buffers[j]);
+            extractors[j]->ReleaseScanBuffers_(buffers[j]);
+            extractors[j]->processed_ += buffers[j].processed;
+            extractors[j]->extracted_ += buffers[j].extracted;
         }
-        FlushThreadLocalBuffer_(local_buffer);
+        timer.Lap(RunStatistics::Stage::LockWait);
     };
-    LaunchMultithreadedTask(extractTask, static_cast<int>(input_files_.size()));
-}
-
-bool Extractor::Process()
-{
-    if (flags_->verbose) {
-        std::string input_names;
-        for (const auto& inFile : input_files_) {
-            input_names.append(inFile.first->filePath() + '\n');
-            if (inFile.second)
-                input_names.append(inFile.second->filePath() + '\n');
+    LaunchMultithreadedTask(scanTask, static_cast<int>(input_files.size()));
+    sampler.Stop();
+    if (sampler.cancelled())
+        CancelEverything();
+    writer.Finish();
+    output_pool.Finish();
+
+    if (statistics) {
+        auto totals = sampler.totals();
+        statistics->Finish(totals.records, totals.bytes);
+        try {
+            statistics->WriteJson(*flags->GetSetting(kStatsJsonFlag));
+        } catch (const std::runtime_error& e) {
+            // The run itself went fine
+            PrintfLog("%s", e.what());
         }
-        
-        std::string queries_string;
-        for (int i = 0; i < queries_.size(); ++i) {
-            queries_string.append("GF" +
-                                  gene::utils::PaddedToLengthString(i + 1, 4) +
-                                  "\t " +
-                                  queries_[i] +
-                                  '\n');
+    }
+    if (trace) {
+        try {
+            trace->WriteJson(*flags->GetSetting(kTraceJsonFlag));
+        } catch (const std::runtime_error& e) {
+            PrintfLog("%s", e.what());
         }
-        
-        if (demultiplex_input_) {
-            std::string output_names;
-            for (const auto& out_file_pair : demultiplexed_output_files_) {
-                if (out_file_pair.first.empty())
-                    continue;
-
-                output_names.append("->" + out_file_pair.second.first->filePath() + '\n');
-                if (out_file_pair.second.second)
-                    output_names.append("->" + out_file_pair.second.second->filePath() + '\n');
-            }
+    }
 
-            PrintfLog("Demultiplexing \n%s \n%s\n", input_names.c_str(), output_names.c_str());
-        } else {
-            std::string target = "sequences";
-            if (!search_in_data_)
-                target = "IDs";
-
-            PrintfLog("Extracting from\n%s \u2517\u2192 %s(%s)%s \n%s containing:\n%s",
-                       input_names.c_str(),
-                       output_file_->filePath().c_str(),
-                       output_file_->strFileType().c_str(),
-                       search_in_data_ ? " (data search)" : "",
-                       target.c_str(),
-                       queries_string.c_str());
+    if (flags->verbose) {
+        PrintfLog("Peak output buffer usage: %lld MB of %lld MB\n",
+                  buffer_budget.peak_usage()/(1024*1024),
+                  buffer_budget.capacity()/(1024*1024));
+        if (output_pool.evictions_count() != 0) {
+            PrintfLog("Kept at most %zu outputs open (%zu evictions)\n",
+                      output_pool.peak_open_targets(),
+                      output_pool.evictions_count());
         }
     }
-    
-    std::atomic<int64_t> counter(0);
-    std::atomic<int64_t> extracted(0);
+}
 
-    auto start = std::chrono::high_resolution_clock::now();
-    if (illumina_r2_barcodes_)
-        MultipleOutputPairedFilesExtract_(counter, extracted);
-    else if (demultiplex_input_)
-        MultipleOutputFilesExtract_(counter, extracted);
-    else
-        SingleOutputFileExtract_(counter, extracted);
+void Extractor::LogJobDescription_() const
+{
+    std::string input_names;
+    for (const auto& inFile : input_files_) {
+        input_names.append(inFile.first->filePath() + '\n');
+        if (inFile.second)
+            input_names.append(inFile.second->filePath() + '\n');
+    }
+    
+    std::string queries_string;
+    for (int i = 0; i < queries_.size(); ++i) {
+        queries_string.append("GF" +
+                              gene::utils::PaddedToLengthString(i + 1, 4) +
+                              "\t " +
+                              queries_[i] +
+                              '\n');
+    }
+    
+    if (demultiplex_input_) {
+        std::string output_names;
+        for (const auto& out_path_pair : demultiplexed_output_paths_) {
+            if (out_path_pair.first.empty())
+                continue;
+
+            output_names.append("->" + out_path_pair.second.first + '\n');
+            if (!out_path_pair.second.second.empty())
+                output_names.append("->" + out_path_pair.second.second + '\n');
+        }
 
-    auto elapsed = std::chrono::high_resolution_clock::now() - start;
+        PrintfLog("Demultiplexing \n%s \n%s\n", input_names.c_str(), output_names.c_str());
+    } else {
+        std::string target = "sequences";
+        if (!search_in_data_)
+            target = "IDs";
+
+        PrintfLog("Extracting from\n%s \u2517\u2192 %s(%s)%s \n%s containing:\n%s",
+                   input_names.c_str(),
+                   output_file_->filePath().c_str(),
+                   output_file_->strFileType().c_str(),
+                   search_in_data_ ? " (data search)" : "",
+                   target.c_str(),
+                   queries_string.c_str());
+    }
+}
 
-    if (counter == 0) {
+bool Extractor::LogJobResult_(std::chrono::high_resolution_clock::duration elapsed) const
+{
+    if (processed_ == 0) {
         PrintfLog("Input file was either empty, or it had an incorrect format\n");
         return false;
     }
 
     if (flags_->verbose) {
-        PrintfLog("%lld records processed in %lli seconds\n%lld records extracted\n", counter.load(),
-                   std::chrono::duration_cast<std::chrono::seconds>(elapsed).count(), extracted.load());
+        PrintfLog("%lld records processed in %lli seconds\n%lld records extracted\n", processed_.load(),
+                   std::chrono::duration_cast<std::chrono::seconds>(elapsed).count(), extracted_.load());
     }
     return !operation_cancelled_;
 }
 
-void Extractor::FlushThreadLocalBuffer_(std::vector<SequenceRecord>& buffer)
+bool Extractor::Process()
 {
-    std::lock_guard<std::mutex> write_lock(write_mutex_);
-    for (auto& r : buffer)
-        output_file_->Write(r);
+    if (flags_->verbose)
+        LogJobDescription_();
 
-    buffer.clear();
+    auto start = std::chrono::high_resolution_clock::now();
+    ScanInputs_({this}, update_progress_callback);
+    auto elapsed = std::chrono::high_resolution_clock::now() - start;
+
+    return LogJobResult_(elapsed);
 }
 
-void Extractor::FlushThreadLocalBuffer_(const std::string& key, std::vector<Extractor::SequenceRecordPair>& buffer)
+void Extractor::FlushThreadLocalBuffer_(RecordArena& buffer)
 {
-    auto& mutex_for_key = write_mutexes_[key];
-    std::lock_guard<std::mutex> lock(*mutex_for_key);
-    auto& output_files_for_key = demultiplexed_output_files_[key];
-    for (const auto& record_pair : buffer) {
-        output_files_for_key.first->Write(record_pair.first);
-        if (!record_pair.second.Empty())
-            output_files_for_key.second->Write(record_pair.second);
-    }
+    RecordFile *output_file = output_file_.get();
+    writer_->Submit(output_file, buffer, [output_file](const RecordArena& records,
+                                                       AsyncRecordWriter::RecordPair& scratch)
+    {
+        for (size_t i = 0; i < records.size(); ++i) {
+            records.CopyRecord(i, scratch.first);
+            output_file->Write(scratch.first);
+        }
+    });
+}
+
+void Extractor::FlushThreadLocalBuffer_(const std::string& key, RecordArena& buffer)
+{
+    // Lookup only, so this is safe to do from several tasks at once
+    OutputFilePool::Target *target = demultiplexed_outputs_.find(key)->second;
+    OutputFilePool *output_pool = output_pool_;
+    writer_->Submit(target, buffer, [output_pool, target](const RecordArena& records,
+                                                          AsyncRecordWriter::RecordPair& scratch)
+    {
+        output_pool->Write(target, records, scratch);
+    });
+}
 
-    buffer.clear();
+static int TasksCountForFiles(int files_count)
+{
+    const int logical_cores = std::thread::hardware_concurrency();
+    return std::min(logical_cores*4, files_count);
 }
 
 template <typename TaskT>
 static void LaunchMultithreadedTask(TaskT& task, int files_count)
 {
-    const int logical_cores = std::thread::hardware_concurrency();
-    const int number_of_tasks = std::min(logical_cores*4, files_count);
+    const int number_of_tasks = TasksCountForFiles(files_count);
     const int chunk_size = std::max(files_count/number_of_tasks, 1);
     
     std::vector<std::future<void>> tasks;
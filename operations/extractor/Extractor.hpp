@@ -18,14 +18,22 @@
 #define LIBGENE_OPERATIONS_EXTRACTOR_HPP_
 
 #include "ExtractorJob.hpp"
+#include "OutputBufferBudget.hpp"
+#include "RecordArena.hpp"
+#include "AsyncRecordWriter.hpp"
+#include "OutputFilePool.hpp"
+#include "RecordFile.hpp"
+#include "RunStatistics.hpp"
+#include "TraceRecorder.hpp"
 
 #include <map>
 #include <string>
 #include <memory>
-#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <cstdint>
 
-#include <libgene/file/sequence/SequenceFile.hpp>
 #include <libgene/flags/CommandLineFlags.hpp>
 
 class Extractor {
@@ -35,17 +43,37 @@ class Extractor {
     std::function<bool(float)> update_progress_callback;
 
  private:
-    typedef std::unique_ptr<gene::SequenceFile> SequenceFilePtr;
+    friend class ExtractorBatch;
+
+    typedef std::unique_ptr<RecordFile> SequenceFilePtr;
     // '.second' can be nullptr if the input files are not paired
     typedef std::pair<SequenceFilePtr, SequenceFilePtr> SequenceFilePtrsPair;
     typedef gene::SequenceRecord Record;
     typedef std::pair<Record, gene::SequenceRecord> SequenceRecordPair;
 
+    // Output buffers owned by a single scanning task. Paired buffers hold
+    // two consecutive records (the second one may be empty) per entry.
+    struct ScanBuffers {
+        RecordArena records;
+        std::map<std::string, RecordArena> record_pairs;
+        // Added to the extractor's totals once the task is done
+        int64_t processed{0};
+        int64_t extracted{0};
+        // Shared by all buffers of the task
+        StageTimer *timer{nullptr};
+    };
+
+    // Creates an extractor that reads records from the inputs opened by
+    // 'input_owner' instead of opening its own.
+    Extractor(ExtractorJob&& job, const Extractor *input_owner);
+
     std::unique_ptr<gene::CommandLineFlags> flags_;
     std::vector<SequenceFilePtrsPair> input_files_;
 
     SequenceFilePtr output_file_;
-    std::map<std::string, SequenceFilePtrsPair> demultiplexed_output_files_;
+    // Demultiplexed outputs are opened on demand by the scan's file pool
+    std::map<std::string, std::pair<std::string, std::string>> demultiplexed_output_paths_;
+    std::map<std::string, OutputFilePool::Target *> demultiplexed_outputs_;
 
     std::vector<std::string> queries_;
     int64_t total_size_in_bytes_{0};
@@ -54,26 +82,65 @@ class Extractor {
     bool solexa_variant_{false};
     bool demultiplex_input_{false};
     bool wildcard_search_{false};
+    bool paired_end_inputs_{false};
     bool paired_demultiplexing_{false};
     bool illumina_r2_barcodes_{false};
+    bool enable_error_correction_{false};
 
     bool operation_cancelled_{false};
 
+    std::atomic<int64_t> processed_{0};
+    std::atomic<int64_t> extracted_{0};
+
     int trim_length_;
-    std::mutex write_mutex_;
-    std::map<std::string, std::unique_ptr<std::mutex>> write_mutexes_;
-
-    bool Init_();
-    void FlushThreadLocalBuffer_(std::vector<gene::SequenceRecord>& buffer);
-    void FlushThreadLocalBuffer_(const std::string& key,
-                                 std::vector<SequenceRecordPair>& buffer);
-
-    void MultipleOutputFilesExtract_(std::atomic<int64_t>& counter,
-                                     std::atomic<int64_t>& extracted);
-    void MultipleOutputPairedFilesExtract_(std::atomic<int64_t>& counter,
-                                           std::atomic<int64_t>& extracted);
-    void SingleOutputFileExtract_(std::atomic<int64_t>& counter,
-                                  std::atomic<int64_t>& extracted);
+    // Shared by all extractors taking part in a scan
+    OutputBufferBudget *buffer_budget_{nullptr};
+    AsyncRecordWriter *writer_{nullptr};
+    OutputFilePool *output_pool_{nullptr};
+
+    void OpenInputs_(const std::vector<std::pair<std::string, std::string>>& input_paths);
+    bool ReadsMateFiles_() const;
+    void LogJobDescription_() const;
+    bool LogJobResult_(std::chrono::high_resolution_clock::duration elapsed) const;
+
+    // Reads every input of 'extractors.front()' once and passes each record
+    // (or pair of records) through the matchers of all 'extractors'.
+    static void ScanInputs_(const std::vector<Extractor *>& extractors,
+                            const std::function<bool(float)>& progress_callback);
+    // Flags that ScanInputs_ takes from the first extractor only. Jobs may
+    // only share a scan if they agree on all of them.
+    static const std::vector<std::string>& ScanSettings_();
+
+    int64_t OutputBufferBudgetSize_() const;
+    int64_t OutputBuffersCount_() const;
+
+    void PrepareScan_(OutputBufferBudget *buffer_budget, AsyncRecordWriter *writer,
+                      OutputFilePool *output_pool);
+    void PrepareScanBuffers_(ScanBuffers& buffers) const;
+    // 'take_records' is false if other extractors still need the records
+    // unchanged after this one is done with them.
+    void ConsumeRecordPair_(ScanBuffers& buffers, SequenceRecordPair& record_pair,
+                            bool take_records);
+    void FlushScanBuffers_(ScanBuffers& buffers);
+    // Frees the buffers of a task that is done, returning their memory to
+    // the budget. Flushed buffers may still hold memory handed back by the
+    // writer.
+    void ReleaseScanBuffers_(ScanBuffers& buffers) const;
+
+    // 'mate' is only given for paired buffers, and 'key' is their query
+    void BufferRecord_(ScanBuffers& buffers, RecordArena& pending,
+                       const std::string *key, const gene::SequenceRecord& record,
+                       const gene::SequenceRecord *mate);
+
+    // Hand the buffer over to the background writer
+    void FlushThreadLocalBuffer_(RecordArena& buffer);
+    void FlushThreadLocalBuffer_(const std::string& key, RecordArena& buffer);
+
+    void DemultiplexRecord_(ScanBuffers& buffers, SequenceRecordPair& record_pair,
+                            bool take_records);
+    // These two only read the records, so they never need a copy
+    void DemultiplexByR2Barcode_(ScanBuffers& buffers, const SequenceRecordPair& record_pair);
+    void ExtractRecord_(ScanBuffers& buffers, const SequenceRecordPair& record_pair);
 };
 
 #endif  // LIBGENE_OPERATIONS_EXTRACTOR_HPP_
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <map>
+#include <chrono>
+
+#include "ExtractorBatch.hpp"
+#include <libgene/def/Flags.hpp>
+#include <libgene/log/Logger.hpp>
+
+ExtractorBatch::InputSetKey ExtractorBatch::InputSetKeyForJob_(const ExtractorJob& job)
+{
+    // Two jobs may only share a scan if their inputs get parsed the same way
+    // and the scan is set up the same way for both of them. Only settings
+    // that are present are kept, so that a missing flag differs from an empty
+    // one.
+    std::map<std::string, std::string> settings;
+    for (const auto& name : Extractor::ScanSettings_()) {
+        if (auto value = job.flags->GetSetting(name))
+            settings.emplace(name, *value);
+    }
+    return std::make_pair(job.input_paths, settings);
+}
+
+ExtractorBatch::ExtractorBatch(std::vector<ExtractorJob>&& jobs)
+{
+    std::map<InputSetKey, size_t> group_for_input_set;
+    for (auto& job : jobs) {
+        auto [it, new_input_set] = group_for_input_set.emplace(InputSetKeyForJob_(job),
+                                                               groups_.size());
+        if (new_input_set) {
+            groups_.emplace_back();
+            groups_.back().push_back(std::make_unique<Extractor>(std::move(job)));
+        } else {
+            auto& group = groups_[it->second];
+            // Only the first job of a group opens the input files
+            std::unique_ptr<Extractor> extractor(new Extractor(std::move(job),
+                                                               group.front().get()));
+            group.push_back(std::move(extractor));
+        }
+    }
+}
+
+size_t ExtractorBatch::groups_count() const
+{
+    return groups_.size();
+}
+
+bool ExtractorBatch::Process()
+{
+    bool all_succeeded = true;
+    for (size_t i = 0; i < groups_.size() && !operation_cancelled_; ++i) {
+        auto& group = groups_[i];
+        if (group_started_callback)
+            group_started_callback(i);
+
+        std::vector<Extractor *> extractors;
+        for (auto& extractor : group) {
+            if (extractor->flags_->verbose)
+                extractor->LogJobDescription_();
+            extractors.push_back(extractor.get());
+        }
+
+        if (extractors.size() > 1 && group.front()->flags_->verbose)
+            PrintfLog("Scanning the inputs once for %zu jobs\n", extractors.size());
+
+        auto start = std::chrono::high_resolution_clock::now();
+        Extractor::ScanInputs_(extractors, update_progress_callback);
+        auto elapsed = std::chrono::high_resolution_clock::now() - start;
+
+        for (auto& extractor : group) {
+            operation_cancelled_ = operation_cancelled_ || extractor->operation_cancelled_;
+            all_succeeded &= extractor->LogJobResult_(elapsed);
+        }
+        // Close the outputs of the finished jobs right away
+        group.clear();
+    }
+    return all_succeeded && !operation_cancelled_;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBGENE_OPERATIONS_EXTRACTOR_BATCH_HPP_
+#define LIBGENE_OPERATIONS_EXTRACTOR_BATCH_HPP_
+
+#include "Extractor.hpp"
+#include "ExtractorJob.hpp"
+
+#include <map>
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstddef>
+
+// Runs a queue of extractor jobs, reading every distinct set of inputs only
+// once. Jobs that share the same input files and scan settings (input format,
+// buffer budget, writer threads, ...) form a group, and every record of the
+// group's inputs is passed through the matchers of all of its jobs. Each job
+// still writes to its own outputs with its own flags.
+class ExtractorBatch final {
+ public:
+    explicit ExtractorBatch(std::vector<ExtractorJob>&& jobs);
+    bool Process();
+
+    size_t groups_count() const;
+
+    // Progress of the group that is being scanned at the moment
+    std::function<bool(float)> update_progress_callback;
+    // Called with a zero-based index before each group is scanned
+    std::function<void(size_t)> group_started_callback;
+
+ private:
+    // Input paths and the values of Extractor::ScanSettings_() that are set
+    typedef std::pair<std::vector<std::pair<std::string, std::string>>,
+                      std::map<std::string, std::string>> InputSetKey;
+    static InputSetKey InputSetKeyForJob_(const ExtractorJob& job);
+
+    std::vector<std::vector<std::unique_ptr<Extractor>>> groups_;
+    bool operation_cancelled_{false};
+};
+
+#endif  // LIBGENE_OPERATIONS_EXTRACTOR_BATCH_HPP_
@@ -0,0 +1,80 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <chrono>
+
+#include "OutputBufferBudget.hpp"
+
+OutputBufferBudget::OutputBufferBudget(int64_t capacity_in_bytes, int64_t buffers_count)
+: capacity_(std::max<int64_t>(capacity_in_bytes, kMinimumFlushThreshold))
+{
+    // Give every buffer an equal share of the budget
+    base_flush_threshold_ = capacity_/std::max<int64_t>(buffers_count, 1);
+    base_flush_threshold_ = std::min(std::max(base_flush_threshold_, kMinimumFlushThreshold),
+                                     kMaximumFlushThreshold);
+}
+
+bool OutputBufferBudget::Acquire(int64_t bytes)
+{
+    int64_t used = (used_ += bytes);
+    int64_t peak = peak_.load(std::memory_order_relaxed);
+    while (used > peak && !peak_.compare_exchange_weak(peak, used, std::memory_order_relaxed))
+        ;
+    return used <= capacity_;
+}
+
+void OutputBufferBudget::Release(int64_t bytes)
+{
+    used_ -= bytes;
+    if (waiters_.load() > 0) {
+        std::lock_guard<std::mutex> lock(wait_mutex_);
+        capacity_released_.notify_all();
+    }
+}
+
+void OutputBufferBudget::WaitForCapacity(int timeout_ms)
+{
+    waiters_++;
+    {
+        std::unique_lock<std::mutex> lock(wait_mutex_);
+        // The timeout guards against waiting on bytes that are held by tasks
+        // which have nothing more to add, and so won't flush until they finish.
+        capacity_released_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] {
+            return used_.load() <= capacity_;
+        });
+    }
+    waiters_--;
+}
+
+int64_t OutputBufferBudget::FlushThreshold() const
+{
+    int64_t free_bytes = std::max<int64_t>(capacity_ - used_.load(std::memory_order_relaxed), 0);
+    // At 50% usage and above, the threshold drops linearly down to the minimum
+    double free_fraction = std::min(2.0*free_bytes/capacity_, 1.0);
+    auto threshold = static_cast<int64_t>(base_flush_threshold_*free_fraction);
+    return std::max(threshold, kMinimumFlushThreshold);
+}
+
+int64_t OutputBufferBudget::capacity() const
+{
+    return capacity_;
+}
+
+int64_t OutputBufferBudget::peak_usage() const
+{
+    return peak_.load();
+}
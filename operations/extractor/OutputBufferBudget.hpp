@@ -0,0 +1,63 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBGENE_OPERATIONS_OUTPUT_BUFFER_BUDGET_HPP_
+#define LIBGENE_OPERATIONS_OUTPUT_BUFFER_BUDGET_HPP_
+
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <condition_variable>
+
+// Caps the total number of bytes held by all thread-local output buffers of
+// a scan, so that peak memory doesn't depend on the number of tasks and
+// output files.
+class OutputBufferBudget final {
+ public:
+    static constexpr int64_t kDefaultCapacity = 512ll*1024*1024;
+    static constexpr int64_t kMinimumFlushThreshold = 64*1024;
+    static constexpr int64_t kMaximumFlushThreshold = 8*1024*1024;
+
+    OutputBufferBudget(int64_t capacity_in_bytes, int64_t buffers_count);
+
+    // Accounts for 'bytes' more being buffered. Returns false if the budget is
+    // exceeded, in which case the caller has to flush what it holds before
+    // buffering anything else.
+    bool Acquire(int64_t bytes);
+    void Release(int64_t bytes);
+    // Blocks until enough buffered bytes have been released to fit into the
+    // budget again, or for at most 'timeout_ms'.
+    void WaitForCapacity(int timeout_ms = 100);
+
+    // Size at which a single buffer should be flushed. Shrinks as the budget
+    // fills up, so that buffers get written out earlier under pressure.
+    int64_t FlushThreshold() const;
+
+    int64_t capacity() const;
+    int64_t peak_usage() const;
+
+ private:
+    const int64_t capacity_;
+    int64_t base_flush_threshold_;
+    std::atomic<int64_t> used_{0};
+    std::atomic<int64_t> peak_{0};
+
+    std::atomic<int> waiters_{0};
+    std::mutex wait_mutex_;
+    std::condition_variable capacity_released_;
+};
+
+#endif  // LIBGENE_OPERATIONS_OUTPUT_BUFFER_BUDGET_HPP_
@@ -0,0 +1,216 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <sys/resource.h>
+
+#include "OutputFilePool.hpp"
+#include "FileSegments.hpp"
+#include <libgene/log/Logger.hpp>
+
+// Descriptors left for the inputs and everything else the process has open
+constexpr size_t kReservedDescriptors = 64;
+// Enough for every writer thread to hold a target while others get evicted
+constexpr size_t kMinimumCapacity = 8;
+constexpr size_t kMaximumDefaultCapacity = 1024;
+
+OutputFilePool::OutputFilePool(size_t capacity, int64_t spill_capacity_in_bytes)
+: capacity_(std::max(capacity, kMinimumCapacity))
+, spill_capacity_(spill_capacity_in_bytes)
+{
+}
+
+OutputFilePool::~OutputFilePool()
+{
+    try {
+        Finish();
+    } catch (...) {
+        // The error has already been reported by the operation
+    }
+}
+
+size_t OutputFilePool::DefaultCapacity()
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY)
+        return kMaximumDefaultCapacity;
+
+    size_t descriptors = static_cast<size_t>(limit.rlim_cur);
+    if (descriptors <= kReservedDescriptors)
+        return kMinimumCapacity;
+
+    // Each target may keep two files open
+    size_t capacity = (descriptors - kReservedDescriptors)/2;
+    return std::min(std::max(capacity, kMinimumCapacity), kMaximumDefaultCapacity);
+}
+
+OutputFilePool::Target *OutputFilePool::AddTarget(const std::pair<std::string, std::string>& paths,
+                                                  const std::unique_ptr<gene::CommandLineFlags>& flags)
+{
+    auto target = std::make_unique<Target>();
+    target->paths = paths;
+    target->flags = &flags;
+    target->lru_position = lru_.end();
+    targets_.push_back(std::move(target));
+    return targets_.back().get();
+}
+
+void OutputFilePool::Close_(Target *target)
+{
+    // Closing flushes whatever the files still buffer
+    target->first = nullptr;
+    target->second = nullptr;
+    if (target->lru_position != lru_.end()) {
+        lru_.erase(target->lru_position);
+        target->lru_position = lru_.end();
+    }
+    --open_count_;
+}
+
+void OutputFilePool::Open_(Target *target)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (open_count_ >= capacity_ && !lru_.empty()) {
+        Close_(lru_.back());
+        ++evictions_count_;
+    }
+
+    auto paths = target->paths;
+    if (target->ever_opened) {
+        // Reopening with OpenMode::Write would truncate the file, so
+        // continue in a new segment instead.
+        auto index = target->segment_paths.size() + 1;
+        paths.first = SegmentPath(paths.first, index);
+        if (!paths.second.empty())
+            paths.second = SegmentPath(paths.second, index);
+        target->segment_paths.push_back(paths);
+    }
+
+    target->first = RecordFile::FileWithName(paths.first, *target->flags, gene::OpenMode::Write);
+    if (!paths.second.empty())
+        target->second = RecordFile::FileWithName(paths.second, *target->flags, gene::OpenMode::Write);
+
+    if (!target->first) {
+        PrintfLog("Can't create output file %s\n", paths.first.c_str());
+        throw std::runtime_error("Can't create output file\n");
+    }
+    target->ever_opened = true;
+    target->pinned = true;
+    peak_open_count_ = std::max(++open_count_, peak_open_count_);
+}
+
+void OutputFilePool::Unpin_(Target *target)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    target->pinned = false;
+    if (target->first) {
+        lru_.push_front(target);
+        target->lru_position = lru_.begin();
+    }
+}
+
+void OutputFilePool::WriteRecords_(Target *target, const RecordArena& records, RecordPair& scratch)
+{
+    for (size_t i = 0; i + 1 < records.size(); i += 2) {
+        records.CopyRecord(i, scratch.first);
+        records.CopyRecord(i + 1, scratch.second);
+        target->first->Write(scratch.first);
+        if (!scratch.second.Empty() && target->second)
+            target->second->Write(scratch.second);
+    }
+}
+
+void OutputFilePool::Write(Target *target, const RecordArena& records, RecordPair& scratch)
+{
+    bool is_open;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        is_open = (target->first != nullptr);
+        if (is_open) {
+            // Pinned targets can't be evicted while they're being written
+            target->pinned = true;
+            lru_.erase(target->lru_position);
+            target->lru_position = lru_.end();
+        }
+    }
+
+    if (!is_open) {
+        int64_t capacity_before = target->spill.capacity();
+        for (size_t i = 0; i < records.size(); ++i) {
+            records.CopyRecord(i, scratch.first);
+            target->spill.Append(scratch.first);
+        }
+        int64_t spilled = (spill_bytes_ += target->spill.capacity() - capacity_before);
+        if (target->spill.bytes() < kSpillFlushThreshold && spilled <= spill_capacity_)
+            return;
+
+        Open_(target);
+        WriteRecords_(target, target->spill, scratch);
+        spill_bytes_ -= target->spill.capacity();
+        target->spill.Release();
+    } else {
+        WriteRecords_(target, records, scratch);
+    }
+    Unpin_(target);
+}
+
+void OutputFilePool::Finish()
+{
+    if (finished_)
+        return;
+    finished_ = true;
+
+    RecordPair scratch;
+    for (auto& target : targets_) {
+        // Targets that got no records still produce (empty) output files
+        if (!target->spill.empty() || !target->ever_opened) {
+            if (!target->first)
+                Open_(target.get());
+            WriteRecords_(target.get(), target->spill, scratch);
+            spill_bytes_ -= target->spill.capacity();
+            target->spill.Release();
+            Unpin_(target.get());
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& target : targets_) {
+            if (target->first)
+                Close_(target.get());
+        }
+    }
+
+    for (auto& target : targets_) {
+        for (const auto& segment : target->segment_paths) {
+            AppendSegment(target->paths.first, segment.first);
+            if (!segment.second.empty())
+                AppendSegment(target->paths.second, segment.second);
+        }
+    }
+}
+
+size_t OutputFilePool::peak_open_targets() const
+{
+    return peak_open_count_;
+}
+
+size_t OutputFilePool::evictions_count() const
+{
+    return evictions_count_;
+}
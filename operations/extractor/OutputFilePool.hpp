@@ -0,0 +1,103 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBGENE_OPERATIONS_OUTPUT_FILE_POOL_HPP_
+#define LIBGENE_OPERATIONS_OUTPUT_FILE_POOL_HPP_
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "RecordArena.hpp"
+#include "RecordFile.hpp"
+
+#include <libgene/flags/CommandLineFlags.hpp>
+
+// Keeps at most 'capacity' demultiplexing targets (pairs of output files)
+// open at the same time.
+//
+// Records for a target without open files are collected in its in-memory
+// spill buffer. Only when that buffer grows large, or all spill buffers
+// together exceed their budget, does the target get files, evicting the
+// least recently used open target. A target that gets opened again writes
+// into a new segment file; segments are appended to the target's output
+// files in Finish().
+class OutputFilePool final {
+ public:
+    typedef std::pair<gene::SequenceRecord, gene::SequenceRecord> RecordPair;
+
+    struct Target {
+        std::pair<std::string, std::string> paths;
+        const std::unique_ptr<gene::CommandLineFlags> *flags;
+
+        std::unique_ptr<RecordFile> first;
+        std::unique_ptr<RecordFile> second;
+        std::vector<std::pair<std::string, std::string>> segment_paths;
+        bool ever_opened{false};
+
+        RecordArena spill;
+        bool pinned{false};
+        std::list<Target *>::iterator lru_position;
+    };
+
+    static constexpr int64_t kSpillFlushThreshold = 1024*1024;
+
+    OutputFilePool(size_t capacity, int64_t spill_capacity_in_bytes);
+    ~OutputFilePool();
+
+    // Number of targets that can be open at once without running out of
+    // file descriptors
+    static size_t DefaultCapacity();
+
+    Target *AddTarget(const std::pair<std::string, std::string>& paths,
+                      const std::unique_ptr<gene::CommandLineFlags>& flags);
+
+    // Writes pairs of records (two consecutive records of 'records' each,
+    // the second of which may be empty) to 'target'. Calls for the same
+    // target must not run concurrently.
+    void Write(Target *target, const RecordArena& records, RecordPair& scratch);
+
+    // Writes out all spill buffers, closes every file and joins the segments
+    void Finish();
+
+    size_t peak_open_targets() const;
+    size_t evictions_count() const;
+
+ private:
+    void Open_(Target *target);
+    void Close_(Target *target);
+    void Unpin_(Target *target);
+    void WriteRecords_(Target *target, const RecordArena& records, RecordPair& scratch);
+
+    const size_t capacity_;
+    const int64_t spill_capacity_;
+
+    std::vector<std::unique_ptr<Target>> targets_;
+    std::mutex mutex_;
+    // Open and unpinned targets, most recently used first
+    std::list<Target *> lru_;
+    size_t open_count_{0};
+    size_t peak_open_count_{0};
+    size_t evictions_count_{0};
+    std::atomic<int64_t> spill_bytes_{0};
+    bool finished_{false};
+};
+
+#endif  // LIBGENE_OPERATIONS_OUTPUT_FILE_POOL_HPP_
@@ -0,0 +1,123 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "RecordArena.hpp"
+
+RecordArena::RecordArena(size_t chunk_size)
+: chunk_size_(chunk_size)
+{
+}
+
+char *RecordArena::Allocate_(size_t bytes)
+{
+    while (current_chunk_ < chunks_.size()) {
+        auto& chunk = chunks_[current_chunk_];
+        if (chunk.size - chunk_offset_ >= bytes) {
+            char *memory = chunk.data.get() + chunk_offset_;
+            chunk_offset_ += bytes;
+            return memory;
+        }
+        ++current_chunk_;
+        chunk_offset_ = 0;
+    }
+
+    // Every new chunk doubles the capacity, up to the chunk size. Records
+    // longer than that get a chunk of their own.
+    size_t size = std::min(std::max(static_cast<size_t>(chunk_bytes_), kInitialChunkSize),
+                           chunk_size_);
+    size = std::max(bytes, size);
+    chunks_.push_back({std::unique_ptr<char[]>(new char[size]), size});
+    chunk_bytes_ += size;
+    current_chunk_ = chunks_.size() - 1;
+    chunk_offset_ = bytes;
+    return chunks_.back().data.get();
+}
+
+void RecordArena::Append(const gene::SequenceRecord& record)
+{
+    Slot slot;
+    slot.name_length = static_cast<uint32_t>(record.name.size());
+    slot.desc_length = static_cast<uint32_t>(record.desc.size());
+    slot.seq_length = static_cast<uint32_t>(record.seq.size());
+    slot.quality_length = static_cast<uint32_t>(record.quality.size());
+
+    size_t length = record.name.size() + record.desc.size() +
+                    record.seq.size() + record.quality.size();
+    slot.data = nullptr;
+    if (length != 0) {
+        char *data = Allocate_(length);
+        slot.data = data;
+        for (const auto *field : {&record.name, &record.desc, &record.seq, &record.quality}) {
+            std::memcpy(data, field->data(), field->size());
+            data += field->size();
+        }
+    }
+    slots_.push_back(slot);
+    bytes_ += length + sizeof(Slot);
+}
+
+void RecordArena::CopyRecord(size_t index, gene::SequenceRecord& record) const
+{
+    const Slot& slot = slots_[index];
+    const char *data = slot.data;
+
+    record.name.assign(data, slot.name_length);
+    data += slot.name_length;
+    record.desc.assign(data, slot.desc_length);
+    data += slot.desc_length;
+    record.seq.assign(data, slot.seq_length);
+    data += slot.seq_length;
+    record.quality.assign(data, slot.quality_length);
+}
+
+size_t RecordArena::size() const
+{
+    return slots_.size();
+}
+
+bool RecordArena::empty() const
+{
+    return slots_.empty();
+}
+
+int64_t RecordArena::bytes() const
+{
+    return bytes_;
+}
+
+int64_t RecordArena::capacity() const
+{
+    return chunk_bytes_ + static_cast<int64_t>(slots_.capacity()*sizeof(Slot));
+}
+
+void RecordArena::Reset()
+{
+    slots_.clear();
+    current_chunk_ = 0;
+    chunk_offset_ = 0;
+    bytes_ = 0;
+}
+
+void RecordArena::Release()
+{
+    Reset();
+    chunks_.clear();
+    chunk_bytes_ = 0;
+    slots_.shrink_to_fit();
+}
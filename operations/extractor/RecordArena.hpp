@@ -0,0 +1,82 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBGENE_OPERATIONS_RECORD_ARENA_HPP_
+#define LIBGENE_OPERATIONS_RECORD_ARENA_HPP_
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+#include <libgene/file/sequence/SequenceRecord.hpp>
+
+// Append-only storage for records waiting to be written. The fields of each
+// record are copied back to back into large chunks of memory, so buffering a
+// record rarely allocates, and Reset() makes the chunks reusable for the next
+// batch without giving them back to the allocator.
+//
+// Chunks start small and double up to the chunk size, so that an arena
+// holding a few records doesn't reserve a whole chunk for them.
+class RecordArena final {
+ public:
+    static constexpr size_t kDefaultChunkSize = 64*1024;
+    static constexpr size_t kInitialChunkSize = 1024;
+
+    explicit RecordArena(size_t chunk_size = kDefaultChunkSize);
+
+    void Append(const gene::SequenceRecord& record);
+    // Copies the record at 'index' into 'record', reusing its storage
+    void CopyRecord(size_t index, gene::SequenceRecord& record) const;
+
+    size_t size() const;
+    bool empty() const;
+    // Memory taken by the records appended since the last reset
+    int64_t bytes() const;
+    // Memory reserved by the arena, used or not. This is what memory budgets
+    // have to account for.
+    int64_t capacity() const;
+
+    // Forgets all records, but keeps the memory for reuse
+    void Reset();
+    // Forgets all records and frees all memory
+    void Release();
+
+ private:
+    struct Chunk {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+    struct Slot {
+        const char *data;
+        uint32_t name_length;
+        uint32_t desc_length;
+        uint32_t seq_length;
+        uint32_t quality_length;
+    };
+
+    char *Allocate_(size_t bytes);
+
+    size_t chunk_size_;
+    std::vector<Chunk> chunks_;
+    size_t current_chunk_{0};
+    size_t chunk_offset_{0};
+    std::vector<Slot> slots_;
+    int64_t bytes_{0};
+    int64_t chunk_bytes_{0};
+};
+
+#endif  // LIBGENE_OPERATIONS_RECORD_ARENA_HPP_
@@ -0,0 +1,122 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+#include <zlib.h>
+
+#include "AlignmentHeader.hpp"
+#include <libgene/log/Logger.hpp>
+
+namespace {
+
+struct GzFileCloser {
+    void operator()(gzFile_s *file) const { gzclose(file); }
+};
+typedef std::unique_ptr<gzFile_s, GzFileCloser> GzFile;
+
+void ReadExactly(const GzFile& file, void *data, size_t size, const std::string& path)
+{
+    if (size != 0 && gzread(file.get(), data, static_cast<unsigned>(size)) != static_cast<int>(size)) {
+        PrintfLog("Header of %s is truncated\n", path.c_str());
+        throw std::runtime_error("Can't read alignment header\n");
+    }
+}
+
+int32_t ReadInt32(const GzFile& file, const std::string& path)
+{
+    // BAM numbers are little-endian, like every platform this runs on
+    int32_t value;
+    ReadExactly(file, &value, sizeof(value), path);
+    return value;
+}
+
+// The reference list after the header text
+std::vector<std::string> ReadBamReferenceNames(const GzFile& file, const std::string& path)
+{
+    int32_t text_length = ReadInt32(file, path);
+    if (text_length < 0 || gzseek(file.get(), text_length, SEEK_CUR) < 0) {
+        PrintfLog("Header of %s is damaged\n", path.c_str());
+        throw std::runtime_error("Can't read alignment header\n");
+    }
+
+    std::vector<std::string> names;
+    int32_t references_count = ReadInt32(file, path);
+    for (int32_t i = 0; i < references_count; ++i) {
+        int32_t name_length = ReadInt32(file, path);
+        if (name_length <= 0) {
+            PrintfLog("Header of %s is damaged\n", path.c_str());
+            throw std::runtime_error("Can't read alignment header\n");
+        }
+        std::string name(static_cast<size_t>(name_length), '\0');
+        ReadExactly(file, &name[0], name.size(), path);
+        // Stored with its terminating NUL, and followed by the length
+        name.pop_back();
+        ReadInt32(file, path);
+        names.push_back(std::move(name));
+    }
+    return names;
+}
+
+// SN fields of the @SQ lines at the top of the file
+std::vector<std::string> ReadSamReferenceNames(const GzFile& file)
+{
+    std::vector<std::string> names;
+    std::string line;
+    char buffer[4096];
+    while (gzgets(file.get(), buffer, sizeof(buffer))) {
+        line += buffer;
+        if (line.back() != '\n' && !gzeof(file.get()))
+            continue;
+        if (line[0] != '@')
+            break;
+
+        while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+            line.pop_back();
+        if (line.compare(0, 4, "@SQ\t") == 0) {
+            auto name = line.find("\tSN:");
+            if (name != std::string::npos) {
+                name += 4;
+                names.push_back(line.substr(name, line.find('\t', name) - name));
+            }
+        }
+        line.clear();
+    }
+    return names;
+}
+
+}  // namespace
+
+std::vector<std::string> ReadReferenceNames(const std::string& path)
+{
+    // Reads SAM as it is, and BAM through its gzip-compatible blocks
+    GzFile file(gzopen(path.c_str(), "rb"));
+    if (!file) {
+        PrintfLog("Can't open %s\n", path.c_str());
+        throw std::runtime_error("Can't read alignment header\n");
+    }
+
+    char magic[4];
+    int magic_size = gzread(file.get(), magic, sizeof(magic));
+    if (magic_size == sizeof(magic) && std::memcmp(magic, "BAM\1", sizeof(magic)) == 0)
+        return ReadBamReferenceNames(file, path);
+
+    gzrewind(file.get());
+    return ReadSamReferenceNames(file);
+}
@@ -0,0 +1,30 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef LIBGENE_OPERATIONS_ALIGNMENT_HEADER_HPP_
+#define LIBGENE_OPERATIONS_ALIGNMENT_HEADER_HPP_
+
+#include <string>
+#include <vector>
+
+// Names of the reference sequences of a SAM or BAM file, in the order of the
+// @SQ lines of its header, the order coordinate-sorted files follow. Empty
+// if the header names none. Throws std::runtime_error if the file can't be
+// read.
+std::vector<std::string> ReadReferenceNames(const std::string& path);
+
+#endif  // LIBGENE_OPERATIONS_ALIGNMENT_HEADER_HPP_
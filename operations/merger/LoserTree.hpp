@@ -0,0 +1,101 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef LIBGENE_OPERATIONS_LOSER_TREE_HPP_
+#define LIBGENE_OPERATIONS_LOSER_TREE_HPP_
+
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include <algorithm>
+
+// Tournament tree over the heads of k sorted sources. Every inner node keeps
+// the source that lost the match played there, so replacing the head of
+// the winner takes one comparison per level of the tree, log2(k) in total.
+//
+// 'Less' compares the current heads of two sources by their indices. Ties
+// go to the source with the lower index, which keeps merges stable.
+template <typename Less>
+class LoserTree final {
+ public:
+    LoserTree(size_t sources_count, Less less)
+    : less_(std::move(less)), tree_(std::max<size_t>(sources_count, 1)),
+      exhausted_(sources_count, false), k_(sources_count)
+    {
+    }
+
+    // Call before Build() for sources that have no records at all
+    void SetExhausted(size_t source) { exhausted_[source] = true; }
+
+    void Build()
+    {
+        if (k_ > 1)
+            tree_[0] = Build_(1);
+        else
+            tree_[0] = 0;
+    }
+
+    bool Empty() const { return k_ == 0 || exhausted_[tree_[0]]; }
+    // The source with the smallest head
+    size_t Top() const { return tree_[0]; }
+
+    // Call once the head of Top() has been replaced, or with 'exhausted'
+    // set if that source has run out of records
+    void Replay(bool exhausted)
+    {
+        size_t winner = tree_[0];
+        exhausted_[winner] = exhausted;
+        for (size_t node = (winner + k_)/2; node > 0; node /= 2) {
+            if (Beats_(tree_[node], winner))
+                std::swap(tree_[node], winner);
+        }
+        tree_[0] = winner;
+    }
+
+ private:
+    Less less_;
+    // tree_[0] is the overall winner, tree_[1, k) the losers of every match.
+    // Source i is the leaf k + i.
+    std::vector<size_t> tree_;
+    std::vector<bool> exhausted_;
+    size_t k_;
+
+    bool Beats_(size_t a, size_t b) const
+    {
+        if (exhausted_[a] || exhausted_[b])
+            return !exhausted_[a] && (exhausted_[b] || a < b);
+        if (less_(a, b))
+            return true;
+        return !less_(b, a) && a < b;
+    }
+
+    size_t Build_(size_t node)
+    {
+        if (node >= k_)
+            return node - k_;
+        size_t left = Build_(2*node);
+        size_t right = Build_(2*node + 1);
+        if (Beats_(left, right)) {
+            tree_[node] = right;
+            return left;
+        }
+        tree_[node] = left;
+        return right;
+    }
+};
+
+#endif  // LIBGENE_OPERATIONS_LOSER_TREE_HPP_
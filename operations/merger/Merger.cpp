@@ -14,12 +14,34 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <chrono>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <thread>
 #include <type_traits>
 
 #include "Merger.hpp"
+#include "AlignmentHeader.hpp"
+#include "FastaStream.hpp"
+#include "LoserTree.hpp"
+#include "PrefetchingRecordFile.hpp"
 #include <libgene/log/Logger.hpp>
+#include <libgene/def/FileType.hpp>
+#include <libgene/file/alignment/AlignmentFile.hpp>
+#include <libgene/file/alignment/sam/SamRecord.hpp>
 #include <libgene/file/sequence/SequenceFile.hpp>
+#include <libgene/utils/StringUtils.hpp>
+
+// Copy FASTA records in pieces instead of reading each one whole
+static const std::string kStreamFastaFlag = "stream-fasta";
+// Number of inputs decoded at the same time, all logical cores by default
+static const std::string kDecodeThreadsFlag = "decode-threads";
+// Merge inputs sorted by "name" or by "coordinate" into a sorted output
+static const std::string kSortedMergeFlag = "sorted-merge";
+// Path of a JSON file to write the statistics of the run to
+static const std::string kStatsJsonFlag = "stats-json";
 
 template <int ThrottleCount = 1024>
 bool HasToUpdateProgress_(int64_t count)
@@ -40,7 +62,7 @@ Merger::Merger(std::vector<std::string> input_paths,
 bool Merger::Init_()
 {
     for (const auto& path : inputFilePaths) {
-        auto in_file = gene::SequenceFile::FileWithName(path, flags_, gene::OpenMode::Read);
+        auto in_file = RecordFile::FileWithName(path, flags_, gene::OpenMode::Read);
         if (!in_file) {
             PrintfLog("Can't open input file %s\n", path.c_str());
             break;
@@ -52,16 +74,413 @@ bool Merger::Init_()
         total_size_in_bytes_ += in_file->length();
         inputFiles.push_back(std::move(in_file));
     }
+
+    // Inputs after the current one get decoded on background threads, and
+    // are still written out one after another in their original order
+    if (inputFiles.size() > 1 && DecodeAheadCount_() > 1) {
+        for (auto& in_file : inputFiles) {
+            if (!dynamic_cast<PrefetchingRecordFile *>(in_file.get()))
+                in_file = std::make_unique<PrefetchingRecordFile>(std::move(in_file), 0);
+        }
+    }
     
-    if (!(outFile = gene::SequenceFile::FileWithName(outputPath, flags_, gene::OpenMode::Write))) {
+    if (!(outFile = RecordFile::FileWithName(outputPath, flags_, gene::OpenMode::Write))) {
         PrintfLog("Can't create output file\n");
         return false;
     }
     return true;
 }
 
+void Merger::StartStatistics_()
+{
+    if (!flags_->SettingExists(kStatsJsonFlag))
+        return;
+    statistics_ = std::make_unique<RunStatistics>("merge");
+    timer_.statistics = statistics_->AddThread("merge");
+    timer_.Restart();
+}
+
+void Merger::FinishStatistics_(int64_t records)
+{
+    if (!statistics_)
+        return;
+    timer_.statistics->AddRecords(records, total_size_in_bytes_);
+    statistics_->Finish(records, total_size_in_bytes_);
+    try {
+        statistics_->WriteJson(*flags_->GetSetting(kStatsJsonFlag));
+    } catch (const std::runtime_error& e) {
+        // The merge itself went fine
+        PrintfLog("%s", e.what());
+    }
+}
+
+size_t Merger::DecodeAheadCount_() const
+{
+    int threads = static_cast<int>(std::thread::hardware_concurrency());
+    if (flags_->SettingExists(kDecodeThreadsFlag))
+        threads = flags_->GetIntSetting(kDecodeThreadsFlag);
+    return static_cast<size_t>(std::max(threads, 1));
+}
+
+bool Merger::StreamsFasta_() const
+{
+    if (!flags_->SettingExists(kStreamFastaFlag) || !FastaStreamReader::IsPlainFasta(outputPath))
+        return false;
+    for (const auto& path : inputFilePaths) {
+        if (!FastaStreamReader::IsPlainFasta(path))
+            return false;
+    }
+    return true;
+}
+
+bool Merger::ProcessFastaStream_()
+{
+    std::vector<std::unique_ptr<FastaStreamReader>> readers;
+    for (const auto& path : inputFilePaths) {
+        auto reader = std::make_unique<FastaStreamReader>(path);
+        if (!reader->is_open()) {
+            PrintfLog("Can't open input file %s\n", path.c_str());
+            return false;
+        }
+        total_size_in_bytes_ += reader->length();
+        readers.push_back(std::move(reader));
+    }
+
+    if (flags_->verbose)
+        PrintfLog("Streaming FASTA records into ->%s\n", outputPath.c_str());
+
+    auto start = std::chrono::high_resolution_clock::now();
+    StartStatistics_();
+    int64_t counter = 0;
+    int64_t bytes_processed = 0;
+    // Created with the first record, so that inputs without any leave no
+    // output behind
+    std::unique_ptr<FastaStreamWriter> writer;
+    std::string header;
+
+    for (size_t i = 0; i < readers.size(); ++i) {
+        if (flags_->verbose)
+            PrintfLog("Merging in <-%s(fasta)\n", inputFilePaths[i].c_str());
+
+        while (readers[i]->NextRecord(header)) {
+            timer_.Lap(RunStatistics::Stage::Read);
+            if (!writer) {
+                writer = std::make_unique<FastaStreamWriter>(outputPath);
+                if (!writer->is_open()) {
+                    PrintfLog("Can't create output file\n");
+                    return false;
+                }
+            }
+            // Every record keeps the line width it had
+            writer->BeginRecord(header, readers[i]->line_width());
+            // The sequence is read and written in the same pass
+            readers[i]->CopySequenceTo(*writer);
+            timer_.Lap(RunStatistics::Stage::Write);
+            ++counter;
+
+            if (HasToUpdateProgress_<64>(counter) && statistics_)
+                statistics_->AddSample(counter, readers[i]->position() + bytes_processed);
+            if (HasToUpdateProgress_<64>(counter) && update_progress_callback) {
+                bool hasToCancelOperation = update_progress_callback((readers[i]->position() + bytes_processed)/static_cast<float>(total_size_in_bytes_)*100);
+
+                if (hasToCancelOperation)
+                    return true;
+            }
+        }
+        bytes_processed += readers[i]->length();
+    }
+
+    if (counter == 0) {
+        PrintfLog("Input file was either empty, or it had an incorrect format\n");
+        return false;
+    }
+    writer->Close();
+    timer_.Lap(RunStatistics::Stage::Write);
+    FinishStatistics_(counter);
+    auto secondsElapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start);
+
+    if (flags_->verbose)
+        PrintfLog("%lld records processed in %.2f seconds\n", counter, secondsElapsed.count());
+
+    return true;
+}
+
+namespace {
+
+// Sorted input with the record at its head
+template <typename Record>
+struct SortedInput {
+    std::string path;
+    int64_t length{0};
+    // Returns false once the input has no more records
+    std::function<bool(Record&)> read;
+    std::function<int64_t()> position;
+
+    Record head;
+    // Order of the reference sequence of 'head', for coordinate merges
+    size_t reference_rank{0};
+};
+
+bool IsAlignmentPath(const std::string& path)
+{
+    auto type = gene::utils::str2type(gene::utils::GetExtension(path));
+    return type == gene::FileType::Sam || type == gene::FileType::Bam;
+}
+
+}  // namespace
+
+// Writes the records of 'inputs' in the order given by 'less', which
+// compares two inputs by their heads. 'on_read' sees every new head before
+// it gets compared. 'timer' and 'statistics' may be left empty. Returns
+// false if the operation got cancelled.
+template <typename Record, typename Less, typename Write, typename OnRead>
+static bool MergeSortedInputs(std::vector<SortedInput<Record>>& inputs, Less less, Write write,
+                              OnRead on_read, const std::function<bool(float)>& progress_callback,
+                              int64_t total_size_in_bytes, int64_t& counter,
+                              StageTimer& timer, RunStatistics *statistics)
+{
+    auto less_heads = [&inputs, &less](size_t a, size_t b) { return less(inputs[a], inputs[b]); };
+    LoserTree<decltype(less_heads)> tree(inputs.size(), less_heads);
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        if (inputs[i].read(inputs[i].head))
+            on_read(inputs[i]);
+        else
+            tree.SetExhausted(i);
+    }
+    tree.Build();
+    timer.Lap(RunStatistics::Stage::Read);
+
+    // The record written last, to check that every input is sorted
+    SortedInput<Record> previous;
+    while (!tree.Empty()) {
+        auto& input = inputs[tree.Top()];
+        write(input.head);
+        timer.Lap(RunStatistics::Stage::Write);
+        ++counter;
+
+        std::swap(previous.head, input.head);
+        previous.reference_rank = input.reference_rank;
+        bool exhausted = !input.read(input.head);
+        if (!exhausted) {
+            on_read(input);
+            if (less(input, previous)) {
+                PrintfLog("Input %s isn't sorted\n", input.path.c_str());
+                throw std::runtime_error("Unsorted input\n");
+            }
+        }
+        tree.Replay(exhausted);
+        timer.Lap(RunStatistics::Stage::Read);
+
+        if (HasToUpdateProgress_(counter) && (progress_callback || statistics)) {
+            int64_t bytes_processed = 0;
+            for (const auto& in : inputs)
+                bytes_processed += in.position();
+            if (statistics)
+                statistics->AddSample(counter, bytes_processed);
+            if (progress_callback &&
+                progress_callback(bytes_processed/static_cast<float>(total_size_in_bytes)*100))
+                return false;
+        }
+    }
+    return true;
+}
+
+bool Merger::ProcessSortedMerge_()
+{
+    const std::string order = *flags_->GetSetting(kSortedMergeFlag);
+    if (order != "name" && order != "coordinate") {
+        PrintfLog("Unknown sort order '%s', expected 'name' or 'coordinate'\n", order.c_str());
+        return false;
+    }
+
+    bool alignment_inputs = std::all_of(inputFilePaths.begin(), inputFilePaths.end(),
+                                        IsAlignmentPath);
+    bool alignment_output = IsAlignmentPath(outputPath);
+    if (order == "coordinate" && !(alignment_inputs && alignment_output)) {
+        PrintfLog("Coordinate-sorted merges need SAM or BAM inputs and output\n");
+        return false;
+    }
+
+    if (flags_->verbose) {
+        PrintfLog("Merging %zu %s-sorted inputs into ->%s\n", inputFilePaths.size(),
+                  order.c_str(), outputPath.c_str());
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    StartStatistics_();
+    int64_t counter = 0;
+    bool completed = true;
+
+    std::vector<std::unique_ptr<gene::AlignmentFile>> alignment_files;
+    auto open_alignment_file = [this, &alignment_files](const std::string& path) {
+        auto file = gene::AlignmentFile::FileWithName(path, flags_, gene::OpenMode::Read);
+        if (!file || !file->isValidAlignmentFile()) {
+            PrintfLog("Can't open input file %s\n", path.c_str());
+            return static_cast<gene::AlignmentFile *>(nullptr);
+        }
+        total_size_in_bytes_ += file->length();
+        alignment_files.push_back(std::move(file));
+        return alignment_files.back().get();
+    };
+
+    try {
+        if (alignment_inputs && alignment_output) {
+            // Alignments are merged as they are, so nothing but the order changes
+            typedef SortedInput<gene::SamRecord> Input;
+
+            // Coordinate-sorted files follow the order of the @SQ lines of
+            // their headers, which all the inputs have to share. Inputs
+            // naming no references can only hold unmapped reads.
+            std::map<std::string, size_t> reference_ranks;
+            if (order == "coordinate") {
+                std::vector<std::string> references;
+                for (const auto& path : inputFilePaths) {
+                    auto names = ReadReferenceNames(path);
+                    if (names.empty())
+                        continue;
+                    if (references.empty()) {
+                        references = std::move(names);
+                    } else if (names != references) {
+                        PrintfLog("Input %s names different references, or names them in a different "
+                                  "order than the other inputs\n", path.c_str());
+                        return false;
+                    }
+                }
+                for (size_t i = 0; i < references.size(); ++i)
+                    reference_ranks.emplace(references[i], i);
+            }
+
+            std::vector<Input> inputs;
+            for (const auto& path : inputFilePaths) {
+                auto file = open_alignment_file(path);
+                if (!file)
+                    return false;
+                Input input;
+                input.path = path;
+                input.read = [file](gene::SamRecord& record) {
+                    return !(record = file->read()).SEQ.empty();
+                };
+                input.position = [file] { return file->position(); };
+                inputs.push_back(std::move(input));
+            }
+
+            auto output = gene::AlignmentFile::FileWithName(outputPath, flags_, gene::OpenMode::Write);
+            if (!output) {
+                PrintfLog("Can't create output file\n");
+                return false;
+            }
+            auto write = [&output](const gene::SamRecord& record) { output->write(record); };
+
+            if (order == "name") {
+                auto less = [](const Input& x, const Input& y) {
+                    return x.head.QNAME < y.head.QNAME;
+                };
+                completed = MergeSortedInputs(inputs, less, write, [](Input&) {},
+                                              update_progress_callback, total_size_in_bytes_,
+                                              counter, timer_, statistics_.get());
+            } else {
+                auto on_read = [&reference_ranks](Input& input) {
+                    const auto& reference = input.head.RNAME;
+                    if (reference == "*") {
+                        // Unmapped reads go last
+                        input.reference_rank = std::numeric_limits<size_t>::max();
+                        return;
+                    }
+                    auto rank = reference_ranks.find(reference);
+                    if (rank == reference_ranks.end()) {
+                        PrintfLog("Reference %s of input %s isn't named in the header\n",
+                                  reference.c_str(), input.path.c_str());
+                        throw std::runtime_error("Unknown reference\n");
+                    }
+                    input.reference_rank = rank->second;
+                };
+                auto less = [](const Input& x, const Input& y) {
+                    if (x.reference_rank != y.reference_rank)
+                        return x.reference_rank < y.reference_rank;
+                    return x.head.POS < y.head.POS;
+                };
+                completed = MergeSortedInputs(inputs, less, write, on_read,
+                                              update_progress_callback, total_size_in_bytes_,
+                                              counter, timer_, statistics_.get());
+            }
+        } else {
+            typedef SortedInput<gene::SequenceRecord> Input;
+            std::vector<Input> inputs;
+            std::vector<std::unique_ptr<RecordFile>> sequence_files;
+            for (const auto& path : inputFilePaths) {
+                Input input;
+                input.path = path;
+                if (IsAlignmentPath(path)) {
+                    auto file = open_alignment_file(path);
+                    if (!file)
+                        return false;
+                    input.read = [file](gene::SequenceRecord& record) {
+                        gene::SamRecord sam_record;
+                        if ((sam_record = file->read()).SEQ.empty())
+                            return false;
+                        record = gene::SequenceRecord{std::move(sam_record)};
+                        return true;
+                    };
+                    input.position = [file] { return file->position(); };
+                } else {
+                    auto file = RecordFile::FileWithName(path, flags_, gene::OpenMode::Read);
+                    if (!file || !file->isValidGeneFile()) {
+                        PrintfLog("Can't open input file %s\n", path.c_str());
+                        return false;
+                    }
+                    // Every input is read all the time, so each one decodes
+                    // big batches in the background
+                    if (!dynamic_cast<PrefetchingRecordFile *>(file.get()))
+                        file = std::make_unique<PrefetchingRecordFile>(std::move(file), 0);
+                    total_size_in_bytes_ += file->length();
+                    auto raw_file = file.get();
+                    input.read = [raw_file](gene::SequenceRecord& record) {
+                        return !(record = raw_file->Read()).Empty();
+                    };
+                    input.position = [raw_file] { return raw_file->position(); };
+                    sequence_files.push_back(std::move(file));
+                }
+                inputs.push_back(std::move(input));
+            }
+
+            if (!(outFile = RecordFile::FileWithName(outputPath, flags_, gene::OpenMode::Write))) {
+                PrintfLog("Can't create output file\n");
+                return false;
+            }
+            auto write = [this](const gene::SequenceRecord& record) { outFile->Write(record); };
+            auto less = [](const Input& x, const Input& y) {
+                return x.head.name < y.head.name;
+            };
+            completed = MergeSortedInputs(inputs, less, write, [](Input&) {},
+                                          update_progress_callback, total_size_in_bytes_,
+                                          counter, timer_, statistics_.get());
+        }
+    } catch (const std::runtime_error&) {
+        return false;
+    }
+
+    if (!completed)
+        return true;
+    if (counter == 0) {
+        PrintfLog("Input file was either empty, or it had an incorrect format\n");
+        return false;
+    }
+    FinishStatistics_(counter);
+    auto secondsElapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start);
+
+    if (flags_->verbose)
+        PrintfLog("%lld records processed in %.2f seconds\n", counter, secondsElapsed.count());
+
+    return true;
+}
+
 bool Merger::Process()
 {
+    if (flags_->SettingExists(kSortedMergeFlag))
+        return ProcessSortedMerge_();
+    if (StreamsFasta_())
+        return ProcessFastaStream_();
+
     if (!Init_()) {
         PrintfLog("Can't proceed further. Aborting operation.");
         return false;
@@ -73,10 +492,19 @@ bool Merger::Process()
                   outFile->strFileType().c_str());
     
     auto start = std::chrono::high_resolution_clock::now();
+    StartStatistics_();
     int64_t counter = 0;
     int64_t bytes_processed = 0;
+    const size_t decode_ahead = DecodeAheadCount_();
     
-    for (const auto& in_file : inputFiles) {
+    for (size_t i = 0; i < inputFiles.size(); ++i) {
+        const auto& in_file = inputFiles[i];
+        // Keep a bounded window of inputs decoding, starting with this one
+        for (size_t j = i; j < std::min(i + decode_ahead, inputFiles.size()); ++j) {
+            if (auto prefetching_file = dynamic_cast<PrefetchingRecordFile *>(inputFiles[j].get()))
+                prefetching_file->Start();
+        }
+
         if (flags_->verbose) {
             PrintfLog("Merging in <-%s(%s)\n",
                       in_file->filePath().c_str(),
@@ -85,23 +513,30 @@ bool Merger::Process()
 
         gene::SequenceRecord record;
         while (!(record = in_file->Read()).Empty()) {
+            timer_.Lap(RunStatistics::Stage::Read);
             ++counter;
             outFile->Write(record);
+            timer_.Lap(RunStatistics::Stage::Write);
             
+            if (HasToUpdateProgress_(counter) && statistics_)
+                statistics_->AddSample(counter, in_file->position() + bytes_processed);
             if (HasToUpdateProgress_(counter) && update_progress_callback) {
-                bool hasToCancelOperation = update_progress_callback((in_file->position() + bytes_processed)/static_cast<float>(total_size_in_bytes_*100.0));
+                bool hasToCancelOperation = update_progress_callback((in_file->position() + bytes_processed)/static_cast<float>(total_size_in_bytes_)*100);
                 
                 if (hasToCancelOperation)
                     return true;
             }
         }
         bytes_processed += in_file->length();
+        // Releases the decoding thread and its buffers
+        inputFiles[i].reset();
     }
 
     if (counter == 0) {
         PrintfLog("Input file was either empty, or it had an incorrect format\n");
         return false;
     }
+    FinishStatistics_(counter);
     auto secondsElapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start);
     
     if (flags_->verbose)
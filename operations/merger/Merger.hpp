@@ -21,7 +21,10 @@
 #include <string>
 #include <functional>
 
-#include <libgene/file/sequence/SequenceFile.hpp>
+#include "RecordFile.hpp"
+#include "RunStatistics.hpp"
+#include "TraceRecorder.hpp"
+
 #include <libgene/flags/CommandLineFlags.hpp>
 
 class Merger final {
@@ -33,13 +36,28 @@ class Merger final {
     std::function<bool(float)> update_progress_callback;
 
  private:
-    std::vector<std::unique_ptr<gene::SequenceFile>> inputFiles;
+    std::vector<std::unique_ptr<RecordFile>> inputFiles;
     std::vector<std::string> inputFilePaths;
-    std::unique_ptr<gene::SequenceFile> outFile;
+    std::unique_ptr<RecordFile> outFile;
     std::unique_ptr<gene::CommandLineFlags> flags_;
     std::string outputPath;
     int64_t total_size_in_bytes_{0};
+    // Only kept with the "stats-json" flag. 'timer_' splits the time of the
+    // thread writing the output, its reads including any wait for inputs
+    // decoded in the background.
+    std::unique_ptr<RunStatistics> statistics_;
+    StageTimer timer_;
     bool Init_();
+    void StartStatistics_();
+    // Writes the statistics out once the merge is done
+    void FinishStatistics_(int64_t records);
+    // Number of inputs decoded at once, including the one being written
+    size_t DecodeAheadCount_() const;
+    bool StreamsFasta_() const;
+    bool ProcessFastaStream_();
+    // Merges inputs that are each sorted by name or coordinate into one
+    // sorted output, reading all of them at once
+    bool ProcessSortedMerge_();
 };
 
 #endif  // LIBGENE_OPERATIONS_MERGER_HPP_
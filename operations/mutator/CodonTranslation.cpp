@@ -0,0 +1,127 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+#include "CodonTranslation.hpp"
+
+static_assert(TranslateCodon("ATG") == 'M' && TranslateCodon("TGG") == 'W' &&
+              TranslateCodon("TAA") == kStopCodon && TranslateCodon("TGA") == kStopCodon &&
+              TranslateCodon("AGA") == 'R' && TranslateCodon("ANG") == 0,
+              "Codon table is off");
+
+#if defined(__SSSE3__)
+// Shuffles that split a block of 16 codons (48 bases, three vectors) into
+// vectors of their first, second and third bases. masks[k][v] picks base k
+// of every codon found in vector v, leaving zero (-1) in the other lanes.
+struct CodonShuffles {
+    signed char masks[3][3][16];
+};
+
+static constexpr CodonShuffles MakeCodonShuffles()
+{
+    CodonShuffles shuffles{};
+    for (int k = 0; k < 3; ++k) {
+        for (int v = 0; v < 3; ++v) {
+            for (int lane = 0; lane < 16; ++lane) {
+                int position = 3*lane + k;
+                shuffles.masks[k][v][lane] = static_cast<signed char>(position/16 == v ? position%16 : -1);
+            }
+        }
+    }
+    return shuffles;
+}
+
+static constexpr CodonShuffles kCodonShuffles = MakeCodonShuffles();
+
+// Two-bit codes of sixteen bases, and which of them are A, C, G or T at all
+static __m128i BaseCodes(__m128i bases, __m128i& valid)
+{
+    __m128i a = _mm_cmpeq_epi8(bases, _mm_set1_epi8('A'));
+    __m128i c = _mm_cmpeq_epi8(bases, _mm_set1_epi8('C'));
+    __m128i g = _mm_cmpeq_epi8(bases, _mm_set1_epi8('G'));
+    __m128i t = _mm_cmpeq_epi8(bases, _mm_set1_epi8('T'));
+    valid = _mm_or_si128(_mm_or_si128(a, c), _mm_or_si128(g, t));
+    return _mm_or_si128(_mm_and_si128(c, _mm_set1_epi8(1)),
+                        _mm_or_si128(_mm_and_si128(g, _mm_set1_epi8(2)),
+                                     _mm_and_si128(t, _mm_set1_epi8(3))));
+}
+#endif
+
+size_t TranslateBases(const char *bases, size_t count, char *amino_acids)
+{
+    size_t codons = count/3;
+    size_t i = 0;
+#if defined(__SSSE3__)
+    // Codon indices are built lane-wise, then looked up in the four
+    // sixteen-entry quarters of the table, each quarter answering for the
+    // lanes whose index falls into it
+    __m128i quarters[4];
+    for (int q = 0; q < 4; ++q)
+        quarters[q] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(kCodonTable + 16*q));
+    __m128i shuffles[3][3];
+    for (int k = 0; k < 3; ++k) {
+        for (int v = 0; v < 3; ++v)
+            shuffles[k][v] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(kCodonShuffles.masks[k][v]));
+    }
+
+    for (; i + 16 <= codons; i += 16) {
+        __m128i codes[3], valid[3];
+        for (int v = 0; v < 3; ++v) {
+            __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bases + 3*i + 16*v));
+            codes[v] = BaseCodes(input, valid[v]);
+        }
+
+        __m128i index = _mm_setzero_si128();
+        __m128i all_valid = _mm_set1_epi8(-1);
+        for (int k = 0; k < 3; ++k) {
+            __m128i base = _mm_setzero_si128();
+            __m128i base_valid = _mm_setzero_si128();
+            for (int v = 0; v < 3; ++v) {
+                base = _mm_or_si128(base, _mm_shuffle_epi8(codes[v], shuffles[k][v]));
+                base_valid = _mm_or_si128(base_valid, _mm_shuffle_epi8(valid[v], shuffles[k][v]));
+            }
+            // Codes are below four, so shifting 16-bit lanes can't carry
+            // into the neighbouring byte
+            index = _mm_or_si128(_mm_slli_epi16(index, 2), base);
+            all_valid = _mm_and_si128(all_valid, base_valid);
+        }
+
+        __m128i low = _mm_and_si128(index, _mm_set1_epi8(0x0F));
+        __m128i quarter = _mm_and_si128(_mm_srli_epi16(index, 4), _mm_set1_epi8(0x03));
+        __m128i result = _mm_setzero_si128();
+        for (int q = 0; q < 4; ++q) {
+            __m128i in_quarter = _mm_cmpeq_epi8(quarter, _mm_set1_epi8(static_cast<char>(q)));
+            result = _mm_or_si128(result, _mm_and_si128(_mm_shuffle_epi8(quarters[q], low), in_quarter));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(amino_acids + i), _mm_and_si128(result, all_valid));
+    }
+#endif
+    for (; i < codons; ++i)
+        amino_acids[i] = TranslateCodon(bases + 3*i);
+    return codons;
+}
+
+std::string TranslateBases(const std::string& bases)
+{
+    std::string amino_acids(bases.size()/3, '\0');
+    if (!amino_acids.empty())
+        TranslateBases(bases.data(), bases.size(), &amino_acids[0]);
+    return amino_acids;
+}
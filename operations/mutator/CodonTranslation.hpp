@@ -0,0 +1,59 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef LIBGENE_OPERATIONS_CODON_TRANSLATION_HPP_
+#define LIBGENE_OPERATIONS_CODON_TRANSLATION_HPP_
+
+#include <string>
+#include <cstddef>
+
+// The standard genetic code. Amino acids go by their one-letter names, stop
+// codons translate to '!' and codons with anything but A, C, G and T
+// (lowercase included) to 0.
+
+constexpr char kStopCodon = '!';
+
+// Indexed by codons packed the way PackedSequence packs bases (A=0, C=1,
+// G=2, T=3), the first base in the high bits
+constexpr char kCodonTable[64 + 1] = "KNKNTTTTRSRSIIMI"
+                                     "QHQHPPPPRRRRLLLL"
+                                     "EDEDAAAAGGGGVVVV"
+                                     "!Y!YSSSS!CWCLFLF";
+
+constexpr int CodonBaseCode(char base)
+{
+    return base == 'A' ? 0 : base == 'C' ? 1 : base == 'G' ? 2 : base == 'T' ? 3 : -1;
+}
+
+constexpr char TranslateCodon(const char *codon)
+{
+    int index = 0;
+    for (int i = 0; i < 3; ++i) {
+        int code = CodonBaseCode(codon[i]);
+        if (code < 0)
+            return 0;
+        index = index*4 + code;
+    }
+    return kCodonTable[index];
+}
+
+// Translates the count/3 whole codons of 'bases' into 'amino_acids', sixteen
+// codons at a time where SSSE3 is there. Returns the number of amino acids.
+size_t TranslateBases(const char *bases, size_t count, char *amino_acids);
+std::string TranslateBases(const std::string& bases);
+
+#endif  // LIBGENE_OPERATIONS_CODON_TRANSLATION_HPP_
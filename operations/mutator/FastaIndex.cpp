@@ -0,0 +1,249 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "FastaIndex.hpp"
+#include <libgene/log/Logger.hpp>
+
+static bool IsModifiedAfter(const std::string& path, const std::string& other_path)
+{
+    struct stat info, other_info;
+    if (stat(path.c_str(), &info) != 0 || stat(other_path.c_str(), &other_info) != 0)
+        return true;
+    return info.st_mtime > other_info.st_mtime;
+}
+
+std::string FastaIndex::IndexPath(const std::string& fasta_path)
+{
+    return fasta_path + ".fai";
+}
+
+FastaIndex::FastaIndex(const std::string& fasta_path)
+: path_(fasta_path)
+{
+    fd_ = open(path_.c_str(), O_RDONLY);
+    if (fd_ < 0)
+        throw std::runtime_error("Can't open " + path_);
+
+    auto index_path = IndexPath(path_);
+    if (IsModifiedAfter(path_, index_path) || !Load_(index_path)) {
+        Build_();
+        Save_(index_path);
+    }
+
+    by_name_.reserve(entries_.size());
+    for (size_t i = 0; i < entries_.size(); ++i)
+        by_name_[UpperCased(entries_[i].name)] = i;
+}
+
+FastaIndex::~FastaIndex()
+{
+    if (fd_ >= 0)
+        close(fd_);
+}
+
+bool FastaIndex::Load_(const std::string& index_path)
+{
+    std::ifstream index(index_path);
+    if (!index)
+        return false;
+
+    std::string line;
+    while (std::getline(index, line)) {
+        if (line.empty())
+            continue;
+        Entry entry;
+        size_t tab = line.find('\t');
+        if (tab == std::string::npos)
+            return false;
+        entry.name = line.substr(0, tab);
+
+        int64_t *values[] = {&entry.length, &entry.offset, &entry.line_bases, &entry.line_width};
+        const char *field = line.c_str() + tab + 1;
+        for (auto value : values) {
+            char *field_end;
+            *value = std::strtoll(field, &field_end, 10);
+            if (field_end == field)
+                return false;
+            field = field_end + (*field_end == '\t' ? 1 : 0);
+        }
+        entries_.push_back(std::move(entry));
+    }
+    return true;
+}
+
+void FastaIndex::Build_()
+{
+    entries_.clear();
+    std::ifstream fasta(path_, std::ios::binary);
+    if (!fasta)
+        throw std::runtime_error("Can't read " + path_);
+
+    PrintfLog("Indexing %s\n", path_.c_str());
+    std::string line;
+    int64_t offset = 0;
+    // Set once a record had a line shorter than the ones before it, which
+    // has to be its last one
+    bool short_line_seen = false;
+    while (std::getline(fasta, line)) {
+        int64_t line_width = static_cast<int64_t>(line.size()) + (fasta.eof() ? 0 : 1);
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        int64_t line_bases = static_cast<int64_t>(line.size());
+        offset += line_width;
+
+        if (!line.empty() && line.front() == '>') {
+            size_t name_end = line.find_first_of(" \t");
+            entries_.push_back({line.substr(1, name_end == std::string::npos ?
+                                              std::string::npos : name_end - 1),
+                                0, offset, 0, 0});
+            short_line_seen = false;
+            continue;
+        }
+        if (entries_.empty()) {
+            if (line.empty())
+                continue;
+            throw std::runtime_error(path_ + " is not a FASTA file");
+        }
+
+        auto& entry = entries_.back();
+        if (entry.length == 0 && line_bases == 0) {
+            // Nothing but blank lines so far, the sequence starts later
+            entry.offset = offset;
+        } else if (entry.line_bases == 0) {
+            entry.line_bases = line_bases;
+            entry.line_width = line_width;
+        } else if (line_bases != 0) {
+            if (short_line_seen || line_bases > entry.line_bases)
+                throw std::runtime_error(path_ + " has lines of different length in " + entry.name);
+            short_line_seen = line_bases < entry.line_bases;
+        } else {
+            short_line_seen = true;
+        }
+        entry.length += line_bases;
+    }
+}
+
+void FastaIndex::Save_(const std::string& index_path) const
+{
+    // Not being able to save the index (say, next to a read-only reference)
+    // only means it has to be built again next time
+    std::ofstream index(index_path, std::ios::trunc);
+    for (const auto& entry : entries_) {
+        index << entry.name << '\t' << entry.length << '\t' << entry.offset << '\t'
+              << entry.line_bases << '\t' << entry.line_width << '\n';
+    }
+    index.close();
+    if (!index)
+        std::remove(index_path.c_str());
+}
+
+const std::vector<FastaIndex::Entry>& FastaIndex::entries() const
+{
+    return entries_;
+}
+
+const FastaIndex::Entry *FastaIndex::Find(const std::string& key) const
+{
+    auto it = by_name_.find(key);
+    return it == by_name_.end() ? nullptr : &entries_[it->second];
+}
+
+void FastaIndex::ReadAt_(int64_t offset, size_t count, char *bytes) const
+{
+    while (count != 0) {
+        ssize_t read = pread(fd_, bytes, count, offset);
+        if (read <= 0)
+            throw std::runtime_error("Can't read " + path_);
+        bytes += read;
+        offset += read;
+        count -= static_cast<size_t>(read);
+    }
+}
+
+std::string FastaIndex::HeaderOf_(const Entry& entry) const
+{
+    // The last non-blank line before the first base
+    std::string bytes;
+    for (int64_t chunk = 256; ; chunk *= 2) {
+        int64_t start = std::max<int64_t>(entry.offset - chunk, 0);
+        bytes.resize(static_cast<size_t>(entry.offset - start));
+        ReadAt_(start, bytes.size(), &bytes[0]);
+
+        size_t line_end = bytes.find_last_not_of("\r\n");
+        size_t line_start = line_end == std::string::npos ?
+                            std::string::npos : bytes.rfind('\n', line_end);
+        if (line_start != std::string::npos || start == 0) {
+            if (line_end == std::string::npos)
+                bytes.clear();
+            else
+                bytes = bytes.substr(line_start + 1, line_end - line_start);
+            break;
+        }
+    }
+    if (bytes.empty() || bytes.front() != '>')
+        throw std::runtime_error(path_ + " has changed since it was indexed");
+    return bytes.substr(1);
+}
+
+gene::SequenceRecord FastaIndex::Read(const Entry& entry) const
+{
+    gene::SequenceRecord record;
+    auto header = HeaderOf_(entry);
+    size_t name_end = header.find_first_of(" \t");
+    record.name = header.substr(0, name_end);
+    if (name_end != std::string::npos)
+        record.desc = header.substr(name_end + 1);
+
+    if (entry.length == 0)
+        return record;
+
+    // Every line but the last one is full
+    int64_t full_lines = (entry.length - 1)/entry.line_bases;
+    int64_t span = full_lines*entry.line_width + entry.length - full_lines*entry.line_bases;
+    record.seq.resize(static_cast<size_t>(span));
+    ReadAt_(entry.offset, record.seq.size(), &record.seq[0]);
+    record.seq.erase(std::remove_if(record.seq.begin(), record.seq.end(),
+                                    [](char c) { return c == '\n' || c == '\r'; }),
+                     record.seq.end());
+    if (static_cast<int64_t>(record.seq.size()) != entry.length)
+        throw std::runtime_error(path_ + " has changed since it was indexed");
+    return record;
+}
+
+bool FastaIndex::Fetch(const std::string& key, gene::SequenceRecord& record) const
+{
+    auto entry = Find(key);
+    if (!entry)
+        return false;
+    record = Read(*entry);
+    return true;
+}
+
+std::string FastaIndex::filePath() const
+{
+    return path_;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef LIBGENE_OPERATIONS_FASTA_INDEX_HPP_
+#define LIBGENE_OPERATIONS_FASTA_INDEX_HPP_
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+#include "ReferenceSource.hpp"
+
+// Random access to the records of a plain FASTA file through a faidx (.fai)
+// index, the same one samtools builds. The index is read from next to the
+// FASTA if it is there and not older than the file, otherwise it's built by
+// scanning the file once and saved for the next time.
+//
+// Records are read on demand, so only the ones asked for ever take memory.
+class FastaIndex final : public ReferenceSource {
+ public:
+    // A line of the .fai file
+    struct Entry {
+        std::string name;
+        int64_t length;
+        // Of the first base
+        int64_t offset;
+        int64_t line_bases;
+        // Including the line break
+        int64_t line_width;
+    };
+
+    static std::string IndexPath(const std::string& fasta_path);
+
+    // Throws std::runtime_error if the file can't be read or indexed: lines
+    // of a record have to be the same length, save for the last one
+    explicit FastaIndex(const std::string& fasta_path);
+    ~FastaIndex() override;
+
+    const std::vector<Entry>& entries() const;
+    // Returns nullptr if there is no record named 'key' (upper-cased)
+    const Entry *Find(const std::string& key) const;
+    // Throws std::runtime_error if the file changed since it was indexed
+    gene::SequenceRecord Read(const Entry& entry) const;
+
+    bool Fetch(const std::string& key, gene::SequenceRecord& record) const override;
+    std::string filePath() const override;
+
+ private:
+    bool Load_(const std::string& index_path);
+    void Build_();
+    void Save_(const std::string& index_path) const;
+    void ReadAt_(int64_t offset, size_t count, char *bytes) const;
+    // The header line ends right before the first base
+    std::string HeaderOf_(const Entry& entry) const;
+
+    std::string path_;
+    int fd_{-1};
+    std::vector<Entry> entries_;
+    // Upper-cased names; later records win over earlier ones of the same name
+    std::unordered_map<std::string, size_t> by_name_;
+};
+
+#endif  // LIBGENE_OPERATIONS_FASTA_INDEX_HPP_
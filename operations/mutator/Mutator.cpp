@@ -0,0 +1,610 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <future>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+#include "Mutator.hpp"
+#include "CodonTranslation.hpp"
+#include <libgene/def/FileType.hpp>
+#include <libgene/utils/StringUtils.hpp>
+#include <libgene/log/Logger.hpp>
+
+// Number of threads mutating transcripts, all logical cores by default
+static const std::string kMutateThreadsFlag = "mutate-threads";
+
+// Rows read before the variants get grouped and applied. Every applied
+// variant holds a copy of its transcript until the window is written out.
+constexpr size_t kVariantsPerWindow = 4096;
+
+static void AppendLog(std::string& log, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    va_list args_copy;
+    va_copy(args_copy, args);
+    int length = std::vsnprintf(nullptr, 0, format, args_copy);
+    va_end(args_copy);
+    if (length > 0) {
+        size_t size = log.size();
+        log.resize(size + static_cast<size_t>(length) + 1);
+        std::vsnprintf(&log[size], static_cast<size_t>(length) + 1, format, args);
+        log.resize(size + static_cast<size_t>(length));
+    }
+    va_end(args);
+}
+
+// Reads a number the way atoi() does, from a field that isn't 0-terminated
+static int ParseInt(std::string_view text)
+{
+    size_t i = 0;
+    while (i < text.size() && std::isspace(static_cast<unsigned char>(text[i])))
+        ++i;
+    bool negative = false;
+    if (i < text.size() && (text[i] == '-' || text[i] == '+'))
+        negative = text[i++] == '-';
+    int value = 0;
+    for (; i < text.size() && text[i] >= '0' && text[i] <= '9'; ++i)
+        value = value*10 + (text[i] - '0');
+    return negative ? -value : value;
+}
+
+// Logs of the names of amino acids, 0 (which would end the log line) goes as
+// '?'
+static char Printable(char amino_acid)
+{
+    return amino_acid ? amino_acid : '?';
+}
+
+Mutator::Mutator(std::string variants_path,
+                 std::string reference_path,
+                 std::string translation_reference_path,
+                 std::string output_path,
+                 std::string translation_output_path,
+                 std::unique_ptr<gene::CommandLineFlags>&& flags)
+: variants_path_(std::move(variants_path)),
+  reference_path_(std::move(reference_path)),
+  translation_reference_path_(std::move(translation_reference_path)),
+  output_path_(std::move(output_path)),
+  translation_output_path_(std::move(translation_output_path)),
+  flags_(std::move(flags)),
+  threads_count_(static_cast<int>(std::thread::hardware_concurrency()))
+{
+    if (flags_->SettingExists(kMutateThreadsFlag))
+        threads_count_ = flags_->GetIntSetting(kMutateThreadsFlag);
+    threads_count_ = std::max(threads_count_, 1);
+}
+
+bool Mutator::Init_()
+{
+    auto variants_type = gene::utils::str2type(gene::utils::GetExtension(variants_path_));
+    if (variants_type != gene::FileType::Csv && variants_type != gene::FileType::Tsv) {
+        PrintfLog("Input file should be tab or comma separated\n");
+        return false;
+    }
+    variants_file_ = std::make_unique<SeparatedTableReader>(variants_path_);
+    if (!variants_file_->is_open()) {
+        PrintfLog("Can't open input file\n");
+        return false;
+    }
+
+    if (!(reference_ = ReferenceSource::Open(reference_path_, flags_))) {
+        PrintfLog("Can't open reference file %s\n", reference_path_.c_str());
+        return false;
+    }
+    if (!(translation_reference_ = ReferenceSource::Open(translation_reference_path_, flags_))) {
+        PrintfLog("Can't open translation reference file %s\n", translation_reference_path_.c_str());
+        return false;
+    }
+
+    if (output_path_.empty()) {
+        output_path_ = gene::utils::ConstructOutputNameWithFile(reference_path_,
+                                                                gene::FileType::Unknown,
+                                                                output_path_,
+                                                                flags_,
+                                                                "-mutated");
+    }
+    if (translation_output_path_.empty()) {
+        translation_output_path_ = gene::utils::ConstructOutputNameWithFile(translation_reference_path_,
+                                                                            gene::FileType::Unknown,
+                                                                            translation_output_path_,
+                                                                            flags_,
+                                                                            "-mutated");
+    }
+    output_file_ = RecordFile::FileWithName(output_path_, flags_, gene::OpenMode::Write);
+    translation_output_file_ = RecordFile::FileWithName(translation_output_path_, flags_,
+                                                        gene::OpenMode::Write);
+    if (!output_file_ || !translation_output_file_) {
+        PrintfLog("Can't create output file\n");
+        return false;
+    }
+    return true;
+}
+
+bool Mutator::FindColumns_(const std::vector<std::string_view>& header)
+{
+    static const char *kColumnNames[ColumnsCount] = {
+        "gene", "gene symbol", "transcript", "protein_pos", "aa_change", "alt", "ref"
+    };
+    static const char *kColumnTitles[ColumnsCount] = {
+        "Gene", "GeneSymbol", "Transcript", "Protein_Pos", "AA_Change", "Alt", "Ref"
+    };
+
+    std::vector<size_t> columns(ColumnsCount, std::string::npos);
+    for (size_t i = 0; i < header.size(); ++i) {
+        std::string name(header[i]);
+        std::transform(name.begin(), name.end(), name.begin(),
+                       [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        for (int column = 0; column < ColumnsCount; ++column) {
+            if (name == kColumnNames[column])
+                columns[column] = i;
+        }
+    }
+
+    for (int column = 0; column < ColumnsCount; ++column) {
+        if (columns[column] == std::string::npos) {
+            PrintfLog("Column %s not found\n", kColumnTitles[column]);
+            return false;
+        }
+    }
+    variants_file_->SetProjection(columns);
+    return true;
+}
+
+bool Mutator::ReportProgress_(float fraction) const
+{
+    return update_progress_callback && update_progress_callback(fraction*100);
+}
+
+bool Mutator::ParseVariant_(const std::vector<std::string_view>& row, Variant& variant) const
+{
+    if (row.size() != ColumnsCount)
+        return false;
+
+    variant.valid = true;
+    variant.key.clear();
+    variant.key.append(row[Gene]).append("|");
+    variant.key.append(row[Transcript]).append("|");
+    variant.key.append(row[GeneSymbol]);
+    variant.key = UpperCased(std::move(variant.key));
+
+    // "13", "13-15", or "13-" if the end is unknown
+    const auto position = row[ProteinPos];
+    variant.position = ParseInt(position);
+    auto dash = position.find('-');
+    if (dash != std::string_view::npos)
+        variant.end_position = ParseInt(position.substr(dash + 1));
+
+    // "N/D", anything without a slash means no change
+    const auto aa_change = row[AaChange];
+    auto slash = aa_change.find('/');
+    if (slash != std::string_view::npos) {
+        variant.aa_change = true;
+        variant.aa_from = aa_change.substr(0, slash);
+        variant.aa_to = aa_change.substr(slash + 1);
+    }
+
+    // "-" stands for no bases
+    variant.has_seq_from = row[Ref] != "-";
+    if (variant.has_seq_from)
+        variant.seq_from = row[Ref];
+    variant.has_seq_to = row[Alt] != "-";
+    if (variant.has_seq_to)
+        variant.seq_to = row[Alt];
+    return true;
+}
+
+void Mutator::ApplyGroup_(const std::string& key, const std::vector<size_t>& rows,
+                          const std::vector<Variant>& variants, std::vector<Result>& results) const
+{
+    gene::SequenceRecord reference, translation;
+    const char *missing_from = nullptr;
+    if (!reference_->Fetch(key, reference))
+        missing_from = "reference file";
+    else if (!translation_reference_->Fetch(key, translation))
+        missing_from = "trans reference file";
+
+    // The amino acids the variants start from all come out of one pass over
+    // the transcript
+    std::string amino_acids;
+    if (!missing_from)
+        amino_acids = TranslateBases(reference.seq);
+
+    for (auto row : rows) {
+        if (missing_from) {
+            AppendLog(results[row].log, "Warning: record %s not found in %s, ignoring...\n",
+                      key.c_str(), missing_from);
+            continue;
+        }
+        results[row] = Apply_(variants[row], reference, amino_acids, translation);
+    }
+}
+
+Mutator::Result Mutator::Apply_(const Variant& variant, const gene::SequenceRecord& reference,
+                                const std::string& amino_acids,
+                                const gene::SequenceRecord& translation) const
+{
+    Result result;
+    auto& log = result.log;
+    const char *id = variant.key.c_str();
+    const auto& seq = reference.seq;
+    const auto& seq_from = variant.seq_from;
+    const auto& seq_to = variant.seq_to;
+    const auto& aa_from = variant.aa_from;
+    const auto& aa_to = variant.aa_to;
+    int64_t seq_position = (static_cast<int64_t>(variant.position) - 1)*3;
+
+    // 'position' is always at the start of a codon
+    auto codon_at = [&](int64_t position, std::string& codon, char& amino_acid) {
+        if (position < 0 || static_cast<int64_t>(seq.size()) < position + 3) {
+            AppendLog(log, "Warning: here is no amino acid at position %lld for %s; whole length is %zu\n",
+                      static_cast<long long>(position), id, seq.size());
+            return false;
+        }
+        codon = seq.substr(static_cast<size_t>(position), 3);
+        amino_acid = amino_acids[static_cast<size_t>(position/3)];
+        if (!amino_acid) {
+            AppendLog(log, "Warning: ignoring unknown amino acid %s for %s \n", codon.c_str(), id);
+            return false;
+        }
+        return true;
+    };
+    // 'mutated' is what amino acid 'index' of the change turned into
+    auto check_amino_acid = [&](char original, char mutated, size_t index) {
+        if (!variant.aa_change) {
+            if (mutated != original) {
+                AppendLog(log, "Warning: ignoring incorrect mutation %s: no aa change recorded but occured\n", id);
+                return false;
+            }
+        } else {
+            char expected = index < aa_to.size() ? aa_to[index] : 0;
+            if (mutated != expected) {
+                AppendLog(log, "Warning: ignoring incorrect mutation %s:  %c change recorded but %c occured\n",
+                          id, Printable(expected), Printable(mutated));
+                return false;
+            }
+        }
+        return true;
+    };
+    auto single_aa_change = [&]() {
+        if (variant.aa_change && (aa_from.size() != 1 || aa_to.size() != 1)) {
+            AppendLog(log, "Warning: ignoring more than 1->1 aa change for %s/%s for %s\n",
+                      aa_from.c_str(), aa_to.c_str(), id);
+            return false;
+        }
+        return true;
+    };
+    auto mutated_name = [&](const std::string& name) {
+        return name + " " + (variant.aa_change ? aa_from + "/" + aa_to : "-") + " " +
+               (variant.has_seq_from ? seq_from : "-") + "/" + (variant.has_seq_to ? seq_to : "-");
+    };
+    // Replacements change the translation too, if they change the amino
+    // acids at all. 'description' starts the verbose log line.
+    auto replace = [&](int64_t position, const std::string& bases, const std::string& description) {
+        int64_t aa_position = variant.position - 1;
+        if (variant.aa_change &&
+            (aa_position < 0 ||
+             static_cast<int64_t>(translation.seq.size()) < aa_position + static_cast<int64_t>(aa_to.size()))) {
+            AppendLog(log, "Warning: amino acid position %d is out of the translation of %s\n",
+                      variant.position, id);
+            return;
+        }
+
+        result.record = reference;
+        result.record.seq.replace(static_cast<size_t>(position), bases.size(), bases);
+        result.record.name = mutated_name(reference.name);
+        result.translation = translation;
+        if (variant.aa_change)
+            result.translation.seq.replace(static_cast<size_t>(aa_position), aa_to.size(), aa_to);
+        result.translation.name = mutated_name(translation.name);
+        result.has_translation = true;
+        result.applied = true;
+
+        if (flags_->verbose) {
+            log += description;
+            if (variant.aa_change)
+                AppendLog(log, ", AA change: %s/%s", aa_from.c_str(), aa_to.c_str());
+            log += '\n';
+        }
+    };
+    auto describe = [&](const char *kind, const std::string& from, const std::string& to) {
+        std::string description;
+        if (!flags_->verbose)
+            return description;
+        AppendLog(description, "%s: %s replacement at position %d (%s->%s) = (%s->%s)",
+                  id, kind, variant.position, seq_from.c_str(), seq_to.c_str(),
+                  from.c_str(), to.c_str());
+        return description;
+    };
+
+    if (variant.has_seq_from && variant.has_seq_to) {
+        if (seq_from.size() <= 2 && seq_from.size() != seq_to.size()) {
+            AppendLog(log, "Warning: %s and %s must be same length for %s \n",
+                      seq_from.c_str(), seq_to.c_str(), id);
+            return result;
+        }
+
+        // One base changes, one amino acid with it (or not)
+        if (seq_from.size() == 1) {
+            std::string codon;
+            char amino_acid;
+            if (!single_aa_change() || !codon_at(seq_position, codon, amino_acid))
+                return result;
+
+            // The base can be anywhere in the codon
+            std::vector<std::string> mutations;
+            for (size_t i = 0; i < 3; ++i) {
+                if (codon[i] == seq_from[0]) {
+                    mutations.push_back(codon);
+                    mutations.back()[i] = seq_to[0];
+                }
+            }
+            if (mutations.empty()) {
+                AppendLog(log, "Warning: can't mutate %s->%s as no such nucleotide exists in %s for %s \n",
+                          seq_from.c_str(), seq_to.c_str(), codon.c_str(), id);
+                return result;
+            }
+            // With two candidates the amino acid change decides
+            auto mutation = mutations[0];
+            if (mutations.size() == 2) {
+                char wanted = variant.aa_change ? aa_to[0] : amino_acid;
+                if (TranslateCodon(mutations[1].c_str()) == wanted) {
+                    mutation = mutations[1];
+                    if (TranslateCodon(mutations[0].c_str()) == wanted)
+                        AppendLog(log, "Warning: more than one variant for %s, ignoring for now...\n", id);
+                }
+            }
+            if (!check_amino_acid(amino_acid, TranslateCodon(mutation.c_str()), 0))
+                return result;
+
+            replace(seq_position, mutation, describe("single", codon, mutation));
+            return result;
+        }
+
+        // Two neighbouring bases within one codon
+        if (seq_from.size() == 2 && variant.end_position <= 0) {
+            std::string codon;
+            char amino_acid;
+            if (!single_aa_change() || !codon_at(seq_position, codon, amino_acid))
+                return result;
+
+            std::string mutation = codon;
+            if (codon.compare(0, 2, seq_from) == 0) {
+                mutation.replace(0, 2, seq_to);
+            } else if (codon.compare(1, 2, seq_from) == 0) {
+                mutation.replace(1, 2, seq_to);
+            } else {
+                mutation.clear();
+            }
+            if (mutation.empty() || !TranslateCodon(mutation.c_str())) {
+                AppendLog(log, "Warning: can't mutate %s->%s as no such nucleotides exist in %s for %s \n",
+                          seq_from.c_str(), seq_to.c_str(), codon.c_str(), id);
+                return result;
+            }
+            if (!check_amino_acid(amino_acid, TranslateCodon(mutation.c_str()), 0))
+                return result;
+
+            replace(seq_position, mutation, describe("double", codon, mutation));
+            return result;
+        }
+
+        // The last base of one codon and the first one of the next
+        if (seq_from.size() == 2) {
+            if (variant.end_position - variant.position != 1) {
+                AppendLog(log, "Warning: 2->2 replacement requires 2 consequent amino acid position for %s, while having %d and %d\n",
+                          id, variant.position, variant.end_position);
+                return result;
+            }
+            if (variant.aa_change && aa_from.size() != aa_to.size()) {
+                AppendLog(log, "Warning: ignoring not equal aa change for %s/%s for %s\n",
+                          aa_from.c_str(), aa_to.c_str(), id);
+                return result;
+            }
+            if (variant.aa_change && aa_from.size() > 2) {
+                AppendLog(log, "Warning: can't mutate %zu amino acids as maximum is 2 for %s \n",
+                          aa_from.size(), id);
+                return result;
+            }
+
+            std::string codon, next_codon;
+            char amino_acid, next_amino_acid;
+            if (!codon_at(seq_position, codon, amino_acid) ||
+                !codon_at(seq_position + 3, next_codon, next_amino_acid))
+                return result;
+            if (codon[2] != seq_from[0]) {
+                AppendLog(log, "Warning: can't mutate %c->%c at 3rd nucleotide of %s for %s \n",
+                          seq_from[0], seq_to[0], codon.c_str(), id);
+                return result;
+            }
+            if (next_codon[0] != seq_from[1]) {
+                AppendLog(log, "Warning: can't mutate %c->%c at 1st nucleotide of %s for %s \n",
+                          seq_from[1], seq_to[1], next_codon.c_str(), id);
+                return result;
+            }
+            auto mutation = codon, next_mutation = next_codon;
+            mutation[2] = seq_to[0];
+            next_mutation[0] = seq_to[1];
+            char mutated = TranslateCodon(mutation.c_str());
+            char next_mutated = TranslateCodon(next_mutation.c_str());
+            if (!mutated || !next_mutated) {
+                AppendLog(log, "Warning: can't mutate %s->%s as no such nucleotides exist in %s%s for %s \n",
+                          seq_from.c_str(), seq_to.c_str(), codon.c_str(), next_codon.c_str(), id);
+                return result;
+            }
+            if (!check_amino_acid(next_amino_acid, next_mutated, 1) ||
+                !check_amino_acid(amino_acid, mutated, 0))
+                return result;
+
+            // The bases straddle the codons
+            replace(seq_position + 2, seq_to,
+                    describe("double", codon + next_codon, mutation + next_mutation));
+            return result;
+        }
+
+        AppendLog(log, "Warning: more that 2->2 replacements are not supported for %s\n", id);
+        return result;
+    }
+
+    if (variant.has_seq_from) {
+        // Where exactly the deletion starts isn't known, but it has to be
+        // within the given amino acid
+        if (seq_position < 0 || static_cast<int64_t>(seq.size()) < seq_position + 3) {
+            AppendLog(log, "Warning: not enough data in %s to make deletion: whole length is %zu while we are trying to delete from %lld\n",
+                      id, seq.size(), static_cast<long long>(seq_position));
+            return result;
+        }
+        auto found = seq.find(seq_from, static_cast<size_t>(seq_position));
+        if (found == std::string::npos) {
+            AppendLog(log, "Warning: can't delete %s at position %lld for %s as it is not found\n",
+                      seq_from.c_str(), static_cast<long long>(seq_position), id);
+            return result;
+        }
+        if (static_cast<int64_t>(found) - seq_position >= 3) {
+            AppendLog(log, "Warning: can't delete %s at position %lld for %s as it not found at given amino acid position\n",
+                      seq_from.c_str(), static_cast<long long>(seq_position), id);
+            return result;
+        }
+
+        result.record = reference;
+        result.record.seq.erase(found, seq_from.size());
+        result.record.name = mutated_name(reference.name);
+        result.applied = true;
+        if (flags_->verbose)
+            AppendLog(log, "%s: deletion at position %zu (%s)\n", id, found, seq_from.c_str());
+        return result;
+    }
+
+    if (!variant.has_seq_to) {
+        AppendLog(log, "Warning: neither Ref nor Alt given for %s, ignoring...\n", id);
+        return result;
+    }
+    if (seq_position < 0 || static_cast<int64_t>(seq.size()) < seq_position) {
+        AppendLog(log, "Warning: can't insert %s at position %lld for %s; whole length is %zu\n",
+                  seq_to.c_str(), static_cast<long long>(seq_position), id, seq.size());
+        return result;
+    }
+    result.record = reference;
+    result.record.seq.insert(static_cast<size_t>(seq_position), seq_to);
+    result.record.name = mutated_name(reference.name);
+    result.applied = true;
+    if (flags_->verbose)
+        AppendLog(log, "%s: insertion at position %d (%s)\n", id, variant.position, seq_to.c_str());
+    return result;
+}
+
+bool Mutator::Process()
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    int64_t counter = 0, applied = 0;
+
+    try {
+        if (!Init_())
+            return false;
+
+        if (flags_->verbose)
+            PrintfLog("Analyzing %s...\n", variants_path_.c_str());
+        std::vector<std::string_view> row;
+        if (!variants_file_->ReadRow(row)) {
+            PrintfLog("Input file is empty\n");
+            return false;
+        }
+        if (!FindColumns_(row))
+            return false;
+        if (flags_->verbose)
+            PrintfLog("Processing...\n");
+
+        std::vector<Variant> variants;
+        std::vector<Result> results;
+        while (true) {
+            variants.clear();
+            results.clear();
+            while (variants.size() < kVariantsPerWindow && variants_file_->ReadRow(row)) {
+                variants.emplace_back();
+                results.emplace_back();
+                if (!ParseVariant_(row, variants.back())) {
+                    const auto text = variants_file_->last_row();
+                    AppendLog(results.back().log, "Warning: ignoring too short string %.*s\n",
+                              static_cast<int>(text.size()), text.data());
+                }
+            }
+            if (variants.empty())
+                break;
+
+            // Each transcript is read once per window, by whoever takes its
+            // group
+            std::vector<std::pair<std::string, std::vector<size_t>>> groups;
+            std::unordered_map<std::string, size_t> group_of_key;
+            for (size_t i = 0; i < variants.size(); ++i) {
+                if (!variants[i].valid)
+                    continue;
+                auto inserted = group_of_key.emplace(variants[i].key, groups.size());
+                if (inserted.second)
+                    groups.emplace_back(variants[i].key, std::vector<size_t>());
+                groups[inserted.first->second].second.push_back(i);
+            }
+
+            std::atomic<size_t> next_group{0};
+            auto apply_groups = [&]() {
+                for (size_t group; (group = next_group++) < groups.size(); )
+                    ApplyGroup_(groups[group].first, groups[group].second, variants, results);
+            };
+            std::vector<std::future<void>> tasks;
+            size_t workers = std::min(static_cast<size_t>(threads_count_), groups.size());
+            for (size_t i = 1; i < workers; ++i)
+                tasks.push_back(std::async(std::launch::async, apply_groups));
+            apply_groups();
+            for (auto& task : tasks)
+                task.get();
+
+            // Written in the order of the table, whichever thread got there
+            // first
+            for (auto& result : results) {
+                ++counter;
+                if (!result.log.empty())
+                    PrintfLog("%s", result.log.c_str());
+                if (!result.applied)
+                    continue;
+                ++applied;
+                output_file_->Write(result.record);
+                if (result.has_translation)
+                    translation_output_file_->Write(result.translation);
+            }
+
+            if (ReportProgress_(variants_file_->position()/static_cast<float>(variants_file_->length())))
+                break;
+        }
+    } catch (const std::runtime_error& e) {
+        PrintfLog("%s\n", e.what());
+        return false;
+    }
+
+    auto secondsElapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start);
+    if (flags_->verbose) {
+        PrintfLog("%lld records (%lld successful) processed in %.2f seconds (%.2f records per second)\n",
+                  static_cast<long long>(counter), static_cast<long long>(applied),
+                  secondsElapsed.count(), counter/secondsElapsed.count());
+    }
+    return true;
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef LIBGENE_OPERATIONS_MUTATOR_HPP_
+#define LIBGENE_OPERATIONS_MUTATOR_HPP_
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <functional>
+#include <cstdint>
+
+#include "RecordFile.hpp"
+#include "ReferenceSource.hpp"
+#include "SeparatedTableReader.hpp"
+
+#include <libgene/flags/CommandLineFlags.hpp>
+
+// Applies the variants listed in a CSV/TSV table to the transcripts of a
+// reference and to their translations, writing a mutated copy of the
+// records for every variant that checks out against the reference.
+//
+// The table needs the Gene, Gene Symbol, Transcript, Protein_Pos,
+// AA_Change, Ref and Alt columns; the reference records are looked up by
+// "GENE|TRANSCRIPT|SYMBOL". Variants are taken in windows and grouped by
+// transcript, so that each transcript is read once per window and groups
+// can be mutated on their own threads. The output (and the log) keep the
+// order of the table regardless.
+class Mutator final {
+ public:
+    // Empty output paths get made from the reference paths
+    Mutator(std::string variants_path,
+            std::string reference_path,
+            std::string translation_reference_path,
+            std::string output_path,
+            std::string translation_output_path,
+            std::unique_ptr<gene::CommandLineFlags>&& flags);
+    bool Process();
+    std::function<bool(float)> update_progress_callback;
+
+ private:
+    typedef std::unique_ptr<RecordFile> RecordFilePtr;
+
+    // A row of the table
+    struct Variant {
+        bool valid{false};
+        std::string key;
+        // Of the amino acid, counting from 1. 'end_position' is -1 if the
+        // position is a single one, 0 if the range has no end.
+        int position{0};
+        int end_position{-1};
+        // Empty if the amino acid doesn't change
+        std::string aa_from;
+        std::string aa_to;
+        bool aa_change{false};
+        // Missing for insertions and deletions respectively
+        std::string seq_from;
+        std::string seq_to;
+        bool has_seq_from{false};
+        bool has_seq_to{false};
+    };
+
+    struct Result {
+        bool applied{false};
+        gene::SequenceRecord record;
+        // Only for replacements
+        bool has_translation{false};
+        gene::SequenceRecord translation;
+        std::string log;
+    };
+
+    enum Column { Gene, GeneSymbol, Transcript, ProteinPos, AaChange, Alt, Ref, ColumnsCount };
+
+    std::string variants_path_;
+    std::string reference_path_;
+    std::string translation_reference_path_;
+    std::string output_path_;
+    std::string translation_output_path_;
+    std::unique_ptr<gene::CommandLineFlags> flags_;
+    int threads_count_;
+
+    std::unique_ptr<SeparatedTableReader> variants_file_;
+    std::unique_ptr<ReferenceSource> reference_;
+    std::unique_ptr<ReferenceSource> translation_reference_;
+    RecordFilePtr output_file_;
+    RecordFilePtr translation_output_file_;
+
+    bool Init_();
+    // Projects the rows that follow onto the columns, in Column order
+    bool FindColumns_(const std::vector<std::string_view>& header);
+    bool ReportProgress_(float fraction) const;
+    // Returns false for rows too short to have all the columns
+    bool ParseVariant_(const std::vector<std::string_view>& row, Variant& variant) const;
+    // Mutates the variants of a window, all of them belonging to 'key'
+    void ApplyGroup_(const std::string& key, const std::vector<size_t>& rows,
+                     const std::vector<Variant>& variants, std::vector<Result>& results) const;
+    // 'amino_acids' is the translation of the reference transcript
+    Result Apply_(const Variant& variant, const gene::SequenceRecord& reference,
+                  const std::string& amino_acids, const gene::SequenceRecord& translation) const;
+};
+
+#endif  // LIBGENE_OPERATIONS_MUTATOR_HPP_
@@ -0,0 +1,397 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ReferenceCache.hpp"
+#include "PackedSequence.hpp"
+#include "RecordFile.hpp"
+#include <libgene/log/Logger.hpp>
+
+const std::string ReferenceCache::kExtension = "gref";
+
+static const char kMagic[] = "GUREF001";
+constexpr size_t kMagicLength = 8;
+constexpr size_t kHeaderLength = kMagicLength + 8*8;
+constexpr size_t kTableEntryLength = 8 + 8 + 4 + 4 + 8 + 4 + 4;
+constexpr size_t kHashSlotLength = 8 + 4 + 4;
+constexpr size_t kRunLength = 4 + 4 + 1;
+// Bytes of the start and of the end of the source the checksum covers
+constexpr int64_t kChecksumSpan = 1024*1024;
+
+enum Encoding : uint32_t { kPackedBases = 0, kRawBytes = 1 };
+
+static void PutU32(std::string& out, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        out.push_back(static_cast<char>((value >> (8*i)) & 0xFF));
+}
+
+static void PutU64(std::string& out, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i)
+        out.push_back(static_cast<char>((value >> (8*i)) & 0xFF));
+}
+
+static uint32_t GetU32(const unsigned char *data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+static uint64_t GetU64(const unsigned char *data)
+{
+    return GetU32(data) | (static_cast<uint64_t>(GetU32(data + 4)) << 32);
+}
+
+// 64-bit FNV-1a
+static uint64_t HashBytes(const void *data, size_t length, uint64_t hash = 0xCBF29CE484222325ull)
+{
+    auto bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+// What the cache of a source gets checked against
+struct SourceStamp {
+    uint64_t size;
+    uint64_t modified;
+    uint64_t checksum;
+};
+
+// Returns false if the source can't be read
+static bool StampSource(const std::string& path, SourceStamp& stamp)
+{
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+        return false;
+    std::ifstream source(path, std::ios::binary);
+    if (!source)
+        return false;
+
+    stamp.size = static_cast<uint64_t>(info.st_size);
+    stamp.modified = static_cast<uint64_t>(info.st_mtime);
+    stamp.checksum = HashBytes(&stamp.size, sizeof(stamp.size));
+    stamp.checksum = HashBytes(&stamp.modified, sizeof(stamp.modified), stamp.checksum);
+
+    int64_t size = info.st_size;
+    std::vector<char> bytes(static_cast<size_t>(std::min(size, kChecksumSpan)));
+    for (int64_t offset : {int64_t{0}, std::max<int64_t>(size - kChecksumSpan, 0)}) {
+        source.seekg(offset);
+        if (!source.read(bytes.data(), static_cast<std::streamsize>(bytes.size())))
+            return false;
+        stamp.checksum = HashBytes(bytes.data(), bytes.size(), stamp.checksum);
+    }
+    return true;
+}
+
+std::string ReferenceCache::CachePath(const std::string& source_path)
+{
+    return source_path + "." + kExtension;
+}
+
+ReferenceCache::ReferenceCache(const std::string& source_path)
+: source_path_(source_path)
+{
+}
+
+ReferenceCache::~ReferenceCache()
+{
+    if (data_)
+        munmap(const_cast<unsigned char *>(data_), size_);
+    if (descriptor_ >= 0)
+        close(descriptor_);
+}
+
+std::unique_ptr<ReferenceCache> ReferenceCache::Open(const std::string& source_path)
+{
+    SourceStamp stamp;
+    if (!StampSource(source_path, stamp))
+        return nullptr;
+    std::unique_ptr<ReferenceCache> cache(new ReferenceCache(source_path));
+    if (!cache->Map_(stamp.checksum))
+        return nullptr;
+    return cache;
+}
+
+std::unique_ptr<ReferenceCache> ReferenceCache::Build(const std::string& source_path,
+                                                      const std::unique_ptr<gene::CommandLineFlags>& flags)
+{
+    SourceStamp stamp;
+    if (!StampSource(source_path, stamp))
+        return nullptr;
+    auto input = RecordFile::FileWithName(source_path, flags, gene::OpenMode::Read);
+    if (!input || !input->isValidGeneFile())
+        return nullptr;
+
+    // Written under a temporary name, so that a run that fails half way
+    // doesn't leave a cache behind
+    auto cache_path = CachePath(source_path);
+    auto temporary_path = cache_path + ".tmp";
+    std::ofstream output(temporary_path, std::ios::binary | std::ios::trunc);
+    if (!output)
+        return nullptr;
+    PrintfLog("Caching %s\n", source_path.c_str());
+
+    output.write(kMagic, kMagicLength);
+    output.write(std::string(kHeaderLength - kMagicLength, '\0').data(), kHeaderLength - kMagicLength);
+    uint64_t offset = kHeaderLength;
+
+    std::string table, names, bases;
+    std::vector<std::string> keys;
+    gene::SequenceRecord record;
+    while (!(record = input->Read()).Empty()) {
+        const auto& seq = record.seq;
+
+        // Runs of whatever doesn't fit into two bits
+        std::string runs;
+        uint32_t runs_count = 0;
+        for (size_t i = 0; i < seq.size(); ) {
+            char base = seq[i];
+            size_t end = i + 1;
+            if (base == 'A' || base == 'C' || base == 'G' || base == 'T') {
+                i = end;
+                continue;
+            }
+            while (end < seq.size() && seq[end] == base)
+                ++end;
+            PutU32(runs, static_cast<uint32_t>(i));
+            PutU32(runs, static_cast<uint32_t>(end - i));
+            runs.push_back(base);
+            ++runs_count;
+            i = end;
+        }
+
+        // Proteins (or anything else packing doesn't make smaller) stay as
+        // they are
+        Encoding encoding = runs.size() < seq.size()*3/4 ? kPackedBases : kRawBytes;
+        if (encoding == kPackedBases) {
+            bases.assign((seq.size() + 3)/4, '\0');
+            PackedSequence::PackBases(seq.data(), seq.size(), reinterpret_cast<unsigned char *>(&bases[0]));
+            bases += runs;
+        } else {
+            bases = seq;
+            runs_count = 0;
+        }
+        output.write(bases.data(), static_cast<std::streamsize>(bases.size()));
+
+        PutU64(table, offset);
+        PutU64(table, seq.size());
+        PutU32(table, runs_count);
+        PutU32(table, encoding);
+        PutU64(table, names.size());
+        PutU32(table, static_cast<uint32_t>(record.name.size()));
+        PutU32(table, static_cast<uint32_t>(record.desc.size()));
+        names += record.name;
+        names += record.desc;
+        keys.push_back(UpperCased(record.name));
+        offset += bases.size();
+    }
+
+    // At most half full. Later records win over earlier ones of the same
+    // name, like they would in a dictionary filled in file order.
+    uint64_t capacity = 16;
+    while (capacity < 2*keys.size())
+        capacity *= 2;
+    std::vector<std::pair<uint64_t, uint32_t>> slots(capacity);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        uint64_t hash = HashBytes(keys[i].data(), keys[i].size());
+        for (uint64_t slot = hash & (capacity - 1); ; slot = (slot + 1) & (capacity - 1)) {
+            auto& entry = slots[slot];
+            if (entry.second == 0 || (entry.first == hash && keys[entry.second - 1] == keys[i])) {
+                entry = {hash, static_cast<uint32_t>(i + 1)};
+                break;
+            }
+        }
+    }
+    std::string hash_table;
+    for (const auto& slot : slots) {
+        PutU64(hash_table, slot.first);
+        PutU32(hash_table, slot.second);
+        PutU32(hash_table, 0);
+    }
+
+    std::string header;
+    uint64_t table_offset = offset;
+    uint64_t names_offset = table_offset + table.size();
+    uint64_t hash_offset = names_offset + names.size();
+    PutU64(header, stamp.size);
+    PutU64(header, stamp.modified);
+    PutU64(header, stamp.checksum);
+    PutU64(header, keys.size());
+    PutU64(header, table_offset);
+    PutU64(header, names_offset);
+    PutU64(header, hash_offset);
+    PutU64(header, capacity);
+
+    output.write(table.data(), static_cast<std::streamsize>(table.size()));
+    output.write(names.data(), static_cast<std::streamsize>(names.size()));
+    output.write(hash_table.data(), static_cast<std::streamsize>(hash_table.size()));
+    output.seekp(kMagicLength);
+    output.write(header.data(), static_cast<std::streamsize>(header.size()));
+    output.close();
+
+    if (!output || std::rename(temporary_path.c_str(), cache_path.c_str()) != 0) {
+        PrintfLog("Can't write %s\n", cache_path.c_str());
+        std::remove(temporary_path.c_str());
+        return nullptr;
+    }
+
+    std::unique_ptr<ReferenceCache> cache(new ReferenceCache(source_path));
+    if (!cache->Map_(stamp.checksum))
+        return nullptr;
+    return cache;
+}
+
+bool ReferenceCache::Map_(uint64_t source_checksum)
+{
+    descriptor_ = open(CachePath(source_path_).c_str(), O_RDONLY);
+    if (descriptor_ < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(descriptor_, &info) != 0 || info.st_size < static_cast<off_t>(kHeaderLength))
+        return false;
+    size_ = static_cast<size_t>(info.st_size);
+
+    void *mapping = mmap(nullptr, size_, PROT_READ, MAP_SHARED, descriptor_, 0);
+    if (mapping == MAP_FAILED)
+        return false;
+    data_ = static_cast<const unsigned char *>(mapping);
+
+    if (std::memcmp(data_, kMagic, kMagicLength) != 0)
+        return false;
+    const unsigned char *header = data_ + kMagicLength;
+    if (GetU64(header + 2*8) != source_checksum)
+        return false;
+
+    records_count_ = GetU64(header + 3*8);
+    uint64_t table_offset = GetU64(header + 4*8);
+    uint64_t names_offset = GetU64(header + 5*8);
+    uint64_t hash_offset = GetU64(header + 6*8);
+    hash_capacity_ = GetU64(header + 7*8);
+
+    // Sections follow each other, the hash table ends the file
+    if (table_offset < kHeaderLength || table_offset > size_ ||
+        records_count_ > (size_ - table_offset)/kTableEntryLength ||
+        names_offset != table_offset + records_count_*kTableEntryLength ||
+        hash_offset < names_offset || hash_offset > size_ ||
+        hash_capacity_ == 0 || (hash_capacity_ & (hash_capacity_ - 1)) != 0 ||
+        hash_capacity_ <= records_count_ ||
+        hash_capacity_ != (size_ - hash_offset)/kHashSlotLength ||
+        hash_offset + hash_capacity_*kHashSlotLength != size_)
+        return false;
+
+    data_end_ = table_offset;
+    table_ = data_ + table_offset;
+    names_ = data_ + names_offset;
+    names_size_ = static_cast<size_t>(hash_offset - names_offset);
+    hash_ = data_ + hash_offset;
+    return true;
+}
+
+size_t ReferenceCache::size() const
+{
+    return static_cast<size_t>(records_count_);
+}
+
+const unsigned char *ReferenceCache::Find_(const std::string& key) const
+{
+    uint64_t hash = HashBytes(key.data(), key.size());
+    uint64_t slot = hash & (hash_capacity_ - 1);
+    for (uint64_t probes = 0; probes < hash_capacity_; ++probes, slot = (slot + 1) & (hash_capacity_ - 1)) {
+        const unsigned char *entry = hash_ + slot*kHashSlotLength;
+        uint32_t record = GetU32(entry + 8);
+        if (record == 0)
+            return nullptr;
+        if (GetU64(entry) != hash || record > records_count_)
+            continue;
+
+        const unsigned char *table_entry = table_ + (record - 1)*kTableEntryLength;
+        uint64_t name_offset = GetU64(table_entry + 24);
+        uint32_t name_length = GetU32(table_entry + 32);
+        if (name_length != key.size() || name_offset + name_length > names_size_)
+            continue;
+        const unsigned char *name = names_ + name_offset;
+        if (std::equal(key.begin(), key.end(), name, [](char a, unsigned char b) {
+                return a == static_cast<char>(std::toupper(b));
+            }))
+            return table_entry;
+    }
+    return nullptr;
+}
+
+bool ReferenceCache::Fetch(const std::string& key, gene::SequenceRecord& record) const
+{
+    const unsigned char *entry = Find_(key);
+    if (!entry)
+        return false;
+
+    uint64_t data_offset = GetU64(entry);
+    uint64_t length = GetU64(entry + 8);
+    uint32_t runs_count = GetU32(entry + 16);
+    uint32_t encoding = GetU32(entry + 20);
+    uint64_t name_offset = GetU64(entry + 24);
+    uint32_t name_length = GetU32(entry + 32);
+    uint32_t desc_length = GetU32(entry + 36);
+
+    uint64_t data_length = encoding == kRawBytes ? length : (length + 3)/4 + runs_count*kRunLength;
+    if (name_offset + name_length + desc_length > names_size_ ||
+        data_offset < kHeaderLength || data_offset > data_end_ || data_length > data_end_ - data_offset)
+        throw std::runtime_error("Reference cache " + CachePath(source_path_) + " is corrupted");
+
+    auto names = reinterpret_cast<const char *>(names_ + name_offset);
+    record.name.assign(names, name_length);
+    record.desc.assign(names + name_length, desc_length);
+    record.quality.clear();
+
+    const unsigned char *data = data_ + data_offset;
+    if (encoding == kRawBytes) {
+        record.seq.assign(reinterpret_cast<const char *>(data), static_cast<size_t>(length));
+        return true;
+    }
+
+    record.seq.resize(static_cast<size_t>(length));
+    PackedSequence::UnpackBases(data, record.seq.size(), &record.seq[0]);
+    const unsigned char *run = data + (length + 3)/4;
+    for (uint32_t i = 0; i < runs_count; ++i, run += kRunLength) {
+        uint32_t start = GetU32(run);
+        uint32_t run_length = GetU32(run + 4);
+        if (start > length || run_length > length - start)
+            throw std::runtime_error("Reference cache " + CachePath(source_path_) + " is corrupted");
+        std::fill_n(record.seq.begin() + start, run_length, static_cast<char>(run[8]));
+    }
+    return true;
+}
+
+std::string ReferenceCache::filePath() const
+{
+    return source_path_;
+}
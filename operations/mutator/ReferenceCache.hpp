@@ -0,0 +1,90 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef LIBGENE_OPERATIONS_REFERENCE_CACHE_HPP_
+#define LIBGENE_OPERATIONS_REFERENCE_CACHE_HPP_
+
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#include "ReferenceSource.hpp"
+
+// Binary copy of a reference that is built once and then memory-mapped, so
+// later runs don't parse the reference again. Nucleotide sequences are kept
+// two bits a base with their non-ACGT runs next to them (see
+// PackedSequence), anything else (protein translations) as it is. Records
+// are found through an open-addressing hash table of their upper-cased
+// names. Layout:
+//
+//   "GUREF001"
+//   header:  u64 source size, u64 source mtime, u64 source checksum,
+//            u64 records, u64 table offset, u64 names offset,
+//            u64 hash offset, u64 hash capacity
+//   data:    per record: bases, then (u32 start, u32 length, u8 base) runs
+//   table:   per record: u64 data offset, u64 length, u32 runs, u32 encoding,
+//            u64 names offset, u32 name length, u32 description length
+//   names:   name and description of every record
+//   hash:    (u64 name hash, u32 record + 1, u32 unused) per slot
+//
+// The checksum covers the size, modification time and the first and last
+// megabyte of the source, so a changed source is noticed without reading
+// all of it.
+class ReferenceCache final : public ReferenceSource {
+ public:
+    static const std::string kExtension;
+
+    static std::string CachePath(const std::string& source_path);
+
+    // Returns nullptr if there is no cache of 'source_path', or if the cache
+    // is out of date or damaged
+    static std::unique_ptr<ReferenceCache> Open(const std::string& source_path);
+    // Reads 'source_path' in any format RecordFile knows about and writes
+    // its cache. Returns nullptr if either fails.
+    static std::unique_ptr<ReferenceCache> Build(const std::string& source_path,
+                                                 const std::unique_ptr<gene::CommandLineFlags>& flags);
+
+    ~ReferenceCache() override;
+
+    size_t size() const;
+
+    bool Fetch(const std::string& key, gene::SequenceRecord& record) const override;
+    std::string filePath() const override;
+
+ private:
+    explicit ReferenceCache(const std::string& source_path);
+    bool Map_(uint64_t source_checksum);
+    // Returns the table entry of the record, nullptr if there is none
+    const unsigned char *Find_(const std::string& key) const;
+
+    std::string source_path_;
+    int descriptor_{-1};
+    const unsigned char *data_{nullptr};
+    size_t size_{0};
+
+    uint64_t records_count_{0};
+    const unsigned char *table_{nullptr};
+    const unsigned char *names_{nullptr};
+    size_t names_size_{0};
+    const unsigned char *hash_{nullptr};
+    uint64_t hash_capacity_{0};
+    // End of the data section
+    uint64_t data_end_{0};
+};
+
+#endif  // LIBGENE_OPERATIONS_REFERENCE_CACHE_HPP_
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "ReferenceSource.hpp"
+#include "FastaIndex.hpp"
+#include "ReferenceCache.hpp"
+#include "FastaStream.hpp"
+#include "RecordFile.hpp"
+#include <libgene/log/Logger.hpp>
+
+// Reads references straight from their files instead of through a cache
+// built next to them (see ReferenceCache)
+static const std::string kNoReferenceCacheFlag = "no-reference-cache";
+
+std::string UpperCased(std::string text)
+{
+    std::transform(text.begin(), text.end(), text.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+    return text;
+}
+
+namespace {
+
+// For the formats that can't be indexed: every record is read up front
+class InMemoryReference final : public ReferenceSource {
+ public:
+    explicit InMemoryReference(RecordFile& file)
+    : path_(file.filePath())
+    {
+        gene::SequenceRecord record;
+        while (!(record = file.Read()).Empty()) {
+            auto key = UpperCased(record.name);
+            records_[key] = std::move(record);
+        }
+    }
+
+    bool Fetch(const std::string& key, gene::SequenceRecord& record) const override
+    {
+        auto it = records_.find(key);
+        if (it == records_.end())
+            return false;
+        record = it->second;
+        return true;
+    }
+
+    std::string filePath() const override
+    {
+        return path_;
+    }
+
+ private:
+    std::string path_;
+    std::unordered_map<std::string, gene::SequenceRecord> records_;
+};
+
+}  // namespace
+
+std::unique_ptr<ReferenceSource> ReferenceSource::Open(const std::string& path,
+                                                       const std::unique_ptr<gene::CommandLineFlags>& flags)
+{
+    if (!flags->SettingExists(kNoReferenceCacheFlag)) {
+        auto cache = ReferenceCache::Open(path);
+        if (!cache)
+            cache = ReferenceCache::Build(path, flags);
+        if (cache)
+            return cache;
+    }
+
+    if (FastaStreamReader::IsPlainFasta(path)) {
+        try {
+            return std::make_unique<FastaIndex>(path);
+        } catch (std::runtime_error& e) {
+            PrintfLog("Can't index %s (%s), reading it into memory\n", path.c_str(), e.what());
+        }
+    }
+
+    auto file = RecordFile::FileWithName(path, flags, gene::OpenMode::Read);
+    if (!file || !file->isValidGeneFile())
+        return nullptr;
+    return std::make_unique<InMemoryReference>(*file);
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef LIBGENE_OPERATIONS_REFERENCE_SOURCE_HPP_
+#define LIBGENE_OPERATIONS_REFERENCE_SOURCE_HPP_
+
+#include <memory>
+#include <string>
+
+#include <libgene/file/sequence/SequenceRecord.hpp>
+#include <libgene/flags/CommandLineFlags.hpp>
+
+// Reference records looked up by name, case-insensitively. Names are
+// compared upper-cased, so keys passed to Fetch() have to be upper-cased
+// too.
+class ReferenceSource {
+ public:
+    virtual ~ReferenceSource() = default;
+
+    // Goes through the cache of the file, which is built first if it isn't
+    // there or is out of date (see ReferenceCache). Without a cache plain
+    // FASTA is read through its index (see FastaIndex), anything else is
+    // read into memory. Returns nullptr if the file can't be opened.
+    static std::unique_ptr<ReferenceSource> Open(const std::string& path,
+                                                 const std::unique_ptr<gene::CommandLineFlags>& flags);
+
+    // Returns false if there is no record named 'key'. Safe to call from
+    // several threads at once.
+    virtual bool Fetch(const std::string& key, gene::SequenceRecord& record) const = 0;
+    virtual std::string filePath() const = 0;
+};
+
+std::string UpperCased(std::string text);
+
+#endif  // LIBGENE_OPERATIONS_REFERENCE_SOURCE_HPP_
@@ -0,0 +1,433 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <future>
+#include <stdexcept>
+#include <thread>
+
+#include <sys/stat.h>
+
+#include "Sorter.hpp"
+#include "LoserTree.hpp"
+#include "ColumnarSequenceFile.hpp"
+#include "PrefetchingRecordFile.hpp"
+#include <libgene/file/sequence/SequenceRecord.hpp>
+#include <libgene/log/Logger.hpp>
+
+// What records are ordered by: "name" (the default), "sequence" or "barcode"
+static const std::string kSortKeyFlag = "sort-key";
+// Number of leading bases compared when sorting by sequence, all by default
+static const std::string kSortPrefixFlag = "sort-prefix";
+// Memory cap for the records held at once, in megabytes
+static const std::string kSortMemoryFlag = "sort-memory-mb";
+// Number of threads sorting a batch, all logical cores by default
+static const std::string kSortThreadsFlag = "sort-threads";
+
+constexpr int64_t kDefaultMemoryCap = 1024*1024*1024;
+// Batches smaller than this are sorted on a single thread
+constexpr size_t kMinParallelChunk = 16*1024;
+// Memory taken by a run while it is merged: a decoded block plus the batches
+// read ahead of it
+constexpr int64_t kRunReaderBytes = 8*1024*1024;
+constexpr size_t kMaxMergeFanIn = 256;
+constexpr size_t kRunPrefetchDepth = 2;
+
+template <int ThrottleCount = 1024>
+bool HasToUpdateProgress_(int64_t count)
+{
+    return (count % ThrottleCount) == 0;
+}
+
+static int64_t EntryBytes(const std::string& key, const gene::SequenceRecord& record)
+{
+    return sizeof(std::string) + key.capacity() + sizeof(gene::SequenceRecord) +
+           record.name.capacity() + record.desc.capacity() + record.seq.capacity() +
+           record.quality.capacity();
+}
+
+// Size of the file at 'path', or 0 if it can't be told
+static int64_t FileLength(const std::string& path)
+{
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+        return 0;
+    return static_cast<int64_t>(info.st_size);
+}
+
+Sorter::Sorter(std::vector<std::string> input_paths,
+               std::string output_path,
+               std::unique_ptr<gene::CommandLineFlags>&& flags)
+: input_paths_(std::move(input_paths)),
+  output_path_(std::move(output_path)),
+  flags_(std::move(flags)),
+  memory_cap_(kDefaultMemoryCap),
+  threads_count_(static_cast<int>(std::thread::hardware_concurrency()))
+{
+    if (flags_->SettingExists(kSortMemoryFlag))
+        memory_cap_ = static_cast<int64_t>(flags_->GetIntSetting(kSortMemoryFlag))*1024*1024;
+    if (flags_->SettingExists(kSortThreadsFlag))
+        threads_count_ = flags_->GetIntSetting(kSortThreadsFlag);
+    threads_count_ = std::max(threads_count_, 1);
+    if (flags_->SettingExists(kSortPrefixFlag))
+        prefix_length_ = static_cast<size_t>(std::max(flags_->GetIntSetting(kSortPrefixFlag), 0));
+}
+
+bool Sorter::Init_()
+{
+    if (flags_->SettingExists(kSortKeyFlag)) {
+        const auto& key = *flags_->GetSetting(kSortKeyFlag);
+        if (key == "sequence") {
+            sort_key_ = SortKey::Sequence;
+        } else if (key == "barcode") {
+            sort_key_ = SortKey::Barcode;
+        } else if (key != "name") {
+            PrintfLog("Unknown sort key '%s', expected 'name', 'sequence' or 'barcode'\n",
+                      key.c_str());
+            return false;
+        }
+    }
+    if (memory_cap_ <= 0) {
+        PrintfLog("Sort memory cap has to be positive\n");
+        return false;
+    }
+
+    for (const auto& path : input_paths_) {
+        auto in_file = RecordFile::FileWithName(path, flags_, gene::OpenMode::Read);
+        if (!in_file) {
+            PrintfLog("Can't open input file %s\n", path.c_str());
+            return false;
+        }
+        if (!in_file->isValidGeneFile()) {
+            PrintfLog("Input file %s has an invalid format\n", path.c_str());
+            return false;
+        }
+        total_size_in_bytes_ += in_file->length();
+        input_files_.push_back(std::move(in_file));
+    }
+    return !input_files_.empty();
+}
+
+bool Sorter::ReportProgress_(float fraction) const
+{
+    return update_progress_callback && update_progress_callback(fraction*100);
+}
+
+std::string Sorter::KeyOf_(const gene::SequenceRecord& record) const
+{
+    switch (sort_key_) {
+        case SortKey::Name:
+            return record.name;
+        case SortKey::Sequence:
+            if (prefix_length_ != 0)
+                return record.seq.substr(0, prefix_length_);
+            return record.seq;
+        case SortKey::Barcode: {
+            // Illumina 1.8 and later end the description with the index,
+            // e.g. "1:N:0:ACGTAC+GGTTAA". Earlier versions end the name with
+            // it, e.g. "...:1234#ACGTAC/1".
+            auto colon = record.desc.rfind(':');
+            if (colon != std::string::npos)
+                return record.desc.substr(colon + 1);
+            auto hash = record.name.rfind('#');
+            if (hash != std::string::npos) {
+                auto slash = record.name.find('/', hash);
+                return record.name.substr(hash + 1, slash == std::string::npos ?
+                                                    std::string::npos : slash - hash - 1);
+            }
+            return std::string();
+        }
+    }
+    return std::string();
+}
+
+void Sorter::SortBatch_(Batch& batch) const
+{
+    auto less = [](const Entry& a, const Entry& b) { return a.key < b.key; };
+
+    size_t chunks = std::min(static_cast<size_t>(threads_count_), batch.size()/kMinParallelChunk);
+    if (chunks < 2) {
+        std::stable_sort(batch.begin(), batch.end(), less);
+        return;
+    }
+
+    // Sort equal chunks on their own threads, then merge neighbours pairwise
+    std::vector<size_t> bounds;
+    for (size_t c = 0; c <= chunks; ++c)
+        bounds.push_back(batch.size()*c/chunks);
+
+    auto begin = batch.begin();
+    std::vector<std::future<void>> tasks;
+    for (size_t c = 0; c < chunks; ++c) {
+        tasks.push_back(std::async(std::launch::async, [=] {
+            std::stable_sort(begin + bounds[c], begin + bounds[c + 1], less);
+        }));
+    }
+    for (auto& task : tasks)
+        task.get();
+
+    for (size_t width = 1; width < chunks; width *= 2) {
+        tasks.clear();
+        for (size_t c = 0; c + width < chunks; c += 2*width) {
+            auto first = begin + bounds[c];
+            auto middle = begin + bounds[c + width];
+            auto last = begin + bounds[std::min(c + 2*width, chunks)];
+            tasks.push_back(std::async(std::launch::async, [=] {
+                std::inplace_merge(first, middle, last, less);
+            }));
+        }
+        for (auto& task : tasks)
+            task.get();
+    }
+}
+
+void Sorter::WriteBatch_(Batch& batch, RecordFile& output) const
+{
+    for (auto& entry : batch)
+        output.Write(entry.record);
+}
+
+std::string Sorter::NewRunPath_()
+{
+    // Runs sit next to the output, which is where there has to be space anyway
+    run_paths_.push_back(output_path_ + "-run" + std::to_string(run_paths_.size() + 1) +
+                         "." + ColumnarSequenceFile::kExtension);
+    return run_paths_.back();
+}
+
+bool Sorter::MergeRuns_(const std::vector<std::string>& run_paths, RecordFile& output,
+                        float progress_from, float progress_to) const
+{
+    std::vector<std::unique_ptr<RecordFile>> runs;
+    int64_t total_bytes = 0;
+    for (const auto& path : run_paths) {
+        auto run = ColumnarSequenceFile::FileWithName(path, gene::OpenMode::Read);
+        if (!run || !run->isValidGeneFile()) {
+            PrintfLog("Can't read sorted run %s\n", path.c_str());
+            throw std::runtime_error("Can't read sorted run\n");
+        }
+        total_bytes += run->length();
+        runs.push_back(std::make_unique<PrefetchingRecordFile>(std::move(run), kRunPrefetchDepth));
+    }
+
+    std::vector<gene::SequenceRecord> heads(runs.size());
+    std::vector<std::string> keys(runs.size());
+    auto less = [&keys](size_t a, size_t b) { return keys[a] < keys[b]; };
+    LoserTree<decltype(less)> tree(runs.size(), less);
+    for (size_t i = 0; i < runs.size(); ++i) {
+        if ((heads[i] = runs[i]->Read()).Empty())
+            tree.SetExhausted(i);
+        else
+            keys[i] = KeyOf_(heads[i]);
+    }
+    tree.Build();
+
+    // Ties go to the earlier run, which keeps equal records in input order
+    int64_t counter = 0;
+    while (!tree.Empty()) {
+        size_t top = tree.Top();
+        output.Write(heads[top]);
+        ++counter;
+
+        bool exhausted = (heads[top] = runs[top]->Read()).Empty();
+        if (!exhausted)
+            keys[top] = KeyOf_(heads[top]);
+        tree.Replay(exhausted);
+
+        if (HasToUpdateProgress_(counter)) {
+            int64_t merged_bytes = 0;
+            for (const auto& run : runs)
+                merged_bytes += run->position();
+            float done = merged_bytes/static_cast<float>(std::max<int64_t>(total_bytes, 1));
+            if (ReportProgress_(progress_from + (progress_to - progress_from)*done))
+                return false;
+        }
+    }
+    return true;
+}
+
+void Sorter::RemoveRuns_() const
+{
+    for (const auto& path : run_paths_)
+        std::remove(path.c_str());
+}
+
+bool Sorter::Process()
+{
+    if (!Init_()) {
+        PrintfLog("Can't proceed further. Aborting operation.");
+        return false;
+    }
+
+    if (flags_->verbose) {
+        PrintfLog("Sorting into ->%s with up to %lld MB of records\n", output_path_.c_str(),
+                  static_cast<long long>(memory_cap_/(1024*1024)));
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    int64_t counter = 0;
+    int64_t bytes_processed = 0;
+
+    // One batch is read while the previous one gets sorted and spilled, and
+    // sorting takes a buffer of up to another batch, so each of them gets a
+    // third of the memory
+    Batch batch;
+    int64_t batch_bytes = 0;
+    std::future<void> spill;
+    auto spill_batch = [this](Batch batch, std::string run_path) {
+        SortBatch_(batch);
+        auto run = ColumnarSequenceFile::FileWithName(run_path, gene::OpenMode::Write);
+        if (!run) {
+            PrintfLog("Can't create sorted run %s\n", run_path.c_str());
+            throw std::runtime_error("Can't create sorted run\n");
+        }
+        WriteBatch_(batch, *run);
+    };
+
+    try {
+        for (const auto& in_file : input_files_) {
+            if (flags_->verbose) {
+                PrintfLog("Sorting in <-%s(%s)\n", in_file->filePath().c_str(),
+                          in_file->strFileType().c_str());
+            }
+
+            gene::SequenceRecord record;
+            while (!(record = in_file->Read()).Empty()) {
+                if (HasToUpdateProgress_(counter)) {
+                    float done = (in_file->position() + bytes_processed)/static_cast<float>(total_size_in_bytes_);
+                    if (ReportProgress_(done/2)) {
+                        if (spill.valid())
+                            spill.wait();
+                        RemoveRuns_();
+                        return true;
+                    }
+                }
+
+                ++counter;
+                Entry entry{KeyOf_(record), std::move(record)};
+                batch_bytes += EntryBytes(entry.key, entry.record);
+                batch.push_back(std::move(entry));
+
+                if (batch_bytes >= memory_cap_/3) {
+                    if (spill.valid())
+                        spill.get();
+                    spill = std::async(std::launch::async, spill_batch, std::move(batch), NewRunPath_());
+                    batch = Batch();
+                    batch_bytes = 0;
+                }
+            }
+            bytes_processed += in_file->length();
+        }
+        if (spill.valid())
+            spill.get();
+
+        if (counter == 0) {
+            PrintfLog("Input file was either empty, or it had an incorrect format\n");
+            return false;
+        }
+
+        std::unique_ptr<RecordFile> output;
+        if (run_paths_.empty()) {
+            // Everything fit into memory
+            SortBatch_(batch);
+            if (!(output = RecordFile::FileWithName(output_path_, flags_, gene::OpenMode::Write))) {
+                PrintfLog("Can't create output file\n");
+                return false;
+            }
+            WriteBatch_(batch, *output);
+        } else {
+            if (!batch.empty())
+                spill_batch(std::move(batch), NewRunPath_());
+            batch = Batch();
+
+            // Merge the runs in passes if reading all of them at once would
+            // take more memory than allowed
+            size_t fan_in = static_cast<size_t>(std::max<int64_t>(memory_cap_/kRunReaderBytes, 2));
+            fan_in = std::min(fan_in, kMaxMergeFanIn);
+            std::vector<std::string> runs = run_paths_;
+
+            // Every pass goes over all of the records, so each one gets an
+            // equal share of the second half of the progress, and the groups
+            // of a pass split that share by their size
+            size_t passes_count = 1;
+            for (size_t count = runs.size(); count > fan_in; count = (count + fan_in - 1)/fan_in)
+                ++passes_count;
+            const float pass_share = 0.5f/passes_count;
+            float pass_from = 0.5f;
+            while (runs.size() > fan_in) {
+                int64_t pass_bytes = 0;
+                for (const auto& path : runs)
+                    pass_bytes += FileLength(path);
+                pass_bytes = std::max<int64_t>(pass_bytes, 1);
+
+                std::vector<std::string> merged_runs;
+                int64_t merged_bytes = 0;
+                for (size_t i = 0; i < runs.size(); i += fan_in) {
+                    std::vector<std::string> group(runs.begin() + i,
+                                                   runs.begin() + std::min(i + fan_in, runs.size()));
+                    float group_from = pass_from + pass_share*merged_bytes/pass_bytes;
+                    for (const auto& path : group)
+                        merged_bytes += FileLength(path);
+                    float group_to = pass_from + pass_share*merged_bytes/pass_bytes;
+                    auto merged_path = NewRunPath_();
+                    auto merged = ColumnarSequenceFile::FileWithName(merged_path, gene::OpenMode::Write);
+                    if (!merged) {
+                        PrintfLog("Can't create sorted run %s\n", merged_path.c_str());
+                        throw std::runtime_error("Can't create sorted run\n");
+                    }
+                    if (!MergeRuns_(group, *merged, group_from, group_to)) {
+                        merged = nullptr;
+                        RemoveRuns_();
+                        return true;
+                    }
+                    for (const auto& path : group)
+                        std::remove(path.c_str());
+                    merged_runs.push_back(merged_path);
+                }
+                runs = std::move(merged_runs);
+                pass_from += pass_share;
+                if (flags_->verbose)
+                    PrintfLog("Merged sorted runs into %zu\n", runs.size());
+            }
+
+            if (!(output = RecordFile::FileWithName(output_path_, flags_, gene::OpenMode::Write))) {
+                PrintfLog("Can't create output file\n");
+                RemoveRuns_();
+                return false;
+            }
+            bool completed = MergeRuns_(runs, *output, pass_from, 1.0f);
+            RemoveRuns_();
+            if (!completed)
+                return true;
+        }
+    } catch (const std::runtime_error&) {
+        if (spill.valid())
+            spill.wait();
+        RemoveRuns_();
+        return false;
+    }
+
+    auto secondsElapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start);
+    if (flags_->verbose) {
+        PrintfLog("%lld records sorted in %.2f seconds using %zu runs\n", counter,
+                  secondsElapsed.count(), run_paths_.size());
+    }
+
+    return true;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef LIBGENE_OPERATIONS_SORTER_HPP_
+#define LIBGENE_OPERATIONS_SORTER_HPP_
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <functional>
+#include <cstdint>
+
+#include "RecordFile.hpp"
+
+#include <libgene/flags/CommandLineFlags.hpp>
+
+// Sorts the records of all inputs by name, sequence (or a prefix of it) or
+// barcode into one output.
+//
+// Records are read in batches of a third of the memory cap, every batch is
+// sorted on all cores and spilled to disk as a run, and the runs are merged
+// at the end. Inputs that fit into a single batch never touch the disk.
+class Sorter final {
+ public:
+    Sorter(std::vector<std::string> input_paths,
+           std::string output_path,
+           std::unique_ptr<gene::CommandLineFlags>&& flags);
+    bool Process();
+    std::function<bool(float)> update_progress_callback;
+
+ private:
+    enum class SortKey {
+        Name,
+        Sequence,
+        Barcode
+    };
+
+    struct Entry {
+        std::string key;
+        gene::SequenceRecord record;
+    };
+    typedef std::vector<Entry> Batch;
+
+    std::vector<std::unique_ptr<RecordFile>> input_files_;
+    std::vector<std::string> input_paths_;
+    std::string output_path_;
+    std::unique_ptr<gene::CommandLineFlags> flags_;
+
+    SortKey sort_key_{SortKey::Name};
+    // Only this many leading bases are compared when sorting by sequence
+    size_t prefix_length_{0};
+    int64_t memory_cap_;
+    int threads_count_;
+
+    int64_t total_size_in_bytes_{0};
+    std::vector<std::string> run_paths_;
+
+    bool Init_();
+    bool ReportProgress_(float fraction) const;
+
+    std::string KeyOf_(const gene::SequenceRecord& record) const;
+    // Sorts 'batch' on all threads, keeping records with equal keys in input order
+    void SortBatch_(Batch& batch) const;
+    void WriteBatch_(Batch& batch, RecordFile& output) const;
+    std::string NewRunPath_();
+
+    // Merges 'run_paths' into 'output', which is taken as done with once
+    // 'progress_from' turns into 'progress_to'. Returns false if cancelled.
+    bool MergeRuns_(const std::vector<std::string>& run_paths, RecordFile& output,
+                    float progress_from, float progress_to) const;
+    void RemoveRuns_() const;
+};
+
+#endif  // LIBGENE_OPERATIONS_SORTER_HPP_
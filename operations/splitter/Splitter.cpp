@@ -15,13 +15,23 @@
  */
 
 #include <chrono>
+#include <stdexcept>
 
 #include "Splitter.hpp"
+#include "FastaStream.hpp"
 #include <libgene/utils/CppUtils.hpp>
 #include <libgene/utils/StringUtils.hpp>
 #include <libgene/file/sequence/SequenceFile.hpp>
+#include <libgene/def/Flags.hpp>
 #include <libgene/log/Logger.hpp>
 
+// Bins output qualities, see QualityBinner for the schemes
+static const std::string kQualityBinsFlag = "quality-bins";
+// Copy FASTA records in pieces instead of reading each one whole
+static const std::string kStreamFastaFlag = "stream-fasta";
+// Path of a JSON file to write the statistics of the run to
+static const std::string kStatsJsonFlag = "stats-json";
+
 template <int ThrottleCount = 1024>
 bool HasToUpdateProgress_(int64_t count)
 {
@@ -37,7 +47,7 @@ Splitter::Splitter(const std::string& input_path,
 
 bool Splitter::Init_()
 {
-    if (!(input_file_ = gene::SequenceFile::FileWithName(inputFilePath, flags_, gene::OpenMode::Read))) {
+    if (!(input_file_ = RecordFile::FileWithName(inputFilePath, flags_, gene::OpenMode::Read))) {
         PrintfLog("Can't open input file\n");
         return false;
     }
@@ -65,9 +75,46 @@ bool Splitter::Init_()
         return false;
     }
     sizeLimit = mb*1024*1024 + kb*1024;
+
+    if (flags_->SettingExists(kQualityBinsFlag)) {
+        // The parts keep the format of the input
+        std::string format;
+        if (flags_->GetSetting(gene::Flags::kInputFormat))
+            format = *flags_->GetSetting(gene::Flags::kInputFormat);
+        try {
+            quality_binner_ = std::make_unique<QualityBinner>(*flags_->GetSetting(kQualityBinsFlag),
+                                                              QualityBinner::PhredOffsetForFormat(format));
+        } catch (const std::invalid_argument& e) {
+            PrintfLog("%s\n", e.what());
+            return false;
+        }
+    }
     return true;
 }
 
+void Splitter::StartStatistics_()
+{
+    if (!flags_->SettingExists(kStatsJsonFlag))
+        return;
+    statistics_ = std::make_unique<RunStatistics>("split");
+    timer_.statistics = statistics_->AddThread("split");
+    timer_.Restart();
+}
+
+void Splitter::FinishStatistics_(int64_t records, int64_t bytes)
+{
+    if (!statistics_)
+        return;
+    timer_.statistics->AddRecords(records, bytes);
+    statistics_->Finish(records, bytes);
+    try {
+        statistics_->WriteJson(*flags_->GetSetting(kStatsJsonFlag));
+    } catch (const std::runtime_error& e) {
+        // The split itself went fine
+        PrintfLog("%s", e.what());
+    }
+}
+
 bool Splitter::Process()
 {
     if (!Init_()) {
@@ -79,6 +126,14 @@ bool Splitter::Process()
         // Estimate file size
         sizeLimit = (input_file_->length()/(double)fileLimit)*101l/100l;
     }
+
+    if (flags_->SettingExists(kStreamFastaFlag) &&
+        FastaStreamReader::IsPlainFasta(inputFilePath) &&
+        FastaStreamReader::IsPlainFasta(outFileName)) {
+        // Don't keep the file open twice
+        input_file_ = nullptr;
+        return ProcessFastaStream_();
+    }
     
     if (flags_->verbose) {
         PrintfLog("Splitting <-%s(%s)\n",
@@ -94,27 +149,33 @@ bool Splitter::Process()
     
     gene::SequenceRecord record;
     auto start = std::chrono::high_resolution_clock::now();
+    StartStatistics_();
     long counter = 0;
     int recordCounter = 0;
     
-    std::unique_ptr<gene::SequenceFile> outFile = nullptr;
+    std::unique_ptr<RecordFile> outFile = nullptr;
     
     int fileNumber = 0;
     int64_t lastChunkStart = 0;
     
     while (!(record = input_file_->Read()).Empty()) {
+        timer_.Lap(RunStatistics::Stage::Read);
         if (!outFile) {
             // Open next
             ++fileNumber;
             std::string outPath = gene::utils::InsertSuffixBeforePathExtension(outFileName, std::to_string(fileNumber));
 
-            if (!(outFile = gene::SequenceFile::FileWithName(outPath, flags_, gene::OpenMode::Write))) {
+            if (!(outFile = RecordFile::FileWithName(outPath, flags_, gene::OpenMode::Write))) {
                 PrintfLog("Can't create output file %s\n", outPath.c_str());
                 return false;
             }
             if (flags_->verbose)
                 PrintfLog("Splitting into ->%s(%s)\n", outFile->filePath().c_str(), outFile->strFileType().c_str());
         }
+        if (quality_binner_) {
+            quality_binner_->Apply(record.quality);
+            timer_.Lap(RunStatistics::Stage::Format);
+        }
         outFile->Write(record);
         ++counter;
         
@@ -131,6 +192,10 @@ bool Splitter::Process()
                 outFile = nullptr;
             }
         }
+        // Includes closing a finished part
+        timer_.Lap(RunStatistics::Stage::Write);
+        if (HasToUpdateProgress_(counter) && statistics_)
+            statistics_->AddSample(counter, input_file_->position());
         if (HasToUpdateProgress_(counter) && update_progress_callback) {
             bool hasToCancelOperation = update_progress_callback(input_file_->position()/(float)input_file_->length()*100.0);
             if (hasToCancelOperation) {
@@ -138,8 +203,95 @@ bool Splitter::Process()
             }
         }
     }
+    FinishStatistics_(counter, input_file_->length());
     auto elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start);
     
+    if (flags_->verbose) {
+        PrintfLog("%ld records processed in %.2f seconds\n", counter, elapsed.count());
+        if (quality_binner_)
+            quality_binner_->LogStatistics();
+    }
+    return true;
+}
+
+bool Splitter::ProcessFastaStream_()
+{
+    FastaStreamReader reader(inputFilePath);
+    if (!reader.is_open()) {
+        PrintfLog("Can't open input file\n");
+        return false;
+    }
+
+    if (flags_->verbose) {
+        PrintfLog("Splitting <-%s(fasta) in pieces\n", inputFilePath.c_str());
+        if (fileLimit)
+            PrintfLog("Trying to get %lld files each of approximately %lldKB\n", fileLimit, sizeLimit/1024);
+        else if (recordLimit)
+            PrintfLog("Writing maximum %d records per file\n", recordLimit);
+        else
+            PrintfLog("Writing maximum %lld bytes per file\n", sizeLimit);
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    StartStatistics_();
+    long counter = 0;
+    int recordCounter = 0;
+    int fileNumber = 0;
+    int64_t lastChunkStart = 0;
+
+    std::unique_ptr<FastaStreamWriter> outFile = nullptr;
+    std::string header;
+
+    while (reader.NextRecord(header)) {
+        timer_.Lap(RunStatistics::Stage::Read);
+        if (!outFile) {
+            // Open next
+            ++fileNumber;
+            std::string outPath = gene::utils::InsertSuffixBeforePathExtension(outFileName, std::to_string(fileNumber));
+
+            outFile = std::make_unique<FastaStreamWriter>(outPath);
+            if (!outFile->is_open()) {
+                PrintfLog("Can't create output file %s\n", outPath.c_str());
+                return false;
+            }
+            if (flags_->verbose)
+                PrintfLog("Splitting into ->%s(fasta)\n", outPath.c_str());
+        }
+        // Every record keeps the line width it had
+        outFile->BeginRecord(header, reader.line_width());
+        // The sequence is read and written in the same pass
+        reader.CopySequenceTo(*outFile);
+        ++counter;
+
+        if (recordLimit) {
+            // by records
+            if (++recordCounter > recordLimit) {
+                recordCounter = 0;
+                outFile = nullptr;
+            }
+        } else {
+            // By size
+            if (reader.position() - lastChunkStart >= sizeLimit) {
+                lastChunkStart = reader.position();
+                outFile = nullptr;
+            }
+        }
+        timer_.Lap(RunStatistics::Stage::Write);
+        if (HasToUpdateProgress_<64>(counter) && statistics_)
+            statistics_->AddSample(counter, reader.position());
+        if (HasToUpdateProgress_<64>(counter) && update_progress_callback) {
+            bool hasToCancelOperation = update_progress_callback(reader.position()/(float)reader.length()*100.0);
+            if (hasToCancelOperation) {
+                return true;
+            }
+        }
+    }
+    if (outFile)
+        outFile->Close();
+    timer_.Lap(RunStatistics::Stage::Write);
+    FinishStatistics_(counter, reader.length());
+    auto elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start);
+
     if (flags_->verbose) {
         PrintfLog("%ld records processed in %.2f seconds\n", counter, elapsed.count());
     }
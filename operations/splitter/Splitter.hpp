@@ -21,7 +21,11 @@
 #include <memory>
 #include <functional>
 
-#include <libgene/file/sequence/SequenceFile.hpp>
+#include "RecordFile.hpp"
+#include "QualityBinner.hpp"
+#include "RunStatistics.hpp"
+#include "TraceRecorder.hpp"
+
 #include <libgene/file/alignment/AlignmentFile.hpp>
 #include <libgene/flags/CommandLineFlags.hpp>
 
@@ -35,9 +39,18 @@ class Splitter final {
 
  private:
     bool Init_();
+    bool ProcessFastaStream_();
+    void StartStatistics_();
+    // Writes the statistics out once the input is split
+    void FinishStatistics_(int64_t records, int64_t bytes);
 
-    std::unique_ptr<gene::SequenceFile> input_file_;
+    std::unique_ptr<RecordFile> input_file_;
     std::unique_ptr<gene::CommandLineFlags> flags_;
+    std::unique_ptr<QualityBinner> quality_binner_;
+    // Only kept with the "stats-json" flag, 'timer_' splits the time of the
+    // one thread splitting
+    std::unique_ptr<RunStatistics> statistics_;
+    StageTimer timer_;
 
     std::string outFileName;
     int recordLimit;
@@ -20,6 +20,7 @@
 #import "GUProgressWindowController.h"
 
 #include "Converter.hpp"
+#include "ColumnarSequenceFile.hpp"
 #include <libgene/flags/CommandLineFlags.hpp>
 #include <libgene/utils/CppUtils.hpp>
 #include <libgene/file/sequence/FastaFile.hpp>
@@ -93,6 +94,7 @@
     auto alignmentExtensions = gene::AlignmentFile::supportedExtensions();
     fileExtensions.insert(fileExtensions.end(),
                           alignmentExtensions.begin(), alignmentExtensions.end());
+    fileExtensions.push_back(ColumnarSequenceFile::kExtension);
     
     for (const auto& ext : fileExtensions) {
         [supportedFileExtensions addObject:[NSString stringWithUTF8String:ext.c_str()]];
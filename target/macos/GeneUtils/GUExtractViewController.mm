@@ -24,6 +24,7 @@
 #import "GUUtils.h"
 
 #include "Extractor.hpp"
+#include "ExtractorBatch.hpp"
 #include <libgene/flags/CommandLineFlags.hpp>
 #include <libgene/def/Flags.hpp>
 #include <libgene/io/streams/PlainStringInputStream.hpp>
@@ -269,10 +270,6 @@
         [self enqueCurrentJob];
     
     [newQueryTextField.window makeFirstResponder:nil];
-    dispatch_async(dispatch_get_main_queue(), ^{
-        [progressWindow showProgessWindowWithMode:GUProgressWindowMode::DeterminateMultipleJobs];
-        progressWindow.numberOfFiles = job_queue_.size() + 1;
-    });
     [self performExtract];
 }
 
@@ -288,54 +285,71 @@
         return;
     }
     
-    auto job = std::move(job_queue_.front());
-    __block auto extractor = std::make_unique<Extractor>(std::move(job));
-    job_queue_.pop_front();
-    
-    if (!extractor)
-        return;
+    // Jobs that read the same inputs are executed in a single pass
+    std::vector<ExtractorJob> jobs;
+    while (!job_queue_.empty()) {
+        jobs.emplace_back(std::move(job_queue_.front()));
+        job_queue_.pop_front();
+    }
 
-    [newQueryTextField.window makeFirstResponder:nil];
+    __block std::unique_ptr<ExtractorBatch> batch;
+    try {
+        batch = std::make_unique<ExtractorBatch>(std::move(jobs));
+    } catch (...) {
+        [GUUtils showAlertWithMessage:@"Can't create output file.\n\nSee the Log for more details."
+                        andImageNamed:@"NSError"];
+        extractButton.title = @"Extract";
+        [self updateDequeLastJobButtonState];
+        return;
+    }
     
+    long numberOfGroups = batch->groups_count();
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [progressWindow showProgessWindowWithMode:GUProgressWindowMode::DeterminateMultipleJobs];
+        progressWindow.numberOfFiles = numberOfGroups;
+    });
+
     __weak id selfWeak = self;
-    extractor->update_progress_callback = [selfWeak](float percentage) {
+    batch->update_progress_callback = [selfWeak](float percentage) {
         return [selfWeak updateProgressTo:percentage];
     };
+    GUProgressWindowController *progress = progressWindow;
+    batch->group_started_callback = [progress](size_t group_index) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [progress setNumberOfCurrentFile:group_index + 1];
+        });
+    };
     
     dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
         __block bool code;
         try {
-             code = extractor->Process();
+             code = batch->Process();
         } catch (...) {
+            batch = nullptr;
             dispatch_async(dispatch_get_main_queue(), ^{
                 [progressWindow cancelCurrentTask];
                 [progressWindow dismissProgressViewController];
                 NSString* text = @"Found a pair of reads that don't correspond to each other.\n\nSee the Log for more details.";
                 [GUUtils showAlertWithMessage:text andImageNamed:@"NSError"];
+                extractButton.title = @"Extract";
+                [self updateDequeLastJobButtonState];
             });
             return;
         }
-        extractor = nullptr;
+        batch = nullptr;
         
         dispatch_async(dispatch_get_main_queue(), ^{
             bool was_сancelled = [progressWindow cancelWasClicked];
-            
-            if (job_queue_.empty() || was_сancelled) {
-                [progressWindow dismissProgressViewController];
-                if (was_сancelled) {
-                    openOutputFileButton.enabled = [[NSFileManager defaultManager]
-                                                     fileExistsAtPath:outputFilePathControl.URL.path] &&
-                    (searchBasedOnBarcodesRadioButton.state == NSControlStateValueOff);
-                    PrintfLog("CANCELLED");
-                    [progressWindow resetController];
-                    return;
-                }
-            } else if (!job_queue_.empty()) {
-                [progressWindow setNumberOfCurrentFile:progressWindow.numberOfFiles -
-                                                        job_queue_.size() + 1];
-                // Recursively dispatch the next job in queue
-                [selfWeak performExtract];
-                // It will show the completion dialogue on the last iteration
+            [progressWindow dismissProgressViewController];
+            extractButton.title = @"Extract";
+            [self updateDequeLastJobButtonState];
+
+            if (was_сancelled) {
+                openOutputFileButton.enabled = [[NSFileManager defaultManager]
+                                                 fileExistsAtPath:outputFilePathControl.URL.path] &&
+                (searchBasedOnBarcodesRadioButton.state == NSControlStateValueOff);
+                PrintfLog("CANCELLED");
+                [progressWindow resetController];
                 return;
             }
             
@@ -347,8 +361,6 @@
                 NSString* text = @"Input file was either empty, or it had an incorrect format";
                 [GUUtils showAlertWithMessage:text andImageNamed:@"NSError"];
             }
-            extractButton.title = @"Extract";
-            [self updateDequeLastJobButtonState];
         });
     });
 }
@@ -14,16 +14,15 @@
  * limitations under the License.
  */
 
-#import "SequenceFileObj.h"
-#import "CommandLineFlagsObj.h"
 #import "GUMutateViewController.h"
-#import "Mutator.h"
 #import "GUProgressWindowController.h"
 #import "Utils.h"
 #import "GUUtils.h"
 #import "GenomicCsvFileObj.h"
 #import "GenomicTsvFileObj.h"
 
+#include "Mutator.hpp"
+
 #include <libgene/log/Logger.hpp>
 
 @implementation GUMutateViewController
@@ -91,16 +90,21 @@
 
 - (IBAction)_mutateButtonClicked:(id)sender
 {
-    CommandLineFlagsObj* flags = [CommandLineFlagsObj new];
-    flags.verbose = YES;
+    auto flags = std::make_unique<gene::CommandLineFlags>();
+    flags->verbose = true;
     
-    __block Mutator *mut = [[Mutator alloc] initWithInput:_mutationDataPathControl.URL.path.UTF8String
-                                        reference:_referenceFilePathControl.URL.path.UTF8String
-                                   transReference:_translationReferenceFilePathControl.URL.path.UTF8String
-                                            flags:flags];
-    if (!mut) {
-        return;
-    }
+    __block auto mut = std::make_unique<Mutator>(_mutationDataPathControl.URL.path.UTF8String,
+                                                 _referenceFilePathControl.URL.path.UTF8String,
+                                                 _translationReferenceFilePathControl.URL.path.UTF8String,
+                                                 std::string(),
+                                                 std::string(),
+                                                 std::move(flags));
+    
+    __weak id selfWeak = self;
+    mut->update_progress_callback = [selfWeak](float percentage)
+    {
+        return [selfWeak updateProgressTo:percentage];
+    };
     
     dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
         
@@ -108,8 +112,8 @@
             [_progressWindow showProgessWindowWithMode:GUProgressWindowMode::Determinate];
         });
         
-        __block BOOL code = [mut process];
-        mut = nil;
+        __block bool code = mut->Process();
+        mut = nullptr;
         
         dispatch_async(dispatch_get_main_queue(), ^{
             BOOL wasCancelled = [_progressWindow dismissProgressViewController];
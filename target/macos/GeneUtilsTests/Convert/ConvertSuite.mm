@@ -17,11 +17,16 @@
 #import <XCTest/XCTest.h>
 
 #include "Converter.hpp"
+#include "ColumnarSequenceFile.hpp"
+#include "FileSegments.hpp"
+#include "SeparatedRecordFile.hpp"
 #include <libgene/def/Flags.hpp>
 
 #include <memory>
 #include <string>
 #include <fstream>
+#include <cmath>
+#include <iterator>
 
 using namespace std::string_literals;
 
@@ -566,6 +571,38 @@ using gene::Flags;
     std::remove(outputPathCtp.c_str());
 }
 
+- (void)testFastTablesMatchLibgeneOutput
+{
+    std::string testPath = testSuiteDir + "/QuotedTsvToCsv";
+    std::vector<std::string> inputPath = {testPath + "/QuotedTsvWithQuotesInput.tsvc"};
+    std::string outputPath = testPath + "/QuotedTsvWithQuotesInput-fast.csvc";
+    
+    auto flags = std::make_unique<gene::CommandLineFlags>();
+    flags->SetSetting("o", "csv");
+    flags->SetSetting("fast-tables", "");
+    
+    auto converter = std::make_unique<Converter>(inputPath, outputPath, std::move(flags));
+    XCTAssert(converter->Process(), "FAIL. Converter 'process' returned false.");
+    converter = nullptr;
+    
+    // Byte for byte what libgene writes for the same input
+    auto ReadWhole = [](const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    };
+    std::string output = ReadWhole(outputPath);
+    XCTAssert(!output.empty(), "Output file wasn't produced");
+    XCTAssert(output == ReadWhole(testPath + "/QuotedTsvWithQuotesOutput.csvc"),
+              "Table doesn't match libgene's output");
+    XCTAssert(ReadWhole(SeparatedRecordFile::ColumnTypesPath(outputPath)) ==
+              ReadWhole(testPath + "/QuotedTsvWithQuotesOutput.ctp"),
+              "Column types don't match libgene's output");
+    
+    // Clean-up
+    std::remove(outputPath.c_str());
+    std::remove(SeparatedRecordFile::ColumnTypesPath(outputPath).c_str());
+}
+
 - (void)testNonQuotedCsvToFastQConversion
 {
     std::string testPath = testSuiteDir + "/QuotedCsvToFastq";
@@ -608,6 +645,336 @@ using gene::Flags;
     std::remove(outputPath.c_str());
 }
 
+- (void)testFastQToColumnarAndBackConversion
+{
+    std::string testPath = testSuiteDir + "/FastqToFasta";
+    std::vector<std::string> inputPath = {testPath + "/IlluminaSimpleInput.fastq"};
+    std::string columnarPath = testPath + "/IlluminaSimpleInput-converted.gcol";
+    
+    auto flags = std::make_unique<gene::CommandLineFlags>();
+    flags->SetSetting("o", "fastq");
+    
+    auto converter = std::make_unique<Converter>(inputPath, columnarPath, std::move(flags));
+    XCTAssert(converter->Process(), "FAIL. Converter 'process' returned false.");
+    converter = nullptr;
+    
+    // Convert back, the records have to survive unchanged
+    std::string outputPath = testPath + "/IlluminaSimpleInput-converted.fastq";
+    flags = std::make_unique<gene::CommandLineFlags>();
+    flags->SetSetting("o", "fastq");
+    
+    converter = std::make_unique<Converter>(std::vector<std::string>{columnarPath},
+                                            outputPath, std::move(flags));
+    XCTAssert(converter->Process(), "FAIL. Converter 'process' returned false.");
+    converter = nullptr;
+    
+    std::ifstream output(outputPath);
+    XCTAssert(output, "Output file wasn't produced");
+    
+    std::ifstream referenceOutput(inputPath.front());
+    XCTAssert(referenceOutput, "Could not open reference file");
+    
+    std::string referenceLine, outputLine;
+    bool outputIsEmpty = true;
+    while (std::getline(output, outputLine)) {
+        outputIsEmpty = false;
+        XCTAssert(std::getline(referenceOutput, referenceLine),
+                  "Output file is longer than expected");
+        XCTAssert(outputLine == referenceLine, "Lines don't match");
+    }
+    
+    XCTAssert(!std::getline(referenceOutput, referenceLine),
+              "Output file is shorter than reference");
+    XCTAssert(!outputIsEmpty, "Output file was empty");
+    
+    referenceOutput.close();
+    output.close();
+    
+    // Clean-up
+    std::remove(columnarPath.c_str());
+    std::remove(outputPath.c_str());
+}
+
+- (void)testColumnarSegmentsAreJoinedInOrder
+{
+    std::string testPath = testSuiteDir + "/FastqToFasta";
+    std::vector<std::string> paths = {
+        testPath + "/Joined.gcol",
+        testPath + "/Joined-segment1.gcol",
+        testPath + "/Joined-segment2.gcol",
+        testPath + "/Joined-segment3.gcol"
+    };
+    // The third segment is left empty
+    std::vector<int> recordsPerFile = {100, 250, 0, 70};
+    
+    std::vector<gene::SequenceRecord> records;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        auto file = ColumnarSequenceFile::FileWithName(paths[i], gene::OpenMode::Write);
+        XCTAssert(file, "Can't create %s", paths[i].c_str());
+        for (int j = 0; j < recordsPerFile[i]; ++j) {
+            gene::SequenceRecord record;
+            record.name = "read" + std::to_string(records.size());
+            record.seq = std::string(j % 40 + 1, "ACGTN"[j % 5]);
+            record.quality = std::string(record.seq.size(), 'I');
+            file->Write(record);
+            records.push_back(record);
+        }
+    }
+    for (size_t i = 1; i < paths.size(); ++i)
+        ColumnarSequenceFile::Concatenate(paths.front(), paths[i]);
+    
+    auto joined = ColumnarSequenceFile::FileWithName(paths.front(), gene::OpenMode::Read);
+    XCTAssert(joined && joined->isValidGeneFile(), "Joined file is invalid");
+    XCTAssert(joined->blocks_count() == 3, "Every non-empty file should keep its block");
+    XCTAssert(joined->records_count() == static_cast<int64_t>(records.size()), "Wrong records count");
+    for (const auto& expected : records) {
+        auto record = joined->Read();
+        XCTAssert(record.name == expected.name && record.seq == expected.seq &&
+                  record.quality == expected.quality, "Records don't match");
+    }
+    XCTAssert(joined->Read().Empty(), "Joined file is longer than expected");
+    joined = nullptr;
+    
+    // Segments are gone once appended
+    for (size_t i = 1; i < paths.size(); ++i)
+        XCTAssert(!std::ifstream(paths[i]), "Segment %s was left behind", paths[i].c_str());
+    std::remove(paths.front().c_str());
+}
+
+- (void)testFastQQualityBinning
+{
+    std::string testPath = testSuiteDir + "/FastqToFasta";
+    std::vector<std::string> inputPath = {testPath + "/IlluminaSimpleInput.fastq"};
+    std::string outputPath = testPath + "/IlluminaSimpleInput-binned.fastq";
+    
+    auto flags = std::make_unique<gene::CommandLineFlags>();
+    flags->SetSetting("o", "fastq");
+    flags->SetSetting("quality-bins", "0-19:10,20-93:30");
+    
+    auto converter = std::make_unique<Converter>(inputPath, outputPath, std::move(flags));
+    XCTAssert(converter->Process(), "FAIL. Converter 'process' returned false.");
+    converter = nullptr;
+    
+    std::ifstream output(outputPath);
+    XCTAssert(output, "Output file wasn't produced");
+    
+    // Every fourth line holds qualities, which may only take the two binned values
+    std::string line;
+    int64_t lineNumber = 0;
+    bool outputIsEmpty = true;
+    while (std::getline(output, line)) {
+        outputIsEmpty = false;
+        if (++lineNumber % 4 != 0)
+            continue;
+        for (char quality : line)
+            XCTAssert(quality == '!' + 10 || quality == '!' + 30, "Quality wasn't binned");
+    }
+    XCTAssert(!outputIsEmpty, "Output file was empty");
+    
+    output.close();
+    
+    // Clean-up
+    std::remove(outputPath.c_str());
+}
+
+- (void)testFastQIllumina1_3QualityBinning
+{
+    std::string testPath = testSuiteDir + "/FastqIllumina1_3ToFastqIllumina1_8";
+    std::vector<std::string> inputPath = {testPath + "/Illumina1_3Input.fastq"};
+    std::string outputPath = testPath + "/Illumina1_3Input-binned.fastq";
+    
+    // Phred+64 can't hold scores above 63, which the top bin has to respect
+    auto flags = std::make_unique<gene::CommandLineFlags>();
+    flags->SetSetting("i", "fastq-"s + Flags::kIllumina1_3Suffix);
+    flags->SetSetting("o", "fastq-"s + Flags::kIllumina1_3Suffix);
+    flags->SetSetting("quality-bins", "illumina8");
+    
+    auto converter = std::make_unique<Converter>(inputPath, outputPath, std::move(flags));
+    XCTAssert(converter->Process(), "FAIL. Converter 'process' returned false.");
+    converter = nullptr;
+    
+    std::ifstream output(outputPath);
+    XCTAssert(output, "Output file wasn't produced");
+    
+    // Scores 0 and 1 are kept, everything else takes one of the bin values
+    const std::string allowedQualities = {'@' + 0, '@' + 1, '@' + 6, '@' + 15, '@' + 22,
+                                          '@' + 27, '@' + 33, '@' + 37, '@' + 40};
+    std::string line;
+    int64_t lineNumber = 0;
+    bool outputIsEmpty = true;
+    while (std::getline(output, line)) {
+        outputIsEmpty = false;
+        if (++lineNumber % 4 != 0)
+            continue;
+        for (char quality : line)
+            XCTAssert(allowedQualities.find(quality) != std::string::npos, "Quality wasn't binned");
+    }
+    XCTAssert(!outputIsEmpty, "Output file was empty");
+    
+    output.close();
+    
+    // Clean-up
+    std::remove(outputPath.c_str());
+}
+
+- (void)testMultipleFastQInputsKeepTheirOrder
+{
+    std::vector<std::string> inputPaths = {
+        testSuiteDir + "/FastqToFasta/IlluminaSimpleInput.fastq",
+        testSuiteDir + "/FastqIllumina1_8ToFastqSanger/Illumina1_8Input.fastq",
+        testSuiteDir + "/FastqToFasta/IlluminaSimpleInput.fastq"
+    };
+    std::string outputPath = testSuiteDir + "/FastqToFasta/IlluminaSimpleInput-joined.fastq";
+    
+    auto flags = std::make_unique<gene::CommandLineFlags>();
+    flags->SetSetting("o", "fastq");
+    flags->SetSetting("conversion-threads", "3");
+    
+    auto converter = std::make_unique<Converter>(inputPaths, outputPath, std::move(flags));
+    XCTAssert(converter->Process(), "FAIL. Converter 'process' returned false.");
+    converter = nullptr;
+    
+    std::ifstream output(outputPath);
+    XCTAssert(output, "Output file wasn't produced");
+    
+    // Inputs are converted in parallel, but the output follows their order
+    std::string referenceLine, outputLine;
+    for (const auto& inputPath : inputPaths) {
+        std::ifstream referenceOutput(inputPath);
+        XCTAssert(referenceOutput, "Could not open reference file");
+        while (std::getline(referenceOutput, referenceLine)) {
+            XCTAssert(std::getline(output, outputLine), "Output file is shorter than expected");
+            XCTAssert(outputLine == referenceLine, "Lines don't match");
+        }
+    }
+    XCTAssert(!std::getline(output, outputLine), "Output file is longer than expected");
+    
+    output.close();
+    
+    // Clean-up
+    std::remove(outputPath.c_str());
+}
+
+- (void)testProgressEndsAtHundredPercent
+{
+    std::vector<std::string> inputPaths = {
+        testSuiteDir + "/FastqToFasta/IlluminaSimpleInput.fastq",
+        testSuiteDir + "/FastqIllumina1_8ToFastqSanger/Illumina1_8Input.fastq"
+    };
+    std::string outputPath = testSuiteDir + "/FastqToFasta/IlluminaSimpleInput-progress.fastq";
+    
+    auto flags = std::make_unique<gene::CommandLineFlags>();
+    flags->SetSetting("o", "fastq");
+    flags->SetSetting("conversion-threads", "2");
+    
+    int callsCount = 0;
+    float lastProgress = 0;
+    auto converter = std::make_unique<Converter>(inputPaths, outputPath, std::move(flags));
+    converter->update_progress_callback = [&](float progress) {
+        // No locking: the sampler thread is the only caller
+        ++callsCount;
+        lastProgress = progress;
+        return false;
+    };
+    XCTAssert(converter->Process(), "FAIL. Converter 'process' returned false.");
+    converter = nullptr;
+    
+    // Progress is in percent, and the last report covers every input
+    XCTAssert(callsCount > 0, "Progress was never reported");
+    XCTAssert(std::abs(lastProgress - 100) < 0.01f, "Progress ended at %f%% instead of 100%%", lastProgress);
+    
+    // Clean-up
+    std::remove(outputPath.c_str());
+}
+
+- (void)testFastQToReorderedCsvConversion
+{
+    std::string testPath = testSuiteDir + "/FastqToFasta";
+    std::vector<std::string> inputPath = {testPath + "/IlluminaSimpleInput.fastq"};
+    std::string outputPath = testPath + "/IlluminaSimpleInput-reordered.csvc";
+    
+    auto flags = std::make_unique<gene::CommandLineFlags>();
+    flags->SetSetting("o", "csv");
+    flags->SetSetting("fast-tables", "");
+    flags->SetSetting(Flags::kReorderOutputColumns, "S.nQ");
+    flags->SetSetting(Flags::kOmitQuality, "");
+    
+    auto converter = std::make_unique<Converter>(inputPath, outputPath, std::move(flags));
+    XCTAssert(converter->Process(), "FAIL. Converter 'process' returned false.");
+    converter = nullptr;
+    
+    std::ifstream output(outputPath);
+    XCTAssert(output, "Output file wasn't produced");
+    
+    // Quality is left out, so the columns stop after the name
+    std::string line;
+    XCTAssert(std::getline(output, line) && line == "Sequence,Unknown,Name", "Wrong header");
+    XCTAssert(std::getline(output, line) &&
+              line == "\"NGAAAAATACTATTAAGCTAGTTTAA\",,\"NS500154:374:HTV5WBGXY:4:11401:19915:1023\"",
+              "Wrong columns order");
+    
+    output.close();
+    
+    // Clean-up
+    std::remove(outputPath.c_str());
+    std::remove(SeparatedRecordFile::ColumnTypesPath(outputPath).c_str());
+}
+
+- (void)testMultipleFastQInputsToCsvKeepEveryRow
+{
+    std::string testPath = testSuiteDir + "/FastqToFasta";
+    std::string inputPath = testPath + "/IlluminaSimpleInput.fastq";
+    std::string outputPath = testPath + "/IlluminaSimpleInput-joined.csvc";
+    
+    std::ifstream input(inputPath);
+    XCTAssert(input, "Could not open input file");
+    int64_t recordsCount = 0;
+    for (std::string line; std::getline(input, line);)
+        ++recordsCount;
+    recordsCount /= 4;
+    
+    // Through libgene's writer and through SeparatedRecordFile
+    for (bool fastTables : {false, true}) {
+        auto flags = std::make_unique<gene::CommandLineFlags>();
+        flags->SetSetting("o", "csv");
+        flags->SetSetting("conversion-threads", "2");
+        if (fastTables)
+            flags->SetSetting("fast-tables", "");
+        
+        // Both segments start with the same header, which is kept only once
+        auto converter = std::make_unique<Converter>(std::vector<std::string>{inputPath, inputPath},
+                                                     outputPath, std::move(flags));
+        XCTAssert(converter->Process(), "FAIL. Converter 'process' returned false.");
+        converter = nullptr;
+        
+        std::ifstream output(outputPath);
+        XCTAssert(output, "Output file wasn't produced");
+        std::string line;
+        int64_t headersCount = 0, rowsCount = 0;
+        while (std::getline(output, line)) {
+            if (line == "Name,Description,Sequence,Quality")
+                ++headersCount;
+            else
+                ++rowsCount;
+        }
+        XCTAssert(headersCount == 1, "Wrong number of header lines");
+        XCTAssert(rowsCount == 2*recordsCount, "Rows were lost or duplicated");
+        output.close();
+        
+        // Only the output keeps its column types
+        std::string segmentPath = SegmentPath(outputPath, 1);
+        XCTAssert(!std::ifstream(segmentPath), "Segment was left behind");
+        XCTAssert(!std::ifstream(SeparatedRecordFile::ColumnTypesPath(segmentPath)),
+                  "Column types of the segment were left behind");
+        XCTAssert(std::ifstream(SeparatedRecordFile::ColumnTypesPath(outputPath)),
+                  "Column types of the output were lost");
+        
+        // Clean-up
+        std::remove(outputPath.c_str());
+        std::remove(SeparatedRecordFile::ColumnTypesPath(outputPath).c_str());
+    }
+}
+
 - (void)testPerformance
 {
     // This is an example of a performance test case.
@@ -0,0 +1,127 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#import <XCTest/XCTest.h>
+
+#include "Deduplicator.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdio>
+
+@interface DedupSuite : XCTestCase
+{
+    std::string projectDir;
+    std::string projectTestsDir;
+    std::string testSuiteDir;
+}
+
+@end
+
+@implementation DedupSuite
+
+- (void)setUp
+{
+    [super setUp];
+    projectDir = std::getenv("PROJECT_DIR");
+    projectTestsDir = projectDir + "/GeneUtilsTests";
+    testSuiteDir = projectTestsDir + "/Dedup";
+}
+
+- (void)tearDown
+{
+    [super tearDown];
+}
+
+// Writes 'recordsCount' reads, read i having the sequence of read i % 'uniqueCount'
+// and a quality that rises with i
+static void WriteDuplicatedFastq(const std::string& path, int recordsCount, int uniqueCount)
+{
+    std::ofstream file(path);
+    for (int i = 0; i < recordsCount; ++i) {
+        std::string sequence;
+        for (int n = i % uniqueCount; sequence.size() < 24; n /= 4)
+            sequence.push_back("ACGT"[n % 4]);
+        file << "@read" << i << "\n" << sequence << "\n+\n"
+             << std::string(sequence.size(), static_cast<char>('#' + i/uniqueCount)) << "\n";
+    }
+}
+
+static std::vector<std::string> ReadNames(const std::string& path)
+{
+    std::vector<std::string> names;
+    std::ifstream file(path);
+    std::string line;
+    for (int64_t number = 0; std::getline(file, line); ++number) {
+        if (number % 4 == 0)
+            names.push_back(line);
+    }
+    return names;
+}
+
+- (void)testFastQKeepsFirstDuplicate
+{
+    std::string inputPath = testSuiteDir + "/DuplicatedInput.fastq";
+    std::string outputPath = testSuiteDir + "/DuplicatedInput-dedup.fastq";
+    WriteDuplicatedFastq(inputPath, 3000, 1000);
+    
+    auto flags = std::make_unique<gene::CommandLineFlags>();
+    auto deduplicator = std::make_unique<Deduplicator>(std::vector<std::pair<std::string, std::string>>{{inputPath, ""}},
+                                                       std::make_pair(outputPath, std::string()),
+                                                       std::move(flags));
+    XCTAssert(deduplicator->Process(), "FAIL. Deduplicator 'process' returned false.");
+    deduplicator = nullptr;
+    
+    auto names = ReadNames(outputPath);
+    XCTAssert(names.size() == 1000, "Wrong number of reads kept");
+    for (size_t i = 0; i < names.size(); ++i)
+        XCTAssert(names[i] == "@read" + std::to_string(i), "Wrong duplicate kept, or out of order");
+    
+    // Clean-up
+    std::remove(inputPath.c_str());
+    std::remove(outputPath.c_str());
+}
+
+- (void)testFastQKeepsBestQualityDuplicateWhenSpilling
+{
+    std::string inputPath = testSuiteDir + "/DuplicatedInput.fastq";
+    std::string outputPath = testSuiteDir + "/DuplicatedInput-dedup.fastq";
+    WriteDuplicatedFastq(inputPath, 150000, 50000);
+    
+    auto flags = std::make_unique<gene::CommandLineFlags>();
+    flags->SetSetting("dedup-keep", "best-quality");
+    flags->SetSetting("dedup-memory-mb", "1");
+    auto deduplicator = std::make_unique<Deduplicator>(std::vector<std::pair<std::string, std::string>>{{inputPath, ""}},
+                                                       std::make_pair(outputPath, std::string()),
+                                                       std::move(flags));
+    XCTAssert(deduplicator->Process(), "FAIL. Deduplicator 'process' returned false.");
+    deduplicator = nullptr;
+    
+    // The last copy of every sequence has the highest quality
+    auto names = ReadNames(outputPath);
+    XCTAssert(names.size() == 50000, "Wrong number of reads kept");
+    for (size_t i = 0; i < names.size(); ++i)
+        XCTAssert(names[i] == "@read" + std::to_string(100000 + i), "Wrong duplicate kept, or out of order");
+    
+    // Clean-up
+    std::remove(inputPath.c_str());
+    std::remove(outputPath.c_str());
+}
+
+@end
@@ -19,13 +19,37 @@
 #include <memory>
 #include <string>
 #include <fstream>
+#include <sstream>
+#include <thread>
+#include <set>
+#include <cmath>
 
 #include "Extractor.hpp"
+#include "ExtractorBatch.hpp"
+#include "FileSegments.hpp"
 
 #include <libgene/def/Flags.hpp>
 
 using gene::Flags;
 
+static bool FileContentsAreEqual(const std::string& output_path,
+                                 const std::string& reference_path)
+{
+    std::ifstream output(output_path);
+    std::ifstream reference(reference_path);
+    if (!output || !reference)
+        return false;
+
+    std::string output_line, reference_line;
+    bool output_is_empty = true;
+    while (std::getline(output, output_line)) {
+        if (!std::getline(reference, reference_line) || output_line != reference_line)
+            return false;
+        output_is_empty = false;
+    }
+    return !output_is_empty && !std::getline(reference, reference_line);
+}
+
 @interface ExtractSuite : XCTestCase
 {
     std::string projectDir;
@@ -256,6 +280,250 @@ using gene::Flags;
     std::remove(outputPath3.c_str());
 }
 
+- (void)testOutputsBeyondOpenFileLimitAreJoined
+{
+    std::string testPath = testSuiteDir + "/DemultiplexOrdinaryFastq";
+    std::string inputPath = testPath + "/ManyBarcodesInput.fastq";
+    std::string outputPath = testPath + "/ManyBarcodesInput";
+
+    // Three times as many barcodes as outputs may be open, and enough records
+    // for the spill buffers to overflow many times over, so that outputs get
+    // evicted and reopened into segments
+    const int barcodesCount = 24;
+    const int recordsCount = 40000;
+    std::vector<std::string> queries;
+    for (int i = 0; i < barcodesCount; ++i) {
+        std::string barcode;
+        for (int digit = i, j = 0; j < 8; ++j, digit /= 4)
+            barcode += "ACGT"[digit % 4];
+        queries.push_back(barcode);
+    }
+
+    std::vector<std::string> expectedOutputs(barcodesCount);
+    {
+        std::ofstream input(inputPath);
+        for (int i = 0; i < recordsCount; ++i) {
+            int barcode = (i*7) % barcodesCount;
+            std::stringstream record;
+            record << "@READ:" << i << " 1:N:0:" << queries[barcode] << "\n"
+                   << std::string(50, "ACGT"[i % 4]) << "\n+\n"
+                   << std::string(50, 'E') << "\n";
+            input << record.str();
+            expectedOutputs[barcode] += record.str();
+        }
+    }
+
+    auto flags = std::make_unique<gene::CommandLineFlags>();
+    flags->SetSetting(Flags::kDemultiplexByTags, "");
+    flags->SetSetting("max-open-outputs", "8");
+    // The smallest budget there is, which leaves 32 KB for the spill buffers
+    flags->SetSetting("buffer-mb", "0");
+
+    std::vector<std::pair<std::string, std::string>> outputPaths = {{"some_fake_dir", ""}};
+    for (const auto& query : queries)
+        outputPaths.push_back({outputPath + "_" + query + ".fastq", ""});
+
+    {
+        Extractor extractor(ExtractorJob({{inputPath, ""}}, outputPaths, std::move(flags), queries));
+        XCTAssert(extractor.Process(), "FAIL. Extractor 'Process' returned false.");
+    }
+
+    for (int i = 0; i < barcodesCount; ++i) {
+        const std::string& output = outputPaths[i + 1].first;
+        std::ifstream outputFile(output);
+        std::stringstream contents;
+        contents << outputFile.rdbuf();
+        XCTAssert(contents.str() == expectedOutputs[i],
+                  "Joined output for barcode %s doesn't hold its records in input order", queries[i].c_str());
+        XCTAssert(!std::ifstream(SegmentPath(output, 1)), "Segments of %s were left behind", output.c_str());
+        std::remove(output.c_str());
+    }
+    std::remove(inputPath.c_str());
+}
+
+- (void)testBatchDemultiplexSharesInputScan
+{
+    std::string testPath = testSuiteDir + "/DemultiplexOrdinaryFastq";
+    std::vector<std::pair<std::string, std::string>> inputPath = {{testPath + "/IlluminaSimpleInput.fastq", ""}};
+    std::string outputPath = testPath + "/IlluminaSimpleInput-batch";
+
+    // Two jobs over the same input with disjoint sets of barcodes
+    std::vector<std::vector<std::string>> queriesPerJob = {{"ATTCAGAN"}, {"GAATTCGN", "TCCGGAAA"}};
+    std::vector<ExtractorJob> jobs;
+    for (const auto& queries : queriesPerJob) {
+        auto flags = std::make_unique<gene::CommandLineFlags>();
+        flags->SetSetting(Flags::kDemultiplexByTags, "");
+
+        std::vector<std::pair<std::string, std::string>> outputPaths = {{"some_fake_dir", ""}};
+        for (const auto& query : queries)
+            outputPaths.push_back({outputPath + "_" + query + ".fastq", ""});
+
+        jobs.emplace_back(inputPath, outputPaths, std::move(flags), queries);
+    }
+
+    {
+        ExtractorBatch batch(std::move(jobs));
+        XCTAssert(batch.groups_count() == 1, "Jobs with the same input should share a scan");
+        XCTAssert(batch.Process(), "FAIL. ExtractorBatch 'Process' returned false.");
+    }
+
+    for (const std::string query : {"ATTCAGAN", "GAATTCGN", "TCCGGAAA"}) {
+        std::string output = outputPath + "_" + query + ".fastq";
+        XCTAssert(FileContentsAreEqual(output, testPath + "/IlluminaSimpleReferenceOutput_" + query + ".fastq"),
+                  "Output for barcode %s doesn't match the reference", query.c_str());
+        std::remove(output.c_str());
+    }
+}
+
+- (void)testBatchSplitsJobsWithDifferentScanSettings
+{
+    std::string testPath = testSuiteDir + "/DemultiplexOrdinaryFastq";
+    std::vector<std::pair<std::string, std::string>> inputPath = {{testPath + "/IlluminaSimpleInput.fastq", ""}};
+    std::string outputPath = testPath + "/IlluminaSimpleInput-batch-settings";
+
+    // Same input, but the jobs ask for different writer threads and buffer
+    // budgets, which are set up once per scan
+    std::vector<std::string> queries = {"ATTCAGAN"};
+    std::vector<std::pair<std::string, std::string>> writerSettings = {{"1", "16"}, {"2", "16"}, {"2", "32"}, {"2", "32"}};
+    std::vector<ExtractorJob> jobs;
+    for (size_t i = 0; i < writerSettings.size(); ++i) {
+        auto flags = std::make_unique<gene::CommandLineFlags>();
+        flags->SetSetting(Flags::kDemultiplexByTags, "");
+        flags->SetSetting("writer-threads", writerSettings[i].first);
+        flags->SetSetting("buffer-mb", writerSettings[i].second);
+
+        std::vector<std::pair<std::string, std::string>> outputPaths = {{"some_fake_dir", ""}};
+        outputPaths.push_back({outputPath + std::to_string(i) + "_" + queries.front() + ".fastq", ""});
+        jobs.emplace_back(inputPath, outputPaths, std::move(flags), queries);
+    }
+
+    {
+        ExtractorBatch batch(std::move(jobs));
+        XCTAssert(batch.groups_count() == 3, "Only jobs with the same scan settings should share a scan");
+        XCTAssert(batch.Process(), "FAIL. ExtractorBatch 'Process' returned false.");
+    }
+
+    for (size_t i = 0; i < writerSettings.size(); ++i) {
+        std::string output = outputPath + std::to_string(i) + "_" + queries.front() + ".fastq";
+        XCTAssert(FileContentsAreEqual(output, testPath + "/IlluminaSimpleReferenceOutput_" + queries.front() + ".fastq"),
+                  "Output of job %zu doesn't match the reference", i);
+        std::remove(output.c_str());
+    }
+}
+
+- (void)testProgressIsReportedFromOneThread
+{
+    std::string testPath = testSuiteDir + "/DemultiplexOrdinaryFastq";
+    std::string inputPath = testPath + "/IlluminaSimpleInput.fastq";
+    std::string outputPath = testPath + "/IlluminaSimpleInput-progress";
+
+    // The same input several times over, so that several tasks scan at once
+    std::vector<std::pair<std::string, std::string>> inputPaths(8, {inputPath, ""});
+    std::vector<std::string> queries = {"ATTCAGAN", "GAATTCGN", "TCCGGAAA"};
+
+    auto flags = std::make_unique<gene::CommandLineFlags>();
+    flags->SetSetting(Flags::kDemultiplexByTags, "");
+
+    std::vector<std::pair<std::string, std::string>> outputPaths = {{"some_fake_dir", ""}};
+    for (const auto& query : queries)
+        outputPaths.push_back({outputPath + "_" + query + ".fastq", ""});
+
+    std::set<std::thread::id> callbackThreads;
+    float lastProgress = 0;
+    bool progressWentBack = false;
+    {
+        auto extractor = std::make_unique<Extractor>(ExtractorJob(inputPaths, outputPaths, std::move(flags), queries));
+        extractor->update_progress_callback = [&](float progress) {
+            // No locking: the sampler thread is the only caller
+            callbackThreads.insert(std::this_thread::get_id());
+            progressWentBack |= progress < lastProgress;
+            lastProgress = progress;
+            return false;
+        };
+        XCTAssert(extractor->Process(), "FAIL. Extractor 'Process' returned false.");
+    }
+
+    // The sampler reports the final progress when it stops, so there's at
+    // least one call, whatever the timing
+    XCTAssert(!callbackThreads.empty(), "Progress was never reported");
+    XCTAssert(callbackThreads.size() == 1, "Progress was reported from several threads");
+    XCTAssert(callbackThreads.count(std::this_thread::get_id()) == 0,
+              "Progress was reported from the calling thread instead of the sampler");
+    XCTAssert(!progressWentBack, "Reported progress decreased");
+    XCTAssert(std::abs(lastProgress - 100) < 0.01f, "Progress ended at %f%% instead of 100%%", lastProgress);
+
+    for (const auto& query : queries)
+        std::remove((outputPath + "_" + query + ".fastq").c_str());
+}
+
+- (void)testRunStatisticsAreWrittenAsJson
+{
+    std::string testPath = testSuiteDir + "/DemultiplexOrdinaryFastq";
+    std::vector<std::pair<std::string, std::string>> inputPath = {{testPath + "/IlluminaSimpleInput.fastq", ""}};
+    std::string outputPath = testPath + "/IlluminaSimpleInput-stats";
+    std::string statsPath = testPath + "/IlluminaSimpleInput-stats.json";
+    std::vector<std::string> queries = {"ATTCAGAN", "GAATTCGN", "TCCGGAAA"};
+
+    auto flags = std::make_unique<gene::CommandLineFlags>();
+    flags->SetSetting(Flags::kDemultiplexByTags, "");
+    flags->SetSetting("stats-json", statsPath);
+
+    std::vector<std::pair<std::string, std::string>> outputPaths = {{"some_fake_dir", ""}};
+    for (const auto& query : queries)
+        outputPaths.push_back({outputPath + "_" + query + ".fastq", ""});
+
+    {
+        Extractor extractor(ExtractorJob(inputPath, outputPaths, std::move(flags), queries));
+        XCTAssert(extractor.Process(), "FAIL. Extractor 'Process' returned false.");
+    }
+
+    std::ifstream statsFile(statsPath);
+    XCTAssert(statsFile, "Statistics file wasn't produced");
+    std::stringstream stats;
+    stats << statsFile.rdbuf();
+    for (const std::string key : {"\"operation\": \"demultiplex\"", "\"stage_seconds\"", "\"flush_latency\"",
+                                  "\"name\": \"scan 0\"", "\"name\": \"writer 0\"", "\"timeline\""})
+        XCTAssert(stats.str().find(key) != std::string::npos, "Statistics are missing %s", key.c_str());
+
+    std::remove(statsPath.c_str());
+    for (const auto& query : queries)
+        std::remove((outputPath + "_" + query + ".fastq").c_str());
+}
+
+- (void)testTraceIsWrittenInChromeFormat
+{
+    std::string testPath = testSuiteDir + "/DemultiplexOrdinaryFastq";
+    std::vector<std::pair<std::string, std::string>> inputPath = {{testPath + "/IlluminaSimpleInput.fastq", ""}};
+    std::string outputPath = testPath + "/IlluminaSimpleInput-trace";
+    std::string tracePath = testPath + "/IlluminaSimpleInput-trace.json";
+    std::vector<std::string> queries = {"ATTCAGAN", "GAATTCGN", "TCCGGAAA"};
+
+    auto flags = std::make_unique<gene::CommandLineFlags>();
+    flags->SetSetting(Flags::kDemultiplexByTags, "");
+    flags->SetSetting("trace-json", tracePath);
+
+    std::vector<std::pair<std::string, std::string>> outputPaths = {{"some_fake_dir", ""}};
+    for (const auto& query : queries)
+        outputPaths.push_back({outputPath + "_" + query + ".fastq", ""});
+
+    {
+        Extractor extractor(ExtractorJob(inputPath, outputPaths, std::move(flags), queries));
+        XCTAssert(extractor.Process(), "FAIL. Extractor 'Process' returned false.");
+    }
+
+    std::ifstream traceFile(tracePath);
+    XCTAssert(traceFile, "Trace file wasn't produced");
+    std::stringstream trace;
+    trace << traceFile.rdbuf();
+    // Short events may be left out, but every thread is named
+    for (const std::string key : {"\"traceEvents\"", "\"thread_name\"", "\"name\": \"scan 0\"", "\"name\": \"writer 0\""})
+        XCTAssert(trace.str().find(key) != std::string::npos, "Trace is missing %s", key.c_str());
+
+    std::remove(tracePath.c_str());
+    for (const auto& query : queries)
+        std::remove((outputPath + "_" + query + ".fastq").c_str());
+}
+
 - (void)testPerformance
 {
     // This is an example of a performance test case.
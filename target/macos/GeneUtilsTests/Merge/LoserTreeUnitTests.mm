@@ -0,0 +1,110 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#import <XCTest/XCTest.h>
+
+#include "LoserTree.hpp"
+
+// Merges 'sources' with a LoserTree, returning (value, source) pairs in the
+// order they come out
+static std::vector<std::pair<int, size_t>> Merge(const std::vector<std::vector<int>>& sources)
+{
+    std::vector<size_t> heads(sources.size(), 0);
+    auto less = [&sources, &heads](size_t a, size_t b) {
+        return sources[a][heads[a]] < sources[b][heads[b]];
+    };
+    LoserTree<decltype(less)> tree(sources.size(), less);
+    for (size_t i = 0; i < sources.size(); ++i) {
+        if (sources[i].empty())
+            tree.SetExhausted(i);
+    }
+    tree.Build();
+
+    std::vector<std::pair<int, size_t>> merged;
+    while (!tree.Empty()) {
+        size_t top = tree.Top();
+        merged.emplace_back(sources[top][heads[top]], top);
+        tree.Replay(++heads[top] == sources[top].size());
+    }
+    return merged;
+}
+
+// What Merge() should return: every value after the ones smaller than it,
+// and equal values by source, then by position in the source
+static std::vector<std::pair<int, size_t>> StableSorted(const std::vector<std::vector<int>>& sources)
+{
+    std::vector<std::pair<int, size_t>> all;
+    for (size_t i = 0; i < sources.size(); ++i) {
+        for (int value : sources[i])
+            all.emplace_back(value, i);
+    }
+    std::stable_sort(all.begin(), all.end(), [](const std::pair<int, size_t>& x,
+                                                 const std::pair<int, size_t>& y) {
+        return x.first < y.first;
+    });
+    return all;
+}
+
+@interface LoserTreeUnitTests : XCTestCase
+
+@end
+
+@implementation LoserTreeUnitTests
+
+- (void)testLoserTree_NoSources
+{
+    XCTAssert(Merge({}).empty());
+    XCTAssert(Merge({{}, {}, {}}).empty());
+}
+
+- (void)testLoserTree_OneSource
+{
+    std::vector<std::vector<int>> sources = {{1, 2, 2, 5}};
+    XCTAssert(Merge(sources) == StableSorted(sources));
+}
+
+- (void)testLoserTree_TiesGoToTheLowerSource
+{
+    std::vector<std::vector<int>> sources = {{3, 3}, {1, 3}, {3}, {0, 3, 3}};
+    auto merged = Merge(sources);
+    XCTAssert(merged == StableSorted(sources));
+    XCTAssert(merged[2] == std::make_pair(3, size_t(0)));
+    XCTAssert(merged.back() == std::make_pair(3, size_t(3)));
+}
+
+- (void)testLoserTree_AnyNumberOfSources
+{
+    // Source counts around powers of two, some sources empty, some
+    // running out long before the others
+    for (size_t count = 1; count <= 17; ++count) {
+        std::vector<std::vector<int>> sources(count);
+        for (size_t i = 0; i < count; ++i) {
+            if (i % 5 == 2)
+                continue;
+            size_t length = (i * 7) % 11 + (i % 3 == 0 ? 40 : 1);
+            for (size_t j = 0; j < length; ++j)
+                sources[i].push_back(static_cast<int>((j * 3 + i) / 2));
+        }
+        XCTAssert(Merge(sources) == StableSorted(sources), "Wrong order with %zu sources", count);
+    }
+}
+
+@end
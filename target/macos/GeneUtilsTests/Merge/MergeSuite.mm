@@ -0,0 +1,250 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#import <XCTest/XCTest.h>
+
+#include "Merger.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <utility>
+#include <tuple>
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+
+@interface MergeSuite : XCTestCase
+{
+    std::string projectDir;
+    std::string projectTestsDir;
+    std::string testSuiteDir;
+}
+
+@end
+
+@implementation MergeSuite
+
+- (void)setUp
+{
+    [super setUp];
+    projectDir = std::getenv("PROJECT_DIR");
+    projectTestsDir = projectDir + "/GeneUtilsTests";
+    testSuiteDir = projectTestsDir + "/Merge";
+}
+
+- (void)tearDown
+{
+    [super tearDown];
+}
+
+// Writes a read per name, all with the same sequence
+static void WriteFastq(const std::string& path, const std::vector<std::string>& names,
+                       const std::string& sequence)
+{
+    std::ofstream file(path);
+    for (const auto& name : names)
+        file << "@" << name << "\n" << sequence << "\n+\n" << std::string(sequence.size(), 'I') << "\n";
+}
+
+// Name and sequence of every read
+static std::vector<std::pair<std::string, std::string>> ReadFastq(const std::string& path)
+{
+    std::vector<std::pair<std::string, std::string>> reads;
+    std::ifstream file(path);
+    std::string name, sequence, line;
+    while (std::getline(file, name) && std::getline(file, sequence) &&
+           std::getline(file, line) && std::getline(file, line))
+        reads.emplace_back(name.substr(1), sequence);
+    return reads;
+}
+
+// Writes a SAM file with an @SQ line per reference, and a four base read at
+// every (name, reference, position). Reference "*" makes an unmapped read.
+static void WriteSam(const std::string& path, const std::vector<std::string>& references,
+                     const std::vector<std::tuple<std::string, std::string, int>>& reads)
+{
+    std::ofstream file(path);
+    file << "@HD\tVN:1.6\tSO:coordinate\n";
+    for (const auto& reference : references)
+        file << "@SQ\tSN:" << reference << "\tLN:100000\n";
+    for (const auto& read : reads) {
+        bool unmapped = std::get<1>(read) == "*";
+        file << std::get<0>(read) << "\t" << (unmapped ? 4 : 0) << "\t" << std::get<1>(read) << "\t"
+             << std::get<2>(read) << "\t" << (unmapped ? "0\t*" : "60\t4M") << "\t*\t0\t0\tACGT\tIIII\n";
+    }
+}
+
+// Names of the reads of a SAM file
+static std::vector<std::string> ReadSamNames(const std::string& path)
+{
+    std::vector<std::string> names;
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line[0] != '@')
+            names.push_back(line.substr(0, line.find('\t')));
+    }
+    return names;
+}
+
+static std::string ReadName(int number)
+{
+    char name[16];
+    std::snprintf(name, sizeof(name), "read%05d", number);
+    return name;
+}
+
+- (void)testNameSortedFastQInputsAreMergedInOrder
+{
+    // Every input is sorted, and some reads are in more than one of them
+    std::vector<std::string> inputPaths;
+    std::vector<std::string> sequences = {"AAAA", "CCCC", "GGGG"};
+    std::vector<std::vector<std::string>> names(sequences.size());
+    for (int i = 0; i < 3000; ++i) {
+        if (i % 2 == 0)
+            names[0].push_back(ReadName(i));
+        if (i % 3 == 0)
+            names[1].push_back(ReadName(i));
+        if (i >= 2000)
+            names[2].push_back(ReadName(i));
+    }
+    for (size_t i = 0; i < sequences.size(); ++i) {
+        inputPaths.push_back(testSuiteDir + "/SortedInput" + std::to_string(i) + ".fastq");
+        WriteFastq(inputPaths.back(), names[i], sequences[i]);
+    }
+    std::string outputPath = testSuiteDir + "/SortedInput-merged.fastq";
+    
+    auto flags = std::make_unique<gene::CommandLineFlags>();
+    flags->SetSetting("sorted-merge", "name");
+    auto merger = std::make_unique<Merger>(inputPaths, outputPath, std::move(flags));
+    XCTAssert(merger->Process(), "FAIL. Merger 'process' returned false.");
+    merger = nullptr;
+    
+    // Reads found in several inputs come in the order of the inputs
+    std::vector<std::pair<std::string, std::string>> expected;
+    for (int i = 0; i < 3000; ++i) {
+        for (size_t j = 0; j < sequences.size(); ++j) {
+            if (std::find(names[j].begin(), names[j].end(), ReadName(i)) != names[j].end())
+                expected.emplace_back(ReadName(i), sequences[j]);
+        }
+    }
+    auto reads = ReadFastq(outputPath);
+    XCTAssert(reads.size() == expected.size(), "Wrong number of reads");
+    XCTAssert(reads == expected, "Reads are out of order");
+    
+    // Clean-up
+    for (const auto& inputPath : inputPaths)
+        std::remove(inputPath.c_str());
+    std::remove(outputPath.c_str());
+}
+
+- (void)testNaturallySortedInputIsRejected
+{
+    // "samtools sort -n" puts read2 before read10, but names are compared
+    // byte by byte here, so the input looks unsorted
+    std::vector<std::string> inputPaths = {
+        testSuiteDir + "/NaturallySortedInput.fastq",
+        testSuiteDir + "/SortedInput.fastq"
+    };
+    WriteFastq(inputPaths[0], {"read1", "read2", "read10", "read11"}, "ACGT");
+    WriteFastq(inputPaths[1], {"read3", "read4"}, "ACGT");
+    std::string outputPath = testSuiteDir + "/NaturallySortedInput-merged.fastq";
+    
+    auto flags = std::make_unique<gene::CommandLineFlags>();
+    flags->SetSetting("sorted-merge", "name");
+    auto merger = std::make_unique<Merger>(inputPaths, outputPath, std::move(flags));
+    XCTAssert(!merger->Process(), "Unsorted input should fail the merge");
+    merger = nullptr;
+    
+    // Clean-up
+    for (const auto& inputPath : inputPaths)
+        std::remove(inputPath.c_str());
+    std::remove(outputPath.c_str());
+}
+
+- (void)testCoordinateSortedInputsStartingOnDifferentReferences
+{
+    // References are ranked by the headers, not by the reads that show up
+    // first, so chr2 still comes after chr1
+    std::vector<std::string> inputPaths = {
+        testSuiteDir + "/CoordinateSortedInput0.sam",
+        testSuiteDir + "/CoordinateSortedInput1.sam"
+    };
+    WriteSam(inputPaths[0], {"chr1", "chr2"}, {{"r1", "chr2", 100}, {"r2", "chr2", 300}});
+    WriteSam(inputPaths[1], {"chr1", "chr2"}, {{"r3", "chr1", 50}, {"r4", "chr1", 500},
+                                               {"r5", "chr2", 200}, {"r6", "*", 0}});
+    std::string outputPath = testSuiteDir + "/CoordinateSortedInput-merged.sam";
+    
+    auto flags = std::make_unique<gene::CommandLineFlags>();
+    flags->SetSetting("sorted-merge", "coordinate");
+    auto merger = std::make_unique<Merger>(inputPaths, outputPath, std::move(flags));
+    XCTAssert(merger->Process(), "FAIL. Merger 'process' returned false.");
+    merger = nullptr;
+    
+    // Unmapped reads go last
+    std::vector<std::string> expected = {"r3", "r4", "r1", "r5", "r2", "r6"};
+    XCTAssert(ReadSamNames(outputPath) == expected, "Reads are out of order");
+    
+    // Clean-up
+    for (const auto& inputPath : inputPaths)
+        std::remove(inputPath.c_str());
+    std::remove(outputPath.c_str());
+}
+
+- (void)testInputsWithDifferentReferenceOrdersAreRejected
+{
+    std::vector<std::string> inputPaths = {
+        testSuiteDir + "/CoordinateSortedInput0.sam",
+        testSuiteDir + "/CoordinateSortedInput1.sam"
+    };
+    WriteSam(inputPaths[0], {"chr1", "chr2"}, {{"r1", "chr1", 100}, {"r2", "chr2", 300}});
+    WriteSam(inputPaths[1], {"chr2", "chr1"}, {{"r3", "chr2", 50}, {"r4", "chr1", 500}});
+    std::string outputPath = testSuiteDir + "/CoordinateSortedInput-merged.sam";
+    
+    auto flags = std::make_unique<gene::CommandLineFlags>();
+    flags->SetSetting("sorted-merge", "coordinate");
+    auto merger = std::make_unique<Merger>(inputPaths, outputPath, std::move(flags));
+    XCTAssert(!merger->Process(), "Inputs sorted in different orders should fail the merge");
+    merger = nullptr;
+    XCTAssert(!std::ifstream(outputPath), "Output was created before the headers were checked");
+    
+    // Clean-up
+    for (const auto& inputPath : inputPaths)
+        std::remove(inputPath.c_str());
+    std::remove(outputPath.c_str());
+}
+
+- (void)testUnsupportedSortOrdersAreRejected
+{
+    std::vector<std::string> inputPaths = {testSuiteDir + "/SortedInput.fastq"};
+    WriteFastq(inputPaths[0], {"read1", "read2"}, "ACGT");
+    std::string outputPath = testSuiteDir + "/SortedInput-merged.fastq";
+    
+    // Only alignments have coordinates
+    for (const std::string order : {"coordinate", "position"}) {
+        auto flags = std::make_unique<gene::CommandLineFlags>();
+        flags->SetSetting("sorted-merge", order);
+        auto merger = std::make_unique<Merger>(inputPaths, outputPath, std::move(flags));
+        XCTAssert(!merger->Process(), "Merge by %s should be rejected", order.c_str());
+    }
+    
+    // Clean-up
+    std::remove(inputPaths[0].c_str());
+    std::remove(outputPath.c_str());
+}
+
+@end
@@ -0,0 +1,238 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#import <XCTest/XCTest.h>
+
+#include "Mutator.hpp"
+#include "ReferenceCache.hpp"
+#include "FastaIndex.hpp"
+#include "CodonTranslation.hpp"
+#include "SeparatedTableReader.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <string_view>
+#include <utility>
+#include <fstream>
+#include <cstdio>
+
+@interface MutateSuite : XCTestCase
+{
+    std::string projectDir;
+    std::string projectTestsDir;
+    std::string testSuiteDir;
+}
+
+@end
+
+@implementation MutateSuite
+
+- (void)setUp
+{
+    [super setUp];
+    projectDir = std::getenv("PROJECT_DIR");
+    projectTestsDir = projectDir + "/GeneUtilsTests";
+    testSuiteDir = projectTestsDir + "/Mutate";
+}
+
+- (void)tearDown
+{
+    [super tearDown];
+}
+
+// Headers and sequences of a FASTA file, lines joined
+static std::vector<std::pair<std::string, std::string>> ReadFasta(const std::string& path)
+{
+    std::vector<std::pair<std::string, std::string>> records;
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line[0] == '>')
+            records.emplace_back(line.substr(1), std::string());
+        else if (!records.empty())
+            records.back().second += line;
+    }
+    return records;
+}
+
+// Mutates the same references either through their cache or, without
+// it, through a FASTA index
+- (void)checkVariantsAreAppliedInTableOrder:(bool)referenceCache
+{
+    std::string referencePath = testSuiteDir + "/Transcripts.fasta";
+    std::string translationPath = testSuiteDir + "/Translations.fasta";
+    std::string variantsPath = testSuiteDir + "/Variants.csv";
+    std::string outputPath = testSuiteDir + "/Transcripts-mutated.fasta";
+    std::string translationOutputPath = testSuiteDir + "/Translations-mutated.fasta";
+    
+    std::ofstream(referencePath) << ">G1|T1|S1\nATGGCC\nAAATTT\nGGGTAA\n>g2|t2|s2\nATGAAAC\nCCTAG\n";
+    std::ofstream(translationPath) << ">G1|T1|S1\nMAKFG!\n>G2|T2|S2\nMKP!\n";
+    std::ofstream(variantsPath) << "Gene,Gene Symbol,Transcript,Protein_Pos,AA_Change,Alt,Ref\n"
+                                   "G1,S1,T1,2,A/V,T,C\n"
+                                   "G3,S3,T3,1,,A,G\n"
+                                   "g2,s2,t2,2,,-,AAA\n"
+                                   "G1,S1,T1,3-4,KF/NL,TC,AT\n"
+                                   "G1,S1,T1,1,M/I,GA,TG\n";
+    
+    auto flags = std::make_unique<gene::CommandLineFlags>();
+    flags->SetSetting("mutate-threads", "4");
+    if (!referenceCache)
+        flags->SetSetting("no-reference-cache", "");
+    auto mutator = std::make_unique<Mutator>(variantsPath, referencePath, translationPath,
+                                             outputPath, translationOutputPath, std::move(flags));
+    XCTAssert(mutator->Process(), "FAIL. Mutator 'process' returned false.");
+    mutator = nullptr;
+    
+    // G3 isn't in the reference and M/I doesn't match the codon change
+    auto records = ReadFasta(outputPath);
+    XCTAssert(records.size() == 3, "Wrong number of mutated transcripts");
+    XCTAssert(records[0].first == "G1|T1|S1 A/V C/T" && records[0].second == "ATGGTCAAATTTGGGTAA",
+              "Wrong single base replacement");
+    XCTAssert(records[1].first == "g2|t2|s2 - AAA/-" && records[1].second == "ATGCCCTAG",
+              "Wrong deletion");
+    XCTAssert(records[2].first == "G1|T1|S1 KF/NL AT/TC" && records[2].second == "ATGGCCAATCTTGGGTAA",
+              "Wrong replacement across codons");
+    
+    auto translations = ReadFasta(translationOutputPath);
+    XCTAssert(translations.size() == 2, "Wrong number of mutated translations");
+    XCTAssert(translations[0].second == "MVKFG!" && translations[1].second == "MANLG!",
+              "Wrong amino acid changes");
+    
+    if (referenceCache) {
+        XCTAssert(ReferenceCache::Open(referencePath) != nullptr, "Reference cache wasn't saved");
+    } else {
+        std::ifstream index(FastaIndex::IndexPath(referencePath));
+        XCTAssert(index.good(), "Reference index wasn't saved");
+        XCTAssert(ReferenceCache::Open(referencePath) == nullptr, "Reference cache was saved anyway");
+    }
+    
+    // Clean-up
+    for (const auto& path : {referencePath, translationPath, variantsPath, outputPath, translationOutputPath,
+                             ReferenceCache::CachePath(referencePath), ReferenceCache::CachePath(translationPath),
+                             FastaIndex::IndexPath(referencePath), FastaIndex::IndexPath(translationPath)})
+        std::remove(path.c_str());
+}
+
+- (void)testVariantsAreAppliedInTableOrder
+{
+    [self checkVariantsAreAppliedInTableOrder:true];
+}
+
+- (void)testVariantsAreAppliedInTableOrderWithoutReferenceCache
+{
+    [self checkVariantsAreAppliedInTableOrder:false];
+}
+
+- (void)testReferenceCacheIsRebuiltWhenTheSourceChanges
+{
+    std::string referencePath = testSuiteDir + "/Transcripts.fasta";
+    std::ofstream(referencePath) << ">G1|T1|S1 first\nATGNNNRAAA\n>G2|T2|S2\nMKP!\n";
+    
+    auto flags = std::make_unique<gene::CommandLineFlags>();
+    XCTAssert(ReferenceCache::Open(referencePath) == nullptr, "Cache opened before it was built");
+    XCTAssert(ReferenceCache::Build(referencePath, flags) != nullptr, "Cache wasn't built");
+    
+    auto cache = ReferenceCache::Open(referencePath);
+    XCTAssert(cache && cache->size() == 2, "Cache doesn't open");
+    gene::SequenceRecord record;
+    XCTAssert(cache->Fetch("G1|T1|S1", record) && record.name == "G1|T1|S1" && record.desc == "first" &&
+              record.seq == "ATGNNNRAAA", "Wrong nucleotide record");
+    XCTAssert(cache->Fetch("G2|T2|S2", record) && record.seq == "MKP!", "Wrong protein record");
+    XCTAssert(!cache->Fetch("G3|T3|S3", record), "Found a record that isn't there");
+    cache = nullptr;
+    
+    std::ofstream(referencePath, std::ios::app) << ">G3|T3|S3\nATG\n";
+    XCTAssert(ReferenceCache::Open(referencePath) == nullptr, "Out of date cache opened");
+    
+    // Clean-up
+    std::remove(referencePath.c_str());
+    std::remove(ReferenceCache::CachePath(referencePath).c_str());
+}
+
+- (void)testBulkTranslationMatchesCodonTable
+{
+    // All 64 codons, then codons with an N and a lowercase base, long
+    // enough to go through the vectorized path and the tail after it
+    std::string bases;
+    for (int codon = 0; codon < 64; ++codon) {
+        for (int shift = 4; shift >= 0; shift -= 2)
+            bases.push_back("ACGT"[(codon >> shift) & 3]);
+    }
+    bases += "ANGaTGATG";
+    
+    auto aminoAcids = TranslateBases(bases);
+    XCTAssert(aminoAcids.size() == bases.size()/3, "Wrong number of amino acids");
+    for (size_t i = 0; i < aminoAcids.size(); ++i)
+        XCTAssert(aminoAcids[i] == TranslateCodon(bases.c_str() + 3*i), "Bulk and single translations differ");
+    XCTAssert(aminoAcids.substr(0, 4) == "KNKN" && aminoAcids.substr(64) == std::string("\0\0M", 3),
+              "Wrong translation");
+}
+
+- (void)testQuotedTableFieldsAreTokenized
+{
+    // Quoted delimiters and line breaks, CRLF and empty lines, and a row
+    // that doesn't fit into the read buffer
+    std::string tablePath = testSuiteDir + "/Table.csv";
+    std::string longField(SeparatedTableReader::kBufferSize + 100, 'A');
+    std::ofstream(tablePath) << "a,\"b,c\",\"say \"\"hi\"\"\"\r\n"
+                                "\n"
+                                "\"multi\nline\",,x\r\n"
+                                << longField << ",tail\n"
+                                "last,row";
+    
+    SeparatedTableReader reader(tablePath);
+    std::vector<std::string_view> fields;
+    XCTAssert(reader.ReadRow(fields) && fields.size() == 3 && fields[0] == "a" && fields[1] == "b,c" &&
+              fields[2] == "say \"hi\"", "Wrong quoted fields");
+    XCTAssert(reader.last_row() == "a,\"b,c\",\"say \"\"hi\"\"\"", "Wrong row text");
+    XCTAssert(reader.ReadRow(fields) && fields.size() == 3 && fields[0] == "multi\nline" &&
+              fields[1].empty() && fields[2] == "x", "Wrong line break in quotes");
+    XCTAssert(reader.ReadRow(fields) && fields.size() == 2 && fields[0] == longField && fields[1] == "tail",
+              "Wrong long row");
+    XCTAssert(reader.ReadRow(fields) && fields.size() == 2 && fields[1] == "row", "Wrong last row");
+    XCTAssert(!reader.ReadRow(fields) && reader.position() == reader.length(), "Read past the end");
+    
+    // Clean-up
+    std::remove(tablePath.c_str());
+}
+
+- (void)testProjectedTableColumnsAreRead
+{
+    std::string tablePath = testSuiteDir + "/Table.tsv";
+    std::ofstream(tablePath) << "a\tb\tc\td\n"
+                                "1\t\"2\"\"\"\t3\t4\r\n"
+                                "short\trow\n"
+                                "5\t6\t7\t8";
+    
+    SeparatedTableReader reader(tablePath);
+    std::vector<std::string_view> fields;
+    XCTAssert(reader.ReadRow(fields) && fields.size() == 4, "Wrong header");
+    reader.SetProjection({2, 1});
+    XCTAssert(reader.ReadRow(fields) && fields.size() == 2 && fields[0] == "3" && fields[1] == "2\"",
+              "Wrong projected fields");
+    XCTAssert(reader.ReadRow(fields) && fields.empty() && reader.last_row() == "short\trow",
+              "Short row wasn't told apart");
+    XCTAssert(reader.ReadRow(fields) && fields.size() == 2 && fields[0] == "7" && fields[1] == "6",
+              "Wrong projected last row");
+    XCTAssert(!reader.ReadRow(fields), "Read past the end");
+    
+    // Clean-up
+    std::remove(tablePath.c_str());
+}
+
+@end
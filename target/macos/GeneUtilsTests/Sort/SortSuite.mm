@@ -0,0 +1,141 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#import <XCTest/XCTest.h>
+
+#include "Sorter.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdio>
+
+@interface SortSuite : XCTestCase
+{
+    std::string projectDir;
+    std::string projectTestsDir;
+    std::string testSuiteDir;
+}
+
+@end
+
+@implementation SortSuite
+
+- (void)setUp
+{
+    [super setUp];
+    projectDir = std::getenv("PROJECT_DIR");
+    projectTestsDir = projectDir + "/GeneUtilsTests";
+    testSuiteDir = projectTestsDir + "/Sort";
+}
+
+- (void)tearDown
+{
+    [super tearDown];
+}
+
+// Reads every fourth line of a FASTQ file, starting with 'first_line'
+static std::vector<std::string> ReadFastqLines(const std::string& path, int first_line)
+{
+    std::vector<std::string> lines;
+    std::ifstream file(path);
+    std::string line;
+    for (int64_t number = 0; std::getline(file, line); ++number) {
+        if (number % 4 == first_line)
+            lines.push_back(line);
+    }
+    return lines;
+}
+
+- (void)testFastQSortBySequence
+{
+    std::vector<std::string> inputPath = {projectTestsDir + "/Convert/FastqToFasta/IlluminaSimpleInput.fastq"};
+    std::string outputPath = testSuiteDir + "/IlluminaSimpleInput-sorted.fastq";
+    
+    auto flags = std::make_unique<gene::CommandLineFlags>();
+    flags->SetSetting("sort-key", "sequence");
+    
+    auto sorter = std::make_unique<Sorter>(inputPath, outputPath, std::move(flags));
+    XCTAssert(sorter->Process(), "FAIL. Sorter 'process' returned false.");
+    sorter = nullptr;
+    
+    auto sequences = ReadFastqLines(outputPath, 1);
+    XCTAssert(sequences.size() == ReadFastqLines(inputPath.front(), 1).size(),
+              "Output has a different number of records");
+    XCTAssert(std::is_sorted(sequences.begin(), sequences.end()), "Output isn't sorted");
+    
+    // Clean-up
+    std::remove(outputPath.c_str());
+}
+
+- (void)testFastQSortByNameSpillingRuns
+{
+    // Far more records than fit into the memory cap, so runs go to disk
+    std::string inputPath = testSuiteDir + "/ShuffledInput.fastq";
+    std::string outputPath = testSuiteDir + "/ShuffledInput-sorted.fastq";
+    const int64_t recordsCount = 50000;
+    {
+        std::ofstream input(inputPath);
+        for (int64_t i = 0; i < recordsCount; ++i) {
+            input << "@read" << (i*7919) % recordsCount << "\n"
+                  << "ACGTACGTACGTACGTACGTACGTACGTACGTACGT\n+\n"
+                  << "IIIIIIIIIIIIIIIIIIIIIIIIIIIIIIIIIIII\n";
+        }
+    }
+    
+    auto flags = std::make_unique<gene::CommandLineFlags>();
+    flags->SetSetting("sort-key", "name");
+    flags->SetSetting("sort-memory-mb", "1");
+    
+    auto sorter = std::make_unique<Sorter>(std::vector<std::string>{inputPath}, outputPath,
+                                           std::move(flags));
+    // With a cap this small, runs are merged in several passes, and every
+    // one of them moves the progress on
+    std::vector<float> mergeProgress;
+    float lastProgress = 0;
+    bool progressWentBack = false;
+    sorter->update_progress_callback = [&](float progress) {
+        progressWentBack |= progress < lastProgress;
+        lastProgress = progress;
+        if (progress >= 50)
+            mergeProgress.push_back(progress);
+        return false;
+    };
+    XCTAssert(sorter->Process(), "FAIL. Sorter 'process' returned false.");
+    sorter = nullptr;
+    
+    XCTAssert(!progressWentBack, "Reported progress decreased");
+    XCTAssert(lastProgress <= 100, "Reported progress went past 100%%");
+    XCTAssert(mergeProgress.size() > 1, "Merging runs reported no progress");
+    if (!mergeProgress.empty()) {
+        auto stalledReports = std::count(mergeProgress.begin(), mergeProgress.end(), mergeProgress.front());
+        XCTAssert(static_cast<size_t>(stalledReports) < mergeProgress.size()/2,
+                  "Progress stalled while merging runs");
+    }
+    
+    auto names = ReadFastqLines(outputPath, 0);
+    XCTAssert(static_cast<int64_t>(names.size()) == recordsCount, "Output has a different number of records");
+    XCTAssert(std::is_sorted(names.begin(), names.end()), "Output isn't sorted");
+    
+    // Clean-up
+    std::remove(inputPath.c_str());
+    std::remove(outputPath.c_str());
+}
+
+@end
@@ -0,0 +1,152 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+
+#import <XCTest/XCTest.h>
+
+#include "FastaStream.hpp"
+
+static void WriteText(const std::string& path, const std::string& text)
+{
+    std::ofstream file(path, std::ios::binary);
+    file << text;
+}
+
+static std::string ReadText(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream text;
+    text << file.rdbuf();
+    return text.str();
+}
+
+@interface FastaStreamUnitTests : XCTestCase
+{
+    std::string inputPath;
+    std::string outputPath;
+}
+
+@end
+
+@implementation FastaStreamUnitTests
+
+- (void)setUp
+{
+    [super setUp];
+    std::string directory = [NSTemporaryDirectory() UTF8String];
+    inputPath = directory + "/FastaStreamInput.fasta";
+    outputPath = directory + "/FastaStreamOutput.fasta";
+}
+
+- (void)tearDown
+{
+    std::remove(inputPath.c_str());
+    std::remove(outputPath.c_str());
+    [super tearDown];
+}
+
+// Streams every record of 'input' through a reader and a writer, the way the
+// operations do, and returns what was written
+- (std::string)roundTrip:(const std::string&)input
+{
+    WriteText(inputPath, input);
+    {
+        FastaStreamReader reader(inputPath);
+        FastaStreamWriter writer(outputPath);
+        XCTAssert(reader.is_open() && writer.is_open());
+
+        std::string header;
+        while (reader.NextRecord(header)) {
+            writer.BeginRecord(header, reader.line_width());
+            reader.CopySequenceTo(writer);
+        }
+        XCTAssert(reader.position() == reader.length());
+        writer.Close();
+    }
+    return ReadText(outputPath);
+}
+
+- (void)testFastaStream_ShortFirstRecord
+{
+    // A short first record says nothing about how the next one is wrapped
+    std::string longSequence;
+    for (int i = 0; i < 182; ++i)
+        longSequence += "ACGT"[i % 4];
+    std::string input = ">short\nACGT\n>long\n";
+    for (size_t i = 0; i < longSequence.size(); i += 60)
+        input += longSequence.substr(i, 60) + "\n";
+
+    XCTAssert([self roundTrip:input] == input);
+}
+
+- (void)testFastaStream_LineWidthPerRecord
+{
+    std::string input = ">a\nACGTACGT\nACGTACGT\nACG\n>b desc\nACGTA\nCGTAC\nGT\n";
+    XCTAssert([self roundTrip:input] == input);
+}
+
+- (void)testFastaStream_EmptySequence
+{
+    std::string input = ">empty\n>next\nACGTAC\nGT\n>last empty\n";
+    XCTAssert([self roundTrip:input] == input);
+}
+
+- (void)testFastaStream_CRLF
+{
+    // Carriage returns are taken out of headers and sequences alike
+    std::string input = ">a desc\r\nACGTAC\r\nGT\r\n>b\r\nACG\r\n";
+    XCTAssert([self roundTrip:input] == ">a desc\nACGTAC\nGT\n>b\nACG\n");
+
+    WriteText(inputPath, input);
+    FastaStreamReader reader(inputPath);
+    std::string header;
+    XCTAssert(reader.NextRecord(header) && header == "a desc");
+    XCTAssert(reader.line_width() == 6);
+}
+
+- (void)testFastaStream_MissingFinalNewline
+{
+    XCTAssert([self roundTrip:">a\nACGTAC\nGT"] == ">a\nACGTAC\nGT\n");
+    XCTAssert([self roundTrip:">a\nACGTAC"] == ">a\nACGTAC\n");
+    XCTAssert([self roundTrip:">a"] == ">a\n");
+}
+
+- (void)testFastaStream_ReadBasesInPieces
+{
+    WriteText(inputPath, ">a\nACGTACGTAC\nGTACGTACGT\nA\n>b\n\n>c\nTTT\n");
+    FastaStreamReader reader(inputPath);
+
+    std::vector<std::pair<std::string, std::string>> records;
+    std::string header;
+    char bases[7];
+    while (reader.NextRecord(header)) {
+        std::string sequence;
+        while (size_t count = reader.ReadBases(bases, sizeof(bases)))
+            sequence.append(bases, count);
+        records.emplace_back(header, sequence);
+    }
+
+    std::vector<std::pair<std::string, std::string>> expected = {
+        {"a", "ACGTACGTACGTACGTACGTA"}, {"b", ""}, {"c", "TTT"}};
+    XCTAssert(records == expected);
+}
+
+@end
@@ -0,0 +1,147 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#import <XCTest/XCTest.h>
+
+#include "ColumnarSequenceFile.hpp"
+#include "PrefetchingRecordFile.hpp"
+
+// Writes 'count' records to a columnar file at 'path', which needs no
+// parsing library to read back
+static std::vector<gene::SequenceRecord> WriteRecords(const std::string& path, size_t count)
+{
+    std::vector<gene::SequenceRecord> records;
+    auto file = ColumnarSequenceFile::FileWithName(path, gene::OpenMode::Write);
+    for (size_t i = 0; i < count; ++i) {
+        gene::SequenceRecord record;
+        record.name = "read" + std::to_string(i);
+        record.seq = std::string(i % 50 + 1, "ACGT"[i % 4]);
+        record.quality = std::string(record.seq.size(), 'I');
+        file->Write(record);
+        records.push_back(record);
+    }
+    file->Close();
+    return records;
+}
+
+// The descriptor the next open() would get, which is always the lowest free one
+static int NextDescriptor()
+{
+    int descriptor = open("/dev/null", O_RDONLY);
+    close(descriptor);
+    return descriptor;
+}
+
+static std::unique_ptr<PrefetchingRecordFile> OpenPrefetching(const std::string& path, size_t depth)
+{
+    std::unique_ptr<RecordFile> file = ColumnarSequenceFile::FileWithName(path, gene::OpenMode::Read);
+    return std::make_unique<PrefetchingRecordFile>(std::move(file), depth);
+}
+
+@interface PrefetchingRecordFileUnitTests : XCTestCase
+{
+    std::string inputPath;
+}
+
+@end
+
+@implementation PrefetchingRecordFileUnitTests
+
+- (void)setUp
+{
+    [super setUp];
+    inputPath = std::string([NSTemporaryDirectory() UTF8String]) + "/PrefetchingInput.gcol";
+}
+
+- (void)tearDown
+{
+    std::remove(inputPath.c_str());
+    [super tearDown];
+}
+
+- (void)testPrefetchingRecordFile_EmptyFile
+{
+    WriteRecords(inputPath, 0);
+    auto file = OpenPrefetching(inputPath, 2);
+
+    XCTAssert(file->isValidGeneFile());
+    XCTAssert(file->Read().Empty());
+    // Reading past the end keeps returning empty records
+    XCTAssert(file->Read().Empty());
+    XCTAssert(file->position() == file->length());
+}
+
+- (void)testPrefetchingRecordFile_ReadsEveryRecordInOrder
+{
+    // More than a few batches, with fewer batches allowed ahead
+    auto records = WriteRecords(inputPath, 3*PrefetchingRecordFile::kBatchRecords + 17);
+    auto file = OpenPrefetching(inputPath, 2);
+
+    for (const auto& expected : records) {
+        auto record = file->Read();
+        XCTAssert(record.name == expected.name && record.seq == expected.seq &&
+                  record.quality == expected.quality);
+    }
+    XCTAssert(file->Read().Empty());
+    XCTAssert(file->Read().Empty());
+    XCTAssert(file->position() == file->length());
+}
+
+- (void)testPrefetchingRecordFile_StartBeforeRead
+{
+    auto records = WriteRecords(inputPath, 10);
+    auto file = OpenPrefetching(inputPath, 1);
+
+    file->Start();
+    XCTAssert(file->Read().name == records.front().name);
+}
+
+- (void)testPrefetchingRecordFile_DestroyedBeforeTheEnd
+{
+    // The background thread is blocked on a full queue, and has to be let go
+    WriteRecords(inputPath, 4*PrefetchingRecordFile::kBatchRecords);
+    auto file = OpenPrefetching(inputPath, 1);
+
+    XCTAssert(!file->Read().Empty());
+    file = nullptr;
+}
+
+- (void)testPrefetchingRecordFile_KeepsNoDescriptorOfItsOwn
+{
+    // Wide merges wrap every input, so a wrapper holding a descriptor would
+    // double the number they need
+    auto records = WriteRecords(inputPath, 3*PrefetchingRecordFile::kBatchRecords);
+    std::unique_ptr<RecordFile> columnar = ColumnarSequenceFile::FileWithName(inputPath, gene::OpenMode::Read);
+    int nextDescriptor = NextDescriptor();
+
+    auto file = std::make_unique<PrefetchingRecordFile>(std::move(columnar), 2);
+    XCTAssert(NextDescriptor() == nextDescriptor);
+    size_t count = 0;
+    while (!file->Read().Empty())
+        ++count;
+    XCTAssert(count == records.size());
+    XCTAssert(NextDescriptor() == nextDescriptor);
+}
+
+@end
@@ -0,0 +1,66 @@
+/*
+ * Copyright 2018 Frangou Lab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string>
+
+#import <XCTest/XCTest.h>
+
+#include "PackedSequence.hpp"
+
+@interface PackedSequenceUnitTests : XCTestCase
+
+@end
+
+@implementation PackedSequenceUnitTests
+
+- (void)testPackedSequence_RoundTrip
+{
+    std::vector<std::string> sequences = {
+        "", "A", "ACGT", "ACGTNNNNACGTRYacgt",
+        "AAGCCTAACCGGTAAGTCGTAATCAGCACAGAACGCATAGCACGAGGGTCGGGATG"};
+
+    for (const auto& sequence : sequences) {
+        PackedSequence packed(sequence);
+        XCTAssert(packed.size() == sequence.size());
+        XCTAssert(packed.Unpack() == sequence);
+    }
+}
+
+- (void)testPackedSequence_ReverseComplement
+{
+    XCTAssert(PackedSequence("ACGTTGCAN").ReverseComplement().Unpack() == "NTGCAACGT");
+    XCTAssert(PackedSequence("AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAC").ReverseComplement().Unpack() ==
+              "GTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTT");
+    XCTAssert(PackedSequence("RYacgt").ReverseComplement().Unpack() == "acgtRY");
+}
+
+- (void)testPackedSequence_Find
+{
+    PackedSequence sequence("AATTGCCTAGGACNTTAC");
+
+    XCTAssert(sequence.Find(PackedSequence("TTGC"), 0) == 2);
+    XCTAssert(sequence.Find(PackedSequence("TTGG"), 0) == std::string::npos);
+    XCTAssert(sequence.Find(PackedSequence("TTGG"), 1) == 2);
+    XCTAssert(sequence.Find(PackedSequence("CTNG"), 0) == 6);
+    // N in the sequence only matches an N
+    XCTAssert(sequence.Find(PackedSequence("GACATTAC"), 0) == std::string::npos);
+    XCTAssert(sequence.Find(PackedSequence("GACATTAC"), 1) == 10);
+    XCTAssert(sequence.Mismatches(PackedSequence("AATTGCCT"), 0, 8) == 0);
+    XCTAssert(sequence.Mismatches(PackedSequence("TTAATTGG"), 0, 8) == 8);
+}
+
+@end